@@ -0,0 +1,18 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+#include "util.h"
+
+double bench_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+int bench_read_file(const char* path, void** result, size_t* size) {
+  return util_read_file(path, result, size);
+}
+
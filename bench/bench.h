@@ -0,0 +1,52 @@
+#ifndef _headers_1667392210_Fluff_Assembler_bench
+#define _headers_1667392210_Fluff_Assembler_bench
+
+#include <stddef.h>
+
+// Benchmarks reachable through `--bench <name> [args...]`
+// each one return process exit code
+
+// `--bench compression <bytecode files...>`
+int bench_compression(int argc, char** argv);
+
+// `--bench context [iterations] [source file]`
+// Per compilation overhead of fresh pipeline against
+// reused assembler_context
+int bench_context(int argc, char** argv);
+
+// `--bench suite [--size=<n>] [--iterations=<n>] [--output=<file>] [--pipeline]
+//                [--check-serialize-jobs=<n>] [workloads...]`
+// Assemble synthetic workloads (see generators.h) and write
+// per stage timings and counters as JSON. With a check, each
+// workload fails unless serializing on `n` jobs gives the
+// same bytes as on one
+int bench_suite(int argc, char** argv);
+
+// `--bench generate <workload> <size> <output>`
+// Write source of a synthetic workload to file
+int bench_generate(int argc, char** argv);
+
+// `--bench stress [instructions] [work directory]`
+// Generate and assemble in pipelined mode an input with more
+// than 2^31 instructions by default then check none was lost
+int bench_stress(int argc, char** argv);
+
+// `--bench hashmap [max keys]`
+// Insert and lookup cost of templated hashmap against
+// swiss hashmap from 10^3 keys up to `max keys`
+int bench_hashmap(int argc, char** argv);
+
+// Helpers
+
+// Monotonic time in seconds
+double bench_now();
+
+// Read whole file into allocator_malloc'ed buffer
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EIO: Cannot read the file
+int bench_read_file(const char* path, void** result, size_t* size);
+
+#endif
+
@@ -0,0 +1,180 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "bench.h"
+#include "bytecode/bytecode.h"
+#include "bytecode/instruction_compression.h"
+#include "bytecode/protobuf_loader.h"
+#include "bytecode/prototype.h"
+#include "vec.h"
+#include "vm_types.h"
+
+// Minimum time spent decoding each file so
+// the timing isn't just noise
+#define MIN_DECODE_SECONDS 0.25
+
+struct compressed_stream {
+  void* data;
+  size_t size;
+  size_t count;
+};
+
+struct totals {
+  size_t prototypes;
+  size_t instructions;
+  size_t rawSize;
+  size_t compressedSize;
+  double compressSeconds;
+  double decodeSeconds;
+  size_t decodedBytes;
+};
+
+typedef vec_t(struct compressed_stream) compressed_stream_vec_t;
+
+static int compressPrototypes(struct prototype* prototype, compressed_stream_vec_t* streams, struct totals* totals) {
+  int res = 0;
+  size_t count = prototype->instructions.length;
+  totals->prototypes++;
+
+  if (count > 0) {
+    struct compressed_stream stream = {
+      .count = count
+    };
+
+    double start = bench_now();
+    res = instruction_compression_compress(prototype->instructions.data, count, &stream.data, &stream.size);
+    totals->compressSeconds += bench_now() - start;
+    if (res < 0)
+      return res;
+
+    if (vec_push(streams, stream) < 0) {
+      allocator_free(stream.data);
+      return -ENOMEM;
+    }
+
+    totals->instructions += count;
+    totals->rawSize += count * sizeof(vm_instruction);
+    totals->compressedSize += stream.size;
+  }
+
+  size_t i = 0;
+  struct prototype* current = NULL;
+  vec_foreach(&prototype->prototypes, current, i)
+    if ((res = compressPrototypes(current, streams, totals)) < 0)
+      return res;
+  return 0;
+}
+
+static int decodeStreams(compressed_stream_vec_t* streams, struct totals* totals) {
+  size_t maxCount = 0;
+  size_t i = 0;
+  struct compressed_stream* stream = NULL;
+  vec_foreach_ptr(streams, stream, i)
+    if (stream->count > maxCount)
+      maxCount = stream->count;
+
+  vm_instruction* output = allocator_malloc((maxCount + 1) * sizeof(*output));
+  if (!output)
+    return -ENOMEM;
+
+  int res = 0;
+  double start = bench_now();
+  double elapsed = 0;
+  do {
+    vec_foreach_ptr(streams, stream, i) {
+      if ((res = instruction_compression_decompress(stream->data, stream->size, output)) < 0)
+        goto decode_failure;
+      totals->decodedBytes += stream->count * sizeof(vm_instruction);
+    }
+    elapsed = bench_now() - start;
+  } while (elapsed < MIN_DECODE_SECONDS && streams->length > 0);
+  totals->decodeSeconds += elapsed;
+
+decode_failure:
+  allocator_free(output);
+  return res;
+}
+
+static void printTotals(const char* name, struct totals* totals) {
+  double ratio = totals->compressedSize > 0 ? (double) totals->rawSize / (double) totals->compressedSize : 0;
+  double compressSpeed = totals->compressSeconds > 0 ? (double) totals->rawSize / totals->compressSeconds / 1e6 : 0;
+  double decodeSpeed = totals->decodeSeconds > 0 ? (double) totals->decodedBytes / totals->decodeSeconds / 1e9 : 0;
+  printf("%s: %zu prototypes, %zu instructions, %zu -> %zu bytes (%.2fx), compress %.1f MB/s, decode %.2f GB/s\n",
+         name, totals->prototypes, totals->instructions, totals->rawSize, totals->compressedSize,
+         ratio, compressSpeed, decodeSpeed);
+}
+
+static int benchFile(const char* path, struct totals* total) {
+  int res = 0;
+  void* data = NULL;
+  size_t size = 0;
+  struct totals totals = {};
+  compressed_stream_vec_t streams;
+  vec_init(&streams);
+
+  if ((res = bench_read_file(path, &data, &size)) < 0) {
+    printf("%s: cannot read file\n", path);
+    return res;
+  }
+
+  struct bytecode* bytecode = NULL;
+  struct bytecode_loader* loader = bytecode_loader_new(data, size);
+  if (!loader) {
+    res = -ENOMEM;
+    goto loader_alloc_failure;
+  }
+
+  if ((res = bytecode_loader_load(loader, &bytecode)) < 0 ||
+      (res = bytecode_loader_decode_all(loader)) < 0) {
+    printf("%s: cannot load bytecode (error %d)\n", path, res);
+    goto load_failure;
+  }
+
+  if ((res = compressPrototypes(bytecode->mainPrototype, &streams, &totals)) < 0 ||
+      (res = decodeStreams(&streams, &totals)) < 0) {
+    printf("%s: benchmark failed (error %d)\n", path, res);
+    goto bench_failure;
+  }
+
+  printTotals(path, &totals);
+  total->prototypes += totals.prototypes;
+  total->instructions += totals.instructions;
+  total->rawSize += totals.rawSize;
+  total->compressedSize += totals.compressedSize;
+  total->compressSeconds += totals.compressSeconds;
+  total->decodeSeconds += totals.decodeSeconds;
+  total->decodedBytes += totals.decodedBytes;
+
+bench_failure:;
+  size_t i = 0;
+  struct compressed_stream* stream = NULL;
+  vec_foreach_ptr(&streams, stream, i)
+    allocator_free(stream->data);
+  vec_deinit(&streams);
+load_failure:
+  bytecode_loader_free(loader);
+loader_alloc_failure:
+  allocator_free(data);
+  return res;
+}
+
+int bench_compression(int argc, char** argv) {
+  if (argc < 1) {
+    printf("Usage: --bench compression <bytecode files...>\n");
+    return EXIT_FAILURE;
+  }
+
+  int exitRes = EXIT_SUCCESS;
+  struct totals total = {};
+  for (int i = 0; i < argc; i++)
+    if (benchFile(argv[i], &total) < 0)
+      exitRes = EXIT_FAILURE;
+
+  if (argc > 1)
+    printTotals("total", &total);
+  return exitRes;
+}
+
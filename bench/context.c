@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "assembler_context.h"
+#include "assembler_driver.h"
+#include "bench.h"
+#include "byte_buffer.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+// Small enough that setting up the pipeline dominates
+static const char tinySource[] =
+  "ldr $r1, #0;\n"
+  "ldr $r2, #1;\n"
+  ":loop:\n"
+  "  cmp $r1, $r0;\n"
+  "  b.ge =done;\n"
+  "  add $r1, $r1, $r2;\n"
+  "b =loop;\n"
+  ":done:\n"
+  "ret;\n";
+
+// Return seconds per compilation or negative errno
+static double run(struct assembler_context* context, const char* source, size_t sourceSize, int iterations, struct byte_buffer* result) {
+  const char* errorMessage = NULL;
+  double start = bench_now();
+  for (int i = 0; i < iterations; i++) {
+    int res;
+    result->size = 0;
+    if (context)
+      res = assembler_context_assemble_buffer(context, "bench", source, sourceSize, NULL, &errorMessage, result, NULL);
+    else
+      res = assembler_driver_assemble_buffer("bench", source, sourceSize, NULL, &errorMessage, result, NULL);
+
+    if (res < 0) {
+      printf("Assembling failed: %s\n", errorMessage ? errorMessage : "out of memory");
+      allocator_free((char*) errorMessage);
+      return res;
+    }
+  }
+  return (bench_now() - start) / iterations;
+}
+
+int bench_context(int argc, char** argv) {
+  int iterations = DEFAULT_ITERATIONS;
+  const char* source = tinySource;
+  size_t sourceSize = sizeof(tinySource) - 1;
+  void* fileSource = NULL;
+  int exitRes = EXIT_FAILURE;
+
+  if (argc > 2 || (argc >= 1 && (iterations = atoi(argv[0])) <= 0)) {
+    printf("Usage: --bench context [iterations] [source file]\n");
+    return EXIT_FAILURE;
+  }
+
+  if (argc == 2) {
+    if (bench_read_file(argv[1], &fileSource, &sourceSize) < 0) {
+      printf("%s: cannot read file\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+    source = fileSource;
+  }
+
+  struct byte_buffer result = BYTE_BUFFER_INIT;
+  struct assembler_context* context = assembler_context_new();
+  if (!context) {
+    printf("Cannot create assembler context\n");
+    goto context_alloc_failure;
+  }
+
+  // Warm up both paths so first touch of the allocator
+  // isn't counted on either side
+  if (run(NULL, source, sourceSize, 1, &result) < 0 ||
+      run(context, source, sourceSize, 1, &result) < 0)
+    goto bench_failure;
+
+  double fresh = run(NULL, source, sourceSize, iterations, &result);
+  if (fresh < 0)
+    goto bench_failure;
+  double reused = run(context, source, sourceSize, iterations, &result);
+  if (reused < 0)
+    goto bench_failure;
+
+  printf("%zu bytes source, %zu bytes bytecode, %d iterations\n", sourceSize, result.size, iterations);
+  printf("fresh pipeline:   %8.2f us per compilation\n", fresh * 1e6);
+  printf("reused context:   %8.2f us per compilation (%.1f%% of fresh)\n", reused * 1e6, reused / fresh * 100.0);
+  exitRes = EXIT_SUCCESS;
+
+bench_failure:
+  assembler_context_free(context);
+context_alloc_failure:
+  byte_buffer_deinit(&result);
+  allocator_free(fileSource);
+  return exitRes;
+}
+
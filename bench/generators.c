@@ -0,0 +1,182 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "generators.h"
+#include "byte_buffer.h"
+#include "util.h"
+
+// Registers used by generated code (VM has 16)
+#define REGISTER_COUNT 8
+
+// Prototypes nest this deep before next chain starts
+#define NESTING_DEPTH 6
+
+// Labels per block in branch heavy code
+#define BRANCH_BLOCK_SIZE 64
+
+ATTRIBUTE_PRINTF(2, 3)
+static int appendf(struct byte_buffer* output, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int length = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+
+  // +1 for vsnprintf's NUL which is dropped right after
+  char* space = byte_buffer_append_space(output, (size_t) length + 1);
+  if (!space)
+    return -ENOMEM;
+
+  va_start(args, fmt);
+  vsnprintf(space, (size_t) length + 1, fmt, args);
+  va_end(args);
+  output->size--;
+  return 0;
+}
+
+// xorshift32, fixed seed so every run generates same source
+static uint32_t nextRandom(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static const char* arithmetic[] = {"add", "sub", "mul", "div", "mod"};
+static const char* conditions[] = {"eq", "ne", "lt", "gt", "le", "ge"};
+
+static int generateStraightLine(struct byte_buffer* output, size_t size) {
+  uint32_t random = 0x1234567;
+  for (size_t i = 0; i < size; i++) {
+    int a = nextRandom(&random) % REGISTER_COUNT;
+    int b = nextRandom(&random) % REGISTER_COUNT;
+    int c = nextRandom(&random) % REGISTER_COUNT;
+    int res;
+    switch (i % 4) {
+      case 0:
+        res = appendf(output, "ldr $r%d, #%zu;\n", a, i);
+        break;
+      case 1:
+        res = appendf(output, "mov $r%d, $r%d;\n", a, b);
+        break;
+      default:
+        res = appendf(output, "%s $r%d, $r%d, $r%d;\n", arithmetic[nextRandom(&random) % ARRAY_SIZE(arithmetic)], a, b, c);
+        break;
+    }
+
+    if (res < 0)
+      return res;
+  }
+  return appendf(output, "ret;\n");
+}
+
+static int generateNestedPrototypes(struct byte_buffer* output, size_t size) {
+  int depth = 0;
+  for (size_t i = 0; i < size; i++) {
+    // Parent refers to its child before the child is defined
+    if (appendf(output, "%*sldr $r2, =p%zu;\n", depth * 2, "", i) < 0 ||
+        appendf(output, "%*s.start_prototype p%zu;\n", depth * 2, "", i) < 0)
+      return -ENOMEM;
+    depth++;
+
+    if (appendf(output, "%*sldr $r0, #%zu;\n", depth * 2, "", i) < 0 ||
+        appendf(output, "%*sadd $r1, $r0, $r0;\n", depth * 2, "") < 0)
+      return -ENOMEM;
+
+    // Close whole chain and start a new one
+    if (depth == NESTING_DEPTH || i == size - 1) {
+      for (; depth > 0; depth--)
+        if (appendf(output, "%*sret;\n%*s.end_prototype;\n", depth * 2, "", (depth - 1) * 2, "") < 0)
+          return -ENOMEM;
+    }
+  }
+  return appendf(output, "ret;\n");
+}
+
+static int generateLabels(struct byte_buffer* output, size_t size) {
+  uint32_t random = 0x2345678;
+  for (size_t i = 0; i < size; i++) {
+    if (appendf(output, ":label_%zu:\n", i) < 0)
+      return -ENOMEM;
+
+    // Jump to any label in the file, forward or backward
+    int res;
+    if (i % 4 == 3) {
+      const char* condition = conditions[nextRandom(&random) % ARRAY_SIZE(conditions)];
+      res = appendf(output, "  b.%s =label_%zu;\n", condition, nextRandom(&random) % size);
+    } else {
+      res = appendf(output, "  add $r1, $r1, $r2;\n");
+    }
+
+    if (res < 0)
+      return res;
+  }
+  return appendf(output, "ret;\n");
+}
+
+static int generateBranches(struct byte_buffer* output, size_t size) {
+  uint32_t random = 0x3456789;
+  for (size_t i = 0; i < size; i++) {
+    size_t block = i / BRANCH_BLOCK_SIZE;
+    if (i % BRANCH_BLOCK_SIZE == 0 && appendf(output, ":block_%zu:\n", block) < 0)
+      return -ENOMEM;
+
+    // Branch back to this block or forward to next one
+    size_t target = block + nextRandom(&random) % 2;
+    if (target * BRANCH_BLOCK_SIZE >= size)
+      target = block;
+
+    uint32_t a = nextRandom(&random) % REGISTER_COUNT;
+    uint32_t b = nextRandom(&random) % REGISTER_COUNT;
+    const char* condition = conditions[nextRandom(&random) % ARRAY_SIZE(conditions)];
+    if (appendf(output, "  cmp $r%u, $r%u;\n", a, b) < 0 ||
+        appendf(output, "  b.%s =block_%zu;\n", condition, target) < 0)
+      return -ENOMEM;
+  }
+  return appendf(output, "ret;\n");
+}
+
+static int generateStrings(struct byte_buffer* output, size_t size) {
+  uint32_t random = 0x456789A;
+  for (size_t i = 0; i < size; i++) {
+    // Every fourth string repeats an earlier one
+    size_t id = i % 4 == 3 ? nextRandom(&random) % i : i;
+    if (appendf(output, "ldr $r%d, \"constant string number %zu with some padding text\";\n", (int) (i % REGISTER_COUNT), id) < 0)
+      return -ENOMEM;
+  }
+  return appendf(output, "ret;\n");
+}
+
+// Assembly only has block comments
+static int generateComments(struct byte_buffer* output, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (appendf(output, "/* Block comment before statement %zu, long enough to dominate\n"
+                        "   the lexer's work compared to the statement itself */\n", i) < 0 ||
+        appendf(output, "add $r1, $r1, $r2; /* Comment after statement %zu */\n", i) < 0 ||
+        appendf(output, "/* Standalone comment %zu */\n", i) < 0)
+      return -ENOMEM;
+  }
+  return appendf(output, "ret;\n");
+}
+
+const struct bench_generator bench_generators[] = {
+  {"straight_line", "One huge prototype of arithmetic and loads", generateStraightLine},
+  {"nested_prototypes", "Many tiny prototypes nested in short chains", generateNestedPrototypes},
+  {"labels", "A label on every statement, some branches between them", generateLabels},
+  {"branches", "Conditional branch on every other statement", generateBranches},
+  {"strings", "String constant loads, a quarter of them duplicates", generateStrings},
+  {"comments", "Mostly comments, long and short ones", generateComments}
+};
+
+const int bench_generator_count = ARRAY_SIZE(bench_generators);
+
+const struct bench_generator* bench_generator_find(const char* name) {
+  for (int i = 0; i < bench_generator_count; i++)
+    if (strcmp(bench_generators[i].name, name) == 0)
+      return &bench_generators[i];
+  return NULL;
+}
+
@@ -0,0 +1,31 @@
+#ifndef _headers_1667901164_Fluff_Assembler_bench_generators
+#define _headers_1667901164_Fluff_Assembler_bench_generators
+
+#include <stddef.h>
+
+struct byte_buffer;
+
+// Synthetic assembly sources stressing different parts of the
+// assembler. Output only depends on the generator and `size`
+// (roughly number of statements) so runs are comparable
+// between commits
+
+struct bench_generator {
+  const char* name;
+  const char* description;
+
+  // Append generated source to `output`
+  // Return 0 on success
+  // Errors:
+  // -ENOMEM: Not enough memory
+  int (*generate)(struct byte_buffer* output, size_t size);
+};
+
+extern const struct bench_generator bench_generators[];
+extern const int bench_generator_count;
+
+// Return NULL if there no generator named `name`
+const struct bench_generator* bench_generator_find(const char* name);
+
+#endif
+
@@ -0,0 +1,152 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "bench.h"
+#include "hashmap.h"
+
+#define MIN_KEYS 1000
+#define DEFAULT_MAX_KEYS 10000000
+
+// Small maps are rebuilt until this many keys went
+// through them so every size runs about as long
+#define KEYS_PER_RUN 10000000
+
+// Longest "label_<n>_miss" plus NUL
+#define MAX_KEY_SIZE 32
+
+struct keys {
+  size_t count;
+  char* storage;
+
+  // Insertion order
+  const char** names;
+  // Same keys, shuffled
+  const char** lookups;
+  // Never inserted
+  const char** misses;
+};
+
+struct result {
+  double insertSeconds;
+  double hitSeconds;
+  double missSeconds;
+};
+
+// Shaped like assembler's labels
+static int generateKeys(struct keys* keys, size_t count) {
+  *keys = (struct keys) {
+    .count = count,
+    .storage = allocator_malloc(count * 2 * MAX_KEY_SIZE),
+    .names = allocator_malloc(count * sizeof(*keys->names)),
+    .lookups = allocator_malloc(count * sizeof(*keys->lookups)),
+    .misses = allocator_malloc(count * sizeof(*keys->misses))
+  };
+  if (!keys->storage || !keys->names || !keys->lookups || !keys->misses)
+    return -ENOMEM;
+
+  char* current = keys->storage;
+  for (size_t i = 0; i < count; i++) {
+    keys->names[i] = current;
+    current += snprintf(current, MAX_KEY_SIZE, "label_%zu", i) + 1;
+    keys->misses[i] = current;
+    current += snprintf(current, MAX_KEY_SIZE, "label_%zu_miss", i) + 1;
+  }
+
+  // Fisher-Yates with xorshift64, fixed seed
+  uint64_t random = 0x123456789ABCDEF;
+  memcpy(keys->lookups, keys->names, count * sizeof(*keys->lookups));
+  for (size_t i = count - 1; i > 0; i--) {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+
+    size_t other = random % (i + 1);
+    const char* tmp = keys->lookups[i];
+    keys->lookups[i] = keys->lookups[other];
+    keys->lookups[other] = tmp;
+  }
+  return 0;
+}
+
+static void freeKeys(struct keys* keys) {
+  allocator_free(keys->storage);
+  allocator_free(keys->names);
+  allocator_free(keys->lookups);
+  allocator_free(keys->misses);
+}
+
+// Both maps go through the same hashmap_* macros, only the
+// declaration and hash function differ
+#define DEFINE_RUNNER(name, mapType, hashFunc) \
+  static int name(const struct keys* keys, size_t rounds, struct result* result) { \
+    int res = 0; \
+    *result = (struct result) {}; \
+    for (size_t round = 0; round < rounds && res >= 0; round++) { \
+      mapType(char, void) map; \
+      hashmap_init(&map, hashFunc, strcmp); \
+\
+      double start = bench_now(); \
+      for (size_t i = 0; i < keys->count && res >= 0; i++) \
+        res = hashmap_put(&map, keys->names[i], (void*) keys->names[i]); \
+      result->insertSeconds += bench_now() - start; \
+\
+      start = bench_now(); \
+      for (size_t i = 0; i < keys->count; i++) \
+        if (hashmap_get(&map, keys->lookups[i]) != keys->lookups[i]) \
+          res = -EFAULT; \
+      result->hitSeconds += bench_now() - start; \
+\
+      start = bench_now(); \
+      for (size_t i = 0; i < keys->count; i++) \
+        if (hashmap_get(&map, keys->misses[i]) != NULL) \
+          res = -EFAULT; \
+      result->missSeconds += bench_now() - start; \
+\
+      hashmap_cleanup(&map); \
+    } \
+    return res; \
+  }
+
+DEFINE_RUNNER(runTemplated, HASHMAP, hashmap_hash_string)
+DEFINE_RUNNER(runSwiss, SWISS_HASHMAP, swiss_hashmap_hash_string)
+
+static void printResult(const char* name, size_t count, size_t rounds, const struct result* result) {
+  double operations = (double) count * (double) rounds / 1e9;
+  printf("%10zu %-10s %12.1lf %12.1lf %12.1lf\n", count, name, result->insertSeconds / operations,
+         result->hitSeconds / operations, result->missSeconds / operations);
+}
+
+int bench_hashmap(int argc, char** argv) {
+  long long maxKeys = DEFAULT_MAX_KEYS;
+  if (argc > 1 || (argc == 1 && (maxKeys = atoll(argv[0])) < MIN_KEYS)) {
+    printf("Usage: --bench hashmap [max keys]\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%10s %-10s %12s %12s %12s\n", "Keys", "Map", "Insert ns", "Hit ns", "Miss ns");
+  for (size_t count = MIN_KEYS; count <= (size_t) maxKeys; count *= 10) {
+    size_t rounds = count < KEYS_PER_RUN ? KEYS_PER_RUN / count : 1;
+    struct keys keys;
+    struct result templated;
+    struct result swiss;
+
+    int res = generateKeys(&keys, count);
+    if (res >= 0 && (res = runTemplated(&keys, rounds, &templated)) >= 0)
+      res = runSwiss(&keys, rounds, &swiss);
+    freeKeys(&keys);
+
+    if (res < 0) {
+      printf("Benchmark failed at %zu keys (error %d)\n", count, res);
+      return EXIT_FAILURE;
+    }
+
+    printResult("templated", count, rounds, &templated);
+    printResult("swiss", count, rounds, &swiss);
+  }
+  return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,131 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "assembler_context.h"
+#include "assembler_driver.h"
+#include "assembler_stats.h"
+#include "bench.h"
+#include "util.h"
+
+// Past INT32_MAX so any int sized counter on the way
+// would overflow
+#define DEFAULT_INSTRUCTIONS ((UINT64_C(1) << 31) + (UINT64_C(1) << 20))
+
+// Instructions per prototype, well below VM_LIMIT_MAX_PROTOTYPE
+// so the input spreads over many prototypes
+#define PROTOTYPE_SIZE (UINT64_C(1) << 24)
+
+// Many statements per line keep line numbers small, a line
+// per instruction would run out of them before instructions
+#define STATEMENTS_PER_LINE 64
+
+static const char statement[] = "add $r1, $r1, $r2; ";
+
+// Write prototypes of `add` followed by `ret` until there
+// are `instructions` in total (last `ret` is main's)
+static int generate(FILE* file, uint64_t instructions, uint64_t* prototypeCount) {
+  uint64_t remaining = instructions - 1;
+  *prototypeCount = 0;
+  while (remaining > 0) {
+    // Prototype needs at least its own `ret`
+    uint64_t size = remaining < PROTOTYPE_SIZE ? remaining : PROTOTYPE_SIZE;
+    fprintf(file, ".start_prototype stress_%" PRIu64 ";\n", *prototypeCount);
+    for (uint64_t i = 1; i < size; i++) {
+      fputs(statement, file);
+      if (i % STATEMENTS_PER_LINE == 0)
+        fputc('\n', file);
+    }
+    fputs("\nret;\n.end_prototype;\n", file);
+    remaining -= size;
+    (*prototypeCount)++;
+  }
+  fputs("ret;\n", file);
+
+  if (ferror(file))
+    return -EIO;
+  return 0;
+}
+
+int bench_stress(int argc, char** argv) {
+  uint64_t instructions = DEFAULT_INSTRUCTIONS;
+  const char* directory = ".";
+  if (argc > 2 || (argc >= 1 && (instructions = strtoull(argv[0], NULL, 10)) == 0)) {
+    printf("Usage: --bench stress [instructions] [work directory]\n");
+    return EXIT_FAILURE;
+  }
+  if (argc == 2)
+    directory = argv[1];
+
+  int exitRes = EXIT_FAILURE;
+  char* sourcePath = NULL;
+  char* outputPath = NULL;
+  util_asprintf(&sourcePath, "%s/stress.fluff", directory);
+  util_asprintf(&outputPath, "%s/stress.fluff_bin", directory);
+  if (!sourcePath || !outputPath) {
+    printf("Not enough memory\n");
+    goto path_alloc_failure;
+  }
+
+  FILE* file = fopen(sourcePath, "w");
+  if (!file) {
+    printf("Cannot open '%s'\n", sourcePath);
+    goto path_alloc_failure;
+  }
+
+  double start = bench_now();
+  uint64_t prototypeCount = 0;
+  int res = generate(file, instructions, &prototypeCount);
+  if (fclose(file) != 0 || res < 0) {
+    printf("Cannot write '%s'\n", sourcePath);
+    goto generate_failure;
+  }
+  fprintf(stderr, "Generated %" PRIu64 " instructions in %" PRIu64 " prototypes (%.3lf s)\n", instructions, prototypeCount, bench_now() - start);
+
+  struct assembler_context* context = assembler_context_new();
+  if (!context) {
+    printf("Cannot create assembler context\n");
+    goto generate_failure;
+  }
+
+  // Pipelined mode frees tokens and statements as it goes,
+  // whole input never has to be tokenized at once
+  struct assembler_driver_options options = ASSEMBLER_DRIVER_OPTIONS_DEFAULT;
+  options.pipelined = true;
+
+  struct assembler_stats stats = ASSEMBLER_STATS_INIT;
+  const char* errorMessage = NULL;
+  size_t outputSize = 0;
+  context->stats = &stats;
+  start = bench_now();
+  res = assembler_context_assemble_file(context, sourcePath, outputPath, NULL, &options, &errorMessage, &outputSize, NULL);
+  context->stats = NULL;
+  if (res < 0) {
+    printf("Assembler failure: %s\n", errorMessage ? errorMessage : "Not enough memory");
+    allocator_free((char*) errorMessage);
+    goto assemble_failure;
+  }
+
+  printf("Assembled %" PRIu64 " instructions in %" PRIu64 " prototypes into %zu bytes (%.3lf s)\n",
+         stats.instructions, stats.prototypes, outputSize, bench_now() - start);
+
+  // Main prototype counts too
+  if (stats.instructions != instructions || stats.prototypes != prototypeCount + 1) {
+    printf("Expected %" PRIu64 " instructions in %" PRIu64 " prototypes\n", instructions, prototypeCount + 1);
+    goto assemble_failure;
+  }
+  exitRes = EXIT_SUCCESS;
+
+assemble_failure:
+  assembler_context_free(context);
+  remove(outputPath);
+generate_failure:
+  remove(sourcePath);
+path_alloc_failure:
+  allocator_free(outputPath);
+  allocator_free(sourcePath);
+  return exitRes;
+}
@@ -0,0 +1,251 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "assembler_context.h"
+#include "assembler_driver.h"
+#include "assembler_stats.h"
+#include "bench.h"
+#include "byte_buffer.h"
+#include "config.h"
+#include "generators.h"
+#include "util.h"
+
+#define DEFAULT_SIZE 20000
+#define DEFAULT_ITERATIONS 10
+
+static const char assemblerVersion[] = stringify(CONFIG_VERSION_MAJOR) "."
+                                       stringify(CONFIG_VERSION_MINOR) "."
+                                       stringify(CONFIG_VERSION_PATCH)
+                                       CONFIG_VERSION_LOCAL_VERSION;
+
+struct workload_result {
+  size_t sourceSize;
+  double generateTime;
+  // Fastest iteration's total wall time
+  double bestTime;
+
+  // Counters from one iteration, stage times are
+  // mean over all iterations
+  struct assembler_stats stats;
+};
+
+// Assemble `source` again serializing on `jobs` threads, output
+// must be same bytes as `expected` which was serialized on one
+// Return 0 if same
+// Errors:
+// -EFAULT: Outputs differ
+// Other errors from assembler_context_assemble_buffer
+static int checkSerializer(struct assembler_context* context, const struct bench_generator* generator, const struct assembler_driver_options* options, int jobs, const struct byte_buffer* source, const struct byte_buffer* expected, const char** errorMessage) {
+  struct assembler_driver_options parallelOptions = *options;
+  parallelOptions.serializer.threadCount = jobs;
+
+  struct byte_buffer output = BYTE_BUFFER_INIT;
+  int res = assembler_context_assemble_buffer(context, generator->name, source->data, source->size, &parallelOptions, errorMessage, &output, NULL);
+  if (res >= 0 && (output.size != expected->size || memcmp(output.data, expected->data, output.size) != 0)) {
+    util_asprintf((char**) errorMessage, "Output serialized with %d jobs differs from one job's", jobs);
+    res = -EFAULT;
+  }
+
+  byte_buffer_deinit(&output);
+  return res;
+}
+
+// `checkJobs` above 1 also checks serializer output with that
+// many jobs against output serialized on one
+static int runWorkload(struct assembler_context* context, const struct bench_generator* generator, const struct assembler_driver_options* options, size_t size, int iterations, int checkJobs, struct workload_result* result) {
+  int res = 0;
+  const char* errorMessage = NULL;
+  struct byte_buffer source = BYTE_BUFFER_INIT;
+  struct byte_buffer output = BYTE_BUFFER_INIT;
+  struct assembler_stats timing = ASSEMBLER_STATS_INIT;
+  *result = (struct workload_result) {};
+
+  double start = util_monotonic_time();
+  if ((res = generator->generate(&source, size)) < 0)
+    goto generate_failure;
+  result->generateTime = util_monotonic_time() - start;
+  result->sourceSize = source.size;
+
+  // First iteration also warms up the context
+  context->stats = &result->stats;
+  res = assembler_context_assemble_buffer(context, generator->name, source.data, source.size, options, &errorMessage, &output, NULL);
+  if (res < 0)
+    goto assemble_failure;
+
+  context->stats = &timing;
+  result->bestTime = -1;
+  for (int i = 0; i < iterations; i++) {
+    output.size = 0;
+    start = util_monotonic_time();
+    res = assembler_context_assemble_buffer(context, generator->name, source.data, source.size, options, &errorMessage, &output, NULL);
+    if (res < 0)
+      goto assemble_failure;
+
+    double elapsed = util_monotonic_time() - start;
+    if (result->bestTime < 0 || elapsed < result->bestTime)
+      result->bestTime = elapsed;
+  }
+
+  // Not counted in stats, output still has last iteration's bytes
+  context->stats = NULL;
+  if (checkJobs > 1 && (res = checkSerializer(context, generator, options, checkJobs, &source, &output, &errorMessage)) < 0)
+    goto assemble_failure;
+
+  for (int i = 0; i < ASSEMBLER_STAGE_COUNT; i++) {
+    result->stats.stages[i].wallTime = timing.stages[i].wallTime / iterations;
+    result->stats.stages[i].cpuTime = timing.stages[i].cpuTime / iterations;
+  }
+
+assemble_failure:
+  if (res < 0) {
+    fprintf(stderr, "%s: Assembler failure: %s\n", generator->name, errorMessage ? errorMessage : "Not enough memory");
+    allocator_free((char*) errorMessage);
+  }
+  context->stats = NULL;
+generate_failure:
+  byte_buffer_deinit(&output);
+  byte_buffer_deinit(&source);
+  return res;
+}
+
+static void printResultJson(const struct bench_generator* generator, const struct workload_result* result, FILE* output) {
+  fprintf(output, "{\n");
+  fprintf(output, "\"name\": \"%s\",\n", generator->name);
+  fprintf(output, "\"source_bytes\": %zu,\n", result->sourceSize);
+  fprintf(output, "\"generate_seconds\": %.9lf,\n", result->generateTime);
+  fprintf(output, "\"best_wall_seconds\": %.9lf,\n", result->bestTime);
+  fprintf(output, "\"stats\": ");
+  assembler_stats_print_json(&result->stats, NULL, output);
+  fprintf(output, "}");
+}
+
+// Sizes past INT_MAX statements are valid, stress
+// inputs are generated that way
+static bool parseSize(const char* str, size_t* size) {
+  char* end = NULL;
+  errno = 0;
+  unsigned long long value = strtoull(str, &end, 10);
+  if (errno != 0 || end == str || *end != '\0' || *str == '-' || value == 0 || value > SIZE_MAX)
+    return false;
+
+  *size = (size_t) value;
+  return true;
+}
+
+static int usage() {
+  printf("Usage: --bench suite [--size=<n>] [--iterations=<n>] [--output=<file>] [--pipeline] [--check-serialize-jobs=<n>] [workloads...]\n");
+  printf("Workloads (all by default):\n");
+  for (int i = 0; i < bench_generator_count; i++)
+    printf("  %-18s %s\n", bench_generators[i].name, bench_generators[i].description);
+  return EXIT_FAILURE;
+}
+
+int bench_suite(int argc, char** argv) {
+  size_t size = DEFAULT_SIZE;
+  int iterations = DEFAULT_ITERATIONS;
+  int checkJobs = 0;
+  const char* outputPath = NULL;
+  struct assembler_driver_options options = ASSEMBLER_DRIVER_OPTIONS_DEFAULT;
+  const struct bench_generator* selected[bench_generator_count];
+  int selectedCount = 0;
+
+  for (int i = 0; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--size=", strlen("--size=")) == 0) {
+      if (!parseSize(arg + strlen("--size="), &size))
+        return usage();
+    } else if (strncmp(arg, "--iterations=", strlen("--iterations=")) == 0) {
+      if ((iterations = atoi(arg + strlen("--iterations="))) <= 0)
+        return usage();
+    } else if (strncmp(arg, "--output=", strlen("--output=")) == 0) {
+      outputPath = arg + strlen("--output=");
+    } else if (strcmp(arg, "--pipeline") == 0) {
+      options.pipelined = true;
+    } else if (strncmp(arg, "--check-serialize-jobs=", strlen("--check-serialize-jobs=")) == 0) {
+      if ((checkJobs = atoi(arg + strlen("--check-serialize-jobs="))) <= 1)
+        return usage();
+    } else {
+      const struct bench_generator* generator = bench_generator_find(arg);
+      if (!generator || selectedCount == bench_generator_count) {
+        printf("Unknown workload '%s'\n", arg);
+        return usage();
+      }
+      selected[selectedCount++] = generator;
+    }
+  }
+
+  if (selectedCount == 0)
+    for (; selectedCount < bench_generator_count; selectedCount++)
+      selected[selectedCount] = &bench_generators[selectedCount];
+
+  FILE* output = stdout;
+  if (outputPath && (output = fopen(outputPath, "w")) == NULL) {
+    printf("Cannot open '%s'\n", outputPath);
+    return EXIT_FAILURE;
+  }
+
+  int exitRes = EXIT_FAILURE;
+  struct assembler_context* context = assembler_context_new();
+  if (!context) {
+    printf("Cannot create assembler context\n");
+    goto context_alloc_failure;
+  }
+
+  fprintf(output, "{\n");
+  fprintf(output, "\"version\": \"%s\",\n", assemblerVersion);
+  fprintf(output, "\"size\": %zu,\n", size);
+  fprintf(output, "\"iterations\": %d,\n", iterations);
+  fprintf(output, "\"pipelined\": %s,\n", options.pipelined ? "true" : "false");
+  fprintf(output, "\"serialize_check_jobs\": %d,\n", checkJobs);
+  fprintf(output, "\"workloads\": [\n");
+
+  exitRes = EXIT_SUCCESS;
+  bool isFirst = true;
+  for (int i = 0; i < selectedCount; i++) {
+    struct workload_result result;
+    if (runWorkload(context, selected[i], &options, size, iterations, checkJobs, &result) < 0) {
+      exitRes = EXIT_FAILURE;
+      continue;
+    }
+
+    if (!isFirst)
+      fprintf(output, ",\n");
+    isFirst = false;
+    printResultJson(selected[i], &result, output);
+
+    // Progress goes to stderr so stdout can be plain JSON
+    fprintf(stderr, "%-18s %8zu bytes, best %9.3lf ms, %7.1lf MB/s\n", selected[i]->name, result.sourceSize,
+            result.bestTime * 1000, (double) result.sourceSize / result.bestTime / 1e6);
+  }
+  fprintf(output, "\n]\n}\n");
+
+  assembler_context_free(context);
+context_alloc_failure:
+  if (output != stdout && fclose(output) != 0) {
+    printf("Cannot write '%s'\n", outputPath);
+    exitRes = EXIT_FAILURE;
+  }
+  return exitRes;
+}
+
+int bench_generate(int argc, char** argv) {
+  const struct bench_generator* generator = argc == 3 ? bench_generator_find(argv[0]) : NULL;
+  size_t size = 0;
+  if (!generator || !parseSize(argv[1], &size)) {
+    printf("Usage: --bench generate <workload> <size> <output>\n");
+    return usage();
+  }
+
+  struct byte_buffer source = BYTE_BUFFER_INIT;
+  int res = generator->generate(&source, size);
+  if (res >= 0 && (res = util_write_file(argv[2], source.data, source.size)) < 0)
+    printf("Cannot write '%s'\n", argv[2]);
+  byte_buffer_deinit(&source);
+  return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
@@ -3,7 +3,7 @@
 set(BUILD_PROJECT_NAME "FluffAssembler")
 
 # We're making library
-set(BUILD_IS_LIBRARY NO)
+set(BUILD_IS_LIBRARY YES)
 set(BUILD_IS_KERNEL NO)
 
 # If we want make libary and
@@ -26,17 +26,36 @@ set(BUILD_SOURCES
   src/default_statement_processors.c
   src/token_iterator.c
   src/bytecode/protobuf_serializer.c
+  src/bytecode/protobuf_loader.c
+  src/bytecode/instruction_compression.c
   src/assembler_driver.c
+  src/assembler_context.c
+  src/assembler_stats.c
+  src/allocator.c
+  src/tracking_allocator.c
+  src/spsc_queue.c
+  src/swiss_hashmap.c
+  src/byte_buffer.c
+  src/server_protocol.c
+  src/assembler_cache.c
+  src/arena.c
+  src/lz_block.c
+  src/trace.c
+  src/perf_counters.c
+  src/fluffasm.c
+  src/linker.c
+  src/incremental_cache.c
   
-  deps/buffer/buffer.c
   deps/templated-hashmap/hashmap.c
   deps/vec/vec.c
 )
 
 set(BUILD_INCLUDE_DIRS 
-  ./deps/buffer
+  ./include
+  ./src
   ./deps/vec
   ./deps/templated-hashmap/
+  ./bench
 )
 
 # Note that exe does not represent Windows' 
@@ -51,19 +70,35 @@ set(BUILD_EXE_SOURCES
   src/specials.c
   src/premain.c
   src/main.c
+  
+  # Command line only, not part of the library
+  src/batch_assembler.c
+  src/server.c
+  src/client.c
+  
+  bench/bench.c
+  bench/compression.c
+  bench/context.c
+  bench/generators.c
+  bench/hashmap.c
+  bench/stress.c
+  bench/suite.c
 )
 
 # Public header to be exported
 # If this a library
 set(BUILD_PUBLIC_HEADERS
-  include/dummy.h
+  include/fluffasm.h
 )
 
 set(BUILD_PROTOBUF_FILES
   src/format/bytecode.proto
 )
 
-set(BUILD_CFLAGS "")
+# Library only exports what include/fluffasm.h marks
+# with FLUFFASM_API, internals and the bundled deps
+# would clash with host's own copies
+set(BUILD_CFLAGS "-fvisibility=hidden")
 set(BUILD_LDFLAGS "")
 
 # AddPkgConfigLib is in ./buildsystem/CMakeLists.txt
@@ -14,6 +14,7 @@
 #include <errno.h>
 
 #include "hashmap_base.h"
+#include "allocator.h"
 
 
 /* Table sizes must be powers of 2 */
@@ -174,7 +175,7 @@ static int hashmap_rehash(struct hashmap_base *hb, size_t table_size)
     assert((table_size & (table_size - 1)) == 0);
     assert(table_size >= hb->size);
 
-    new_table = (struct hashmap_entry *)calloc(table_size, sizeof(struct hashmap_entry));
+    new_table = (struct hashmap_entry *)allocator_calloc(table_size, sizeof(struct hashmap_entry));
     if (!new_table) {
         return -ENOMEM;
     }
@@ -195,7 +196,7 @@ static int hashmap_rehash(struct hashmap_base *hb, size_t table_size)
         /* Shallow copy */
         *new_entry = *entry;
     }
-    free(old_table);
+    allocator_free(old_table);
     return 0;
 }
 
@@ -246,7 +247,7 @@ void hashmap_base_cleanup(struct hashmap_base *hb)
         return;
     }
     hashmap_free_keys(hb);
-    free(hb->table);
+    allocator_free(hb->table);
     memset(hb, 0, sizeof(*hb));
 }
 
@@ -402,7 +403,7 @@ void hashmap_base_reset(struct hashmap_base *hb)
     hashmap_free_keys(hb);
     hb->size = 0;
     if (hb->table_size != hb->table_size_init) {
-        new_table = (struct hashmap_entry *)realloc(hb->table,
+        new_table = (struct hashmap_entry *)allocator_realloc(hb->table,
                 sizeof(struct hashmap_entry) * hb->table_size_init);
         if (new_table) {
             hb->table = new_table;
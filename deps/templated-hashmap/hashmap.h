@@ -13,12 +13,25 @@ extern "C" {
 
 #include <stddef.h>
 #include "hashmap_base.h"
+#include "swiss_hashmap.h"
+
+/*
+ * INTERNAL USE ONLY: Selects hashmap_base_<name>() or swiss_hashmap_base_<name>()
+ * by the type of a map base or iterator position, so every macro below works
+ * on both HASHMAP() and SWISS_HASHMAP() maps.
+ */
+#define __HASHMAP_BASE_FUNC(base, name) _Generic((base),                \
+    struct swiss_hashmap_base *: swiss_hashmap_base_ ## name,           \
+    const struct swiss_hashmap_base *: swiss_hashmap_base_ ## name,     \
+    struct swiss_hashmap_slot *: swiss_hashmap_base_ ## name,           \
+    const struct swiss_hashmap_slot *: swiss_hashmap_base_ ## name,     \
+    default: hashmap_base_ ## name)
 
 /*
  * INTERNAL USE ONLY: Updates an iterator structure after the current element was removed.
  */
-#define __HASHMAP_ITER_RESET(iter) ({                                   \
-    ((iter)->iter_pos = hashmap_base_iter((iter)->iter_map, (iter)->iter_pos)) != NULL; \
+#define __HASHMAP_ITER_RESET(it) ({                                     \
+    ((it)->iter_pos = __HASHMAP_BASE_FUNC((it)->iter_map, iter)((it)->iter_map, (it)->iter_pos)) != NULL; \
 })
 
 /*
@@ -125,7 +138,7 @@ extern "C" {
 #define hashmap_init(h, hash_func, compare_func) do {                   \
     typeof((h)->map_types->t_hash_func) __map_hash = (hash_func);       \
     typeof((h)->map_types->t_compare_func) __map_compare = (compare_func); \
-    hashmap_base_init(&(h)->map_base, (size_t (*)(const void *))__map_hash, (int (*)(const void *, const void *))__map_compare); \
+    __HASHMAP_BASE_FUNC(&(h)->map_base, init)(&(h)->map_base, (size_t (*)(const void *))__map_hash, (int (*)(const void *, const void *))__map_compare); \
 } while (0)
 
 /*
@@ -135,7 +148,7 @@ extern "C" {
  *   HASHMAP(<key_type>, <data_type>) *h - hashmap pointer
  */
 #define hashmap_cleanup(h)                                              \
-    hashmap_base_cleanup(&(h)->map_base)
+    __HASHMAP_BASE_FUNC(&(h)->map_base, cleanup)(&(h)->map_base)
 
 /*
  * Enable internal memory allocation and management for hash keys.
@@ -149,7 +162,7 @@ extern "C" {
 #define hashmap_set_key_alloc_funcs(h, key_dup_func, key_free_func) do { \
     typeof((h)->map_types->t_key_dup_func) __map_key_dup = (key_dup_func); \
     typeof((h)->map_types->t_key_free_func) __map_key_free = (key_free_func); \
-    hashmap_base_set_key_alloc_funcs(&(h)->map_base, (void *(*)(const void *))__map_key_dup, (void(*)(void *))__map_key_free); \
+    __HASHMAP_BASE_FUNC(&(h)->map_base, set_key_alloc_funcs)(&(h)->map_base, (void *(*)(const void *))__map_key_dup, (void(*)(void *))__map_key_free); \
 } while (0)
 
 /*
@@ -172,7 +185,7 @@ extern "C" {
  * Returns 0 on success, or -errno on failure.
  */
 #define hashmap_reserve(h, capacity)                                    \
-    hashmap_base_reserve(&(h)->map_base, capacity)
+    __HASHMAP_BASE_FUNC(&(h)->map_base, reserve)(&(h)->map_base, capacity)
 
 /*
  * Add a new entry to the hashmap. If an entry with a matching key
@@ -188,7 +201,7 @@ extern "C" {
 #define hashmap_put(h, key, data) ({                                    \
     typeof((h)->map_types->t_key) __map_key = (key);                    \
     typeof((h)->map_types->t_data) __map_data = (data);                 \
-    hashmap_base_put(&(h)->map_base, (const void *)__map_key, (void *)__map_data); \
+    __HASHMAP_BASE_FUNC(&(h)->map_base, put)(&(h)->map_base, (const void *)__map_key, (void *)__map_data); \
 })
 
 /*
@@ -202,7 +215,7 @@ extern "C" {
  */
 #define hashmap_get(h, key) ({                                          \
     typeof((h)->map_types->t_key) __map_key = (key);                    \
-    (typeof((h)->map_types->t_data))hashmap_base_get(&(h)->map_base, (const void *)__map_key); \
+    (typeof((h)->map_types->t_data))__HASHMAP_BASE_FUNC(&(h)->map_base, get)(&(h)->map_base, (const void *)__map_key); \
 })
 
 /*
@@ -220,7 +233,7 @@ extern "C" {
  */
 #define hashmap_remove(h, key) ({                                       \
     typeof((h)->map_types->t_key) __map_key = (key);                    \
-    (typeof((h)->map_types->t_data))hashmap_base_remove(&(h)->map_base, (const void *)__map_key); \
+    (typeof((h)->map_types->t_data))__HASHMAP_BASE_FUNC(&(h)->map_base, remove)(&(h)->map_base, (const void *)__map_key); \
 })
 
 /*
@@ -230,7 +243,7 @@ extern "C" {
  *   HASHMAP(<key_type>, <data_type>) *h - hashmap pointer
  */
 #define hashmap_clear(h)                                                \
-    hashmap_base_clear(&(h)->map_base)
+    __HASHMAP_BASE_FUNC(&(h)->map_base, clear)(&(h)->map_base)
 
 /*
  * Remove all entries and reset the hash table to its initial size.
@@ -239,7 +252,7 @@ extern "C" {
  *   HASHMAP(<key_type>, <data_type>) *h - hashmap pointer
  */
 #define hashmap_reset(h)                                                \
-    hashmap_base_reset(&(h)->map_base)
+    __HASHMAP_BASE_FUNC(&(h)->map_base, reset)(&(h)->map_base)
 
 /*
  * Return an iterator for this hashmap. The iterator is a type-specific
@@ -249,7 +262,7 @@ extern "C" {
  *   HASHMAP(<key_type>, <data_type>) *h - hashmap pointer
  */
 #define hashmap_iter(h)                                                 \
-    ((HASHMAP_ITER(*(h))){ &(h)->map_base, hashmap_base_iter(&(h)->map_base, NULL) })
+    ((HASHMAP_ITER(*(h))){ &(h)->map_base, __HASHMAP_BASE_FUNC(&(h)->map_base, iter)(&(h)->map_base, NULL) })
 
 /*
  * Return true if an iterator is valid and safe to use.
@@ -258,7 +271,7 @@ extern "C" {
  *   HASHMAP_ITER(<hashmap_type>) *iter - iterator pointer
  */
 #define hashmap_iter_valid(iter)                                        \
-    hashmap_base_iter_valid((iter)->iter_map, (iter)->iter_pos)
+    __HASHMAP_BASE_FUNC((iter)->iter_map, iter_valid)((iter)->iter_map, (iter)->iter_pos)
 
 /*
  * Advance an iterator to the next hashmap entry.
@@ -269,7 +282,7 @@ extern "C" {
  * Returns true if the iterator is valid after the operation.
  */
 #define hashmap_iter_next(iter)                                         \
-    hashmap_base_iter_next((iter)->iter_map, &(iter)->iter_pos)
+    __HASHMAP_BASE_FUNC((iter)->iter_map, iter_next)((iter)->iter_map, &(iter)->iter_pos)
 
 /*
  * Remove the hashmap entry pointed to by this iterator and advance the
@@ -281,7 +294,7 @@ extern "C" {
  * Returns true if the iterator is valid after the operation.
  */
 #define hashmap_iter_remove(iter)                                       \
-    hashmap_base_iter_remove((iter)->iter_map, &(iter)->iter_pos)
+    __HASHMAP_BASE_FUNC((iter)->iter_map, iter_remove)((iter)->iter_map, &(iter)->iter_pos)
 
 /*
  * Return the key of the entry pointed to by the iterator.
@@ -290,7 +303,7 @@ extern "C" {
  *   HASHMAP_ITER(<hashmap_type>) *iter - iterator pointer
  */
 #define hashmap_iter_get_key(iter)                                      \
-    ((typeof((iter)->iter_types->t_key))hashmap_base_iter_get_key((iter)->iter_pos))
+    ((typeof((iter)->iter_types->t_key))__HASHMAP_BASE_FUNC((iter)->iter_pos, iter_get_key)((iter)->iter_pos))
 
 /*
  * Return the data of the entry pointed to by the iterator.
@@ -299,7 +312,7 @@ extern "C" {
  *   HASHMAP_ITER(<hashmap_type>) *iter - iterator pointer
  */
 #define hashmap_iter_get_data(iter)                                     \
-    ((typeof((iter)->iter_types->t_data))hashmap_base_iter_get_data((iter)->iter_pos))
+    ((typeof((iter)->iter_types->t_data))__HASHMAP_BASE_FUNC((iter)->iter_pos, iter_get_data)((iter)->iter_pos))
 
 /*
  * Set the data pointer of the entry pointed to by the iterator.
@@ -310,7 +323,7 @@ extern "C" {
  */
 #define hashmap_iter_set_data(iter, data) ({                            \
     (typeof((iter)->iter_types->t_data)) __map_data = (data);           \
-    hashmap_base_iter_set_data((iter)->iter_pos), (void *)__map_data); \
+    __HASHMAP_BASE_FUNC((iter)->iter_pos, iter_set_data)((iter)->iter_pos), (void *)__map_data); \
 })
 
 /*
@@ -400,7 +413,7 @@ extern "C" {
  *   HASHMAP(<key_type>, <data_type>) *h - hashmap pointer
  */
 #define hashmap_load_factor(h)                                          \
-    hashmap_base_load_factor(&(h)->map_base)
+    __HASHMAP_BASE_FUNC(&(h)->map_base, load_factor)(&(h)->map_base)
 
 /*
  * Return the number of collisions for this key.
@@ -414,7 +427,7 @@ extern "C" {
  */
 #define hashmap_collisions(h, key) ({                                   \
     typeof((h)->map_types->t_key) __map_key = (key);                    \
-    hashmap_base_collisions(&(h)->map_base, (const void *)__map_key);   \
+    __HASHMAP_BASE_FUNC(&(h)->map_base, collisions)(&(h)->map_base, (const void *)__map_key); \
 })
 
 /*
@@ -424,7 +437,7 @@ extern "C" {
  *   HASHMAP(<key_type>, <data_type>) *h - hashmap pointer
  */
 #define hashmap_collisions_mean(h)                                      \
-    hashmap_base_collisions_mean(&(h)->map_base)
+    __HASHMAP_BASE_FUNC(&(h)->map_base, collisions_mean)(&(h)->map_base)
 
 /*
  * Return the variance between entry collisions. The higher the variance,
@@ -434,7 +447,7 @@ extern "C" {
  *   HASHMAP(<key_type>, <data_type>) *h - hashmap pointer
  */
 #define hashmap_collisions_variance(h)                                  \
-    hashmap_base_collisions_variance(&(h)->map_base)
+    __HASHMAP_BASE_FUNC(&(h)->map_base, collisions_variance)(&(h)->map_base)
 
 #ifdef __cplusplus
 }
@@ -5,64 +5,71 @@
  * under the terms of the MIT license. See LICENSE for details.
  */
 
+#include <stdint.h>
+
 #include "vec.h"
 
 
-int vec_expand_(char **data, int *length, int *capacity, int memsz) {
+/* Fails instead of wrapping around if n elements can't be addressed */
+static int vec_resize_(char **data, size_t *capacity, size_t memsz, size_t n) {
+  void *ptr;
+  if (memsz != 0 && n > SIZE_MAX / memsz) return -1;
+  ptr = allocator_realloc(*data, n * memsz);
+  if (ptr == NULL) return -1;
+  *data = ptr;
+  *capacity = n;
+  return 0;
+}
+
+
+int vec_expand_(char **data, size_t *length, size_t *capacity, size_t memsz) {
   if (*length + 1 > *capacity) {
-    void *ptr;
-    int n = (*capacity == 0) ? 1 : *capacity << 1;
-    ptr = realloc(*data, n * memsz);
-    if (ptr == NULL) return -1;
-    *data = ptr;
-    *capacity = n;
+    size_t n;
+    if (*capacity > SIZE_MAX / 2) return -1;
+    n = (*capacity == 0) ? 1 : *capacity << 1;
+    return vec_resize_(data, capacity, memsz, n);
   }
   return 0;
 }
 
 
-int vec_reserve_(char **data, int *length, int *capacity, int memsz, int n) {
+int vec_reserve_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                 size_t n
+) {
   (void) length;
   if (n > *capacity) {
-    void *ptr = realloc(*data, n * memsz);
-    if (ptr == NULL) return -1;
-    *data = ptr;
-    *capacity = n;
+    return vec_resize_(data, capacity, memsz, n);
   }
   return 0;
 }
 
 
 int vec_reserve_po2_(
-  char **data, int *length, int *capacity, int memsz, int n
+  char **data, size_t *length, size_t *capacity, size_t memsz, size_t n
 ) {
-  int n2 = 1;
+  size_t n2 = 1;
   if (n == 0) return 0;
-  while (n2 < n) n2 <<= 1;
+  while (n2 < n) {
+    if (n2 > SIZE_MAX / 2) return -1;
+    n2 <<= 1;
+  }
   return vec_reserve_(data, length, capacity, memsz, n2);
 }
 
 
-int vec_compact_(char **data, int *length, int *capacity, int memsz) {
+int vec_compact_(char **data, size_t *length, size_t *capacity, size_t memsz) {
   if (*length == 0) {
-    free(*data);
+    allocator_free(*data);
     *data = NULL;
     *capacity = 0;
     return 0;
-  } else {
-    void *ptr;
-    int n = *length;
-    ptr = realloc(*data, n * memsz);
-    if (ptr == NULL) return -1;
-    *capacity = n;
-    *data = ptr;
   }
-  return 0;
+  return vec_resize_(data, capacity, memsz, *length);
 }
 
 
-int vec_insert_(char **data, int *length, int *capacity, int memsz,
-                 int idx
+int vec_insert_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                 size_t idx
 ) {
   int err = vec_expand_(data, length, capacity, memsz);
   if (err) return err;
@@ -73,8 +80,8 @@ int vec_insert_(char **data, int *length, int *capacity, int memsz,
 }
 
 
-void vec_splice_(char **data, int *length, int *capacity, int memsz,
-                 int start, int count
+void vec_splice_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                 size_t start, size_t count
 ) {
   (void) capacity;
   memmove(*data + start * memsz,
@@ -83,8 +90,8 @@ void vec_splice_(char **data, int *length, int *capacity, int memsz,
 }
 
 
-void vec_swapsplice_(char **data, int *length, int *capacity, int memsz,
-                     int start, int count
+void vec_swapsplice_(char **data, size_t *length, size_t *capacity,
+                     size_t memsz, size_t start, size_t count
 ) {
   (void) capacity;
   memmove(*data + start * memsz,
@@ -93,11 +100,11 @@ void vec_swapsplice_(char **data, int *length, int *capacity, int memsz,
 }
 
 
-void vec_swap_(char **data, int *length, int *capacity, int memsz,
-               int idx1, int idx2 
+void vec_swap_(char **data, size_t *length, size_t *capacity, size_t memsz,
+               size_t idx1, size_t idx2 
 ) {
   unsigned char *a, *b, tmp;
-  int count;
+  size_t count;
   (void) length;
   (void) capacity;
   if (idx1 == idx2) return;
@@ -111,4 +118,3 @@ void vec_swap_(char **data, int *length, int *capacity, int memsz,
     a++, b++;
   }
 }
-
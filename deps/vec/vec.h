@@ -8,18 +8,24 @@
 #ifndef VEC_H
 #define VEC_H
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocator.h"
+
 #define VEC_VERSION "0.2.1"
 
+/* Index vec_find gives when value isn't found */
+#define VEC_NPOS ((size_t) -1)
+
 
 #define vec_unpack_(v)\
   (char**)&(v)->data, &(v)->length, &(v)->capacity, sizeof(*(v)->data)
 
 
 #define vec_t(T)\
-  struct { T *data; int length, capacity; }
+  struct { T *data; size_t length, capacity; }
 
 
 #define vec_init(v)\
@@ -27,13 +33,13 @@
 
 
 #define vec_deinit(v)\
-  ( free((v)->data),\
+  ( allocator_free((v)->data),\
     vec_init(v) ) 
 
 
 #define vec_push(v, val)\
   ( vec_expand_(vec_unpack_(v)) ? -1 :\
-    ((v)->data[(v)->length++] = (val), 0), 0 )
+    ((v)->data[(v)->length++] = (val), 0) )
 
 
 #define vec_pop(v)\
@@ -52,7 +58,7 @@
 
 #define vec_insert(v, idx, val)\
   ( vec_insert_(vec_unpack_(v), idx) ? -1 :\
-    ((v)->data[idx] = (val), 0), (v)->length++, 0 )
+    ((v)->data[idx] = (val), (v)->length++, 0) )
     
 
 #define vec_sort(v, fn)\
@@ -89,7 +95,7 @@
 
 #define vec_pusharr(v, arr, count)\
   do {\
-    int i__, n__ = (count);\
+    size_t i__, n__ = (count);\
     if (vec_reserve_po2_(vec_unpack_(v), (v)->length + n__) != 0) break;\
     for (i__ = 0; i__ < n__; i__++) {\
       (v)->data[(v)->length++] = (arr)[i__];\
@@ -106,21 +112,21 @@
     for ((idx) = 0; (idx) < (v)->length; (idx)++) {\
       if ((v)->data[(idx)] == (val)) break;\
     }\
-    if ((idx) == (v)->length) (idx) = -1;\
+    if ((idx) == (v)->length) (idx) = VEC_NPOS;\
   } while (0)
 
 
 #define vec_remove(v, val)\
   do {\
-    int idx__;\
+    size_t idx__;\
     vec_find(v, val, idx__);\
-    if (idx__ != -1) vec_splice(v, idx__, 1);\
+    if (idx__ != VEC_NPOS) vec_splice(v, idx__, 1);\
   } while (0)
 
 
 #define vec_reverse(v)\
   do {\
-    int i__ = (v)->length / 2;\
+    size_t i__ = (v)->length / 2;\
     while (i__--) {\
       vec_swap((v), i__, (v)->length - (i__ + 1));\
     }\
@@ -136,9 +142,9 @@
 
 #define vec_foreach_rev(v, var, iter)\
   if  ( (v)->length > 0 )\
-  for ( (iter) = (v)->length - 1;\
-        (iter) >= 0 && (((var) = (v)->data[(iter)]), 1);\
-        --(iter))
+  for ( (iter) = (v)->length;\
+        (iter)-- > 0 && (((var) = (v)->data[(iter)]), 1);\
+        )
 
 
 #define vec_foreach_ptr(v, var, iter)\
@@ -150,25 +156,26 @@
 
 #define vec_foreach_ptr_rev(v, var, iter)\
   if  ( (v)->length > 0 )\
-  for ( (iter) = (v)->length - 1;\
-        (iter) >= 0 && (((var) = &(v)->data[(iter)]), 1);\
-        --(iter))
-
-
-
-int vec_expand_(char **data, int *length, int *capacity, int memsz);
-int vec_reserve_(char **data, int *length, int *capacity, int memsz, int n);
-int vec_reserve_po2_(char **data, int *length, int *capacity, int memsz,
-                     int n);
-int vec_compact_(char **data, int *length, int *capacity, int memsz);
-int vec_insert_(char **data, int *length, int *capacity, int memsz,
-                int idx);
-void vec_splice_(char **data, int *length, int *capacity, int memsz,
-                 int start, int count);
-void vec_swapsplice_(char **data, int *length, int *capacity, int memsz,
-                     int start, int count);
-void vec_swap_(char **data, int *length, int *capacity, int memsz,
-               int idx1, int idx2);
+  for ( (iter) = (v)->length;\
+        (iter)-- > 0 && (((var) = &(v)->data[(iter)]), 1);\
+        )
+
+
+
+int vec_expand_(char **data, size_t *length, size_t *capacity, size_t memsz);
+int vec_reserve_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                 size_t n);
+int vec_reserve_po2_(char **data, size_t *length, size_t *capacity,
+                     size_t memsz, size_t n);
+int vec_compact_(char **data, size_t *length, size_t *capacity, size_t memsz);
+int vec_insert_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                size_t idx);
+void vec_splice_(char **data, size_t *length, size_t *capacity, size_t memsz,
+                 size_t start, size_t count);
+void vec_swapsplice_(char **data, size_t *length, size_t *capacity,
+                     size_t memsz, size_t start, size_t count);
+void vec_swap_(char **data, size_t *length, size_t *capacity, size_t memsz,
+               size_t idx1, size_t idx2);
 
 
 typedef vec_t(void*) vec_void_t;
@@ -0,0 +1,86 @@
+#ifndef header_1668302410_7c1e5b0a_3f2d_4b8e_9a61_d2c4f08e5b17_fluffasm_h
+#define header_1668302410_7c1e5b0a_3f2d_4b8e_9a61_d2c4f08e5b17_fluffasm_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Public API of libfluffasm, for assembling Fluff assembly
+// from memory into memory inside host process (e.g. the VM
+// at script load time) instead of running the assembler
+//
+// Everything goes through opaque `struct fluffasm` handle,
+// which keeps the assembler's state and output buffers
+// between calls so assembling many scripts reuses them. A
+// handle is not thread safe but separate handles can be
+// used concurrently, use one per thread
+//
+// Functions returning int return 0 on success or negative
+// errno on failure, with human readable description from
+// fluffasm_get_error
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef __GNUC__
+# define FLUFFASM_API __attribute__((visibility("default")))
+#else
+# define FLUFFASM_API
+#endif
+
+// Bumped on incompatible changes to this header
+#define FLUFFASM_API_VERSION 1
+
+struct fluffasm;
+
+// API version the library was built with, hosts should
+// check it against FLUFFASM_API_VERSION
+FLUFFASM_API int fluffasm_get_api_version(void);
+
+// Return NULL if out of memory
+FLUFFASM_API struct fluffasm* fluffasm_new(void);
+FLUFFASM_API void fluffasm_free(struct fluffasm* self);
+
+// Options apply to following fluffasm_assemble calls, new
+// handle starts with assembler's defaults (newest bytecode
+// version, no compaction or compression, debug info inline)
+
+// Return 0 on success
+// Errors:
+// -EINVAL: Version is not supported
+FLUFFASM_API int fluffasm_set_version(struct fluffasm* self, int version);
+FLUFFASM_API void fluffasm_set_compact_instructions(struct fluffasm* self, bool enable);
+FLUFFASM_API void fluffasm_set_compress_instructions(struct fluffasm* self, bool enable);
+
+// Leave line tables out of the bytecode
+FLUFFASM_API void fluffasm_set_strip_debug_info(struct fluffasm* self, bool enable);
+
+// Also produce `.fluff_dbg` sidecar, see fluffasm_get_debug_info
+FLUFFASM_API void fluffasm_set_generate_debug_info(struct fluffasm* self, bool enable);
+
+// Assemble `sourceSize` bytes of `source`, `inputName` is
+// only used in error messages and can be NULL
+// Return 0 on success
+// Errors:
+// -EFAULT: Source has errors
+// -ENOMEM: Not enough memory
+// -EINVAL: Options are not valid together (e.g. compact
+//          instructions with version 1)
+FLUFFASM_API int fluffasm_assemble(struct fluffasm* self, const char* inputName, const char* source, size_t sourceSize);
+
+// Output of last successful fluffasm_assemble, stays valid
+// until next fluffasm_assemble or fluffasm_free
+// Return NULL with `size` set to 0 if there is none
+FLUFFASM_API const void* fluffasm_get_output(const struct fluffasm* self, size_t* size);
+FLUFFASM_API const void* fluffasm_get_debug_info(const struct fluffasm* self, size_t* size);
+
+// Why last call failed, stays valid until next call on
+// `self`. Return NULL if it succeeded
+FLUFFASM_API const char* fluffasm_get_error(const struct fluffasm* self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
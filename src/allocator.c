@@ -0,0 +1,48 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+
+static struct allocator* current = NULL;
+
+void allocator_set(struct allocator* allocator) {
+  current = allocator;
+}
+
+struct allocator* allocator_get() {
+  return current;
+}
+
+void* allocator_malloc_at(size_t size, const char* file, int line) {
+  if (!current)
+    return malloc(size);
+  return current->malloc(current, size, file, line);
+}
+
+void* allocator_calloc_at(size_t count, size_t size, const char* file, int line) {
+  if (!current)
+    return calloc(count, size);
+  return current->calloc(current, count, size, file, line);
+}
+
+void* allocator_realloc_at(void* ptr, size_t size, const char* file, int line) {
+  if (!current)
+    return realloc(ptr, size);
+  return current->realloc(current, ptr, size, file, line);
+}
+
+char* allocator_strdup_at(const char* str, const char* file, int line) {
+  size_t size = strlen(str) + 1;
+  char* copy = allocator_malloc_at(size, file, line);
+  if (copy)
+    memcpy(copy, str, size);
+  return copy;
+}
+
+void allocator_free(void* ptr) {
+  if (!current)
+    free(ptr);
+  else
+    current->free(current, ptr);
+}
+
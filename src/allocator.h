@@ -0,0 +1,40 @@
+#ifndef _headers_1667987312_Fluff_Assembler_allocator
+#define _headers_1667987312_Fluff_Assembler_allocator
+
+#include <stddef.h>
+
+// Pluggable allocator, every heap allocation of the assembler
+// and the vendored deps (vec, buffer, templated-hashmap) goes
+// through here so it can be swapped for a tracking one
+//
+// Memory must be freed through the same allocator it came from,
+// so don't pass memory from libc (getline, strdup, ...) to
+// allocator_free or the other way around
+
+struct allocator {
+  // `file` and `line` are allocation site
+  void* (*malloc)(struct allocator* self, size_t size, const char* file, int line);
+  void* (*calloc)(struct allocator* self, size_t count, size_t size, const char* file, int line);
+  void* (*realloc)(struct allocator* self, void* ptr, size_t size, const char* file, int line);
+  void (*free)(struct allocator* self, void* ptr);
+};
+
+// NULL for libc's allocator (default). Only change this
+// while nothing allocated by current allocator is alive,
+// in practice before main does anything
+void allocator_set(struct allocator* allocator);
+struct allocator* allocator_get();
+
+void* allocator_malloc_at(size_t size, const char* file, int line);
+void* allocator_calloc_at(size_t count, size_t size, const char* file, int line);
+void* allocator_realloc_at(void* ptr, size_t size, const char* file, int line);
+char* allocator_strdup_at(const char* str, const char* file, int line);
+void allocator_free(void* ptr);
+
+#define allocator_malloc(size) allocator_malloc_at((size), __FILE__, __LINE__)
+#define allocator_calloc(count, size) allocator_calloc_at((count), (size), __FILE__, __LINE__)
+#define allocator_realloc(ptr, size) allocator_realloc_at((ptr), (size), __FILE__, __LINE__)
+#define allocator_strdup(str) allocator_strdup_at((str), __FILE__, __LINE__)
+
+#endif
+
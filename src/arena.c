@@ -0,0 +1,134 @@
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "allocator.h"
+
+#define DEFAULT_BLOCK_SIZE (64 * 1024)
+#define ALIGNMENT (alignof(max_align_t))
+#define ALIGN_UP(x) (((x) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+
+struct arena_block {
+  struct arena_block* next;
+  size_t size;
+  size_t used;
+
+  alignas(max_align_t) unsigned char data[];
+};
+
+static struct arena_block* newBlock(size_t size) {
+  struct arena_block* block = allocator_malloc(sizeof(*block) + size);
+  if (!block)
+    return NULL;
+
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+struct arena* arena_new(size_t blockSize) {
+  struct arena* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
+
+  self->blockSize = blockSize > 0 ? ALIGN_UP(blockSize) : DEFAULT_BLOCK_SIZE;
+  self->blocks = NULL;
+  self->current = NULL;
+  return self;
+}
+
+static void freeBlocks(struct arena_block* block) {
+  while (block) {
+    struct arena_block* next = block->next;
+    allocator_free(block);
+    block = next;
+  }
+}
+
+void arena_free(struct arena* self) {
+  if (!self)
+    return;
+
+  freeBlocks(self->blocks);
+  allocator_free(self);
+}
+
+void arena_reset(struct arena* self) {
+  if (!self->blocks)
+    return;
+
+  freeBlocks(self->blocks->next);
+  self->blocks->next = NULL;
+  self->blocks->used = 0;
+  self->current = self->blocks;
+}
+
+void* arena_alloc(struct arena* self, size_t size) {
+  if (size > SIZE_MAX - ALIGNMENT)
+    return NULL;
+  size = ALIGN_UP(size);
+
+  struct arena_block* block = self->current;
+  if (block && block->size - block->used >= size)
+    goto enough_space;
+
+  // Oversized allocation get its own block and placed
+  // after current block so the current block still usable
+  if (size > self->blockSize / 4) {
+    block = newBlock(size);
+    if (!block)
+      return NULL;
+
+    if (self->current) {
+      block->next = self->current->next;
+      self->current->next = block;
+    } else {
+      self->blocks = self->current = block;
+    }
+    goto enough_space;
+  }
+
+  block = newBlock(self->blockSize);
+  if (!block)
+    return NULL;
+
+  // Also goes right after current block, oversized
+  // blocks placed there stay linked after it
+  if (self->current) {
+    block->next = self->current->next;
+    self->current->next = block;
+  } else {
+    self->blocks = block;
+  }
+  self->current = block;
+
+enough_space:;
+  void* ptr = block->data + block->used;
+  block->used += size;
+  return ptr;
+}
+
+void* arena_calloc(struct arena* self, size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size)
+    return NULL;
+
+  void* ptr = arena_alloc(self, count * size);
+  if (ptr)
+    memset(ptr, 0, count * size);
+  return ptr;
+}
+
+char* arena_strndup(struct arena* self, const char* str, size_t len) {
+  char* copy = arena_alloc(self, len + 1);
+  if (!copy)
+    return NULL;
+
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  return copy;
+}
+
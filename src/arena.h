@@ -0,0 +1,37 @@
+#ifndef _headers_1667306150_Fluff_Assembler_arena
+#define _headers_1667306150_Fluff_Assembler_arena
+
+#include <stddef.h>
+
+// Bump allocator, everything allocated from it
+// is released at once by arena_free or arena_reset
+
+struct arena_block;
+
+struct arena {
+  size_t blockSize;
+
+  struct arena_block* current;
+  struct arena_block* blocks;
+};
+
+// `blockSize` of zero use the default size
+struct arena* arena_new(size_t blockSize);
+void arena_free(struct arena* self);
+
+// Release everything allocated but keep the
+// first block around for reuse
+void arena_reset(struct arena* self);
+
+// Return NULL if out of memory
+// Returned memory is aligned to max_align_t
+void* arena_alloc(struct arena* self, size_t size);
+
+// Same as arena_alloc but zero the memory
+void* arena_calloc(struct arena* self, size_t count, size_t size);
+
+// Copy `len` bytes of `str` and NUL terminate it
+char* arena_strndup(struct arena* self, const char* str, size_t len);
+
+#endif
+
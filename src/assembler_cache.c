@@ -0,0 +1,430 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "assembler_cache.h"
+#include "allocator.h"
+#include "assembler_context.h"
+#include "assembler_driver.h"
+#include "byte_buffer.h"
+#include "config.h"
+#include "constants.h"
+#include "lexer.h"
+#include "server_protocol.h"
+#include "util.h"
+#include "vec.h"
+
+// Bump when entry layout or key material changes
+#define CACHE_FORMAT_TAG "fluff-assembler-cache-1"
+
+// "FACE", entry file header
+#define CACHE_ENTRY_MAGIC 0x46414345
+
+// 128-bit key as hex
+#define CACHE_KEY_LENGTH 32
+
+// Leftover temporary files older than this are
+// removed by eviction
+#define CACHE_STALE_TEMP_AGE (60 * 60)
+
+static const char assemblerVersion[] = stringify(CONFIG_VERSION_MAJOR) "."
+                                       stringify(CONFIG_VERSION_MINOR) "."
+                                       stringify(CONFIG_VERSION_PATCH)
+                                       CONFIG_VERSION_LOCAL_VERSION;
+
+struct cache_entry_header {
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t assembleTimeNs;
+  uint64_t bytecodeSize;
+  uint64_t debugInfoSize;
+};
+
+// Return 0 on success
+// Errors:
+// -ENOTDIR: `directory` exists but isn't a directory
+// Other errno from mkdir or stat
+static int createDirectory(const char* directory) {
+  if (mkdir(directory, 0777) == 0)
+    return 0;
+  if (errno != EEXIST)
+    return -errno;
+  
+  struct stat st;
+  if (stat(directory, &st) < 0)
+    return -errno;
+  return S_ISDIR(st.st_mode) ? 0 : -ENOTDIR;
+}
+
+struct assembler_cache* assembler_cache_new(const char* directory) {
+  int res = createDirectory(directory);
+  if (res < 0) {
+    errno = -res;
+    return NULL;
+  }
+  
+  struct assembler_cache* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
+  
+  if ((self->directory = allocator_strdup(directory)) == NULL) {
+    allocator_free(self);
+    return NULL;
+  }
+  
+  atomic_init(&self->hits, 0);
+  atomic_init(&self->misses, 0);
+  atomic_init(&self->stores, 0);
+  atomic_init(&self->timeSavedNs, 0);
+  return self;
+}
+
+void assembler_cache_free(struct assembler_cache* self) {
+  if (!self)
+    return;
+  
+  allocator_free(self->directory);
+  allocator_free(self);
+}
+
+// FNV-1a 128, collision in a content addressed cache means
+// silently wrong output so 64-bit is not enough
+typedef unsigned __int128 cache_hash;
+
+static cache_hash hashUpdate(cache_hash hash, const void* data, size_t size) {
+  static const cache_hash prime = ((cache_hash) 0x0000000001000000ULL << 64) | 0x000000000000013BULL;
+  const uint8_t* bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= prime;
+  }
+  return hash;
+}
+
+// Length prefixed so adjacent fields can't alias
+static cache_hash hashBlob(cache_hash hash, const void* data, size_t size) {
+  uint64_t length = size;
+  hash = hashUpdate(hash, &length, sizeof(length));
+  return hashUpdate(hash, data, size);
+}
+
+static void computeKey(const char* inputPath, const void* source, size_t sourceSize, const struct assembler_driver_options* options, bool debugInfo, char key[CACHE_KEY_LENGTH + 1]) {
+  static const cache_hash offset = ((cache_hash) 0x6C62272E07BB0142ULL << 64) | 0x62B821756295C58DULL;
+  uint64_t versions[] = {
+    VM_BYTECODE_VERSION,
+    options->serializer.version,
+    server_protocol_encode_flags(options, debugInfo)
+  };
+  
+  cache_hash hash = offset;
+  hash = hashBlob(hash, CACHE_FORMAT_TAG, strlen(CACHE_FORMAT_TAG));
+  hash = hashBlob(hash, assemblerVersion, strlen(assemblerVersion));
+  hash = hashBlob(hash, versions, sizeof(versions));
+  hash = hashBlob(hash, inputPath, strlen(inputPath));
+  hash = hashBlob(hash, source, sourceSize);
+  
+  snprintf(key, CACHE_KEY_LENGTH + 1, "%016llx%016llx", (unsigned long long) (hash >> 64), (unsigned long long) hash);
+}
+
+static uint64_t toNanoseconds(double seconds) {
+  return seconds > 0 ? (uint64_t) (seconds * 1e9) : 0;
+}
+
+// Return 0 on hit
+// Errors:
+// -ENOENT: Not in cache (or entry unusable)
+// -EIO: Cannot write the output
+static int lookup(struct assembler_cache* self, const char* entryPath, const char* outputPath, const char* debugInfoPath, char** errorMessage, size_t* resultSize, size_t* debugInfoSize, double start) {
+  void* entry = NULL;
+  size_t entrySize = 0;
+  int res = 0;
+  
+  if (util_read_file(entryPath, &entry, &entrySize) < 0)
+    return -ENOENT;
+  
+  // Truncated or foreign entries are just misses, storing
+  // will replace them
+  struct cache_entry_header header;
+  if (entrySize < sizeof(header)) {
+    res = -ENOENT;
+    goto unusable_entry;
+  }
+  
+  memcpy(&header, entry, sizeof(header));
+  if (header.magic != CACHE_ENTRY_MAGIC ||
+      header.bytecodeSize > entrySize ||
+      header.debugInfoSize > entrySize ||
+      sizeof(header) + header.bytecodeSize + header.debugInfoSize != entrySize) {
+    res = -ENOENT;
+    goto unusable_entry;
+  }
+  
+  const char* bytecode = (const char*) entry + sizeof(header);
+  const char* debugInfo = bytecode + header.bytecodeSize;
+  if (util_write_file(outputPath, bytecode, header.bytecodeSize) < 0) {
+    util_asprintf(errorMessage, "Cannot write output file '%s'", outputPath);
+    res = -EIO;
+    goto unusable_entry;
+  }
+  
+  if (debugInfoPath && util_write_file(debugInfoPath, debugInfo, header.debugInfoSize) < 0) {
+    util_asprintf(errorMessage, "Cannot write debug info file '%s'", debugInfoPath);
+    res = -EIO;
+    goto unusable_entry;
+  }
+  
+  // Mark as recently used, access time is unreliable
+  // with relatime/noatime mounts
+  utimensat(AT_FDCWD, entryPath, NULL, 0);
+  
+  if (resultSize)
+    *resultSize = header.bytecodeSize;
+  if (debugInfoSize)
+    *debugInfoSize = header.debugInfoSize;
+  
+  uint64_t hitTimeNs = toNanoseconds(util_monotonic_time() - start);
+  if (header.assembleTimeNs > hitTimeNs)
+    atomic_fetch_add(&self->timeSavedNs, header.assembleTimeNs - hitTimeNs);
+  atomic_fetch_add(&self->hits, 1);
+  
+unusable_entry:
+  allocator_free(entry);
+  return res;
+}
+
+// Best effort, failure only means next lookup misses
+static void store(struct assembler_cache* self, const char* entryPath, const void* bytecode, size_t bytecodeSize, const void* debugInfo, size_t debugInfoSize, double assembleTime) {
+  char* tempPath = NULL;
+  FILE* file = NULL;
+  
+  util_asprintf(&tempPath, "%s/.tmp-XXXXXX", self->directory);
+  if (!tempPath)
+    return;
+  
+  int fd = mkstemp(tempPath);
+  if (fd < 0)
+    goto temp_create_failure;
+  
+  // mkstemp creates it as 0600 but the cache may be shared
+  fchmod(fd, 0644);
+  
+  if ((file = fdopen(fd, "wb")) == NULL) {
+    close(fd);
+    goto write_failure;
+  }
+  
+  struct cache_entry_header header = {
+    .magic = CACHE_ENTRY_MAGIC,
+    .assembleTimeNs = toNanoseconds(assembleTime),
+    .bytecodeSize = bytecodeSize,
+    .debugInfoSize = debugInfoSize
+  };
+  
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(bytecode, 1, bytecodeSize, file) == bytecodeSize &&
+            (debugInfoSize == 0 || fwrite(debugInfo, 1, debugInfoSize, file) == debugInfoSize);
+  if (fclose(file) != 0 || !ok)
+    goto write_failure;
+  
+  // Atomic, concurrent writers of same key both produce
+  // identical entry so last rename winning is fine
+  if (rename(tempPath, entryPath) < 0)
+    goto write_failure;
+  
+  atomic_fetch_add(&self->stores, 1);
+  allocator_free(tempPath);
+  return;
+  
+write_failure:
+  unlink(tempPath);
+temp_create_failure:
+  allocator_free(tempPath);
+}
+
+int assembler_cache_assemble_file(struct assembler_cache* self, struct assembler_context* context, const char* inputPath, const char* outputPath, const char* debugInfoPath, const struct assembler_driver_options* options, const char** errorMessageRet, size_t* resultSizeRet, size_t* debugInfoSizeRet) {
+  static const struct assembler_driver_options defaultOptions = ASSEMBLER_DRIVER_OPTIONS_DEFAULT;
+  double start = util_monotonic_time();
+  int res = 0;
+  char* errorMessage = NULL;
+  struct util_mapped_file input = UTIL_MAPPED_FILE_INIT;
+  char* entryPath = NULL;
+  struct byte_buffer result = BYTE_BUFFER_INIT;
+  struct byte_buffer debugInfo = BYTE_BUFFER_INIT;
+  
+  if (!options)
+    options = &defaultOptions;
+  
+  if ((res = util_map_file(inputPath, LEXER_MAX_INPUT_SIZE, &input)) == -EFBIG) {
+    util_asprintf(&errorMessage, "Input file '%s' is too large", inputPath);
+    goto read_failure;
+  } else if (res < 0) {
+    util_asprintf(&errorMessage, "Cannot open input file '%s'", inputPath);
+    goto read_failure;
+  }
+  
+  char key[CACHE_KEY_LENGTH + 1];
+  computeKey(inputPath, input.data, input.size, options, debugInfoPath != NULL, key);
+  util_asprintf(&entryPath, "%s/%s", self->directory, key);
+  if (!entryPath) {
+    res = -ENOMEM;
+    goto entry_path_failure;
+  }
+  
+  res = lookup(self, entryPath, outputPath, debugInfoPath, &errorMessage, resultSizeRet, debugInfoSizeRet, start);
+  if (res != -ENOENT)
+    goto lookup_done;
+  atomic_fetch_add(&self->misses, 1);
+  
+  if (context)
+    res = assembler_context_assemble_buffer(context, inputPath, input.data, input.size, options, (const char**) &errorMessage, &result,
+                                            debugInfoPath ? &debugInfo : NULL);
+  else
+    res = assembler_driver_assemble_buffer(inputPath, input.data, input.size, options, (const char**) &errorMessage, &result,
+                                           debugInfoPath ? &debugInfo : NULL);
+  if (res < 0)
+    goto assemble_failure;
+  
+  if ((res = util_write_file(outputPath, result.data, result.size)) < 0) {
+    util_asprintf(&errorMessage, "Cannot write output file '%s'", outputPath);
+    goto write_failure;
+  }
+  
+  if (debugInfoPath && (res = util_write_file(debugInfoPath, debugInfo.data, debugInfo.size)) < 0) {
+    util_asprintf(&errorMessage, "Cannot write debug info file '%s'", debugInfoPath);
+    goto write_failure;
+  }
+  
+  store(self, entryPath, result.data, result.size, debugInfo.data, debugInfo.size, util_monotonic_time() - start);
+  
+  if (resultSizeRet)
+    *resultSizeRet = result.size;
+  if (debugInfoSizeRet)
+    *debugInfoSizeRet = debugInfo.size;
+  
+write_failure:
+assemble_failure:
+  byte_buffer_deinit(&debugInfo);
+  byte_buffer_deinit(&result);
+lookup_done:
+  allocator_free(entryPath);
+entry_path_failure:
+  util_unmap_file(&input);
+read_failure:
+  if (errorMessageRet)
+    *errorMessageRet = errorMessage;
+  else
+    allocator_free(errorMessage);
+  return res;
+}
+
+void assembler_cache_get_stats(struct assembler_cache* self, struct assembler_cache_stats* stats) {
+  *stats = (struct assembler_cache_stats) {
+    .hits = atomic_load(&self->hits),
+    .misses = atomic_load(&self->misses),
+    .stores = atomic_load(&self->stores),
+    .timeSaved = (double) atomic_load(&self->timeSavedNs) / 1e9
+  };
+}
+
+struct cache_file {
+  char name[CACHE_KEY_LENGTH + 1];
+  struct timespec lastUsed;
+  uint64_t size;
+};
+
+static bool isEntryName(const char* name) {
+  if (strlen(name) != CACHE_KEY_LENGTH)
+    return false;
+  
+  for (int i = 0; i < CACHE_KEY_LENGTH; i++)
+    if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')))
+      return false;
+  return true;
+}
+
+static int compareLastUsed(const void* _a, const void* _b) {
+  const struct cache_file* a = _a;
+  const struct cache_file* b = _b;
+  if (a->lastUsed.tv_sec != b->lastUsed.tv_sec)
+    return a->lastUsed.tv_sec < b->lastUsed.tv_sec ? -1 : 1;
+  if (a->lastUsed.tv_nsec != b->lastUsed.tv_nsec)
+    return a->lastUsed.tv_nsec < b->lastUsed.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+int assembler_cache_evict(struct assembler_cache* self, uint64_t maxSize, int* evictedCountRet, uint64_t* evictedSizeRet) {
+  int res = 0;
+  int evictedCount = 0;
+  uint64_t evictedSize = 0;
+  uint64_t totalSize = 0;
+  vec_t(struct cache_file) files;
+  vec_init(&files);
+  
+  DIR* dir = opendir(self->directory);
+  if (!dir)
+    return -EIO;
+  
+  time_t now = time(NULL);
+  struct dirent* dirEntry;
+  while ((dirEntry = readdir(dir)) != NULL) {
+    struct stat st;
+    if (fstatat(dirfd(dir), dirEntry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(st.st_mode))
+      continue;
+  
+    // Temporary file from writer which died before renaming
+    if (strncmp(dirEntry->d_name, ".tmp-", strlen(".tmp-")) == 0) {
+      if (now - st.st_mtim.tv_sec > CACHE_STALE_TEMP_AGE)
+        unlinkat(dirfd(dir), dirEntry->d_name, 0);
+      continue;
+    }
+  
+    if (!isEntryName(dirEntry->d_name))
+      continue;
+  
+    struct cache_file file = {
+      .lastUsed = st.st_mtim,
+      .size = st.st_size
+    };
+    strcpy(file.name, dirEntry->d_name);
+  
+    if (vec_push(&files, file) < 0) {
+      res = -ENOMEM;
+      goto scan_failure;
+    }
+    totalSize += file.size;
+  }
+  
+  qsort(files.data, files.length, sizeof(*files.data), compareLastUsed);
+  
+  struct cache_file* file;
+  size_t i;
+  vec_foreach_ptr(&files, file, i) {
+    if (totalSize <= maxSize)
+      break;
+  
+    // Someone else (another evictor) may have removed it
+    // already, either way it no longer counts
+    unlinkat(dirfd(dir), file->name, 0);
+    totalSize -= file->size;
+    evictedSize += file->size;
+    evictedCount++;
+  }
+  
+  if (evictedCountRet)
+    *evictedCountRet = evictedCount;
+  if (evictedSizeRet)
+    *evictedSizeRet = evictedSize;
+  
+scan_failure:
+  vec_deinit(&files);
+  closedir(dir);
+  return res;
+}
+
@@ -0,0 +1,68 @@
+#ifndef _headers_1667646512_Fluff_Assembler_assembler_cache
+#define _headers_1667646512_Fluff_Assembler_assembler_cache
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct assembler_context;
+struct assembler_driver_options;
+
+// Content addressed on-disk cache of assembled outputs
+//
+// Entries are keyed by hash of the source bytes, input name
+// (it ends up in the bytecode), assembler version, bytecode
+// version and output options. Each entry is a single file
+// written to a temporary name and renamed into place, so
+// concurrent writers (threads or processes) never expose
+// partial entries. Entry's modification time is bumped on
+// every hit and is what eviction uses as LRU order
+
+struct assembler_cache {
+  char* directory;
+
+  // Counters shared by every thread using the cache
+  atomic_uint_fast64_t hits;
+  atomic_uint_fast64_t misses;
+  atomic_uint_fast64_t stores;
+  // Time assembling would have taken minus time to
+  // serve the hit, in nanoseconds
+  atomic_uint_fast64_t timeSavedNs;
+};
+
+struct assembler_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t stores;
+
+  // In seconds
+  double timeSaved;
+};
+
+// Directory is created if not exist (but not its parents)
+// Return NULL if out of memory or cannot create directory,
+// errno is ENOTDIR if `directory` exists but isn't one
+struct assembler_cache* assembler_cache_new(const char* directory);
+void assembler_cache_free(struct assembler_cache* self);
+
+// Same contract as assembler_driver_assemble_file but serve
+// the result from cache if possible, and store it on a miss
+// Failing to store never fails the assembly
+// `context` can be NULL, if not it is used to assemble on a miss
+// Safe to call concurrently from multiple threads (with
+// different contexts)
+int assembler_cache_assemble_file(struct assembler_cache* self, struct assembler_context* context, const char* inputPath, const char* outputPath, const char* debugInfoPath, const struct assembler_driver_options* options, const char** errorMessage, size_t* resultSize, size_t* debugInfoSize);
+
+void assembler_cache_get_stats(struct assembler_cache* self, struct assembler_cache_stats* stats);
+
+// Delete least recently used entries until total size of
+// the cache is at most `maxSize` bytes
+// `evictedCount` and `evictedSize` can be NULL
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EIO: Cannot read the cache directory
+int assembler_cache_evict(struct assembler_cache* self, uint64_t maxSize, int* evictedCount, uint64_t* evictedSize);
+
+#endif
+
@@ -0,0 +1,478 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler_context.h"
+#include "allocator.h"
+#include "assembler_driver.h"
+#include "assembler_stats.h"
+#include "bytecode/bytecode.h"
+#include "bytecode/protobuf_serializer.h"
+#include "byte_buffer.h"
+#include "incremental_cache.h"
+#include "lexer.h"
+#include "parser_stage1.h"
+#include "parser_stage2.h"
+#include "spsc_queue.h"
+#include "statement_compiler.h"
+#include "trace.h"
+#include "util.h"
+
+// Tokens and statements in flight between pipelined stages
+#define PIPELINE_TOKEN_QUEUE_SIZE 4096
+#define PIPELINE_STATEMENT_QUEUE_SIZE 1024
+
+struct assembler_context* assembler_context_new() {
+  struct assembler_context* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
+  
+  self->parser_stage1 = NULL;
+  self->parser_stage2 = NULL;
+  self->stats = NULL;
+  self->incremental = NULL;
+  
+  if ((self->lexer = lexer_new(NULL, NULL)) == NULL)
+    goto failure;
+  if ((self->parser_stage1 = parser_stage1_new(self->lexer)) == NULL)
+    goto failure;
+  if ((self->parser_stage2 = parser_stage2_new(self->parser_stage1)) == NULL)
+    goto failure;
+  return self;
+  
+failure:
+  assembler_context_free(self);
+  return NULL;
+}
+
+void assembler_context_free(struct assembler_context* self) {
+  if (!self)
+    return;
+  
+  parser_stage2_free(self->parser_stage2);
+  parser_stage1_free(self->parser_stage1);
+  if (self->lexer)
+    lexer_free(self->lexer);
+  allocator_free(self);
+}
+
+static char* copyErrorMessage(const char* errorMessage) {
+  return errorMessage ? allocator_strdup(errorMessage) : NULL;
+}
+
+static int runLexer(struct assembler_context* self) {
+  struct assembler_stats* stats = self->stats;
+  struct assembler_stats_timer timer;
+  struct trace_span span;
+  
+  trace_span_begin(&span, "stage", assembler_stats_get_stage_name(ASSEMBLER_STAGE_LEXER));
+  if (stats)
+    assembler_stats_timer_start(&timer, ASSEMBLER_STAGE_LEXER);
+  int res = lexer_process(self->lexer);
+  trace_span_end(&span);
+  if (stats) {
+    assembler_stats_timer_stop(stats, &timer);
+    stats->bytesRead += self->lexer->sourceOffset;
+    stats->tokens += self->lexer->tokenCount;
+  }
+  return res;
+}
+
+static int runParserStage1(struct assembler_context* self) {
+  struct assembler_stats* stats = self->stats;
+  struct assembler_stats_timer timer;
+  struct trace_span span;
+  
+  trace_span_begin(&span, "stage", assembler_stats_get_stage_name(ASSEMBLER_STAGE_PARSER_STAGE1));
+  if (stats)
+    assembler_stats_timer_start(&timer, ASSEMBLER_STAGE_PARSER_STAGE1);
+  int res = parser_stage1_process(self->parser_stage1);
+  trace_span_end(&span);
+  if (stats) {
+    assembler_stats_timer_stop(stats, &timer);
+    stats->statements += self->parser_stage1->statementCount;
+  }
+  return res;
+}
+
+static int runParserStage2(struct assembler_context* self, struct bytecode** bytecode) {
+  struct assembler_stats* stats = self->stats;
+  struct assembler_stats_timer timer;
+  struct parser_stage2* parser_stage2 = self->parser_stage2;
+  struct trace_span span;
+  
+  // Emitter finalize happens inside stage 2, take it out
+  // so the stages don't overlap (in trace it shows nested)
+  struct assembler_stage_time finalizeBefore;
+  trace_span_begin(&span, "stage", assembler_stats_get_stage_name(ASSEMBLER_STAGE_PARSER_STAGE2));
+  if (stats) {
+    finalizeBefore = stats->stages[ASSEMBLER_STAGE_EMITTER_FINALIZE];
+    assembler_stats_timer_start(&timer, ASSEMBLER_STAGE_PARSER_STAGE2);
+  }
+  int res = parser_stage2_process(parser_stage2, bytecode);
+  trace_span_end(&span);
+  if (stats) {
+    assembler_stats_timer_stop(stats, &timer);
+    
+    assembler_stats_exclude_nested(stats, ASSEMBLER_STAGE_PARSER_STAGE2, ASSEMBLER_STAGE_EMITTER_FINALIZE, &finalizeBefore);
+    assembler_stats_sample_hashmap(&stats->instructionRegistry,
+                                   hashmap_load_factor(&parser_stage2->statementCompiler->emitterRegistry),
+                                   hashmap_collisions_mean(&parser_stage2->statementCompiler->emitterRegistry));
+  }
+  return res;
+}
+
+static int runSequential(struct assembler_context* self, struct bytecode** bytecode, char** errorMessage) {
+  int res;
+  if ((res = runLexer(self)) < 0) {
+    *errorMessage = copyErrorMessage(self->lexer->errorMessage);
+    return res;
+  }
+  
+  if ((res = runParserStage1(self)) < 0) {
+    *errorMessage = copyErrorMessage(self->parser_stage1->errorMessage);
+    return res;
+  }
+  
+  if ((res = runParserStage2(self, bytecode)) < 0)
+    *errorMessage = copyErrorMessage(self->parser_stage2->errorMessage);
+  return res;
+}
+
+struct pipeline {
+  struct assembler_context* context;
+  struct spsc_queue tokens;
+  struct spsc_queue statements;
+  
+  int lexerResult;
+  int parserStage1Result;
+};
+
+static void* lexerWorker(void* _pipeline) {
+  struct pipeline* pipeline = _pipeline;
+  pipeline->lexerResult = runLexer(pipeline->context);
+  spsc_queue_close(&pipeline->tokens);
+  return NULL;
+}
+
+static void* parserStage1Worker(void* _pipeline) {
+  struct pipeline* pipeline = _pipeline;
+  pipeline->parserStage1Result = runParserStage1(pipeline->context);
+  
+  // Lexer may be waiting on full queue, let it run to the
+  // end so its errors still come first like in sequential
+  if (pipeline->parserStage1Result < 0)
+    spsc_queue_abort(&pipeline->tokens);
+  spsc_queue_close(&pipeline->statements);
+  return NULL;
+}
+
+// Thread entries, workers also run on caller's thread
+static void* lexerThreadEntry(void* pipeline) {
+  trace_set_thread_name("lexer");
+  return lexerWorker(pipeline);
+}
+
+static void* parserStage1ThreadEntry(void* pipeline) {
+  trace_set_thread_name("parser_stage1");
+  return parserStage1Worker(pipeline);
+}
+
+// Lexer and stage 1 get their own threads, stage 2 runs
+// on caller's. Errors are reported from the earliest
+// failing stage so result is same as runSequential's
+static int runPipelined(struct assembler_context* self, struct bytecode** bytecode, char** errorMessage) {
+  struct pipeline pipeline = {
+    .context = self
+  };
+  
+  int res = 0;
+  if ((res = spsc_queue_init(&pipeline.tokens, PIPELINE_TOKEN_QUEUE_SIZE)) < 0)
+    goto tokens_queue_alloc_failure;
+  if ((res = spsc_queue_init(&pipeline.statements, PIPELINE_STATEMENT_QUEUE_SIZE)) < 0)
+    goto statements_queue_alloc_failure;
+  
+  self->lexer->output = &pipeline.tokens;
+  self->parser_stage1->input = &pipeline.tokens;
+  self->parser_stage1->output = &pipeline.statements;
+  self->parser_stage2->input = &pipeline.statements;
+  
+  // Stages which can't get a thread run here before
+  // the next one starts reading their results directly
+  pthread_t lexerThread;
+  bool isLexerThreaded = pthread_create(&lexerThread, NULL, lexerThreadEntry, &pipeline) == 0;
+  if (!isLexerThreaded) {
+    self->lexer->output = NULL;
+    self->parser_stage1->input = NULL;
+    lexerWorker(&pipeline);
+  }
+  
+  pthread_t parserStage1Thread;
+  bool isParserStage1Threaded = pthread_create(&parserStage1Thread, NULL, parserStage1ThreadEntry, &pipeline) == 0;
+  if (!isParserStage1Threaded) {
+    self->parser_stage1->output = NULL;
+    self->parser_stage2->input = NULL;
+    parserStage1Worker(&pipeline);
+  }
+  
+  res = runParserStage2(self, bytecode);
+  
+  // Stage 2 can stop before reading everything
+  spsc_queue_abort(&pipeline.statements);
+  if (isParserStage1Threaded)
+    pthread_join(parserStage1Thread, NULL);
+  if (isLexerThreaded)
+    pthread_join(lexerThread, NULL);
+  
+  // Statements stage 2 never got are owned by nobody now
+  struct statement* leftover;
+  while ((leftover = spsc_queue_take_leftover(&pipeline.statements)) != NULL)
+    parser_stage1_free_statement(leftover);
+  
+  self->lexer->output = NULL;
+  self->parser_stage1->input = NULL;
+  self->parser_stage1->output = NULL;
+  self->parser_stage2->input = NULL;
+  
+  if (pipeline.lexerResult < 0) {
+    res = pipeline.lexerResult;
+    *errorMessage = copyErrorMessage(self->lexer->errorMessage);
+  } else if (pipeline.parserStage1Result < 0) {
+    res = pipeline.parserStage1Result;
+    *errorMessage = copyErrorMessage(self->parser_stage1->errorMessage);
+  } else if (res < 0) {
+    *errorMessage = copyErrorMessage(self->parser_stage2->errorMessage);
+  }
+  
+  // Stage 2 may have succeeded on truncated input
+  if (res < 0 && *bytecode) {
+    bytecode_free(*bytecode);
+    *bytecode = NULL;
+  }
+  
+  spsc_queue_deinit(&pipeline.statements);
+statements_queue_alloc_failure:
+  spsc_queue_deinit(&pipeline.tokens);
+tokens_queue_alloc_failure:
+  return res;
+}
+
+// Lexer must be reset to new input before calling this
+// `result` can be NULL to only check the source
+static int assemble(struct assembler_context* self, const struct assembler_driver_options* options, const char** errorMessageRet, struct byte_buffer* result, struct byte_buffer* debugInfo) {
+  static const struct assembler_driver_options defaultOptions = ASSEMBLER_DRIVER_OPTIONS_DEFAULT;
+  int res = 0;
+  struct bytecode* bytecode = NULL;
+  struct parser_stage2* parser_stage2 = self->parser_stage2;
+  struct assembler_stats* stats = self->stats;
+  struct assembler_stats_timer timer;
+  struct trace_span span;
+  struct trace_span serializeSpan;
+  char* errorMessage = NULL;
+  
+  // Needs whole source before lexing
+  struct incremental_cache* incremental = self->lexer->input ? NULL : self->incremental;
+  const char* source = self->lexer->source;
+  size_t sourceSize = self->lexer->sourceSize;
+  const char* inputName = self->lexer->inputName;
+  uint64_t reusedBefore = stats ? stats->reusedPrototypes : 0;
+  
+  if (!options)
+    options = &defaultOptions;
+  
+  trace_span_begin(&span, "assemble", inputName ? inputName : "<input>");
+
+assemble_again:
+  parser_stage1_reset(self->parser_stage1, self->lexer);
+  parser_stage2_reset(parser_stage2, self->parser_stage1);
+  parser_stage2->compactInstructions = options->compactInstructions;
+  parser_stage2->allowUnresolvedPrototypes = options->object;
+  parser_stage2->stats = stats;
+  
+  if (incremental) {
+    if ((res = incremental_cache_prepare(incremental, options, source, sourceSize)) < 0)
+      goto stages_failure;
+    self->lexer->skipRanges = incremental->skips.data;
+    self->lexer->skipRangeCount = incremental->skips.length;
+    parser_stage2->incremental = incremental;
+  }
+  
+  if (options->pipelined)
+    res = runPipelined(self, &bytecode, &errorMessage);
+  else
+    res = runSequential(self, &bytecode, &errorMessage);
+  
+  // Without last assembly nothing is reused so this
+  // happens at most once
+  if (res == -EAGAIN && incremental) {
+    allocator_free(errorMessage);
+    errorMessage = NULL;
+    if (stats)
+      stats->reusedPrototypes = reusedBefore;
+    
+    incremental_cache_reset(incremental);
+    lexer_reset_buffer(self->lexer, source, sourceSize, inputName);
+    goto assemble_again;
+  }
+  if (res < 0)
+    goto stages_failure;
+  
+  if (stats && assembler_stats_count_bytecode(stats, bytecode) < 0) {
+    res = -ENOMEM;
+    goto count_failure;
+  }
+  
+  // Only serialize when needed
+  size_t resultStart = result ? result->size : 0;
+  if (!result)
+    goto serialization_unneded;
+  
+  trace_span_begin(&serializeSpan, "stage", assembler_stats_get_stage_name(ASSEMBLER_STAGE_SERIALIZE));
+  if (stats)
+    assembler_stats_timer_start(&timer, ASSEMBLER_STAGE_SERIALIZE);
+  
+  size_t debugInfoStart = debugInfo ? debugInfo->size : 0;
+  if ((res = bytecode_serializer_protobuf_append(bytecode, &options->serializer, result)) < 0)
+    goto serializing_failure;
+  
+  if (debugInfo) {
+    res = bytecode_serializer_protobuf_debug_info_append(bytecode, &options->serializer, (char*) result->data + resultStart,
+                                                         result->size - resultStart, debugInfo);
+    if (res < 0) {
+      result->size = resultStart;
+      goto serializing_failure;
+    }
+  }
+  
+  if (stats) {
+    stats->outputBytes += result->size - resultStart;
+    stats->debugInfoBytes += debugInfo ? debugInfo->size - debugInfoStart : 0;
+  }
+  
+serializing_failure:
+  if (stats)
+    assembler_stats_timer_stop(stats, &timer);
+  trace_span_end(&serializeSpan);
+serialization_unneded:
+  // Failure to keep it only makes next one slower
+  if (res >= 0 && incremental)
+    incremental_cache_update(incremental, options, source, sourceSize, bytecode,
+                             result ? (char*) result->data + resultStart : NULL, result ? result->size - resultStart : 0);
+count_failure:
+  bytecode_free(bytecode);
+stages_failure:
+  trace_span_end(&span);
+  if (errorMessageRet)
+    *errorMessageRet = errorMessage;
+  else
+    allocator_free(errorMessage);
+  return res;
+}
+
+int assembler_context_assemble(struct assembler_context* self, const char* inputName, FILE* inputFile, const struct assembler_driver_options* options, const char** errorMessage, struct byte_buffer* result, struct byte_buffer* debugInfo) {
+  lexer_reset(self->lexer, inputFile, inputName);
+  return assemble(self, options, errorMessage, result, debugInfo);
+}
+
+int assembler_context_assemble_buffer(struct assembler_context* self, const char* inputName, const char* source, size_t sourceSize, const struct assembler_driver_options* options, const char** errorMessage, struct byte_buffer* result, struct byte_buffer* debugInfo) {
+  lexer_reset_buffer(self->lexer, source, sourceSize, inputName);
+  return assemble(self, options, errorMessage, result, debugInfo);
+}
+
+int assembler_context_assemble_file(struct assembler_context* self, const char* inputPath, const char* outputPath, const char* debugInfoPath, const struct assembler_driver_options* options, const char** errorMessageRet, size_t* resultSizeRet, size_t* debugInfoSizeRet) {
+  int res = 0;
+  char* errorMessage = NULL;
+  struct util_mapped_file input = UTIL_MAPPED_FILE_INIT;
+  struct byte_buffer result = BYTE_BUFFER_INIT;
+  struct byte_buffer debugInfo = BYTE_BUFFER_INIT;
+  struct incremental_cache* incremental = NULL;
+  char* incrementalPath = NULL;
+  struct assembler_stats_timer timer;
+  struct trace_span span;
+  
+  trace_span_begin(&span, "stage", assembler_stats_get_stage_name(ASSEMBLER_STAGE_READ));
+  if (self->stats)
+    assembler_stats_timer_start(&timer, ASSEMBLER_STAGE_READ);
+  res = util_map_file(inputPath, LEXER_MAX_INPUT_SIZE, &input);
+  if (self->stats)
+    assembler_stats_timer_stop(self->stats, &timer);
+  trace_span_end(&span);
+  
+  if (res == -EFBIG) {
+    util_asprintf(&errorMessage, "Input file '%s' is too large", inputPath);
+    goto input_read_failure;
+  } else if (res < 0) {
+    util_asprintf(&errorMessage, "Cannot open input file '%s'", inputPath);
+    goto input_read_failure;
+  }
+  
+  // Missing or unreadable sidecar means nothing to reuse
+  struct incremental_cache* oldIncremental = self->incremental;
+  if (options && options->incremental) {
+    if ((incrementalPath = incremental_cache_get_path(outputPath)) == NULL || (incremental = incremental_cache_new()) == NULL) {
+      res = -ENOMEM;
+      goto incremental_failure;
+    }
+    
+    void* data = NULL;
+    size_t size = 0;
+    if (util_read_file(incrementalPath, &data, &size) >= 0) {
+      res = incremental_cache_load(incremental, data, size);
+      allocator_free(data);
+      if (res < 0)
+        goto incremental_failure;
+    }
+    self->incremental = incremental;
+  }
+  
+  res = assembler_context_assemble_buffer(self, inputPath, input.data, input.size, options, (const char**) &errorMessage, &result,
+                                          debugInfoPath ? &debugInfo : NULL);
+  self->incremental = oldIncremental;
+  if (res < 0)
+    goto assemble_failure;
+  
+  trace_span_begin(&span, "stage", assembler_stats_get_stage_name(ASSEMBLER_STAGE_WRITE));
+  if (self->stats)
+    assembler_stats_timer_start(&timer, ASSEMBLER_STAGE_WRITE);
+  
+  if ((res = util_write_file(outputPath, result.data, result.size)) < 0) {
+    util_asprintf(&errorMessage, "Cannot write output file '%s'", outputPath);
+    goto write_failure;
+  }
+  
+  if (debugInfoPath && (res = util_write_file(debugInfoPath, debugInfo.data, debugInfo.size)) < 0) {
+    util_asprintf(&errorMessage, "Cannot write debug info file '%s'", debugInfoPath);
+    goto write_failure;
+  }
+  
+  // Output is already written, without the sidecar next
+  // assemble just reuses nothing
+  if (incremental && incremental->data.size > 0)
+    util_write_file(incrementalPath, incremental->data.data, incremental->data.size);
+  
+  if (resultSizeRet)
+    *resultSizeRet = result.size;
+  if (debugInfoSizeRet)
+    *debugInfoSizeRet = debugInfo.size;
+  
+write_failure:
+  if (self->stats)
+    assembler_stats_timer_stop(self->stats, &timer);
+  trace_span_end(&span);
+assemble_failure:
+incremental_failure:
+  incremental_cache_free(incremental);
+  allocator_free(incrementalPath);
+  byte_buffer_deinit(&debugInfo);
+  byte_buffer_deinit(&result);
+  util_unmap_file(&input);
+input_read_failure:
+  if (errorMessageRet)
+    *errorMessageRet = errorMessage;
+  else
+    allocator_free(errorMessage);
+  return res;
+}
+
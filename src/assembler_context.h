@@ -0,0 +1,58 @@
+#ifndef _headers_1667812408_Fluff_Assembler_assembler_context
+#define _headers_1667812408_Fluff_Assembler_assembler_context
+
+#include <stddef.h>
+#include <stdio.h>
+
+struct assembler_driver_options;
+struct assembler_stats;
+struct byte_buffer;
+struct incremental_cache;
+struct lexer;
+struct parser_stage1;
+struct parser_stage2;
+
+// Reusable state for assembling many inputs one after another
+//
+// Keeps the lexer, both parsers and the statement compiler with
+// its instruction registry alive between compilations, they
+// are reset instead of being rebuilt, which also keeps their
+// vectors' and hashmaps' capacity. Not thread safe, use one
+// context per thread
+
+struct assembler_context {
+  struct lexer* lexer;
+  struct parser_stage1* parser_stage1;
+  struct parser_stage2* parser_stage2;
+  
+  // Statistics of every assemble through this context are
+  // added to this if not NULL (default NULL)
+  struct assembler_stats* stats;
+  
+  // Every assemble from memory through this context reuses
+  // prototypes unchanged since last one and updates it if
+  // not NULL (default NULL), see incremental_cache.h
+  struct incremental_cache* incremental;
+};
+
+struct assembler_context* assembler_context_new();
+void assembler_context_free(struct assembler_context* self);
+
+// Same as assembler_driver_assemble but result and debug info
+// is appended to caller's buffers (`result` and `debugInfo`
+// can be NULL), which are left as they were on error
+// `errorMessage` must be free'd on error
+// Return 0 on success
+// Errors:
+// -EFAULT: Failure assembling
+// -ENOMEM: No memory
+int assembler_context_assemble(struct assembler_context* self, const char* inputName, FILE* inputFile, const struct assembler_driver_options* options, const char** errorMessage, struct byte_buffer* result, struct byte_buffer* debugInfo);
+
+// Same as assembler_driver_assemble_buffer
+int assembler_context_assemble_buffer(struct assembler_context* self, const char* inputName, const char* source, size_t sourceSize, const struct assembler_driver_options* options, const char** errorMessage, struct byte_buffer* result, struct byte_buffer* debugInfo);
+
+// Same as assembler_driver_assemble_file
+int assembler_context_assemble_file(struct assembler_context* self, const char* inputPath, const char* outputPath, const char* debugInfoPath, const struct assembler_driver_options* options, const char** errorMessage, size_t* resultSize, size_t* debugInfoSize);
+
+#endif
+
@@ -1,82 +1,62 @@
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "assembler_context.h"
 #include "assembler_driver.h"
-#include "bytecode/bytecode.h"
-#include "bytecode/protobuf_serializer.h"
-#include "code_emitter.h"
-#include "lexer.h"
-#include "parser_stage1.h"
-#include "parser_stage2.h"
-#include "vec.h"
-#include "vm_types.h"
+#include "byte_buffer.h"
 
-int assembler_driver_assemble(const char* inputName, FILE* inputFile, const char** errorMessageRet, void** resultRet, size_t* sizeRet) {
-  int res = 0;
-  struct lexer* lexer = NULL;
-  struct bytecode* bytecode = NULL;
-  struct parser_stage1* parser_stage1 = NULL;
-  struct parser_stage2* parser_stage2 = NULL;
-  char* errorMessage = NULL;
-  
-  if ((lexer = lexer_new(inputFile, inputName)) == NULL) {
-    res = -ENOMEM;
-    goto lexer_alloc_failure;
-  }
-  
-  if ((parser_stage1 = parser_stage1_new(lexer)) == NULL) {
-    res = -ENOMEM;
-    goto stage1_alloc_failure;
+// Each call builds and tears down whole pipeline, callers
+// assembling many inputs should keep an assembler_context
+int assembler_driver_assemble(const char* inputName, FILE* inputFile, const struct assembler_driver_options* options, const char** errorMessage, void** resultRet, size_t* sizeRet, void** debugInfoRet, size_t* debugInfoSizeRet) {
+  struct byte_buffer result = BYTE_BUFFER_INIT;
+  struct byte_buffer debugInfo = BYTE_BUFFER_INIT;
+  struct assembler_context* context = assembler_context_new();
+  if (!context) {
+    if (errorMessage)
+      *errorMessage = NULL;
+    return -ENOMEM;
   }
   
-  if ((parser_stage2 = parser_stage2_new(parser_stage1)) == NULL) {
-    res = -ENOMEM;
-    goto stage2_alloc_failure;
-  } 
-  
-  if ((res = lexer_process(lexer)) < 0) {
-    errorMessage = strdup(lexer->errorMessage);
-    goto lexer_failure;
+  int res = assembler_context_assemble(context, inputName, inputFile, options, errorMessage, resultRet ? &result : NULL, debugInfoRet ? &debugInfo : NULL);
+  assembler_context_free(context);
+  if (res < 0 || !resultRet) {
+    byte_buffer_deinit(&result);
+    byte_buffer_deinit(&debugInfo);
+    return res;
   }
   
-  if ((res = parser_stage1_process(parser_stage1)) < 0) {
-    errorMessage = strdup(parser_stage1->errorMessage);
-    goto stage1_failure;
+  *resultRet = result.data;
+  *sizeRet = result.size;
+  if (debugInfoRet) {
+    *debugInfoRet = debugInfo.data;
+    *debugInfoSizeRet = debugInfo.size;
   }
-  
-  if ((res = parser_stage2_process(parser_stage2, &bytecode)) < 0) {
-    errorMessage = strdup(parser_stage2->errorMessage);
-    goto stage2_failure;
+  return 0;
+}
+
+int assembler_driver_assemble_buffer(const char* inputName, const char* source, size_t sourceSize, const struct assembler_driver_options* options, const char** errorMessage, struct byte_buffer* result, struct byte_buffer* debugInfo) {
+  struct assembler_context* context = assembler_context_new();
+  if (!context) {
+    if (errorMessage)
+      *errorMessage = NULL;
+    return -ENOMEM;
   }
   
-  // Only serialize when needed
-  if (!resultRet)
-    goto serialization_unneded;
-  
-  void* result;
-  size_t size;
-  res = bytecode_serializer_protobuf(bytecode, &result, &size);
-  
-  if (res < 0)
-    goto serializing_failure;
-  
-  *sizeRet = size;
-  *resultRet = result;
+  int res = assembler_context_assemble_buffer(context, inputName, source, sourceSize, options, errorMessage, result, debugInfo);
+  assembler_context_free(context);
+  return res;
+}
 
-serializing_failure:
-serialization_unneded:
-  bytecode_free(bytecode);
-stage1_failure:
-stage2_failure:
-lexer_failure:
-  parser_stage2_free(parser_stage2);
-stage2_alloc_failure:
-  parser_stage1_free(parser_stage1);
-stage1_alloc_failure:
-  lexer_free(lexer);
-lexer_alloc_failure:
+int assembler_driver_assemble_file(const char* inputPath, const char* outputPath, const char* debugInfoPath, const struct assembler_driver_options* options, const char** errorMessage, size_t* resultSize, size_t* debugInfoSize) {
+  struct assembler_context* context = assembler_context_new();
+  if (!context) {
+    if (errorMessage)
+      *errorMessage = NULL;
+    return -ENOMEM;
+  }
   
-  if (errorMessageRet)
-    *errorMessageRet = errorMessage;
+  int res = assembler_context_assemble_file(context, inputPath, outputPath, debugInfoPath, options, errorMessage, resultSize, debugInfoSize);
+  assembler_context_free(context);
   return res;
 }
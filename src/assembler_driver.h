@@ -1,17 +1,83 @@
 #ifndef _headers_1667133524_Fluff_Assembler_assembler_driver
 #define _headers_1667133524_Fluff_Assembler_assembler_driver
 
+#include <stdbool.h>
 #include <stdio.h>
 
+#include "bytecode/protobuf_serializer.h"
+
+struct byte_buffer;
+
 // Convenience layer for assembler
 
+struct assembler_driver_options {
+  // Use 32-bit short instructions where possible
+  // (needs version 2 or newer)
+  bool compactInstructions;
+  
+  // Run lexer, parser stage 1 and stage 2 concurrently on
+  // their own threads connected by bounded queues. Output
+  // is same as without
+  bool pipelined;
+  
+  // Output object file for the linker (see linker.h), loads
+  // of prototypes not defined in the input are left for it
+  // to resolve instead of being an error
+  bool object;
+  
+  // Keep `.fluff_inc` sidecar next to the output file and
+  // only assemble prototypes changed since it was written
+  // (see incremental_cache.h). Output behaves same as
+  // without, only used when assembling a file
+  bool incremental;
+  
+  struct bytecode_serializer_options serializer;
+};
+
+#define ASSEMBLER_DRIVER_OPTIONS_DEFAULT { \
+  .compactInstructions = false, \
+  .pipelined = false, \
+  .object = false, \
+  .incremental = false, \
+  .serializer = BYTECODE_SERIALIZER_OPTIONS_DEFAULT \
+}
+
 // Resulting in protobuf encoded bytecode (with the bytecode magic)
+// `options` can be NULL for defaults
+// `debugInfo` and `debugInfoSize` can be NULL, if not then
+// `.fluff_dbg` sidecar is generated into it (usually combined
+// with options->serializer.stripDebugInfo)
+// `errorMessage` must be free'd on error
+// Return 0 on success
+// Errors:
+// -EFAULT: Failure assembling
+// -ENOMEM: No memory
+int assembler_driver_assemble(const char* inputName, FILE* inputFile, const struct assembler_driver_options* options, const char** errorMessage, void** result, size_t* resultSize, void** debugInfo, size_t* debugInfoSize);
+
+// Same as assembler_driver_assemble but source is in memory and
+// lexed directly from it, output is appended to caller's `result`
+// and `debugInfo` (can be NULL) which are left as they were on
+// error. With reused buffers going from source to bytecode needs
+// no syscalls
+// `errorMessage` must be free'd on error
+// Return 0 on success
+// Errors:
+// -EFAULT: Failure assembling
+// -ENOMEM: No memory
+int assembler_driver_assemble_buffer(const char* inputName, const char* source, size_t sourceSize, const struct assembler_driver_options* options, const char** errorMessage, struct byte_buffer* result, struct byte_buffer* debugInfo);
+
+// Assemble `inputPath` and write the bytecode to `outputPath`
+// `debugInfoPath` can be NULL, if not then `.fluff_dbg` sidecar
+// is written to it
+// `resultSize` and `debugInfoSize` can be NULL
 // `errorMessage` must be free'd on error
+// Safe to call concurrently from multiple threads
 // Return 0 on success
 // Errors:
 // -EFAULT: Failure assembling
 // -ENOMEM: No memory
-int assembler_driver_assemble(const char* inputName, FILE* inputFile, const char** errorMessage, void** result, size_t* resultSize);
+// -EIO: Cannot open, read or write one of the files
+int assembler_driver_assemble_file(const char* inputPath, const char* outputPath, const char* debugInfoPath, const struct assembler_driver_options* options, const char** errorMessage, size_t* resultSize, size_t* debugInfoSize);
 
 #endif
 
@@ -0,0 +1,306 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assembler_stats.h"
+#include "allocator.h"
+#include "assembler_cache.h"
+#include "bytecode/bytecode.h"
+#include "bytecode/prototype.h"
+#include "util.h"
+
+static _Thread_local enum assembler_stage currentStage = ASSEMBLER_STAGE_COUNT;
+
+void assembler_stats_timer_start(struct assembler_stats_timer* timer, enum assembler_stage stage) {
+  timer->stage = stage;
+  timer->previousStage = currentStage;
+  currentStage = stage;
+  timer->wallTime = util_monotonic_time();
+  timer->cpuTime = util_thread_cpu_time();
+  
+  // Last so reading them isn't counted
+  if (perf_counters_is_enabled())
+    perf_counters_read(&timer->counters);
+}
+
+void assembler_stats_timer_stop(struct assembler_stats* self, const struct assembler_stats_timer* timer) {
+  struct assembler_stage_time* stage = &self->stages[timer->stage];
+  if (perf_counters_is_enabled()) {
+    struct perf_counters_sample counters;
+    perf_counters_read(&counters);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+      stage->counters[i] += counters.values[i] - timer->counters.values[i];
+    self->hasCounters = true;
+  }
+  
+  stage->wallTime += util_monotonic_time() - timer->wallTime;
+  stage->cpuTime += util_thread_cpu_time() - timer->cpuTime;
+  currentStage = timer->previousStage;
+}
+
+void assembler_stats_exclude_nested(struct assembler_stats* self, enum assembler_stage stage, enum assembler_stage nested, const struct assembler_stage_time* before) {
+  struct assembler_stage_time* outer = &self->stages[stage];
+  struct assembler_stage_time* inner = &self->stages[nested];
+  outer->wallTime -= inner->wallTime - before->wallTime;
+  outer->cpuTime -= inner->cpuTime - before->cpuTime;
+  for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+    outer->counters[i] -= inner->counters[i] - before->counters[i];
+}
+
+enum assembler_stage assembler_stats_get_current_stage() {
+  return currentStage;
+}
+
+void assembler_stats_sample_hashmap(struct assembler_hashmap_stats* self, double loadFactor, double collisionsMean) {
+  self->count++;
+  self->loadFactorSum += loadFactor;
+  self->collisionsMeanSum += collisionsMean;
+}
+
+static void countPrototype(struct assembler_stats* self, const struct prototype* prototype) {
+  self->prototypes++;
+  self->instructions += prototype->instructions.length;
+  
+  size_t i = 0;
+  struct prototype* current = NULL;
+  vec_foreach(&prototype->prototypes, current, i)
+    countPrototype(self, current);
+}
+
+static int compareConstant(const void* _a, const void* _b) {
+  const struct constant* a = _a;
+  const struct constant* b = _b;
+  if (a->type != b->type)
+    return a->type < b->type ? -1 : 1;
+  
+  if (a->type == BYTECODE_CONSTANT_STRING)
+    return strcmp(a->data.string, b->data.string);
+  
+  // Compare the bits so equal numbers are equal even if NaN
+  uint64_t aBits, bBits;
+  memcpy(&aBits, &a->data, sizeof(aBits));
+  memcpy(&bBits, &b->data, sizeof(bBits));
+  return aBits < bBits ? -1 : aBits > bBits;
+}
+
+int assembler_stats_count_bytecode(struct assembler_stats* self, const struct bytecode* bytecode) {
+  if (bytecode->mainPrototype)
+    countPrototype(self, bytecode->mainPrototype);
+  
+  size_t count = bytecode->constants.length;
+  self->constants += count;
+  if (count < 2)
+    return 0;
+  
+  // Sorted copy puts duplicates next to each other
+  struct constant* sorted = allocator_malloc(count * sizeof(*sorted));
+  if (!sorted)
+    return -ENOMEM;
+  memcpy(sorted, bytecode->constants.data, count * sizeof(*sorted));
+  qsort(sorted, count, sizeof(*sorted), compareConstant);
+  
+  for (size_t i = 1; i < count; i++)
+    if (compareConstant(&sorted[i - 1], &sorted[i]) == 0)
+      self->duplicateConstants++;
+  
+  allocator_free(sorted);
+  return 0;
+}
+
+const char* assembler_stats_get_stage_name(enum assembler_stage stage) {
+  static const char* lookup[] = {
+#   define X(t, str, ...) [t] = str,
+    ASSEMBLER_STAGE
+#   undef X
+  };
+  
+  return lookup[stage];
+}
+
+static double getMean(double sum, uint64_t count) {
+  return count > 0 ? sum / (double) count : 0.0;
+}
+
+// Derived from hardware counters, negative if
+// counters it needs aren't available
+struct counter_rates {
+  double ipc;
+  // Per thousand instructions
+  double branchMpki;
+  double cacheMpki;
+};
+
+static double getRate(const struct assembler_stage_time* stage, enum perf_counter counter, enum perf_counter per, double scale) {
+  if (!perf_counters_is_available(counter) || !perf_counters_is_available(per))
+    return -1;
+  return getMean((double) stage->counters[counter] * scale, stage->counters[per]);
+}
+
+static struct counter_rates getCounterRates(const struct assembler_stage_time* stage) {
+  return (struct counter_rates) {
+    .ipc = getRate(stage, PERF_COUNTER_INSTRUCTIONS, PERF_COUNTER_CYCLES, 1),
+    .branchMpki = getRate(stage, PERF_COUNTER_BRANCH_MISSES, PERF_COUNTER_INSTRUCTIONS, 1000),
+    .cacheMpki = getRate(stage, PERF_COUNTER_CACHE_MISSES, PERF_COUNTER_INSTRUCTIONS, 1000)
+  };
+}
+
+static void printCounter(const struct assembler_stage_time* stage, enum perf_counter counter, FILE* output) {
+  if (perf_counters_is_available(counter))
+    fprintf(output, " %14" PRIu64, stage->counters[counter]);
+  else
+    fprintf(output, " %14s", "n/a");
+}
+
+static void printRate(double rate, FILE* output) {
+  if (rate >= 0)
+    fprintf(output, " %11.3lf", rate);
+  else
+    fprintf(output, " %11s", "n/a");
+}
+
+static void printCounters(const struct assembler_stats* self, FILE* output) {
+  fprintf(output, "%-18s", "Stage");
+  for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+    fprintf(output, " %14s", perf_counters_get_name(i));
+  fprintf(output, " %11s %11s %11s\n", "IPC", "Branch MPKI", "Cache MPKI");
+  
+  for (int i = 0; i < ASSEMBLER_STAGE_COUNT; i++) {
+    const struct assembler_stage_time* stage = &self->stages[i];
+    struct counter_rates rates = getCounterRates(stage);
+    fprintf(output, "%-18s", assembler_stats_get_stage_name(i));
+    for (int counter = 0; counter < PERF_COUNTER_COUNT; counter++)
+      printCounter(stage, counter, output);
+    printRate(rates.ipc, output);
+    printRate(rates.branchMpki, output);
+    printRate(rates.cacheMpki, output);
+    fprintf(output, "\n");
+  }
+}
+
+void assembler_stats_print(const struct assembler_stats* self, const struct assembler_cache_stats* cacheStats, FILE* output) {
+  double totalWall = 0;
+  double totalCpu = 0;
+  
+  fprintf(output, "%-18s %12s %12s\n", "Stage", "Wall (ms)", "CPU (ms)");
+  for (int i = 0; i < ASSEMBLER_STAGE_COUNT; i++) {
+    fprintf(output, "%-18s %12.3lf %12.3lf\n", assembler_stats_get_stage_name(i),
+            self->stages[i].wallTime * 1000, self->stages[i].cpuTime * 1000);
+    totalWall += self->stages[i].wallTime;
+    totalCpu += self->stages[i].cpuTime;
+  }
+  fprintf(output, "%-18s %12.3lf %12.3lf\n", "total", totalWall * 1000, totalCpu * 1000);
+  
+  if (self->hasCounters) {
+    fprintf(output, "\n");
+    printCounters(self, output);
+  }
+  
+  fprintf(output, "\n");
+  fprintf(output, "Bytes read:          %" PRIu64 "\n", self->bytesRead);
+  fprintf(output, "Tokens:              %" PRIu64 "\n", self->tokens);
+  fprintf(output, "Statements:          %" PRIu64 "\n", self->statements);
+  fprintf(output, "Prototypes:          %" PRIu64 " (%" PRIu64 " reused)\n", self->prototypes, self->reusedPrototypes);
+  fprintf(output, "Instructions:        %" PRIu64 "\n", self->instructions);
+  fprintf(output, "Constants:           %" PRIu64 " (%" PRIu64 " duplicates)\n", self->constants, self->duplicateConstants);
+  fprintf(output, "Labels:              %" PRIu64 "\n", self->labels);
+  fprintf(output, "Output bytes:        %" PRIu64 "\n", self->outputBytes);
+  fprintf(output, "Debug info bytes:    %" PRIu64 "\n", self->debugInfoBytes);
+  
+  const struct {
+    const char* name;
+    const struct assembler_hashmap_stats* stats;
+  } hashmaps[] = {
+    {"instruction registry", &self->instructionRegistry},
+    {"label lookup", &self->labelLookup},
+    {"prototypes registry", &self->prototypesRegistry}
+  };
+  
+  fprintf(output, "\n");
+  for (int i = 0; i < ARRAY_SIZE(hashmaps); i++)
+    fprintf(output, "Hashmap %-21s load factor %.3lf, mean collisions %.3lf (%" PRIu64 " sampled)\n", hashmaps[i].name,
+            getMean(hashmaps[i].stats->loadFactorSum, hashmaps[i].stats->count),
+            getMean(hashmaps[i].stats->collisionsMeanSum, hashmaps[i].stats->count),
+            hashmaps[i].stats->count);
+  
+  if (!cacheStats)
+    return;
+  
+  uint64_t lookups = cacheStats->hits + cacheStats->misses;
+  fprintf(output, "\n");
+  fprintf(output, "Cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1lf%% hit rate)\n", cacheStats->hits, cacheStats->misses,
+          lookups > 0 ? (double) cacheStats->hits * 100 / lookups : 0.0);
+}
+
+static void printJsonRate(const char* name, double rate, FILE* output) {
+  if (rate >= 0)
+    fprintf(output, ", \"%s\": %.6lf", name, rate);
+  else
+    fprintf(output, ", \"%s\": null", name);
+}
+
+static void printCountersJson(const struct assembler_stage_time* stage, FILE* output) {
+  fprintf(output, ", \"counters\": {");
+  for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+    fprintf(output, "%s\"%s\": ", i > 0 ? ", " : "", perf_counters_get_name(i));
+    if (perf_counters_is_available(i))
+      fprintf(output, "%" PRIu64, stage->counters[i]);
+    else
+      fprintf(output, "null");
+  }
+  
+  struct counter_rates rates = getCounterRates(stage);
+  printJsonRate("ipc", rates.ipc, output);
+  printJsonRate("branch_mpki", rates.branchMpki, output);
+  printJsonRate("cache_mpki", rates.cacheMpki, output);
+  fprintf(output, "}");
+}
+
+static void printHashmapJson(const char* name, const struct assembler_hashmap_stats* stats, FILE* output) {
+  fprintf(output, "    \"%s\": {\"sampled\": %" PRIu64 ", \"load_factor\": %.6lf, \"collisions_mean\": %.6lf}",
+          name, stats->count, getMean(stats->loadFactorSum, stats->count), getMean(stats->collisionsMeanSum, stats->count));
+}
+
+void assembler_stats_print_json(const struct assembler_stats* self, const struct assembler_cache_stats* cacheStats, FILE* output) {
+  fprintf(output, "{\n");
+  fprintf(output, "  \"stages\": {\n");
+  for (int i = 0; i < ASSEMBLER_STAGE_COUNT; i++) {
+    fprintf(output, "    \"%s\": {\"wall_seconds\": %.9lf, \"cpu_seconds\": %.9lf", assembler_stats_get_stage_name(i),
+            self->stages[i].wallTime, self->stages[i].cpuTime);
+    if (self->hasCounters)
+      printCountersJson(&self->stages[i], output);
+    fprintf(output, "}%s\n", i + 1 < ASSEMBLER_STAGE_COUNT ? "," : "");
+  }
+  fprintf(output, "  },\n");
+  
+  fprintf(output, "  \"counters\": {\n");
+  fprintf(output, "    \"bytes_read\": %" PRIu64 ",\n", self->bytesRead);
+  fprintf(output, "    \"tokens\": %" PRIu64 ",\n", self->tokens);
+  fprintf(output, "    \"statements\": %" PRIu64 ",\n", self->statements);
+  fprintf(output, "    \"prototypes\": %" PRIu64 ",\n", self->prototypes);
+  fprintf(output, "    \"reused_prototypes\": %" PRIu64 ",\n", self->reusedPrototypes);
+  fprintf(output, "    \"instructions\": %" PRIu64 ",\n", self->instructions);
+  fprintf(output, "    \"constants\": %" PRIu64 ",\n", self->constants);
+  fprintf(output, "    \"duplicate_constants\": %" PRIu64 ",\n", self->duplicateConstants);
+  fprintf(output, "    \"labels\": %" PRIu64 ",\n", self->labels);
+  fprintf(output, "    \"output_bytes\": %" PRIu64 ",\n", self->outputBytes);
+  fprintf(output, "    \"debug_info_bytes\": %" PRIu64 "\n", self->debugInfoBytes);
+  fprintf(output, "  },\n");
+  
+  fprintf(output, "  \"hashmaps\": {\n");
+  printHashmapJson("instruction_registry", &self->instructionRegistry, output);
+  fprintf(output, ",\n");
+  printHashmapJson("label_lookup", &self->labelLookup, output);
+  fprintf(output, ",\n");
+  printHashmapJson("prototypes_registry", &self->prototypesRegistry, output);
+  fprintf(output, "\n  }");
+  
+  if (cacheStats) {
+    uint64_t lookups = cacheStats->hits + cacheStats->misses;
+    fprintf(output, ",\n  \"cache\": {\"hits\": %" PRIu64 ", \"misses\": %" PRIu64 ", \"hit_rate\": %.6lf, \"time_saved_seconds\": %.9lf}",
+            cacheStats->hits, cacheStats->misses, lookups > 0 ? (double) cacheStats->hits / lookups : 0.0, cacheStats->timeSaved);
+  }
+  fprintf(output, "\n}\n");
+}
+
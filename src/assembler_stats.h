@@ -0,0 +1,117 @@
+#ifndef _headers_1667899537_Fluff_Assembler_assembler_stats
+#define _headers_1667899537_Fluff_Assembler_assembler_stats
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "perf_counters.h"
+
+struct assembler_cache_stats;
+struct bytecode;
+
+// Per stage timing and counters of assembling (see --stats)
+//
+// Everything accumulates so one instance can cover several
+// assembles. Stages don't overlap, parser_stage2 excludes
+// time spent in emitter finalize
+
+#define ASSEMBLER_STAGE \
+  X(ASSEMBLER_STAGE_READ, "read") \
+  X(ASSEMBLER_STAGE_LEXER, "lexer") \
+  X(ASSEMBLER_STAGE_PARSER_STAGE1, "parser_stage1") \
+  X(ASSEMBLER_STAGE_PARSER_STAGE2, "parser_stage2") \
+  X(ASSEMBLER_STAGE_EMITTER_FINALIZE, "emitter_finalize") \
+  X(ASSEMBLER_STAGE_SERIALIZE, "serialize") \
+  X(ASSEMBLER_STAGE_WRITE, "write")
+
+enum assembler_stage {
+# define X(name, ...) name,
+  ASSEMBLER_STAGE
+# undef X
+  ASSEMBLER_STAGE_COUNT
+};
+
+struct assembler_stage_time {
+  // In seconds
+  double wallTime;
+  double cpuTime;
+
+  // Zero unless perf_counters_enable'd
+  uint64_t counters[PERF_COUNTER_COUNT];
+};
+
+// Sums over sampled hashmaps, divide by `count` for mean
+struct assembler_hashmap_stats {
+  uint64_t count;
+  double loadFactorSum;
+  double collisionsMeanSum;
+};
+
+struct assembler_stats {
+  struct assembler_stage_time stages[ASSEMBLER_STAGE_COUNT];
+  // Some timer read hardware counters
+  bool hasCounters;
+
+  uint64_t bytesRead;
+  uint64_t tokens;
+  uint64_t statements;
+  uint64_t prototypes;
+  // Copied from last assembly (see incremental_cache.h)
+  uint64_t reusedPrototypes;
+  uint64_t instructions;
+  uint64_t constants;
+  // Constants with same type and value as an earlier one
+  uint64_t duplicateConstants;
+  uint64_t labels;
+  uint64_t outputBytes;
+  uint64_t debugInfoBytes;
+
+  struct assembler_hashmap_stats instructionRegistry;
+  // Sampled once per prototype before it is cleared
+  struct assembler_hashmap_stats labelLookup;
+  struct assembler_hashmap_stats prototypesRegistry;
+};
+
+struct assembler_stats_timer {
+  enum assembler_stage stage;
+  enum assembler_stage previousStage;
+  double wallTime;
+  double cpuTime;
+  struct perf_counters_sample counters;
+};
+
+#define ASSEMBLER_STATS_INIT {}
+
+// Calling thread is in `stage` until timer stops, timers
+// can nest (emitter finalize happens inside parser_stage2)
+void assembler_stats_timer_start(struct assembler_stats_timer* timer, enum assembler_stage stage);
+
+// Add time (and hardware counters if enabled) since
+// `timer` started to its stage
+void assembler_stats_timer_stop(struct assembler_stats* self, const struct assembler_stats_timer* timer);
+
+// Take `nested` stage's growth since `before` out of `stage`
+// so stages don't overlap
+void assembler_stats_exclude_nested(struct assembler_stats* self, enum assembler_stage stage, enum assembler_stage nested, const struct assembler_stage_time* before);
+
+// Stage calling thread is timing, ASSEMBLER_STAGE_COUNT
+// if none (used to attribute allocations to stages)
+enum assembler_stage assembler_stats_get_current_stage();
+
+void assembler_stats_sample_hashmap(struct assembler_hashmap_stats* self, double loadFactor, double collisionsMean);
+
+// Count prototypes, instructions, constants and duplicates
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int assembler_stats_count_bytecode(struct assembler_stats* self, const struct bytecode* bytecode);
+
+const char* assembler_stats_get_stage_name(enum assembler_stage stage);
+
+// `cacheStats` can be NULL if cache not used
+void assembler_stats_print(const struct assembler_stats* self, const struct assembler_cache_stats* cacheStats, FILE* output);
+void assembler_stats_print_json(const struct assembler_stats* self, const struct assembler_cache_stats* cacheStats, FILE* output);
+
+#endif
+
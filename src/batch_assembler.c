@@ -0,0 +1,134 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "batch_assembler.h"
+#include "allocator.h"
+#include "assembler_cache.h"
+#include "assembler_context.h"
+#include "assembler_driver.h"
+#include "trace.h"
+#include "util.h"
+
+struct batch_context {
+  struct batch_assembler_job* jobs;
+  size_t jobCount;
+  const struct assembler_driver_options* options;
+  struct assembler_cache* cache;
+  
+  // Index of next job to be picked up
+  atomic_size_t nextJob;
+};
+
+// `context` can be NULL
+static void runJob(struct batch_context* ctx, struct assembler_context* context, struct batch_assembler_job* job) {
+  struct trace_span span;
+  trace_span_begin(&span, "job", job->inputPath);
+  double start = util_monotonic_time();
+  job->errorMessage = NULL;
+  job->resultSize = 0;
+  if (ctx->cache)
+    job->result = assembler_cache_assemble_file(ctx->cache, context, job->inputPath, job->outputPath, job->debugInfoPath, ctx->options,
+                                                &job->errorMessage, &job->resultSize, NULL);
+  else if (context)
+    job->result = assembler_context_assemble_file(context, job->inputPath, job->outputPath, job->debugInfoPath, ctx->options,
+                                                  &job->errorMessage, &job->resultSize, NULL);
+  else
+    job->result = assembler_driver_assemble_file(job->inputPath, job->outputPath, job->debugInfoPath, ctx->options,
+                                                 &job->errorMessage, &job->resultSize, NULL);
+  job->time = util_monotonic_time() - start;
+  trace_span_end(&span);
+}
+
+static void* worker(void* _ctx) {
+  struct batch_context* ctx = _ctx;
+  trace_set_thread_name("batch_worker");
+  
+  // Each thread reuses one assembler context for all of its
+  // jobs, without it (out of memory) every job builds its own
+  struct assembler_context* context = assembler_context_new();
+  
+  // Jobs are handed out one at a time so a few large files
+  // can't leave other threads idle
+  size_t current;
+  while ((current = atomic_fetch_add_explicit(&ctx->nextJob, 1, memory_order_relaxed)) < ctx->jobCount)
+    runJob(ctx, context, &ctx->jobs[current]);
+  
+  assembler_context_free(context);
+  return NULL;
+}
+
+int batch_assembler_run(struct batch_assembler_job* jobs, size_t jobCount, int threadCount, const struct assembler_driver_options* options, struct assembler_cache* cache, struct batch_assembler_stats* stats) {
+  if (threadCount < 0)
+    return -EINVAL;
+  
+  if (threadCount == 0) {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = processors > 0 ? (int) processors : 1;
+  }
+  
+  if ((size_t) threadCount > jobCount)
+    threadCount = jobCount > 0 ? (int) jobCount : 1;
+  
+  pthread_t* threads = allocator_calloc(threadCount, sizeof(*threads));
+  if (!threads)
+    return -ENOMEM;
+  
+  struct batch_context ctx = {
+    .jobs = jobs,
+    .jobCount = jobCount,
+    .options = options,
+    .cache = cache
+  };
+  atomic_init(&ctx.nextJob, 0);
+  
+  double start = util_monotonic_time();
+  
+  // Threads which failed to start are fine as long as
+  // at least one is running
+  int started = 0;
+  for (int i = 0; i < threadCount; i++) {
+    if (pthread_create(&threads[started], NULL, worker, &ctx) != 0)
+      break;
+    started++;
+  }
+  
+  if (started == 0) {
+    allocator_free(threads);
+    return -EAGAIN;
+  }
+  
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  allocator_free(threads);
+  
+  if (!stats)
+    return 0;
+  
+  *stats = (struct batch_assembler_stats) {
+    .threadCount = started,
+    .wallTime = util_monotonic_time() - start
+  };
+  
+  for (size_t i = 0; i < jobCount; i++) {
+    stats->busyTime += jobs[i].time;
+    if (jobs[i].result < 0) {
+      stats->failed++;
+      continue;
+    }
+    
+    stats->succeeded++;
+    stats->totalSize += jobs[i].resultSize;
+  }
+  return 0;
+}
+
+void batch_assembler_cleanup(struct batch_assembler_job* jobs, size_t jobCount) {
+  for (size_t i = 0; i < jobCount; i++) {
+    allocator_free((char*) jobs[i].errorMessage);
+    jobs[i].errorMessage = NULL;
+  }
+}
+
@@ -0,0 +1,55 @@
+#ifndef _headers_1667481302_Fluff_Assembler_batch_assembler
+#define _headers_1667481302_Fluff_Assembler_batch_assembler
+
+#include <stddef.h>
+
+struct assembler_cache;
+struct assembler_driver_options;
+
+// Assemble many files in one process on a pool of threads
+
+struct batch_assembler_job {
+  const char* inputPath;
+  const char* outputPath;
+  
+  // Can be NULL if no sidecar debug info wanted
+  const char* debugInfoPath;
+  
+  // Filled by batch_assembler_run
+  // Result of assembler_driver_assemble_file
+  int result;
+  // NULL on success, free'd by batch_assembler_cleanup
+  const char* errorMessage;
+  size_t resultSize;
+  // Wall time taken by this job in seconds
+  double time;
+};
+
+struct batch_assembler_stats {
+  size_t succeeded;
+  size_t failed;
+  int threadCount;
+  
+  // Wall time for whole batch in seconds
+  double wallTime;
+  // Sum of each job's time in seconds
+  double busyTime;
+  size_t totalSize;
+};
+
+// `threadCount` of zero use number of online processors
+// `cache` can be NULL, if not then jobs go through it
+// Every job is attempted even if some failed
+// Return 0 on success (which include failed jobs,
+// check stats->failed or each job's result)
+// Errors:
+// -EINVAL: Invalid thread count
+// -ENOMEM: Not enough memory
+// -EAGAIN: Cannot create any thread
+int batch_assembler_run(struct batch_assembler_job* jobs, size_t jobCount, int threadCount, const struct assembler_driver_options* options, struct assembler_cache* cache, struct batch_assembler_stats* stats);
+
+// Free error messages left by batch_assembler_run
+void batch_assembler_cleanup(struct batch_assembler_job* jobs, size_t jobCount);
+
+#endif
+
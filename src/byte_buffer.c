@@ -0,0 +1,57 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "byte_buffer.h"
+#include "allocator.h"
+
+void byte_buffer_deinit(struct byte_buffer* self) {
+  allocator_free(self->data);
+  *self = (struct byte_buffer) BYTE_BUFFER_INIT;
+}
+
+int byte_buffer_reserve(struct byte_buffer* self, size_t size) {
+  if (size > SIZE_MAX - self->size)
+    return -ENOMEM;
+  
+  size_t needed = self->size + size;
+  if (needed <= self->capacity && self->data)
+    return 0;
+  
+  // Exact size for first allocation so one shot outputs
+  // don't waste memory, doubling after that
+  size_t newCapacity = self->capacity * 2;
+  if (newCapacity < needed)
+    newCapacity = needed;
+  // So data is never NULL even for empty output
+  if (newCapacity == 0)
+    newCapacity = 1;
+  
+  void* newData = allocator_realloc(self->data, newCapacity);
+  if (!newData)
+    return -ENOMEM;
+  
+  self->data = newData;
+  self->capacity = newCapacity;
+  return 0;
+}
+
+void* byte_buffer_append_space(struct byte_buffer* self, size_t size) {
+  if (byte_buffer_reserve(self, size) < 0)
+    return NULL;
+  
+  void* space = (char*) self->data + self->size;
+  self->size += size;
+  return space;
+}
+
+int byte_buffer_append(struct byte_buffer* self, const void* data, size_t size) {
+  void* space = byte_buffer_append_space(self, size);
+  if (!space)
+    return -ENOMEM;
+  
+  memcpy(space, data, size);
+  return 0;
+}
+
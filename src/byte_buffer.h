@@ -0,0 +1,39 @@
+#ifndef _headers_1667730925_Fluff_Assembler_byte_buffer
+#define _headers_1667730925_Fluff_Assembler_byte_buffer
+
+#include <stddef.h>
+
+// Growable binary buffer
+//
+// Owned by whoever set it up, zero initialized is valid empty
+// buffer. Data is realloc'ed as needed so caller can keep
+// reusing same buffer (set `size` to zero) without allocating
+
+struct byte_buffer {
+  void* data;
+  size_t size;
+  size_t capacity;
+};
+
+#define BYTE_BUFFER_INIT {.data = NULL, .size = 0, .capacity = 0}
+
+void byte_buffer_deinit(struct byte_buffer* self);
+
+// Make room for `size` more bytes after current data
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int byte_buffer_reserve(struct byte_buffer* self, size_t size);
+
+// Grow by `size` bytes and return pointer to the new
+// (uninitialized) bytes
+// Return NULL if out of memory
+void* byte_buffer_append_space(struct byte_buffer* self, size_t size);
+
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int byte_buffer_append(struct byte_buffer* self, const void* data, size_t size);
+
+#endif
+
@@ -4,6 +4,7 @@
 #include <stdio.h>
 
 #include "bytecode.h"
+#include "allocator.h"
 #include "prototype.h"
 #include "constants.h"
 #include "vm_types.h"
@@ -11,7 +12,7 @@
 #include "vm_limits.h"
 
 struct bytecode* bytecode_new() {
-  struct bytecode* self = malloc(sizeof(*self));
+  struct bytecode* self = allocator_malloc(sizeof(*self));
   if (!self)
     return NULL;
   
@@ -26,18 +27,18 @@ void bytecode_free(struct bytecode* self) {
 
   prototype_free(self->mainPrototype);
   
-  int i;
+  size_t i;
   struct constant constant;
   vec_foreach(&self->constants, constant, i)
     if (constant.type == BYTECODE_CONSTANT_STRING)
-      free((char*) constant.data.string);
+      allocator_free((char*) constant.data.string);
   
   vec_deinit(&self->constants);
-  free(self);
+  allocator_free(self);
 }
 
 int bytecode_add_constant_generic(struct bytecode* self, struct constant constant) {
-  if (self->constants.length > VM_LIMIT_MAX_CONSTANT)
+  if (self->constants.length >= VM_LIMIT_MAX_CONSTANT)
     return -ENOSPC;
   
   if (vec_push(&self->constants, constant) < 0)
@@ -60,7 +61,7 @@ int bytecode_add_constant_number(struct bytecode* self, vm_number number) {
 }
 
 int bytecode_add_constant_string(struct bytecode* self, const char* str) {
-  char* cloned = strdup(str);
+  char* cloned = allocator_strdup(str);
   if (!cloned)
     return -ENOMEM;
   
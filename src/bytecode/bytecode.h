@@ -7,7 +7,6 @@
 #include "bytecode/prototype.h"
 #include "vec.h"
 #include "vm_types.h"
-#include "buffer.h"
 
 enum constant_type {
   BYTECODE_CONSTANT_INTEGER,
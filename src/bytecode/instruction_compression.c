@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode/instruction_compression.h"
+#include "allocator.h"
+#include "bytecode/protobuf_wire.h"
+#include "byteorder.h"
+#include "lz_block.h"
+#include "vm_types.h"
+
+#define PLANE_COUNT (sizeof(vm_instruction))
+
+// Prototypes are usually small so avoid malloc for them
+#define STACK_PLANES_SIZE 4096
+
+// Each input byte expands to at most 255 output bytes
+// anything claiming more is malformed
+#define MAX_EXPANSION 256
+
+static void transpose(const vm_instruction* instructions, size_t count, uint8_t* planes) {
+  for (size_t i = 0; i < count; i++) {
+    vm_instruction ins = instructions[i];
+    for (size_t plane = 0; plane < PLANE_COUNT; plane++)
+      planes[plane * count + i] = (uint8_t) (ins >> ((PLANE_COUNT - 1 - plane) * 8));
+  }
+}
+
+static inline uint64_t swapBytes(uint64_t value, uint64_t other, int shift, uint64_t mask, uint64_t* otherResult) {
+  uint64_t diff = ((value >> shift) ^ other) & mask;
+  *otherResult = other ^ diff;
+  return value ^ (diff << shift);
+}
+
+// Transpose 8 instructions at once as 8x8 byte matrix
+// in registers, reading each plane with one load
+static void untransposeBlock(const uint8_t* planes, size_t count, vm_instruction* instructions) {
+  uint64_t rows[PLANE_COUNT];
+
+  // Reversed so the first plane ends in the most significant byte
+  for (size_t plane = 0; plane < PLANE_COUNT; plane++) {
+    le64 row;
+    memcpy(&row, planes + plane * count, sizeof(row));
+    rows[PLANE_COUNT - 1 - plane] = le64_to_cpu(row);
+  }
+
+  for (int i = 0; i < 4; i++)
+    rows[i] = swapBytes(rows[i], rows[i + 4], 32, 0x00000000FFFFFFFFULL, &rows[i + 4]);
+  static const int pairs16[] = {0, 1, 4, 5};
+  for (int i = 0; i < 4; i++)
+    rows[pairs16[i]] = swapBytes(rows[pairs16[i]], rows[pairs16[i] + 2], 16, 0x0000FFFF0000FFFFULL, &rows[pairs16[i] + 2]);
+  for (int i = 0; i < 8; i += 2)
+    rows[i] = swapBytes(rows[i], rows[i + 1], 8, 0x00FF00FF00FF00FFULL, &rows[i + 1]);
+
+  memcpy(instructions, rows, sizeof(rows));
+}
+
+static void untranspose(const uint8_t* planes, size_t count, vm_instruction* instructions) {
+  size_t i = 0;
+  for (; i + PLANE_COUNT <= count; i += PLANE_COUNT)
+    untransposeBlock(planes + i, count, instructions + i);
+
+  for (; i < count; i++) {
+    vm_instruction ins = 0;
+    for (size_t plane = 0; plane < PLANE_COUNT; plane++)
+      ins = (ins << 8) | planes[plane * count + i];
+    instructions[i] = ins;
+  }
+}
+
+static size_t writeVarint(uint8_t* output, uint64_t value) {
+  size_t len = 0;
+  while (value >= 0x80) {
+    output[len++] = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  output[len++] = (uint8_t) value;
+  return len;
+}
+
+int instruction_compression_compress(const vm_instruction* instructions, size_t count, void** result, size_t* resultSize) {
+  size_t planesSize = count * PLANE_COUNT;
+  uint8_t stackPlanes[STACK_PLANES_SIZE];
+  uint8_t* planes = stackPlanes;
+  if (planesSize > sizeof(stackPlanes) && (planes = allocator_malloc(planesSize)) == NULL)
+    return -ENOMEM;
+
+  int res = 0;
+  uint8_t* output = allocator_malloc(10 + lz_block_compress_bound(planesSize));
+  if (!output) {
+    res = -ENOMEM;
+    goto alloc_output_failure;
+  }
+
+  transpose(instructions, count, planes);
+  size_t headerSize = writeVarint(output, count);
+  *resultSize = headerSize + lz_block_compress(planes, planesSize, output + headerSize);
+  *result = output;
+
+alloc_output_failure:
+  if (planes != stackPlanes)
+    allocator_free(planes);
+  return res;
+}
+
+static int readHeader(struct protobuf_wire_reader* reader, size_t* count) {
+  uint64_t value;
+  int res = protobuf_wire_read_varint(reader, &value);
+  if (res < 0)
+    return res;
+
+  size_t remaining = (size_t) (reader->end - reader->current);
+  if (value > SIZE_MAX / PLANE_COUNT / MAX_EXPANSION ||
+      value * PLANE_COUNT > remaining * MAX_EXPANSION)
+    return -EINVAL;
+
+  *count = (size_t) value;
+  return 0;
+}
+
+int instruction_compression_get_count(const void* data, size_t size, size_t* count) {
+  struct protobuf_wire_reader reader = protobuf_wire_reader(data, size);
+  return readHeader(&reader, count);
+}
+
+int instruction_compression_decompress(const void* data, size_t size, vm_instruction* result) {
+  size_t count;
+  struct protobuf_wire_reader reader = protobuf_wire_reader(data, size);
+  int res = readHeader(&reader, &count);
+  if (res < 0)
+    return res;
+
+  size_t planesSize = count * PLANE_COUNT;
+  uint8_t stackPlanes[STACK_PLANES_SIZE];
+  uint8_t* planes = stackPlanes;
+  if (planesSize > sizeof(stackPlanes) && (planes = allocator_malloc(planesSize)) == NULL)
+    return -ENOMEM;
+
+  if ((res = lz_block_decompress(reader.current, (size_t) (reader.end - reader.current), planes, planesSize)) < 0)
+    goto decompress_failure;
+  untranspose(planes, count, result);
+
+decompress_failure:
+  if (planes != stackPlanes)
+    allocator_free(planes);
+  return res;
+}
+
@@ -0,0 +1,42 @@
+#ifndef _headers_1667391544_Fluff_Assembler_instruction_compression
+#define _headers_1667391544_Fluff_Assembler_instruction_compression
+
+#include <stddef.h>
+
+#include "vm_types.h"
+
+// Compressed instruction stream used by compressedInstructions
+// field in format/bytecode.proto
+//
+// Layout
+//   varint   : instruction count
+//   lz block : instructions transposed into 8 byte planes, first
+//              plane is the most significant byte (the opcode) of
+//              every instruction then the condition byte and so on
+//
+// Transposing puts the opcodes, conditions and mostly zero
+// operand bytes into their own long runs which the LZ codec
+// compress far better than interleaved 64-bit words
+
+// Compress `count` instructions, result is allocator_malloc'ed
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int instruction_compression_compress(const vm_instruction* instructions, size_t count, void** result, size_t* resultSize);
+
+// Get number of instructions in compressed `data`
+// Return 0 on success
+// Errors:
+// -EINVAL: Malformed input
+int instruction_compression_get_count(const void* data, size_t size, size_t* count);
+
+// `result` must have space for instruction_compression_get_count
+// instructions
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EINVAL: Malformed input
+int instruction_compression_decompress(const void* data, size_t size, vm_instruction* result);
+
+#endif
+
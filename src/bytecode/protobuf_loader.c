@@ -0,0 +1,889 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "arena.h"
+#include "bytecode/bytecode.h"
+#include "bytecode/prototype.h"
+#include "bytecode/protobuf_wire.h"
+#include "bytecode/instruction_compression.h"
+#include "protobuf_loader.h"
+#include "constants.h"
+#include "opcodes.h"
+#include "util.h"
+#include "vec.h"
+#include "vm_types.h"
+#include "vm_limits.h"
+
+// Field numbers in format/bytecode.proto
+#define BYTECODE_FIELD_VERSION 1
+#define BYTECODE_FIELD_CONSTANTS 2
+#define BYTECODE_FIELD_MAIN_PROTOTYPE 3
+#define BYTECODE_FIELD_REQUIRED_FEATURES 4
+#define BYTECODE_FIELD_SOURCE_FILES 5
+
+#define CONSTANT_FIELD_DATA_STR 2
+#define CONSTANT_FIELD_DATA_INTEGER 3
+#define CONSTANT_FIELD_DATA_NUMBER 4
+
+#define PROTOTYPE_FIELD_INSTRUCTIONS 1
+#define PROTOTYPE_FIELD_PROTOTYPES 2
+#define PROTOTYPE_FIELD_SYMBOL_NAME 3
+#define PROTOTYPE_FIELD_PACKED_INSTRUCTIONS 6
+#define PROTOTYPE_FIELD_PC_TO_LINE_DELTA 7
+#define PROTOTYPE_FIELD_COMPRESSED_INSTRUCTIONS 8
+#define PROTOTYPE_FIELD_COMPACT_INSTRUCTIONS 9
+#define PROTOTYPE_FIELD_LINE_TABLE 10
+#define PROTOTYPE_FIELD_PROTOTYPE_REFERENCES 11
+
+#define PROTOTYPE_REFERENCE_FIELD_INSTRUCTION 1
+#define PROTOTYPE_REFERENCE_FIELD_SYMBOL_NAME 2
+
+#define LINE_TABLE_FIELD_SOURCE_FILE 1
+#define LINE_TABLE_FIELD_DEFINED_AT_LINE 2
+#define LINE_TABLE_FIELD_DEFINED_AT_COLUMN 3
+#define LINE_TABLE_FIELD_RUN_LENGTH 4
+#define LINE_TABLE_FIELD_RUN_LINE_DELTA 5
+
+#define PROTOTYPE_DEBUG_INFO_FIELD_LINE_TABLE 1
+#define PROTOTYPE_DEBUG_INFO_FIELD_PROTOTYPES 2
+
+#define DEBUG_INFO_FIELD_VERSION 1
+#define DEBUG_INFO_FIELD_SOURCE_FILES 2
+#define DEBUG_INFO_FIELD_MAIN_PROTOTYPE 3
+#define DEBUG_INFO_FIELD_BYTECODE_CHECKSUM 4
+
+// Prototypes nested deeper than this is assumed to be malicious
+// input trying to blow the stack
+#define MAX_PROTOTYPE_NESTING 4096
+
+// Index entry for a prototype, the struct prototype given
+// to user is embedded here so it can be found back
+struct loaded_prototype {
+  struct prototype prototype;
+
+  const uint8_t* data;
+  size_t size;
+  bool isDecoded;
+
+  // Line table from sidecar debug info (NULL if none)
+  const uint8_t* debugLineTable;
+  size_t debugLineTableSize;
+};
+
+struct bytecode_loader* bytecode_loader_new(const void* data, size_t size) {
+  struct bytecode_loader* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
+
+  self->data = data;
+  self->size = size;
+  self->bytecode = NULL;
+  self->version = 0;
+  self->requiredFeatures = 0;
+  self->allowUnlinked = false;
+  self->prototypeCount = 0;
+  self->decodedPrototypeCount = 0;
+  self->sourceFiles = NULL;
+  self->sourceFileCount = 0;
+
+  self->arena = arena_new(0);
+  if (!self->arena)
+    goto failure;
+  return self;
+
+failure:
+  bytecode_loader_free(self);
+  return NULL;
+}
+
+void bytecode_loader_free(struct bytecode_loader* self) {
+  if (!self)
+    return;
+
+  // The bytecode and all prototypes live in the arena
+  arena_free(self->arena);
+  allocator_free(self);
+}
+
+static int decodeConstant(struct bytecode_loader* self, const uint8_t* data, size_t size, struct constant* result) {
+  struct protobuf_wire_reader reader = protobuf_wire_reader(data, size);
+  struct protobuf_wire_field field;
+  bool hasData = false;
+  int res = 0;
+
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    // Oneof, last one wins like the protobuf rules
+    switch (field.number) {
+      case CONSTANT_FIELD_DATA_STR:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+
+        result->type = BYTECODE_CONSTANT_STRING;
+        result->data.string = arena_strndup(self->arena, (const char*) field.data, field.size);
+        if (!result->data.string)
+          return -ENOMEM;
+        break;
+      case CONSTANT_FIELD_DATA_INTEGER:
+        if (field.type != PROTOBUF_WIRE_VARINT)
+          return -EINVAL;
+
+        result->type = BYTECODE_CONSTANT_INTEGER;
+        result->data.integer = protobuf_wire_zigzag_decode64(field.value);
+        break;
+      case CONSTANT_FIELD_DATA_NUMBER:
+        if (field.type != PROTOBUF_WIRE_FIXED64)
+          return -EINVAL;
+
+        result->type = BYTECODE_CONSTANT_NUMBER;
+        memcpy(&result->data.number, &field.value, sizeof(result->data.number));
+        break;
+      default:
+        // Unknown fields are skipped
+        continue;
+    }
+    hasData = true;
+  }
+
+  return hasData ? 0 : -EINVAL;
+}
+
+// First pass over a prototype, only record where it is and
+// recursively index its childs
+static int indexPrototype(struct bytecode_loader* self, const uint8_t* data, size_t size, int depth, struct prototype** result) {
+  if (depth > MAX_PROTOTYPE_NESTING)
+    return -EINVAL;
+
+  struct loaded_prototype* loaded = arena_alloc(self->arena, sizeof(*loaded));
+  if (!loaded)
+    return -ENOMEM;
+
+  loaded->data = data;
+  loaded->size = size;
+  loaded->isDecoded = false;
+  loaded->debugLineTable = NULL;
+  loaded->debugLineTableSize = 0;
+  loaded->prototype = (struct prototype) {
+    .sourceFile = NULL,
+    .prototypeName = NULL,
+    .definedAtLine = -1,
+    .definedAtColumn = -1
+  };
+  vec_init(&loaded->prototype.prototypes);
+  vec_init(&loaded->prototype.instructions);
+  vec_init(&loaded->prototype.instructionLines);
+  vec_init(&loaded->prototype.references);
+
+  int res = 0;
+  struct protobuf_wire_reader reader = protobuf_wire_reader(data, size);
+  struct protobuf_wire_field field;
+  size_t childCount = 0;
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    if (field.number == PROTOTYPE_FIELD_PROTOTYPES)
+      childCount++;
+  }
+
+  if (childCount > VM_LIMIT_MAX_PROTOTYPE)
+    return -EINVAL;
+
+  struct prototype** childs = NULL;
+  if (childCount > 0 && (childs = arena_alloc(self->arena, childCount * sizeof(*childs))) == NULL)
+    return -ENOMEM;
+
+  size_t i = 0;
+  reader = protobuf_wire_reader(data, size);
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    if (field.number != PROTOTYPE_FIELD_PROTOTYPES)
+      continue;
+    if (field.type != PROTOBUF_WIRE_LEN)
+      return -EINVAL;
+
+    if ((res = indexPrototype(self, field.data, field.size, depth + 1, &childs[i])) < 0)
+      return res;
+    i++;
+  }
+
+  loaded->prototype.prototypes.data = childs;
+  loaded->prototype.prototypes.length = childCount;
+  loaded->prototype.prototypes.capacity = childCount;
+
+  self->prototypeCount++;
+  *result = &loaded->prototype;
+  return 0;
+}
+
+// Count elements in a repeated scalar field which may be packed or not
+static int countRepeated(struct protobuf_wire_field* field, enum protobuf_wire_type elementType, size_t* count) {
+  if (field->type == elementType) {
+    (*count)++;
+    return 0;
+  } else if (field->type != PROTOBUF_WIRE_LEN) {
+    return -EINVAL;
+  }
+
+  switch (elementType) {
+    case PROTOBUF_WIRE_FIXED64:
+      if (field->size % 8 != 0)
+        return -EINVAL;
+      *count += field->size / 8;
+      return 0;
+    case PROTOBUF_WIRE_VARINT:
+      // Each varint ends at byte without MSB set
+      for (size_t i = 0; i < field->size; i++)
+        if ((field->data[i] & 0x80) == 0)
+          (*count)++;
+      return 0;
+    default:
+      return -EINVAL;
+  }
+}
+
+static int decodeRepeated(struct protobuf_wire_field* field, enum protobuf_wire_type elementType, uint64_t* result) {
+  if (field->type == elementType) {
+    *result = field->value;
+    return 1;
+  }
+
+  int res = 0;
+  int count = 0;
+  struct protobuf_wire_reader packed = protobuf_wire_reader(field->data, field->size);
+  while (!protobuf_wire_eof(&packed)) {
+    if (elementType == PROTOBUF_WIRE_FIXED64)
+      res = protobuf_wire_read_fixed64(&packed, &result[count]);
+    else
+      res = protobuf_wire_read_varint(&packed, &result[count]);
+
+    if (res < 0)
+      return res;
+    count++;
+  }
+  return count;
+}
+
+static int decodeLineDeltas(struct protobuf_wire_field* field, int* lines, size_t* current, int* line) {
+  // sint32 is zigzag encoded
+  if (field->type != PROTOBUF_WIRE_LEN) {
+    *line += (int32_t) protobuf_wire_zigzag_decode64(field->value);
+    lines[(*current)++] = *line;
+    return 0;
+  }
+
+  uint64_t value;
+  int res = 0;
+  struct protobuf_wire_reader packed = protobuf_wire_reader(field->data, field->size);
+  while (!protobuf_wire_eof(&packed)) {
+    if ((res = protobuf_wire_read_varint(&packed, &value)) < 0)
+      return res;
+
+    *line += (int32_t) protobuf_wire_zigzag_decode64(value);
+    lines[(*current)++] = *line;
+  }
+  return 0;
+}
+
+// Normal instruction may be split between two fields
+// so the state is kept across fields
+struct compact_decoder {
+  // NULL to only count
+  vm_instruction* output;
+  size_t count;
+
+  bool hasHighWord;
+  uint32_t highWord;
+};
+
+static void feedCompactWord(struct compact_decoder* self, uint32_t word) {
+  vm_instruction instruction;
+  if (self->hasHighWord) {
+    instruction = (vm_instruction) self->highWord << 32 | word;
+    self->hasHighWord = false;
+  } else if (OP_IS_SHORT((vm_instruction) word << 32)) {
+    instruction = (vm_instruction) word << 32;
+  } else {
+    self->highWord = word;
+    self->hasHighWord = true;
+    return;
+  }
+
+  if (self->output)
+    self->output[self->count] = instruction;
+  self->count++;
+}
+
+static int decodeCompact(struct protobuf_wire_field* field, struct compact_decoder* decoder) {
+  if (field->type == PROTOBUF_WIRE_FIXED32) {
+    feedCompactWord(decoder, (uint32_t) field->value);
+    return 0;
+  } else if (field->type != PROTOBUF_WIRE_LEN) {
+    return -EINVAL;
+  }
+
+  uint32_t word;
+  int res = 0;
+  struct protobuf_wire_reader packed = protobuf_wire_reader(field->data, field->size);
+  while (!protobuf_wire_eof(&packed)) {
+    if ((res = protobuf_wire_read_fixed32(&packed, &word)) < 0)
+      return res;
+    feedCompactWord(decoder, word);
+  }
+  return 0;
+}
+
+// Decode every `fieldNumber` strings as loader's source file table
+static int decodeStringTable(struct bytecode_loader* self, const uint8_t* data, size_t size, uint32_t fieldNumber, size_t count) {
+  if (count > INT_MAX)
+    return -EINVAL;
+
+  const char** strings = NULL;
+  if (count > 0 && (strings = arena_alloc(self->arena, count * sizeof(*strings))) == NULL)
+    return -ENOMEM;
+
+  int res = 0;
+  size_t i = 0;
+  struct protobuf_wire_reader reader = protobuf_wire_reader(data, size);
+  struct protobuf_wire_field field;
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    if (field.number != fieldNumber)
+      continue;
+    if ((strings[i] = arena_strndup(self->arena, (const char*) field.data, field.size)) == NULL)
+      return -ENOMEM;
+    i++;
+  }
+
+  self->sourceFiles = strings;
+  self->sourceFileCount = count;
+  return 0;
+}
+
+static int decodeLineTable(struct bytecode_loader* self, const uint8_t* data, size_t size, struct prototype* prototype) {
+  int res = 0;
+  struct protobuf_wire_reader reader = protobuf_wire_reader(data, size);
+  struct protobuf_wire_field field;
+  size_t runCount = 0;
+  size_t deltaCount = 0;
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    switch (field.number) {
+      case LINE_TABLE_FIELD_SOURCE_FILE:
+        if (field.type != PROTOBUF_WIRE_VARINT || field.value >= self->sourceFileCount)
+          return -EINVAL;
+        prototype->sourceFile = self->sourceFiles[field.value];
+        break;
+      case LINE_TABLE_FIELD_DEFINED_AT_LINE:
+        if (field.type != PROTOBUF_WIRE_VARINT)
+          return -EINVAL;
+        prototype->definedAtLine = (int32_t) field.value;
+        break;
+      case LINE_TABLE_FIELD_DEFINED_AT_COLUMN:
+        if (field.type != PROTOBUF_WIRE_VARINT)
+          return -EINVAL;
+        prototype->definedAtColumn = (int32_t) field.value;
+        break;
+      case LINE_TABLE_FIELD_RUN_LENGTH:
+        res = countRepeated(&field, PROTOBUF_WIRE_VARINT, &runCount);
+        break;
+      case LINE_TABLE_FIELD_RUN_LINE_DELTA:
+        res = countRepeated(&field, PROTOBUF_WIRE_VARINT, &deltaCount);
+        break;
+    }
+
+    if (res < 0)
+      return res;
+  }
+
+  if (runCount != deltaCount || runCount > VM_LIMIT_MAX_CODE)
+    return -EINVAL;
+  if (runCount == 0)
+    return 0;
+
+  uint64_t* runLengths = arena_alloc(self->arena, runCount * sizeof(*runLengths));
+  uint64_t* runDeltas = arena_alloc(self->arena, runCount * sizeof(*runDeltas));
+  if (!runLengths || !runDeltas)
+    return -ENOMEM;
+
+  size_t currentLength = 0;
+  size_t currentDelta = 0;
+  reader = protobuf_wire_reader(data, size);
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    if (field.number == LINE_TABLE_FIELD_RUN_LENGTH)
+      res = decodeRepeated(&field, PROTOBUF_WIRE_VARINT, &runLengths[currentLength]);
+    else if (field.number == LINE_TABLE_FIELD_RUN_LINE_DELTA)
+      res = decodeRepeated(&field, PROTOBUF_WIRE_VARINT, &runDeltas[currentDelta]);
+    else
+      continue;
+
+    if (res < 0)
+      return res;
+    if (field.number == LINE_TABLE_FIELD_RUN_LENGTH)
+      currentLength += res;
+    else
+      currentDelta += res;
+  }
+
+  // Every instruction has a line so no more lines than instructions
+  size_t lineCount = 0;
+  for (size_t i = 0; i < runCount; i++) {
+    if (runLengths[i] > (uint64_t) prototype->instructions.length - lineCount)
+      return -EINVAL;
+    lineCount += runLengths[i];
+  }
+
+  int* lines = NULL;
+  if (lineCount > 0 && (lines = arena_alloc(self->arena, lineCount * sizeof(*lines))) == NULL)
+    return -ENOMEM;
+
+  size_t current = 0;
+  int line = 0;
+  for (size_t i = 0; i < runCount; i++) {
+    line += (int32_t) protobuf_wire_zigzag_decode64(runDeltas[i]);
+    for (uint64_t j = 0; j < runLengths[i]; j++)
+      lines[current++] = line;
+  }
+
+  prototype->instructionLines.data = lines;
+  prototype->instructionLines.length = lineCount;
+  prototype->instructionLines.capacity = lineCount;
+  return 0;
+}
+
+static int decodeReference(struct bytecode_loader* self, const uint8_t* data, size_t size, struct prototype_reference* result) {
+  struct protobuf_wire_reader reader = protobuf_wire_reader(data, size);
+  struct protobuf_wire_field field;
+  bool hasInstruction = false;
+  int res = 0;
+
+  result->symbolName = NULL;
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    switch (field.number) {
+      case PROTOTYPE_REFERENCE_FIELD_INSTRUCTION:
+        if (field.type != PROTOBUF_WIRE_VARINT)
+          return -EINVAL;
+        result->instruction = field.value;
+        hasInstruction = true;
+        break;
+      case PROTOTYPE_REFERENCE_FIELD_SYMBOL_NAME:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+        if ((result->symbolName = arena_strndup(self->arena, (const char*) field.data, field.size)) == NULL)
+          return -ENOMEM;
+        break;
+    }
+  }
+
+  // Both are required
+  return hasInstruction && result->symbolName ? 0 : -EINVAL;
+}
+
+// References must point at placeholder loads
+static int checkReferences(struct prototype* prototype) {
+  size_t i = 0;
+  struct prototype_reference* reference = NULL;
+  vec_foreach_ptr(&prototype->references, reference, i) {
+    if (reference->instruction >= prototype->instructions.length)
+      return -EINVAL;
+
+    vm_instruction instruction = prototype->instructions.data[reference->instruction];
+    if (OP_IS_SHORT(instruction) || instruction >> 56 != FLUFFYVM_OPCODE_IMPLDEP1)
+      return -EINVAL;
+  }
+  return 0;
+}
+
+int bytecode_loader_decode_prototype(struct bytecode_loader* self, struct prototype* prototype) {
+  struct loaded_prototype* loaded = container_of(prototype, struct loaded_prototype, prototype);
+  if (loaded->isDecoded)
+    return 0;
+
+  int res = 0;
+  struct protobuf_wire_reader reader = protobuf_wire_reader(loaded->data, loaded->size);
+  struct protobuf_wire_field field;
+  size_t instructionCount = 0;
+  size_t lineCount = 0;
+  size_t referenceCount = 0;
+  const char* name = NULL;
+  bool isCompact = false;
+  struct compact_decoder compactDecoder = {};
+  struct protobuf_wire_field lineTable = {};
+  bool hasLineTable = false;
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    switch (field.number) {
+      case PROTOTYPE_FIELD_INSTRUCTIONS:
+        res = countRepeated(&field, PROTOBUF_WIRE_VARINT, &instructionCount);
+        break;
+      case PROTOTYPE_FIELD_PACKED_INSTRUCTIONS:
+        res = countRepeated(&field, PROTOBUF_WIRE_FIXED64, &instructionCount);
+        break;
+      case PROTOTYPE_FIELD_PC_TO_LINE_DELTA:
+        res = countRepeated(&field, PROTOBUF_WIRE_VARINT, &lineCount);
+        break;
+      case PROTOTYPE_FIELD_COMPRESSED_INSTRUCTIONS: {
+        size_t count = 0;
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+        res = instruction_compression_get_count(field.data, field.size, &count);
+        instructionCount += count;
+        break;
+      }
+      case PROTOTYPE_FIELD_COMPACT_INSTRUCTIONS:
+        res = decodeCompact(&field, &compactDecoder);
+        isCompact = true;
+        break;
+      case PROTOTYPE_FIELD_SYMBOL_NAME:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+
+        if ((name = arena_strndup(self->arena, (const char*) field.data, field.size)) == NULL)
+          return -ENOMEM;
+        break;
+      case PROTOTYPE_FIELD_LINE_TABLE:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+        lineTable = field;
+        hasLineTable = true;
+        break;
+      case PROTOTYPE_FIELD_PROTOTYPE_REFERENCES:
+        // Only objects may have them
+        if (field.type != PROTOBUF_WIRE_LEN || !(self->requiredFeatures & BYTECODE_FEATURE_UNLINKED))
+          return -EINVAL;
+        referenceCount++;
+        break;
+    }
+
+    if (res < 0)
+      return res;
+  }
+
+  // Truncated normal instruction in compact stream
+  if (compactDecoder.hasHighWord)
+    return -EINVAL;
+  instructionCount += compactDecoder.count;
+
+  // symbolName is required
+  if (!name || instructionCount > VM_LIMIT_MAX_CODE || lineCount > VM_LIMIT_MAX_CODE)
+    return -EINVAL;
+
+  vm_instruction* instructions = NULL;
+  if (instructionCount > 0 && (instructions = arena_alloc(self->arena, instructionCount * sizeof(*instructions))) == NULL)
+    return -ENOMEM;
+
+  int* lines = NULL;
+  if (lineCount > 0 && (lines = arena_alloc(self->arena, lineCount * sizeof(*lines))) == NULL)
+    return -ENOMEM;
+
+  struct prototype_reference* references = NULL;
+  if (referenceCount > 0 && (references = arena_alloc(self->arena, referenceCount * sizeof(*references))) == NULL)
+    return -ENOMEM;
+
+  size_t currentReference = 0;
+  size_t currentInstruction = 0;
+  size_t currentLine = 0;
+  int line = 0;
+  compactDecoder = (struct compact_decoder) {};
+  reader = protobuf_wire_reader(loaded->data, loaded->size);
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    switch (field.number) {
+      case PROTOTYPE_FIELD_INSTRUCTIONS:
+        res = decodeRepeated(&field, PROTOBUF_WIRE_VARINT, &instructions[currentInstruction]);
+        break;
+      case PROTOTYPE_FIELD_PACKED_INSTRUCTIONS:
+        res = decodeRepeated(&field, PROTOBUF_WIRE_FIXED64, &instructions[currentInstruction]);
+        break;
+      case PROTOTYPE_FIELD_PC_TO_LINE_DELTA:
+        if ((res = decodeLineDeltas(&field, lines, &currentLine, &line)) < 0)
+          return res;
+        continue;
+      case PROTOTYPE_FIELD_COMPRESSED_INSTRUCTIONS: {
+        size_t count = 0;
+        if ((res = instruction_compression_get_count(field.data, field.size, &count)) < 0 ||
+            (res = instruction_compression_decompress(field.data, field.size, &instructions[currentInstruction])) < 0)
+          return res;
+        currentInstruction += count;
+        continue;
+      }
+      case PROTOTYPE_FIELD_COMPACT_INSTRUCTIONS:
+        compactDecoder.output = &instructions[currentInstruction];
+        compactDecoder.count = 0;
+        if ((res = decodeCompact(&field, &compactDecoder)) < 0)
+          return res;
+        currentInstruction += compactDecoder.count;
+        continue;
+      case PROTOTYPE_FIELD_PROTOTYPE_REFERENCES:
+        if ((res = decodeReference(self, field.data, field.size, &references[currentReference])) < 0)
+          return res;
+        currentReference++;
+        continue;
+      default:
+        continue;
+    }
+
+    if (res < 0)
+      return res;
+    currentInstruction += res;
+  }
+
+  prototype->prototypeName = name;
+  prototype->instructions.data = instructions;
+  prototype->instructions.length = instructionCount;
+  prototype->instructions.capacity = instructionCount;
+  prototype->instructionLines.data = lines;
+  prototype->instructionLines.length = lineCount;
+  prototype->instructionLines.capacity = lineCount;
+  prototype->isCompact = isCompact;
+  prototype->references.data = references;
+  prototype->references.length = referenceCount;
+  prototype->references.capacity = referenceCount;
+  if ((res = checkReferences(prototype)) < 0)
+    return res;
+
+  // Line table replaces the older pcToLineDelta
+  if (hasLineTable)
+    res = decodeLineTable(self, lineTable.data, lineTable.size, prototype);
+  else if (loaded->debugLineTable)
+    res = decodeLineTable(self, loaded->debugLineTable, loaded->debugLineTableSize, prototype);
+  if (res < 0)
+    return res;
+
+  loaded->isDecoded = true;
+  self->decodedPrototypeCount++;
+  return 0;
+}
+
+bool bytecode_loader_is_decoded(const struct prototype* prototype) {
+  return container_of(prototype, const struct loaded_prototype, prototype)->isDecoded;
+}
+
+static int decodeAll(struct bytecode_loader* self, struct prototype* prototype) {
+  int res = bytecode_loader_decode_prototype(self, prototype);
+  if (res < 0)
+    return res;
+
+  size_t i = 0;
+  struct prototype* current = NULL;
+  vec_foreach(&prototype->prototypes, current, i)
+    if ((res = decodeAll(self, current)) < 0)
+      return res;
+  return 0;
+}
+
+int bytecode_loader_decode_all(struct bytecode_loader* self) {
+  if (!self->bytecode)
+    return -EINVAL;
+  return decodeAll(self, self->bytecode->mainPrototype);
+}
+
+int bytecode_loader_load(struct bytecode_loader* self, struct bytecode** result) {
+  if (self->bytecode)
+    return -EINVAL;
+
+  int res = 0;
+  struct protobuf_wire_reader reader = protobuf_wire_reader(self->data, self->size);
+  struct protobuf_wire_field field;
+  struct protobuf_wire_field mainPrototype = {};
+  bool hasVersion = false;
+  bool hasMainPrototype = false;
+  uint32_t requiredFeatures = 0;
+  size_t sourceFileCount = 0;
+  size_t constantCount = 0;
+
+  // First pass: find the version, main prototype and count constants
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    switch (field.number) {
+      case BYTECODE_FIELD_VERSION:
+        if (field.type != PROTOBUF_WIRE_VARINT)
+          return -EINVAL;
+        self->version = (int32_t) field.value;
+        hasVersion = true;
+        break;
+      case BYTECODE_FIELD_CONSTANTS:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+        constantCount++;
+        break;
+      case BYTECODE_FIELD_MAIN_PROTOTYPE:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+        mainPrototype = field;
+        hasMainPrototype = true;
+        break;
+      case BYTECODE_FIELD_REQUIRED_FEATURES:
+        if (field.type != PROTOBUF_WIRE_VARINT)
+          return -EINVAL;
+        requiredFeatures = (uint32_t) field.value;
+        break;
+      case BYTECODE_FIELD_SOURCE_FILES:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+        sourceFileCount++;
+        break;
+    }
+  }
+
+  if (!hasVersion || !hasMainPrototype || constantCount > VM_LIMIT_MAX_CONSTANT)
+    return -EINVAL;
+  if (self->version <= 0 || self->version > VM_BYTECODE_VERSION)
+    return -ENOTSUP;
+  uint32_t supportedFeatures = BYTECODE_FEATURES_SUPPORTED | (self->allowUnlinked ? BYTECODE_FEATURE_UNLINKED : 0);
+  if ((requiredFeatures & ~supportedFeatures) != 0)
+    return -ENOTSUP;
+  self->requiredFeatures = requiredFeatures;
+
+  struct bytecode* bytecode = arena_alloc(self->arena, sizeof(*bytecode));
+  if (!bytecode)
+    return -ENOMEM;
+  vec_init(&bytecode->constants);
+  bytecode->mainPrototype = NULL;
+
+  struct constant* constants = NULL;
+  if (constantCount > 0 && (constants = arena_alloc(self->arena, constantCount * sizeof(*constants))) == NULL)
+    return -ENOMEM;
+
+  // Second pass: decode the constants
+  size_t i = 0;
+  reader = protobuf_wire_reader(self->data, self->size);
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    if (field.number != BYTECODE_FIELD_CONSTANTS)
+      continue;
+    if ((res = decodeConstant(self, field.data, field.size, &constants[i])) < 0)
+      return res;
+    i++;
+  }
+
+  bytecode->constants.data = constants;
+  bytecode->constants.length = constantCount;
+  bytecode->constants.capacity = constantCount;
+
+  if ((res = decodeStringTable(self, self->data, self->size, BYTECODE_FIELD_SOURCE_FILES, sourceFileCount)) < 0)
+    return res;
+
+  if ((res = indexPrototype(self, mainPrototype.data, mainPrototype.size, 0, &bytecode->mainPrototype)) < 0)
+    return res;
+
+  self->bytecode = bytecode;
+  if (result)
+    *result = bytecode;
+  return 0;
+}
+
+
+// Debug info tree mirrors the prototype tree
+static int attachPrototypeDebugInfo(struct bytecode_loader* self, struct prototype* prototype, const uint8_t* data, size_t size) {
+  struct loaded_prototype* loaded = container_of(prototype, struct loaded_prototype, prototype);
+  int res = 0;
+  size_t childIndex = 0;
+  struct protobuf_wire_reader reader = protobuf_wire_reader(data, size);
+  struct protobuf_wire_field field;
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    switch (field.number) {
+      case PROTOTYPE_DEBUG_INFO_FIELD_LINE_TABLE:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+        loaded->debugLineTable = field.data;
+        loaded->debugLineTableSize = field.size;
+        break;
+      case PROTOTYPE_DEBUG_INFO_FIELD_PROTOTYPES:
+        if (field.type != PROTOBUF_WIRE_LEN || childIndex >= prototype->prototypes.length)
+          return -EINVAL;
+        if ((res = attachPrototypeDebugInfo(self, prototype->prototypes.data[childIndex], field.data, field.size)) < 0)
+          return res;
+        childIndex++;
+        break;
+    }
+  }
+
+  if (childIndex != prototype->prototypes.length)
+    return -EINVAL;
+
+  // Already decoded ones wont see it otherwise
+  if (loaded->isDecoded && loaded->debugLineTable)
+    return decodeLineTable(self, loaded->debugLineTable, loaded->debugLineTableSize, prototype);
+  return 0;
+}
+
+int bytecode_loader_attach_debug_info(struct bytecode_loader* self, const void* data, size_t size) {
+  if (!self->bytecode || self->sourceFileCount > 0)
+    return -EINVAL;
+
+  int res = 0;
+  struct protobuf_wire_reader reader = protobuf_wire_reader(data, size);
+  struct protobuf_wire_field field;
+  struct protobuf_wire_field mainPrototype = {};
+  bool hasMainPrototype = false;
+  int32_t version = 0;
+  size_t sourceFileCount = 0;
+  while (!protobuf_wire_eof(&reader)) {
+    if ((res = protobuf_wire_read_field(&reader, &field)) < 0)
+      return res;
+
+    switch (field.number) {
+      case DEBUG_INFO_FIELD_VERSION:
+        if (field.type != PROTOBUF_WIRE_VARINT)
+          return -EINVAL;
+        version = (int32_t) field.value;
+        break;
+      case DEBUG_INFO_FIELD_SOURCE_FILES:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+        sourceFileCount++;
+        break;
+      case DEBUG_INFO_FIELD_MAIN_PROTOTYPE:
+        if (field.type != PROTOBUF_WIRE_LEN)
+          return -EINVAL;
+        mainPrototype = field;
+        hasMainPrototype = true;
+        break;
+      case DEBUG_INFO_FIELD_BYTECODE_CHECKSUM:
+        if (field.type != PROTOBUF_WIRE_FIXED64)
+          return -EINVAL;
+        if (field.value != util_fnv1a64(self->data, self->size))
+          return -EINVAL;
+        break;
+    }
+  }
+
+  if (!hasMainPrototype || version != self->version)
+    return -EINVAL;
+
+  if ((res = decodeStringTable(self, data, size, DEBUG_INFO_FIELD_SOURCE_FILES, sourceFileCount)) < 0)
+    return res;
+  return attachPrototypeDebugInfo(self, self->bytecode->mainPrototype, mainPrototype.data, mainPrototype.size);
+}
+
@@ -0,0 +1,91 @@
+#ifndef _headers_1667307410_Fluff_Assembler_protobuf_loader
+#define _headers_1667307410_Fluff_Assembler_protobuf_loader
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Load protobuf encoded bytecode back into struct bytecode
+//
+// Loading only index where each prototype lives in the input and
+// prototype's instructions and name only decoded on first
+// bytecode_loader_decode_prototype call on it. Everything
+// is allocated from an arena owned by the loader so the
+// struct bytecode and struct prototype given by the loader
+// is read only and must not be free'd with bytecode_free or
+// prototype_free (those are released by bytecode_loader_free)
+
+struct arena;
+struct bytecode;
+struct prototype;
+
+struct bytecode_loader {
+  // Input is not copied and must outlive the loader
+  const uint8_t* data;
+  size_t size;
+
+  struct arena* arena;
+  struct bytecode* bytecode;
+  int32_t version;
+  uint32_t requiredFeatures;
+
+  // Accept object files (BYTECODE_FEATURE_UNLINKED) and
+  // decode their prototype references, for the linker.
+  // Must be set before bytecode_loader_load (default false)
+  bool allowUnlinked;
+
+  size_t prototypeCount;
+  size_t decodedPrototypeCount;
+
+  // Interned source files from the bytecode or from
+  // attached debug info
+  const char** sourceFiles;
+  size_t sourceFileCount;
+};
+
+// `data` must be kept alive until bytecode_loader_free
+struct bytecode_loader* bytecode_loader_new(const void* data, size_t size);
+void bytecode_loader_free(struct bytecode_loader* self);
+
+// Index the input and decode everything except the
+// prototypes content. Prototype tree is available through
+// bytecode->mainPrototype but each prototype must be
+// decoded by bytecode_loader_decode_prototype before use
+//
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EINVAL: Malformed input or already loaded
+// -ENOTSUP: Unsupported bytecode version or required feature
+//           (includes object file if not allowUnlinked)
+int bytecode_loader_load(struct bytecode_loader* self, struct bytecode** result);
+
+// Decode `prototype`'s name and instructions if not yet
+// decoded. `prototype` must come from this loader
+//
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EINVAL: Malformed input
+int bytecode_loader_decode_prototype(struct bytecode_loader* self, struct prototype* prototype);
+
+// `prototype` must come from a loader
+bool bytecode_loader_is_decoded(const struct prototype* prototype);
+
+// Decode every prototypes (for tools which need everything)
+// Errors is same as bytecode_loader_decode_prototype
+int bytecode_loader_decode_all(struct bytecode_loader* self);
+
+// Use line tables from `.fluff_dbg` sidecar for bytecode which
+// was serialized without them. Must be called after
+// bytecode_loader_load and `data` must outlive the loader
+//
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EINVAL: Malformed debug info, it belongs to different bytecode
+//          or bytecode already has debug info
+int bytecode_loader_attach_debug_info(struct bytecode_loader* self, const void* data, size_t size);
+
+#endif
+
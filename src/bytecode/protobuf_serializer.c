@@ -3,23 +3,53 @@
 #include <errno.h>
 #include <assert.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
 
+#include "allocator.h"
 #include "bytecode/bytecode.h"
+#include "byte_buffer.h"
 #include "bytecode/prototype.h"
+#include "bytecode/instruction_compression.h"
+#include "bytecode/protobuf_wire.h"
 #include "protobuf_serializer.h"
 #include "format/bytecode.pb-c.h"
 #include "constants.h"
 #include "vec.h"
 #include "util.h"
 #include "vm_types.h"
+#include "opcodes.h"
+#include "trace.h"
 
 // Sanity checks (to catch mistakes of changing sizes without changing the proto file)
 static_assert(sizeof(vm_instruction) == FIELD_SIZEOF(FluffyVmFormat__Bytecode__Prototype, instructions[0]));
+static_assert(sizeof(vm_instruction) == FIELD_SIZEOF(FluffyVmFormat__Bytecode__Prototype, packedinstructions[0]));
 static_assert(sizeof(vm_int) == FIELD_SIZEOF(FluffyVmFormat__Bytecode__Constant, data_integer));
 static_assert(sizeof(vm_number) == FIELD_SIZEOF(FluffyVmFormat__Bytecode__Constant, data_number));
 
+// State shared by whole conversion
+struct conversion_state {
+  const struct bytecode_serializer_options* options;
+  uint32_t requiredFeatures;
+  
+  // Interned source file names (borrowed from prototypes), there
+  // only few of them per bytecode so linear search is enough
+  vec_t(const char*) sourceFiles;
+};
+
 static void freeConstant(FluffyVmFormat__Bytecode__Constant* constant) {
-  free(constant);
+  allocator_free(constant);
+}
+
+static void freeLineTable(FluffyVmFormat__Bytecode__LineTable* lineTable) {
+  if (!lineTable)
+    return;
+  
+  allocator_free(lineTable->runlength);
+  allocator_free(lineTable->runlinedelta);
+  allocator_free(lineTable);
 }
 
 static void freePrototype(FluffyVmFormat__Bytecode__Prototype* prototype) {
@@ -29,9 +59,13 @@ static void freePrototype(FluffyVmFormat__Bytecode__Prototype* prototype) {
   for (int i = 0; i < prototype->n_prototypes; i++)
     freePrototype(prototype->prototypes[i]);
   
-  free(prototype->instructions);
-  free(prototype->prototypes);
-  free(prototype);
+  // Instructions are borrowed from struct prototype
+  freeLineTable(prototype->linetable);
+  allocator_free(prototype->compressedinstructions.data);
+  allocator_free(prototype->compactinstructions);
+  allocator_free(prototype->prototypereferences);
+  allocator_free(prototype->prototypes);
+  allocator_free(prototype);
 }
 
 static void freeBytecode(FluffyVmFormat__Bytecode__Bytecode* bytecode) {
@@ -41,8 +75,8 @@ static void freeBytecode(FluffyVmFormat__Bytecode__Bytecode* bytecode) {
   freePrototype(bytecode->mainprototype);
   for (int i = 0; i < bytecode->n_constants; i++) 
     freeConstant(bytecode->constants[i]);
-  free(bytecode->constants);
-  free(bytecode);
+  allocator_free(bytecode->constants);
+  allocator_free(bytecode);
 }
 
 static FluffyVmFormat__Bytecode__Constant__DataCase convertConstantType(enum constant_type type) {
@@ -59,7 +93,7 @@ static FluffyVmFormat__Bytecode__Constant__DataCase convertConstantType(enum con
 }
 
 static int convertConstant(FluffyVmFormat__Bytecode__Constant** resultRet, struct constant* constant) {
-  FluffyVmFormat__Bytecode__Constant* result = malloc(sizeof(*result));
+  FluffyVmFormat__Bytecode__Constant* result = allocator_malloc(sizeof(*result));
   int res = 0;
   if (!result)
     return -ENOMEM;
@@ -89,34 +123,227 @@ invalid_constant:
   return res;
 }
 
-static int convertPrototype(struct prototype* prototype, FluffyVmFormat__Bytecode__Prototype** resultRet) {
+static int internSourceFile(struct conversion_state* state, const char* name, uint32_t* index) {
+  size_t i = 0;
+  const char* current = NULL;
+  vec_foreach(&state->sourceFiles, current, i) {
+    if (strcmp(current, name) == 0) {
+      *index = i;
+      return 0;
+    }
+  }
+  
+  if (vec_push(&state->sourceFiles, name) < 0)
+    return -ENOMEM;
+  *index = state->sourceFiles.length - 1;
+  return 0;
+}
+
+// Consecutive instructions from same line (common as one statement
+// may generate few instructions and lines rarely go back) are
+// collapsed into one run
+static int convertLineTable(struct conversion_state* state, struct prototype* prototype, FluffyVmFormat__Bytecode__LineTable** resultRet) {
   int res = 0;
-  FluffyVmFormat__Bytecode__Prototype* result = malloc(sizeof(*result));
+  FluffyVmFormat__Bytecode__LineTable* result = allocator_malloc(sizeof(*result));
   if (result == NULL)
     return -ENOMEM;
+  *result = (FluffyVmFormat__Bytecode__LineTable) FLUFFY_VM_FORMAT__BYTECODE__LINE_TABLE__INIT;
+  
+  if (prototype->sourceFile) {
+    result->has_sourcefile = true;
+    if ((res = internSourceFile(state, prototype->sourceFile, &result->sourcefile)) < 0)
+      goto failure;
+  }
+  
+  result->has_definedatline = true;
+  result->definedatline = prototype->definedAtLine;
+  result->has_definedatcolumn = true;
+  result->definedatcolumn = prototype->definedAtColumn;
+  
+  size_t i = 0;
+  int line = 0;
+  int runLine = 0;
+  size_t runCount = 0;
+  vec_foreach(&prototype->instructionLines, line, i) {
+    if (i == 0 || line != runLine)
+      runCount++;
+    runLine = line;
+  }
+  
+  if (runCount == 0)
+    goto no_runs;
+  
+  result->n_runlength = runCount;
+  result->n_runlinedelta = runCount;
+  result->runlength = allocator_calloc(runCount, sizeof(*result->runlength));
+  result->runlinedelta = allocator_calloc(runCount, sizeof(*result->runlinedelta));
+  if (result->runlength == NULL || result->runlinedelta == NULL) {
+    res = -ENOMEM;
+    goto failure;
+  }
+  
+  size_t current = 0;
+  runLine = 0;
+  vec_foreach(&prototype->instructionLines, line, i) {
+    if (i > 0 && line == runLine) {
+      result->runlength[current - 1]++;
+      continue;
+    }
+    
+    result->runlength[current] = 1;
+    result->runlinedelta[current] = line - runLine;
+    runLine = line;
+    current++;
+  }
+
+no_runs:
+failure:
+  if (res < 0) {
+    freeLineTable(result);
+    result = NULL;
+  }
+  *resultRet = result;
+  return res;
+}
+
+// Streams shorter than this rarely get smaller
+#define MIN_COMPRESSED_INSTRUCTIONS 16
+
+// Split into 32-bit words, short instructions take one word
+static int convertCompactInstructions(struct prototype* prototype, FluffyVmFormat__Bytecode__Prototype* result) {
+  size_t wordCount = 0;
+  size_t i = 0;
+  vm_instruction instruction = 0;
+  vec_foreach(&prototype->instructions, instruction, i)
+    wordCount += OP_WORD_COUNT(instruction);
+  
+  result->n_compactinstructions = wordCount;
+  result->compactinstructions = allocator_calloc(wordCount, sizeof(*result->compactinstructions));
+  if (result->compactinstructions == NULL)
+    return -ENOMEM;
+  
+  size_t current = 0;
+  vec_foreach(&prototype->instructions, instruction, i) {
+    result->compactinstructions[current++] = (uint32_t) (instruction >> 32);
+    if (!OP_IS_SHORT(instruction))
+      result->compactinstructions[current++] = (uint32_t) instruction;
+  }
+  return 0;
+}
+
+static int convertInstructions(struct conversion_state* state, struct prototype* prototype, FluffyVmFormat__Bytecode__Prototype* result) {
+  size_t count = prototype->instructions.length;
+  
+  // Compact stream is already small and not compressed
+  if (prototype->isCompact) {
+    state->requiredFeatures |= BYTECODE_FEATURE_COMPACT_INSTRUCTIONS;
+    return convertCompactInstructions(prototype, result);
+  }
+  
+  if (state->options->compressInstructions && count >= MIN_COMPRESSED_INSTRUCTIONS) {
+    void* compressed = NULL;
+    size_t compressedSize = 0;
+    int res = instruction_compression_compress(prototype->instructions.data, count, &compressed, &compressedSize);
+    if (res < 0)
+      return res;
+    
+    // Keep it packed if it didn't help
+    if (compressedSize < count * sizeof(vm_instruction)) {
+      result->has_compressedinstructions = true;
+      result->compressedinstructions.data = compressed;
+      result->compressedinstructions.len = compressedSize;
+      state->requiredFeatures |= BYTECODE_FEATURE_COMPRESSED_INSTRUCTIONS;
+      return 0;
+    }
+    allocator_free(compressed);
+  }
+  
+  result->n_packedinstructions = count;
+  result->packedinstructions = prototype->instructions.data;
+  return 0;
+}
+
+static int convertReferences(struct conversion_state* state, struct prototype* prototype, FluffyVmFormat__Bytecode__Prototype* result) {
+  size_t count = prototype->references.length;
+  if (count == 0)
+    return 0;
+  
+  // Pointers and the messages they point to in one allocation
+  FluffyVmFormat__Bytecode__PrototypeReference** references = allocator_malloc(count * (sizeof(*references) + sizeof(**references)));
+  if (references == NULL)
+    return -ENOMEM;
+  FluffyVmFormat__Bytecode__PrototypeReference* messages = (FluffyVmFormat__Bytecode__PrototypeReference*) (references + count);
+  
+  size_t i = 0;
+  struct prototype_reference* reference = NULL;
+  vec_foreach_ptr(&prototype->references, reference, i) {
+    messages[i] = (FluffyVmFormat__Bytecode__PrototypeReference) FLUFFY_VM_FORMAT__BYTECODE__PROTOTYPE_REFERENCE__INIT;
+    messages[i].instruction = (uint32_t) reference->instruction;
+    messages[i].symbolname = (char*) reference->symbolName;
+    references[i] = &messages[i];
+  }
+  
+  result->n_prototypereferences = count;
+  result->prototypereferences = references;
+  state->requiredFeatures |= BYTECODE_FEATURE_UNLINKED;
+  return 0;
+}
+
+static FluffyVmFormat__Bytecode__Prototype* newPrototype(struct prototype* prototype) {
+  FluffyVmFormat__Bytecode__Prototype* result = allocator_malloc(sizeof(*result));
+  if (result == NULL)
+    return NULL;
   
   *result = (FluffyVmFormat__Bytecode__Prototype) FLUFFY_VM_FORMAT__BYTECODE__PROTOTYPE__INIT;
   result->symbolname = (char*) prototype->prototypeName;
+  return result;
+}
+
+// Everything except child prototypes
+static int convertPrototypeFields(struct conversion_state* state, struct prototype* prototype, FluffyVmFormat__Bytecode__Prototype* result) {
+  // Version 1 stored instructions as unpacked varints which
+  // costs 11 bytes each and has no line info
+  if (state->options->version == 1) {
+    // Short instructions would be misread and there
+    // is nowhere to put references
+    if (prototype->isCompact || prototype->references.length > 0)
+      return -EINVAL;
+    
+    result->n_instructions = prototype->instructions.length;
+    result->instructions = prototype->instructions.data;
+    return 0;
+  }
+  
+  int res = convertInstructions(state, prototype, result);
+  if (res < 0)
+    return res;
+  if ((res = convertReferences(state, prototype, result)) < 0)
+    return res;
+  if (!state->options->stripDebugInfo)
+    res = convertLineTable(state, prototype, &result->linetable);
+  return res;
+}
+
+static int convertPrototype(struct conversion_state* state, struct prototype* prototype, FluffyVmFormat__Bytecode__Prototype** resultRet) {
+  int res = 0;
+  FluffyVmFormat__Bytecode__Prototype* result = newPrototype(prototype);
+  if (result == NULL)
+    return -ENOMEM;
+  
   result->n_prototypes = prototype->prototypes.length;
-  result->prototypes = calloc(prototype->prototypes.length, sizeof(void*));
+  result->prototypes = allocator_calloc(prototype->prototypes.length, sizeof(void*));
   if (result->prototypes == NULL) {
     res = -ENOMEM;
     goto failure;
   }
   
-  int i = 0;
+  size_t i = 0;
   struct prototype* current = NULL;
   vec_foreach(&prototype->prototypes, current, i)
-    if (convertPrototype(current, &result->prototypes[i]) < 0)
+    if ((res = convertPrototype(state, current, &result->prototypes[i])) < 0)
       goto failure;
   
-  result->n_instructions = prototype->instructions.length;
-  result->instructions = calloc(prototype->instructions.length, sizeof(vm_instruction));
-  if (result->instructions == NULL) {
-    res = -ENOMEM;
-    goto failure;
-  }
-  memcpy(result->instructions, prototype->instructions.data, prototype->instructions.length * sizeof(vm_instruction));
+  res = convertPrototypeFields(state, prototype, result);
 
 failure:
   if (res < 0) {
@@ -127,30 +354,36 @@ failure:
   return res;
 }
 
-static int convertBytecode(struct bytecode* bytecode, FluffyVmFormat__Bytecode__Bytecode** resultRet) {
+static int convertBytecode(struct conversion_state* state, struct bytecode* bytecode, FluffyVmFormat__Bytecode__Bytecode** resultRet) {
   int res = 0;
-  FluffyVmFormat__Bytecode__Bytecode* result = malloc(sizeof(*result));
+  FluffyVmFormat__Bytecode__Bytecode* result = allocator_malloc(sizeof(*result));
   if (!result)
     return -ENOMEM;
   *result = (FluffyVmFormat__Bytecode__Bytecode) FLUFFY_VM_FORMAT__BYTECODE__BYTECODE__INIT;
   
-  result->version = VM_BYTECODE_VERSION;
+  result->version = state->options->version;
   result->n_constants = bytecode->constants.length;
-  result->constants = calloc(bytecode->constants.length, sizeof(void*));
+  result->constants = allocator_calloc(bytecode->constants.length, sizeof(void*));
   
   if (result->constants == NULL) {
     res = -ENOMEM;
     goto allocate_constants_error;
   }
   
-  int i = 0;
+  size_t i = 0;
   struct constant* constant = NULL;
   vec_foreach_ptr(&bytecode->constants, constant, i)
     if ((res = convertConstant(&result->constants[i], constant)) < 0)
       goto convert_constant_error;
   
-  if (convertPrototype(bytecode->mainPrototype, &result->mainprototype) < 0)
+  if ((res = convertPrototype(state, bytecode->mainPrototype, &result->mainprototype)) < 0)
     goto convert_prototype_error;
+  
+  // Only written if used so the output stays readable by older readers
+  result->has_requiredfeatures = state->requiredFeatures != 0;
+  result->requiredfeatures = state->requiredFeatures;
+  result->n_sourcefiles = state->sourceFiles.length;
+  result->sourcefiles = (char**) state->sourceFiles.data;
 
 convert_prototype_error:
 convert_constant_error:
@@ -163,44 +396,526 @@ allocate_constants_error:
   return res;
 }
 
-int bytecode_serializer_protobuf(struct bytecode* bytecode, void** result, size_t* size) {
+static int appendSerial(struct conversion_state* state, struct bytecode* bytecode, struct byte_buffer* output) {
   FluffyVmFormat__Bytecode__Bytecode* protobufBytecode = NULL;
   int res = 0;
-  void* buffer = NULL;
-  size_t serializedSize = 0;
+  size_t originalSize = output->size;
   
-  if ((res = convertBytecode(bytecode, &protobufBytecode)) < 0)
-    goto conversion_error;
+  if ((res = convertBytecode(state, bytecode, &protobufBytecode)) < 0)
+    return res;
   
-  serializedSize = fluffy_vm_format__bytecode__bytecode__get_packed_size(protobufBytecode);
+  size_t serializedSize = fluffy_vm_format__bytecode__bytecode__get_packed_size(protobufBytecode);
   if (serializedSize == 0) {
     res = -EINVAL;
     goto size_calculate_error;
   }
   
-  buffer = malloc(serializedSize);
+  void* buffer = byte_buffer_append_space(output, serializedSize);
   if (!buffer) {
     res = -ENOMEM;
     goto alloc_buffer_failure;
   }
   
   if (fluffy_vm_format__bytecode__bytecode__pack(protobufBytecode, buffer) != serializedSize) {
-    buffer = NULL;
+    output->size = originalSize;
     res = -EFAULT;
     goto serialize_failure;
   }
 
 serialize_failure:
+alloc_buffer_failure:
+size_calculate_error:
+  freeBytecode(protobufBytecode);
+  return res;
+}
+
+// Parallel conversion and packing
+//
+// Prototype tree is cut into subtrees of roughly equal
+// weight which are converted, sized and packed by worker
+// threads, each straight into its own slice of the output.
+// Prototypes above the cut (the spine) are converted and
+// packed without their children and the children's tag
+// and length prefixes are written in between the slices
+//
+// Bytes are the same as protobuf-c's because it packs
+// fields in field number order and since version 2 child
+// prototypes (field 2) come before everything else a
+// prototype has
+
+// Field numbers from format/bytecode.proto
+#define BYTECODE_FIELD_VERSION 1
+#define BYTECODE_FIELD_CONSTANTS 2
+#define BYTECODE_FIELD_MAIN_PROTOTYPE 3
+#define BYTECODE_FIELD_REQUIRED_FEATURES 4
+#define BYTECODE_FIELD_SOURCE_FILES 5
+#define PROTOTYPE_FIELD_PROTOTYPES 2
+
+// Trees lighter than this are done on calling thread
+#define PARALLEL_MIN_WEIGHT (1 << 16)
+
+// More subtrees balance threads better but grow the spine
+#define PARALLEL_SUBTREES_PER_THREAD 8
+
+enum pack_node_kind {
+  // Converted and packed along with all of its children
+  PACK_NODE_SUBTREE,
+  // Converted and packed without children, each of
+  // which is a node of its own
+  PACK_NODE_SPINE,
+  // Inside some PACK_NODE_SUBTREE
+  PACK_NODE_COVERED
+};
+
+struct pack_node {
+  struct prototype* prototype;
+  enum pack_node_kind kind;
+  // SIZE_MAX for main prototype
+  size_t parent;
+  // Instructions plus one per prototype in whole subtree
+  size_t weight;
+  
+  FluffyVmFormat__Bytecode__Prototype* converted;
+  uint32_t requiredFeatures;
+  int res;
+  
+  // Packed size of `converted` alone and with children
+  // (same unless spine)
+  size_t ownSize;
+  size_t size;
+  
+  uint8_t* output;
+  // Where next child's slice goes while laying out
+  uint8_t* nextChild;
+};
+
+struct parallel_context {
+  struct conversion_state* state;
+  
+  // In preorder, so parent comes before its children
+  // and children before parent's next sibling
+  struct pack_node* nodes;
+  size_t nodeCount;
+  
+  void (*task)(struct parallel_context* ctx, struct pack_node* node);
+  const char* taskName;
+  // Index of next node to be picked up
+  atomic_size_t nextNode;
+};
+
+static void measureTree(struct prototype* prototype, size_t* count, size_t* weight) {
+  *count += 1;
+  *weight += prototype->instructions.length + 1;
+  
+  size_t i = 0;
+  struct prototype* current = NULL;
+  vec_foreach(&prototype->prototypes, current, i)
+    measureTree(current, count, weight);
+}
+
+static void collectNodes(struct pack_node* nodes, size_t* count, struct prototype* prototype, size_t parent) {
+  size_t index = (*count)++;
+  nodes[index] = (struct pack_node) {
+    .prototype = prototype,
+    .parent = parent,
+    .weight = prototype->instructions.length + 1
+  };
+  
+  size_t i = 0;
+  struct prototype* current = NULL;
+  vec_foreach(&prototype->prototypes, current, i)
+    collectNodes(nodes, count, current, index);
+}
+
+// Same order convertPrototype interns in so indices
+// match the serial conversion's
+static int internSourceFiles(struct conversion_state* state, struct prototype* prototype) {
+  int res = 0;
+  size_t i = 0;
+  struct prototype* current = NULL;
+  vec_foreach(&prototype->prototypes, current, i)
+    if ((res = internSourceFiles(state, current)) < 0)
+      return res;
+  
+  if (!prototype->sourceFile)
+    return 0;
+  return internSourceFile(state, prototype->sourceFile, &(uint32_t) {0});
+}
+
+static void convertNode(struct parallel_context* ctx, struct pack_node* node) {
+  // Own copy so requiredFeatures isn't shared, source files
+  // are all interned already and only ever looked up
+  struct conversion_state state = *ctx->state;
+  state.requiredFeatures = 0;
+  
+  if (node->kind == PACK_NODE_SUBTREE) {
+    node->res = convertPrototype(&state, node->prototype, &node->converted);
+  } else if ((node->converted = newPrototype(node->prototype)) == NULL) {
+    node->res = -ENOMEM;
+  } else {
+    node->res = convertPrototypeFields(&state, node->prototype, node->converted);
+  }
+  
+  if (node->res < 0)
+    return;
+  
+  node->requiredFeatures = state.requiredFeatures;
+  node->ownSize = fluffy_vm_format__bytecode__prototype__get_packed_size(node->converted);
+  node->size = node->ownSize;
+}
+
+static void packNode(struct parallel_context* ctx, struct pack_node* node) {
+  // Spine's own fields go after its children
+  uint8_t* output = node->output + node->size - node->ownSize;
+  if (fluffy_vm_format__bytecode__prototype__pack(node->converted, output) != node->ownSize)
+    node->res = -EFAULT;
+}
+
+static void* parallelWorker(void* _ctx) {
+  struct parallel_context* ctx = _ctx;
+  struct trace_span span;
+  trace_span_begin(&span, "serialize", ctx->taskName);
+  
+  size_t current;
+  while ((current = atomic_fetch_add_explicit(&ctx->nextNode, 1, memory_order_relaxed)) < ctx->nodeCount)
+    if (ctx->nodes[current].kind != PACK_NODE_COVERED)
+      ctx->task(ctx, &ctx->nodes[current]);
+  
+  trace_span_end(&span);
+  return NULL;
+}
+
+// Calling thread works too so threads which failed
+// to start only make it slower
+static void runParallel(struct parallel_context* ctx, void (*task)(struct parallel_context* ctx, struct pack_node* node), const char* taskName, pthread_t* threads, int threadCount) {
+  ctx->task = task;
+  ctx->taskName = taskName;
+  atomic_store_explicit(&ctx->nextNode, 0, memory_order_relaxed);
+  
+  int started = 0;
+  for (int i = 1; i < threadCount; i++) {
+    if (pthread_create(&threads[started], NULL, parallelWorker, ctx) != 0)
+      break;
+    started++;
+  }
+  
+  parallelWorker(ctx);
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+}
+
+// First error in preorder so it doesn't depend on timing
+static int firstNodeError(struct parallel_context* ctx) {
+  for (size_t i = 0; i < ctx->nodeCount; i++)
+    if (ctx->nodes[i].kind != PACK_NODE_COVERED && ctx->nodes[i].res < 0)
+      return ctx->nodes[i].res;
+  return 0;
+}
+
+static void splitTree(struct parallel_context* ctx, size_t totalWeight, int threadCount) {
+  for (size_t i = ctx->nodeCount - 1; i > 0; i--)
+    ctx->nodes[ctx->nodes[i].parent].weight += ctx->nodes[i].weight;
+  
+  size_t maxSubtreeWeight = totalWeight / ((size_t) threadCount * PARALLEL_SUBTREES_PER_THREAD);
+  for (size_t i = 0; i < ctx->nodeCount; i++) {
+    struct pack_node* node = &ctx->nodes[i];
+    if (i > 0 && ctx->nodes[node->parent].kind != PACK_NODE_SPINE)
+      node->kind = PACK_NODE_COVERED;
+    else if (node->weight > maxSubtreeWeight && node->prototype->prototypes.length > 0)
+      node->kind = PACK_NODE_SPINE;
+    else
+      node->kind = PACK_NODE_SUBTREE;
+  }
+}
+
+// Children come after parent in preorder so reverse
+// order visits each node after all of its descendants
+static void sizeNodes(struct parallel_context* ctx) {
+  for (size_t i = ctx->nodeCount - 1; i > 0; i--) {
+    struct pack_node* node = &ctx->nodes[i];
+    if (node->kind != PACK_NODE_COVERED)
+      ctx->nodes[node->parent].size += protobuf_wire_len_header_size(PROTOTYPE_FIELD_PROTOTYPES, node->size) + node->size;
+  }
+}
+
+// Give each node its slice and write prefixes of spine's
+// children, children follow in preorder same order they're
+// in their parent's prototypes field
+static void placeNodes(struct parallel_context* ctx, uint8_t* mainPrototype) {
+  ctx->nodes[0].output = mainPrototype;
+  ctx->nodes[0].nextChild = mainPrototype;
+  for (size_t i = 1; i < ctx->nodeCount; i++) {
+    struct pack_node* node = &ctx->nodes[i];
+    if (node->kind == PACK_NODE_COVERED)
+      continue;
+    
+    struct pack_node* parent = &ctx->nodes[node->parent];
+    node->output = parent->nextChild + protobuf_wire_write_len_header(parent->nextChild, PROTOTYPE_FIELD_PROTOTYPES, node->size);
+    node->nextChild = node->output;
+    parent->nextChild = node->output + node->size;
+  }
+}
+
+static int appendParallel(struct conversion_state* state, struct bytecode* bytecode, int threadCount, size_t prototypeCount, size_t totalWeight, struct byte_buffer* output) {
+  int res = 0;
+  size_t originalSize = output->size;
+  struct parallel_context ctx = {
+    .state = state,
+    .nodes = allocator_calloc(prototypeCount, sizeof(*ctx.nodes))
+  };
+  pthread_t* threads = allocator_calloc(threadCount, sizeof(*threads));
+  FluffyVmFormat__Bytecode__Constant** constants = allocator_calloc(bytecode->constants.length, sizeof(*constants));
+  if (!ctx.nodes || !threads || !constants) {
+    res = -ENOMEM;
+    goto alloc_failure;
+  }
+  
+  size_t i = 0;
+  struct constant* constant = NULL;
+  vec_foreach_ptr(&bytecode->constants, constant, i)
+    if ((res = convertConstant(&constants[i], constant)) < 0)
+      goto convert_constant_error;
+  
+  if (!state->options->stripDebugInfo && (res = internSourceFiles(state, bytecode->mainPrototype)) < 0)
+    goto intern_error;
+  
+  collectNodes(ctx.nodes, &ctx.nodeCount, bytecode->mainPrototype, SIZE_MAX);
+  splitTree(&ctx, totalWeight, threadCount);
+  
+  runParallel(&ctx, convertNode, "convert", threads, threadCount);
+  if ((res = firstNodeError(&ctx)) < 0)
+    goto convert_prototype_error;
+  
+  for (i = 0; i < ctx.nodeCount; i++)
+    state->requiredFeatures |= ctx.nodes[i].requiredFeatures;
+  
+  // Laid out like convertBytecode's result would be packed
+  sizeNodes(&ctx);
+  size_t mainPrototypeSize = ctx.nodes[0].size;
+  uint64_t version = (uint64_t) (int64_t) state->options->version;
+  
+  size_t serializedSize = protobuf_wire_varint_size(protobuf_wire_tag(BYTECODE_FIELD_VERSION, PROTOBUF_WIRE_VARINT)) + protobuf_wire_varint_size(version);
+  for (i = 0; i < bytecode->constants.length; i++) {
+    size_t size = fluffy_vm_format__bytecode__constant__get_packed_size(constants[i]);
+    serializedSize += protobuf_wire_len_header_size(BYTECODE_FIELD_CONSTANTS, size) + size;
+  }
+  serializedSize += protobuf_wire_len_header_size(BYTECODE_FIELD_MAIN_PROTOTYPE, mainPrototypeSize) + mainPrototypeSize;
+  if (state->requiredFeatures != 0)
+    serializedSize += protobuf_wire_varint_size(protobuf_wire_tag(BYTECODE_FIELD_REQUIRED_FEATURES, PROTOBUF_WIRE_VARINT)) + protobuf_wire_varint_size(state->requiredFeatures);
+  for (i = 0; i < state->sourceFiles.length; i++) {
+    size_t size = strlen(state->sourceFiles.data[i]);
+    serializedSize += protobuf_wire_len_header_size(BYTECODE_FIELD_SOURCE_FILES, size) + size;
+  }
+  
+  uint8_t* buffer = byte_buffer_append_space(output, serializedSize);
+  if (!buffer) {
+    res = -ENOMEM;
+    goto alloc_buffer_failure;
+  }
+  
+  uint8_t* current = buffer;
+  current += protobuf_wire_write_varint(current, protobuf_wire_tag(BYTECODE_FIELD_VERSION, PROTOBUF_WIRE_VARINT));
+  current += protobuf_wire_write_varint(current, version);
+  for (i = 0; i < bytecode->constants.length; i++) {
+    size_t size = fluffy_vm_format__bytecode__constant__get_packed_size(constants[i]);
+    current += protobuf_wire_write_len_header(current, BYTECODE_FIELD_CONSTANTS, size);
+    current += fluffy_vm_format__bytecode__constant__pack(constants[i], current);
+  }
+  
+  current += protobuf_wire_write_len_header(current, BYTECODE_FIELD_MAIN_PROTOTYPE, mainPrototypeSize);
+  placeNodes(&ctx, current);
+  current += mainPrototypeSize;
+  
+  if (state->requiredFeatures != 0) {
+    current += protobuf_wire_write_varint(current, protobuf_wire_tag(BYTECODE_FIELD_REQUIRED_FEATURES, PROTOBUF_WIRE_VARINT));
+    current += protobuf_wire_write_varint(current, state->requiredFeatures);
+  }
+  for (i = 0; i < state->sourceFiles.length; i++) {
+    size_t size = strlen(state->sourceFiles.data[i]);
+    current += protobuf_wire_write_len_header(current, BYTECODE_FIELD_SOURCE_FILES, size);
+    memcpy(current, state->sourceFiles.data[i], size);
+    current += size;
+  }
+  
+  runParallel(&ctx, packNode, "pack", threads, threadCount);
+  res = firstNodeError(&ctx);
+  if (res >= 0 && current != buffer + serializedSize)
+    res = -EFAULT;
+  if (res < 0)
+    output->size = originalSize;
+
+alloc_buffer_failure:
+convert_prototype_error:
+  for (i = 0; i < ctx.nodeCount; i++)
+    freePrototype(ctx.nodes[i].converted);
+intern_error:
+convert_constant_error:
+  for (i = 0; i < bytecode->constants.length; i++)
+    freeConstant(constants[i]);
+alloc_failure:
+  allocator_free(constants);
+  allocator_free(threads);
+  allocator_free(ctx.nodes);
+  return res;
+}
+
+int bytecode_serializer_protobuf_append(struct bytecode* bytecode, const struct bytecode_serializer_options* options, struct byte_buffer* output) {
+  static const struct bytecode_serializer_options defaultOptions = BYTECODE_SERIALIZER_OPTIONS_DEFAULT;
+  int res = 0;
+  
+  if (!options)
+    options = &defaultOptions;
+  
+  struct conversion_state state = {
+    .options = options
+  };
+  vec_init(&state.sourceFiles);
+  
+  if (options->version < VM_BYTECODE_VERSION_OLDEST || options->version > VM_BYTECODE_VERSION || options->threadCount < 0) {
+    res = -EINVAL;
+    goto conversion_error;
+  }
+  
+  // Version 1 has no compressed instructions field
+  if (options->compressInstructions && options->version < 2) {
+    res = -EINVAL;
+    goto conversion_error;
+  }
+  
+  int threadCount = options->threadCount;
+  if (threadCount == 0) {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = processors > 0 ? (int) processors : 1;
+  }
+  
+  size_t prototypeCount = 0;
+  size_t totalWeight = 0;
+  measureTree(bytecode->mainPrototype, &prototypeCount, &totalWeight);
+  
+  // Version 1's instructions are field 1, before child
+  // prototypes so spine can't be packed in pieces
+  if (threadCount > 1 && options->version >= 2 && totalWeight >= PARALLEL_MIN_WEIGHT)
+    res = appendParallel(&state, bytecode, threadCount, prototypeCount, totalWeight, output);
+  else
+    res = appendSerial(&state, bytecode, output);
+
+conversion_error:
+  vec_deinit(&state.sourceFiles);
+  return res;
+}
+
+int bytecode_serializer_protobuf(struct bytecode* bytecode, const struct bytecode_serializer_options* options, void** result, size_t* size) {
+  struct byte_buffer output = BYTE_BUFFER_INIT;
+  int res = bytecode_serializer_protobuf_append(bytecode, options, &output);
+  if (res < 0)
+    byte_buffer_deinit(&output);
+  
+  *result = output.data;
+  *size = output.size;
+  return res;
+}
+
+static void freePrototypeDebugInfo(FluffyVmFormat__Bytecode__PrototypeDebugInfo* prototype) {
+  if (!prototype)
+    return;
+  
+  for (int i = 0; i < prototype->n_prototypes; i++)
+    freePrototypeDebugInfo(prototype->prototypes[i]);
+  
+  freeLineTable(prototype->linetable);
+  allocator_free(prototype->prototypes);
+  allocator_free(prototype);
+}
+
+static int convertPrototypeDebugInfo(struct conversion_state* state, struct prototype* prototype, FluffyVmFormat__Bytecode__PrototypeDebugInfo** resultRet) {
+  int res = 0;
+  FluffyVmFormat__Bytecode__PrototypeDebugInfo* result = allocator_malloc(sizeof(*result));
+  if (result == NULL)
+    return -ENOMEM;
+  
+  *result = (FluffyVmFormat__Bytecode__PrototypeDebugInfo) FLUFFY_VM_FORMAT__BYTECODE__PROTOTYPE_DEBUG_INFO__INIT;
+  result->n_prototypes = prototype->prototypes.length;
+  result->prototypes = allocator_calloc(prototype->prototypes.length, sizeof(void*));
+  if (result->prototypes == NULL) {
+    res = -ENOMEM;
+    goto failure;
+  }
+  
+  size_t i = 0;
+  struct prototype* current = NULL;
+  vec_foreach(&prototype->prototypes, current, i)
+    if ((res = convertPrototypeDebugInfo(state, current, &result->prototypes[i])) < 0)
+      goto failure;
+  
+  res = convertLineTable(state, prototype, &result->linetable);
+
+failure:
   if (res < 0) {
-    free(buffer);
-    buffer = NULL;
+    freePrototypeDebugInfo(result);
+    result = NULL;
   }
+  *resultRet = result;
+  return res;
+}
 
-  freeBytecode(protobufBytecode);
+int bytecode_serializer_protobuf_debug_info_append(struct bytecode* bytecode, const struct bytecode_serializer_options* options, const void* serializedBytecode, size_t serializedBytecodeSize, struct byte_buffer* output) {
+  static const struct bytecode_serializer_options defaultOptions = BYTECODE_SERIALIZER_OPTIONS_DEFAULT;
+  FluffyVmFormat__Bytecode__DebugInfo debugInfo = FLUFFY_VM_FORMAT__BYTECODE__DEBUG_INFO__INIT;
+  int res = 0;
+  size_t originalSize = output->size;
+  
+  if (!options)
+    options = &defaultOptions;
+  
+  struct conversion_state state = {
+    .options = options
+  };
+  vec_init(&state.sourceFiles);
+  
+  // Version 1 has no line info at all
+  if (options->version < 2 || options->version > VM_BYTECODE_VERSION) {
+    res = -EINVAL;
+    goto conversion_error;
+  }
+  
+  if ((res = convertPrototypeDebugInfo(&state, bytecode->mainPrototype, &debugInfo.mainprototype)) < 0)
+    goto conversion_error;
+  
+  debugInfo.version = options->version;
+  debugInfo.n_sourcefiles = state.sourceFiles.length;
+  debugInfo.sourcefiles = (char**) state.sourceFiles.data;
+  debugInfo.has_bytecodechecksum = true;
+  debugInfo.bytecodechecksum = util_fnv1a64(serializedBytecode, serializedBytecodeSize);
+  
+  size_t serializedSize = fluffy_vm_format__bytecode__debug_info__get_packed_size(&debugInfo);
+  void* buffer = byte_buffer_append_space(output, serializedSize);
+  if (!buffer) {
+    res = -ENOMEM;
+    goto alloc_buffer_failure;
+  }
+  
+  if (fluffy_vm_format__bytecode__debug_info__pack(&debugInfo, buffer) != serializedSize) {
+    output->size = originalSize;
+    res = -EFAULT;
+    goto serialize_failure;
+  }
+
+serialize_failure:
 alloc_buffer_failure:
-size_calculate_error:
+  freePrototypeDebugInfo(debugInfo.mainprototype);
 conversion_error:
-  *result = buffer;
-  *size = serializedSize;
+  vec_deinit(&state.sourceFiles);
   return res;
 }
+
+int bytecode_serializer_protobuf_debug_info(struct bytecode* bytecode, const struct bytecode_serializer_options* options, const void* serializedBytecode, size_t serializedBytecodeSize, void** result, size_t* size) {
+  struct byte_buffer output = BYTE_BUFFER_INIT;
+  int res = bytecode_serializer_protobuf_debug_info_append(bytecode, options, serializedBytecode, serializedBytecodeSize, &output);
+  if (res < 0)
+    byte_buffer_deinit(&output);
+  
+  *result = output.data;
+  *size = output.size;
+  return res;
+}
+
@@ -1,18 +1,70 @@
 #ifndef _headers_1667052779_Fluff_Assembler_protobuf_serializer
 #define _headers_1667052779_Fluff_Assembler_protobuf_serializer
 
+#include <stdbool.h>
 #include <stddef.h>
 
+#include "constants.h"
+
 // Serialize bytecode with protobuf
 struct bytecode;
+struct byte_buffer;
+
+struct bytecode_serializer_options {
+  // Format version to emit, between VM_BYTECODE_VERSION_OLDEST
+  // and VM_BYTECODE_VERSION
+  int version;
+  
+  // Compress instruction streams (version 2 and newer), output
+  // then requires BYTECODE_FEATURE_COMPRESSED_INSTRUCTIONS if
+  // any prototype got smaller
+  bool compressInstructions;
+  
+  // Leave line tables out (for release builds or when they
+  // are written by bytecode_serializer_protobuf_debug_info)
+  bool stripDebugInfo;
+  
+  // Convert and pack large prototype trees (version 2 and newer)
+  // on up to this many threads, 0 for number of processors. Small
+  // trees always stay on calling thread and output is same as
+  // with 1 regardless
+  int threadCount;
+};
+
+#define BYTECODE_SERIALIZER_OPTIONS_DEFAULT { \
+  .version = VM_BYTECODE_VERSION, \
+  .compressInstructions = false, \
+  .stripDebugInfo = false, \
+  .threadCount = 1 \
+}
 
 // `result` and `size` assumed to be non NULL as it doesnt make sense 
-// if these were NULL
+// if these were NULL, `options` can be NULL for defaults
+// Return zero on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EFAULT: Failure serializing
+// -EINVAL: Unsupported format version or options or
+//          compact instructions or object with version 1
+int bytecode_serializer_protobuf(struct bytecode* bytecode, const struct bytecode_serializer_options* options, void** result, size_t* size);
+
+// Same as bytecode_serializer_protobuf but append to `output`
+// which is left as it was on failure
+int bytecode_serializer_protobuf_append(struct bytecode* bytecode, const struct bytecode_serializer_options* options, struct byte_buffer* output);
+
+// Serialize only the debug info as `.fluff_dbg` sidecar for
+// `serializedBytecode` which is output of bytecode_serializer_protobuf
+// with same `bytecode` and `options` (usually with stripDebugInfo)
 // Return zero on success
 // Errors:
 // -ENOMEM: Not enough memory
 // -EFAULT: Failure serializing
-int bytecode_serializer_protobuf(struct bytecode* bytecode, void** result, size_t* size);
+// -EINVAL: Version 1 (has no debug info)
+int bytecode_serializer_protobuf_debug_info(struct bytecode* bytecode, const struct bytecode_serializer_options* options, const void* serializedBytecode, size_t serializedBytecodeSize, void** result, size_t* size);
+
+// Same as bytecode_serializer_protobuf_debug_info but append
+// to `output` which is left as it was on failure
+int bytecode_serializer_protobuf_debug_info_append(struct bytecode* bytecode, const struct bytecode_serializer_options* options, const void* serializedBytecode, size_t serializedBytecodeSize, struct byte_buffer* output);
 
 #endif
 
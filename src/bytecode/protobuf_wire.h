@@ -0,0 +1,182 @@
+#ifndef _headers_1667306822_Fluff_Assembler_protobuf_wire
+#define _headers_1667306822_Fluff_Assembler_protobuf_wire
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Minimal protobuf wire format helpers for code which
+// need to walk encoded messages without protobuf-c
+
+enum protobuf_wire_type {
+  PROTOBUF_WIRE_VARINT = 0,
+  PROTOBUF_WIRE_FIXED64 = 1,
+  PROTOBUF_WIRE_LEN = 2,
+  PROTOBUF_WIRE_FIXED32 = 5
+};
+
+struct protobuf_wire_reader {
+  const uint8_t* current;
+  const uint8_t* end;
+};
+
+struct protobuf_wire_field {
+  uint32_t number;
+  enum protobuf_wire_type type;
+
+  // For PROTOBUF_WIRE_LEN
+  const uint8_t* data;
+  size_t size;
+
+  // For other types
+  uint64_t value;
+};
+
+static inline struct protobuf_wire_reader protobuf_wire_reader(const void* data, size_t size) {
+  return (struct protobuf_wire_reader) {
+    .current = data,
+    .end = (const uint8_t*) data + size
+  };
+}
+
+static inline bool protobuf_wire_eof(struct protobuf_wire_reader* self) {
+  return self->current >= self->end;
+}
+
+// Return 0 on success
+// Errors:
+// -EINVAL: Malformed or truncated varint
+static inline int protobuf_wire_read_varint(struct protobuf_wire_reader* self, uint64_t* result) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (self->current >= self->end)
+      return -EINVAL;
+
+    uint8_t byte = *self->current++;
+    value |= (uint64_t) (byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *result = value;
+      return 0;
+    }
+  }
+
+  return -EINVAL;
+}
+
+static inline int protobuf_wire_read_fixed64(struct protobuf_wire_reader* self, uint64_t* result) {
+  if (self->end - self->current < 8)
+    return -EINVAL;
+
+  // Protobuf fixed values are little endian
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--)
+    value = (value << 8) | self->current[i];
+  self->current += 8;
+  *result = value;
+  return 0;
+}
+
+static inline int protobuf_wire_read_fixed32(struct protobuf_wire_reader* self, uint32_t* result) {
+  if (self->end - self->current < 4)
+    return -EINVAL;
+
+  *result = (uint32_t) self->current[0] |
+            (uint32_t) self->current[1] << 8 |
+            (uint32_t) self->current[2] << 16 |
+            (uint32_t) self->current[3] << 24;
+  self->current += 4;
+  return 0;
+}
+
+// Read one field, LEN fields are not copied and
+// `field->data` points into the reader's buffer
+// Return 0 on success
+// Errors:
+// -EINVAL: Malformed field or unsupported wire type
+static inline int protobuf_wire_read_field(struct protobuf_wire_reader* self, struct protobuf_wire_field* field) {
+  uint64_t tag;
+  int res = protobuf_wire_read_varint(self, &tag);
+  if (res < 0)
+    return res;
+
+  field->number = (uint32_t) (tag >> 3);
+  field->type = (enum protobuf_wire_type) (tag & 0x07);
+  if (field->number == 0 || tag >> 3 > UINT32_MAX)
+    return -EINVAL;
+
+  switch (field->type) {
+    case PROTOBUF_WIRE_VARINT:
+      return protobuf_wire_read_varint(self, &field->value);
+    case PROTOBUF_WIRE_FIXED64:
+      return protobuf_wire_read_fixed64(self, &field->value);
+    case PROTOBUF_WIRE_FIXED32: {
+      uint32_t value;
+      if ((res = protobuf_wire_read_fixed32(self, &value)) < 0)
+        return res;
+      field->value = value;
+      return 0;
+    }
+    case PROTOBUF_WIRE_LEN: {
+      uint64_t len;
+      if ((res = protobuf_wire_read_varint(self, &len)) < 0)
+        return res;
+      if (len > (uint64_t) (self->end - self->current))
+        return -EINVAL;
+
+      field->data = self->current;
+      field->size = (size_t) len;
+      self->current += len;
+      return 0;
+    }
+  }
+
+  // Groups (wire type 3 and 4) are deprecated and never used by us
+  return -EINVAL;
+}
+
+static inline int64_t protobuf_wire_zigzag_decode64(uint64_t value) {
+  return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+// Writing side, for encoders which lay out messages by
+// themselves and let protobuf-c fill in the pieces
+
+static inline size_t protobuf_wire_varint_size(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+// `output` must have protobuf_wire_varint_size(value) bytes
+// Return number of bytes written
+static inline size_t protobuf_wire_write_varint(uint8_t* output, uint64_t value) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    output[size++] = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  output[size++] = (uint8_t) value;
+  return size;
+}
+
+static inline uint64_t protobuf_wire_tag(uint32_t number, enum protobuf_wire_type type) {
+  return (uint64_t) number << 3 | type;
+}
+
+// Tag and length prefix of LEN field carrying `size` bytes
+static inline size_t protobuf_wire_len_header_size(uint32_t number, size_t size) {
+  return protobuf_wire_varint_size(protobuf_wire_tag(number, PROTOBUF_WIRE_LEN)) + protobuf_wire_varint_size(size);
+}
+
+static inline size_t protobuf_wire_write_len_header(uint8_t* output, uint32_t number, size_t size) {
+  size_t written = protobuf_wire_write_varint(output, protobuf_wire_tag(number, PROTOBUF_WIRE_LEN));
+  return written + protobuf_wire_write_varint(output + written, size);
+}
+
+#endif
+
@@ -4,28 +4,32 @@
 #include <string.h>
 
 #include "prototype.h"
+#include "allocator.h"
 #include "constants.h"
 #include "vec.h"
 #include "vm_types.h"
 
 struct prototype* prototype_new(const char* sourceFile, const char* prototypeName, int line, int column) {
-  struct prototype* self = malloc(sizeof(*self));
+  struct prototype* self = allocator_malloc(sizeof(*self));
   if (!self)
     return NULL;
   
   vec_init(&self->prototypes);
   vec_init(&self->instructions);
+  vec_init(&self->instructionLines);
+  vec_init(&self->references);
   
   self->sourceFile = NULL;
   self->prototypeName = NULL;
+  self->isCompact = false;
   self->definedAtLine = line;
   self->definedAtColumn = column;
   
-  self->sourceFile = strdup(sourceFile);
+  self->sourceFile = allocator_strdup(sourceFile);
   if (!self->sourceFile)
     goto out_of_mem;
   
-  self->prototypeName = strdup(prototypeName);
+  self->prototypeName = allocator_strdup(prototypeName);
   if (!self->prototypeName)
     goto out_of_mem;
   return self;
@@ -39,15 +43,37 @@ void prototype_free(struct prototype* self) {
   if (!self)
     return;
   
-  int i = 0;
+  size_t i = 0;
   struct prototype* current = NULL;
   vec_foreach(&self->prototypes, current, i)
     prototype_free(current);
   
   vec_deinit(&self->prototypes);
   vec_deinit(&self->instructions);
-  free((char*) self->prototypeName);
-  free((char*) self->sourceFile);
-  free(self);
+  vec_deinit(&self->instructionLines);
+  
+  struct prototype_reference* reference = NULL;
+  vec_foreach_ptr(&self->references, reference, i)
+    allocator_free((char*) reference->symbolName);
+  vec_deinit(&self->references);
+  
+  allocator_free((char*) self->prototypeName);
+  allocator_free((char*) self->sourceFile);
+  allocator_free(self);
+}
+
+int prototype_add_reference(struct prototype* self, size_t instruction, const char* symbolName) {
+  struct prototype_reference reference = {
+    .instruction = instruction,
+    .symbolName = allocator_strdup(symbolName)
+  };
+  if (!reference.symbolName)
+    return -ENOMEM;
+  
+  if (vec_push(&self->references, reference) < 0) {
+    allocator_free((char*) reference.symbolName);
+    return -ENOMEM;
+  }
+  return 0;
 }
 
@@ -1,6 +1,7 @@
 #ifndef header_1662272978_47ee9894_beca_4e37_be7d_a1a8c4d5a3ac_prototype_h
 #define header_1662272978_47ee9894_beca_4e37_be7d_a1a8c4d5a3ac_prototype_h
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "vec.h"
@@ -8,6 +9,13 @@
 
 struct bytecode;
 
+// Placeholder load of prototype defined in another object
+struct prototype_reference {
+  // Index into instructions
+  size_t instruction;
+  const char* symbolName;
+};
+
 struct prototype {
   const char* sourceFile;
   const char* prototypeName;
@@ -16,10 +24,25 @@ struct prototype {
   
   vec_t(struct prototype*) prototypes;
   vec_t(vm_instruction) instructions;
+  
+  // Zero based line of each instruction (may be empty if unknown)
+  vec_t(int) instructionLines;
+  
+  // Instructions may be in short form and instruction
+  // pointers count 32-bit words (see opcodes.h)
+  bool isCompact;
+  
+  // Loads resolved by linker, only in objects
+  vec_t(struct prototype_reference) references;
 };
 
 struct prototype* prototype_new(const char* sourceFile, const char* prototypeName, int line, int column);
 void prototype_free(struct prototype* self);
 
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int prototype_add_reference(struct prototype* self, size_t instruction, const char* symbolName);
+
 #endif
 
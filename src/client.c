@@ -0,0 +1,188 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "allocator.h"
+#include "assembler_driver.h"
+#include "server_protocol.h"
+#include "util.h"
+
+int client_connect(const char* socketPath) {
+  struct sockaddr_un addr = {
+    .sun_family = AF_UNIX
+  };
+  
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    return -ENAMETOOLONG;
+  strcpy(addr.sun_path, socketPath);
+  
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -errno;
+  
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    int res = -errno;
+    close(fd);
+    return res;
+  }
+  return fd;
+}
+
+// Read `size` bytes into new allocator_malloc'ed buffer
+// NUL terminated for convenience
+static int readPayload(int fd, size_t size, char** result) {
+  char* buffer = allocator_malloc(size + 1);
+  if (!buffer)
+    return -ENOMEM;
+  
+  int res = server_protocol_read(fd, buffer, size);
+  if (res < 0) {
+    allocator_free(buffer);
+    return res;
+  }
+  
+  buffer[size] = '\0';
+  *result = buffer;
+  return 0;
+}
+
+int client_assemble(int fd, const char* inputName, const void* source, size_t sourceSize, const struct assembler_driver_options* options, const char** errorMessageRet, void** resultRet, size_t* resultSizeRet, void** debugInfoRet, size_t* debugInfoSizeRet) {
+  static const struct assembler_driver_options defaultOptions = ASSEMBLER_DRIVER_OPTIONS_DEFAULT;
+  char* bytecode = NULL;
+  char* debugInfo = NULL;
+  char* errorMessage = NULL;
+  int res = 0;
+  
+  if (!options)
+    options = &defaultOptions;
+  
+  size_t nameSize = strlen(inputName);
+  if (nameSize > SERVER_PROTOCOL_MAX_NAME_SIZE || sourceSize > SERVER_PROTOCOL_MAX_SOURCE_SIZE) {
+    res = -EINVAL;
+    goto failure;
+  }
+  
+  struct server_request_header request = {
+    .magic = SERVER_PROTOCOL_MAGIC,
+    .flags = server_protocol_encode_flags(options, debugInfoRet != NULL),
+    .nameSize = nameSize,
+    .sourceSize = sourceSize
+  };
+  
+  struct iovec iov[] = {
+    {&request, sizeof(request)},
+    {(char*) inputName, nameSize},
+    {(void*) source, sourceSize}
+  };
+  if ((res = server_protocol_writev(fd, iov, ARRAY_SIZE(iov))) < 0)
+    goto failure;
+  
+  struct server_response_header response;
+  if ((res = server_protocol_read(fd, &response, sizeof(response))) < 0)
+    goto failure;
+  if (response.magic != SERVER_PROTOCOL_MAGIC || response.result > 0) {
+    res = -EPROTO;
+    goto failure;
+  }
+  
+  if ((res = readPayload(fd, response.bytecodeSize, &bytecode)) < 0)
+    goto failure;
+  if ((res = readPayload(fd, response.debugInfoSize, &debugInfo)) < 0)
+    goto failure;
+  if (response.errorMessageSize > 0 && (res = readPayload(fd, response.errorMessageSize, &errorMessage)) < 0)
+    goto failure;
+  
+  res = response.result;
+  if (res < 0)
+    goto failure;
+  
+  *resultRet = bytecode;
+  *resultSizeRet = response.bytecodeSize;
+  if (debugInfoRet) {
+    *debugInfoRet = debugInfo;
+    *debugInfoSizeRet = response.debugInfoSize;
+  } else {
+    allocator_free(debugInfo);
+  }
+  
+  allocator_free(errorMessage);
+  if (errorMessageRet)
+    *errorMessageRet = NULL;
+  return 0;
+
+failure:
+  allocator_free(bytecode);
+  allocator_free(debugInfo);
+  if (errorMessageRet)
+    *errorMessageRet = errorMessage;
+  else
+    allocator_free(errorMessage);
+  return res;
+}
+
+int client_assemble_file(const char* socketPath, const char* inputPath, const char* outputPath, const char* debugInfoPath, const struct assembler_driver_options* options, const char** errorMessageRet, size_t* resultSizeRet, size_t* debugInfoSizeRet) {
+  int res = 0;
+  char* errorMessage = NULL;
+  struct util_mapped_file input = UTIL_MAPPED_FILE_INIT;
+  void* result = NULL;
+  size_t resultSize = 0;
+  void* debugInfo = NULL;
+  size_t debugInfoSize = 0;
+  
+  int fd = client_connect(socketPath);
+  if (fd < 0) {
+    util_asprintf(&errorMessage, "Cannot connect to assembler server at '%s' (Error: %d)", socketPath, fd);
+    res = -EIO;
+    goto connect_failure;
+  }
+  
+  // Server takes only this much, don't read more than that
+  if ((res = util_map_file(inputPath, SERVER_PROTOCOL_MAX_SOURCE_SIZE, &input)) == -EFBIG) {
+    util_asprintf(&errorMessage, "Input file '%s' is too large for assembler server", inputPath);
+    goto read_failure;
+  } else if (res < 0) {
+    util_asprintf(&errorMessage, "Cannot open input file '%s'", inputPath);
+    goto read_failure;
+  }
+  
+  res = client_assemble(fd, inputPath, input.data, input.size, options, (const char**) &errorMessage, &result, &resultSize,
+                        debugInfoPath ? &debugInfo : NULL, &debugInfoSize);
+  if (res < 0)
+    goto assemble_failure;
+  
+  if ((res = util_write_file(outputPath, result, resultSize)) < 0) {
+    util_asprintf(&errorMessage, "Cannot write output file '%s'", outputPath);
+    goto write_failure;
+  }
+  
+  if (debugInfoPath && (res = util_write_file(debugInfoPath, debugInfo, debugInfoSize)) < 0) {
+    util_asprintf(&errorMessage, "Cannot write debug info file '%s'", debugInfoPath);
+    goto write_failure;
+  }
+  
+  if (resultSizeRet)
+    *resultSizeRet = resultSize;
+  if (debugInfoSizeRet)
+    *debugInfoSizeRet = debugInfoSize;
+
+write_failure:
+  allocator_free(debugInfo);
+  allocator_free(result);
+assemble_failure:
+  util_unmap_file(&input);
+read_failure:
+  close(fd);
+connect_failure:
+  if (errorMessageRet)
+    *errorMessageRet = errorMessage;
+  else
+    allocator_free(errorMessage);
+  return res;
+}
+
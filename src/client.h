@@ -0,0 +1,33 @@
+#ifndef _headers_1667560118_Fluff_Assembler_client
+#define _headers_1667560118_Fluff_Assembler_client
+
+#include <stddef.h>
+
+struct assembler_driver_options;
+
+// Client side of assembler server (see server.h)
+
+// Return connected socket
+// Errors:
+// -ENAMETOOLONG: Socket path too long
+// Other errno from socket or connect
+int client_connect(const char* socketPath);
+
+// Same contract as assembler_driver_assemble but source is
+// in memory and assembled by server connected on `fd`
+// `debugInfo` and `debugInfoSize` can be NULL
+// `errorMessage` must be free'd on error
+// Return 0 on success
+// Errors:
+// -EPROTO: Malformed response
+// -ENOMEM: Not enough memory
+// -EPIPE: Server closed the connection
+// Other errors from server (-EFAULT, -ENOMEM, ...)
+int client_assemble(int fd, const char* inputName, const void* source, size_t sourceSize, const struct assembler_driver_options* options, const char** errorMessage, void** result, size_t* resultSize, void** debugInfo, size_t* debugInfoSize);
+
+// Same contract as assembler_driver_assemble_file but through
+// the server listening at `socketPath`
+int client_assemble_file(const char* socketPath, const char* inputPath, const char* outputPath, const char* debugInfoPath, const struct assembler_driver_options* options, const char** errorMessage, size_t* resultSize, size_t* debugInfoSize);
+
+#endif
+
@@ -6,6 +6,7 @@
 #include <errno.h>
 
 #include "code_emitter.h"
+#include "allocator.h"
 #include "common.h"
 #include "vm_types.h"
 #include "opcodes.h"
@@ -13,9 +14,11 @@
 #include "vec.h"
 
 struct code_emitter* code_emitter_new() {
-  struct code_emitter* self = malloc(sizeof(*self));
+  struct code_emitter* self = allocator_malloc(sizeof(*self));
   
   self->ip = 0;
+  self->compactEncoding = false;
+  self->lexer = NULL;
   self->finalized = false;
   self->errorMessage = NULL;
   self->canFreeErrorMessage = false;
@@ -32,31 +35,31 @@ void code_emitter_free(struct code_emitter* self) {
   code_emitter_finalize(self);
   
   if (self->canFreeErrorMessage)
-    free((char*) self->errorMessage);
+    allocator_free((char*) self->errorMessage);
 
   struct instruction* ins;
-  int i = 0;
+  size_t i = 0;
   vec_foreach_ptr(&self->partialInstructions, ins, i)
     if (ins->type == INSTRUCTION_DEFERRED)
       Block_release(ins->data.deferred);
 
   struct code_emitter_label* label = 0;
   vec_foreach(&self->labels, label, i)
-    free(label);
+    allocator_free(label);
   
   vec_deinit(&self->labels);
   vec_deinit(&self->partialInstructions);
   vec_deinit(&self->instructions);
-  free(self);
+  allocator_free(self);
 }
 
-struct code_emitter_label* code_emitter_label_new(struct code_emitter* self, struct token* token) {
-  struct code_emitter_label* label = malloc(sizeof(*self));
+struct code_emitter_label* code_emitter_label_new(struct code_emitter* self, size_t offset) {
+  struct code_emitter_label* label = allocator_malloc(sizeof(*self));
   if (!label)
     return NULL;
   
   label->defined = false;
-  label->definedAt = token;
+  label->definedAt = offset;
   label->location = 0;
   label->owner = self;
   label->usageCount = 0; 
@@ -80,10 +83,29 @@ static inline int emit(struct code_emitter* self, struct instruction ins) {
     return -ENOSPC;
   
   int ret = vec_push(&self->partialInstructions, ins) < 0 ? -ENOMEM : 0;
-  self->ip++;
+  
+  // Deferred instructions are always in normal form
+  if (self->compactEncoding && ins.type == INSTRUCTION_NORMAL)
+    self->ip += OP_WORD_COUNT(ins.data.instruction);
+  else if (self->compactEncoding)
+    self->ip += 2;
+  else
+    self->ip++;
   return ret;
 }
 
+static inline int emitNormal(struct code_emitter* self, vm_instruction instruction) {
+  return emit(self, (struct instruction) {
+    .type = INSTRUCTION_NORMAL,
+    .data.instruction = instruction
+  });
+}
+
+static inline bool fitsShort(struct code_emitter* self, uint8_t cond, uint16_t a, uint16_t b, uint16_t c) {
+  return self->compactEncoding && cond == OP_COND_AL &&
+         a <= OP_SHORT_MAX_U8 && b <= OP_SHORT_MAX_U8 && c <= OP_SHORT_MAX_U8;
+}
+
 int code_emitter_finalize(struct code_emitter* self) {
   if (!self->shuttingDown && self->finalized)
     return -EINVAL;
@@ -95,7 +117,7 @@ int code_emitter_finalize(struct code_emitter* self) {
   bool status = true;
   int res = 0;
   struct instruction* ins;
-  int i = 0;
+  size_t i = 0;
   vec_foreach_ptr(&self->partialInstructions, ins, i) {
     vm_instruction instructionFinalized;
     
@@ -158,10 +180,14 @@ int code_emitter_emit_jmp(struct code_emitter* self, uint8_t cond, struct code_e
       // Use of undefined labels
       if (!target->defined) {
         *status = false;
-        setErrorMessage(self, target->definedAt->filename, target->definedAt->startLine, target->definedAt->startColumn, "Use of undefined label!");
+        struct lexer_location location = LEXER_LOCATION_INIT;
+        lexer_locate(self->lexer, target->definedAt, &location);
+        setErrorMessage(self, self->lexer->inputName, location.line, location.column, "Use of undefined label!");
         return 0;
       }
       
+      // Both are in ip units so the delta is counted in
+      // 32-bit words when emitting compact encoding
       vm_instruction_pointer targetIP = target->location;
       int op = FLUFFYVM_OPCODE_JMP_BACKWARD;
       vm_instruction_pointer delta;
@@ -185,65 +211,67 @@ int code_emitter_emit_jmp(struct code_emitter* self, uint8_t cond, struct code_e
   return emit(self, ins);
 }
 
+int code_emitter_emit_u16x3(struct code_emitter* self, uint8_t op, uint8_t cond, uint16_t a, uint16_t b, uint16_t c) {
+  if (fitsShort(self, cond, a, b, c))
+    return emitNormal(self, OP_SHORT_OPCODE(op) |
+      OP_SHORT_A(a) |
+      OP_SHORT_B(b) |
+      OP_SHORT_C(c));
+  return emitNormal(self, OP_ARG_OPCODE(op) |
+    OP_ARG_COND(cond) |
+    OP_ARG_A_U16x3(a) |
+    OP_ARG_B_U16x3(b) |
+    OP_ARG_C_U16x3(c));
+}
+
+// IMPLDEP1 is placeholder patched into LOAD_PROTOTYPE
+// with 32-bit location later so it must stay long
+int code_emitter_emit_u16_u32(struct code_emitter* self, uint8_t op, uint8_t cond, uint16_t a, uint32_t b) {
+  if (op != FLUFFYVM_OPCODE_IMPLDEP1 && fitsShort(self, cond, a, 0, 0) && b <= OP_SHORT_MAX_U16)
+    return emitNormal(self, OP_SHORT_OPCODE(op) |
+      OP_SHORT_A(a) |
+      OP_SHORT_B_16(b));
+  return emitNormal(self, OP_ARG_OPCODE(op) |
+    OP_ARG_COND(cond) |
+    OP_ARG_A_U16_U32(a) |
+    OP_ARG_B_U16_U32(b));
+}
+
+int code_emitter_emit_u16_s32(struct code_emitter* self, uint8_t op, uint8_t cond, uint16_t a, int32_t b) {
+  if (fitsShort(self, cond, a, 0, 0) && b >= OP_SHORT_MIN_S16 && b <= OP_SHORT_MAX_S16)
+    return emitNormal(self, OP_SHORT_OPCODE(op) |
+      OP_SHORT_A(a) |
+      OP_SHORT_B_16(b));
+  return emitNormal(self, OP_ARG_OPCODE(op) |
+    OP_ARG_COND(cond) |
+    OP_ARG_A_U16_S32(a) |
+    OP_ARG_B_U16_S32(b));
+}
+
 // Other instructions generation UwU
 #define gen_u16x3(name, op) \
   int code_emitter_emit_ ## name(struct code_emitter* self, uint8_t cond, uint16_t a, uint16_t b, uint16_t c) { \
-    return emit(self, (struct instruction) { \
-      .type = INSTRUCTION_NORMAL, \
-      .data.instruction = OP_ARG_OPCODE(op) | \
-        OP_ARG_COND(cond) | \
-        OP_ARG_A_U16x3(a) | \
-        OP_ARG_B_U16x3(b) | \
-        OP_ARG_C_U16x3(c) \
-    }); \
+    return code_emitter_emit_u16x3(self, op, cond, a, b, c); \
   }
 #define gen_u16x2(name, op) \
   int code_emitter_emit_ ## name(struct code_emitter* self, uint8_t cond, uint16_t a, uint16_t b) { \
-    return emit(self, (struct instruction) { \
-      .type = INSTRUCTION_NORMAL, \
-      .data.instruction = OP_ARG_OPCODE(op) | \
-        OP_ARG_COND(cond) | \
-        OP_ARG_A_U16x3(a) | \
-        OP_ARG_B_U16x3(b) \
-    }); \
+    return code_emitter_emit_u16x3(self, op, cond, a, b, 0); \
   }
 #define gen_u16x1(name, op) \
   int code_emitter_emit_ ## name(struct code_emitter* self, uint8_t cond, uint16_t a) { \
-    return emit(self, (struct instruction) { \
-      .type = INSTRUCTION_NORMAL, \
-      .data.instruction = OP_ARG_OPCODE(op) | \
-        OP_ARG_COND(cond) | \
-        OP_ARG_A_U16x3(a) \
-    }); \
+    return code_emitter_emit_u16x3(self, op, cond, a, 0, 0); \
   }
 #define gen_u16_u32(name, op) \
   int code_emitter_emit_ ## name(struct code_emitter* self, uint8_t cond, uint16_t a, uint32_t b) { \
-    self->ip++; \
-    return emit(self, (struct instruction) { \
-      .type = INSTRUCTION_NORMAL, \
-      .data.instruction = OP_ARG_OPCODE(op) | \
-        OP_ARG_COND(cond) | \
-        OP_ARG_A_U16_U32(a) | \
-        OP_ARG_B_U16_U32(b) \
-    }); \
+    return code_emitter_emit_u16_u32(self, op, cond, a, b); \
   }
 #define gen_u16_s32(name, op) \
   int code_emitter_emit_ ## name(struct code_emitter* self, uint8_t cond, uint16_t a, int32_t b) { \
-    return emit(self, (struct instruction) { \
-      .type = INSTRUCTION_NORMAL, \
-      .data.instruction = OP_ARG_OPCODE(op) | \
-        OP_ARG_COND(cond) | \
-        OP_ARG_A_U16_S32(a) | \
-        OP_ARG_B_U16_S32(b) \
-    }); \
+    return code_emitter_emit_u16_s32(self, op, cond, a, b); \
   }
 #define gen_no_arg(name, op) \
   int code_emitter_emit_ ## name(struct code_emitter* self, uint8_t cond) { \
-    return emit(self, (struct instruction) { \
-      .type = INSTRUCTION_NORMAL, \
-      .data.instruction = OP_ARG_OPCODE(op) | \
-        OP_ARG_COND(cond) \
-    }); \
+    return code_emitter_emit_u16x3(self, op, cond, 0, 0, 0); \
   }
 
 #define X(name, op) gen_u16x2(name, op);
@@ -28,7 +28,8 @@ struct code_emitter_label {
   bool defined;
   vm_instruction_pointer location;
 
-  struct token* definedAt;
+  // Offset of token which first named the label
+  size_t definedAt;
   
   // Number of time label is used
   int usageCount;
@@ -41,8 +42,17 @@ struct code_emitter {
   vec_t(struct instruction) partialInstructions;
   vec_t(vm_instruction) instructions;
   
+  // Counted in instructions or in 32-bit words
+  // if compactEncoding is enabled
   vm_instruction_pointer ip;
   
+  // Emit 32-bit short form (see opcodes.h) for instructions
+  // which fits. Must be set before emitting anything
+  bool compactEncoding;
+  
+  // Where labels' tokens come from, for error messages
+  const struct lexer* lexer;
+  
   bool shuttingDown;
   bool canFreeErrorMessage;
   const char* errorMessage;
@@ -59,7 +69,7 @@ void code_emitter_free(struct code_emitter* self);
 // -EINVAL: Finalize a fully or partially finalized code emitter
 int code_emitter_finalize(struct code_emitter* self);
 
-struct code_emitter_label* code_emitter_label_new(struct code_emitter* self, struct token* token);
+struct code_emitter_label* code_emitter_label_new(struct code_emitter* self, size_t offset);
 
 /* Return 0 on success
  * Errors:
@@ -76,6 +86,12 @@ int code_emitter_label_define(struct code_emitter* self, struct code_emitter_lab
  */ 
 int code_emitter_emit_jmp(struct code_emitter* self, uint8_t cond, struct code_emitter_label* target);
 
+// Emit any opcode by its layout, unused fields are zero
+// Named emitters below are shorthands for these
+int code_emitter_emit_u16x3(struct code_emitter* self, uint8_t op, uint8_t cond, uint16_t a, uint16_t b, uint16_t c);
+int code_emitter_emit_u16_u32(struct code_emitter* self, uint8_t op, uint8_t cond, uint16_t a, uint32_t b);
+int code_emitter_emit_u16_s32(struct code_emitter* self, uint8_t op, uint8_t cond, uint16_t a, int32_t b);
+
 typedef int (*code_emitter_u16x3_emitter_func)(struct code_emitter* self, uint8_t cond, uint16_t a, uint16_t b, uint16_t c);
 typedef int (*code_emitter_u16x2_emitter_func)(struct code_emitter* self, uint8_t cond, uint16_t a, uint16_t b);
 typedef int (*code_emitter_u16x1_emitter_func)(struct code_emitter* self, uint8_t cond, uint16_t a);
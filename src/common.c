@@ -2,11 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "buffer.h"
+#include "allocator.h"
 #include "util.h"
 #include "common.h"
 #include "lexer.h"
 
+// Longer lines aren't quoted in messages
+#define MAX_QUOTED_LINE_LENGTH (1024 * 1024)
+
 char* common_format_error_message_valist(const char* filename, const char* source, int line, int column, const char* fmt, va_list args) {
   char* result = NULL;
   char* errmsg = NULL;
@@ -15,7 +18,7 @@ char* common_format_error_message_valist(const char* filename, const char* sourc
     return NULL;
   
   util_asprintf(&result, "%s: %s:%d:%d: %s", source, filename, line < 0 ? -1 : line + 1, column < 0 ? -1 : column + 1, errmsg);
-  free(errmsg);
+  allocator_free(errmsg);
   return result;
 }
 
@@ -27,23 +30,30 @@ char* common_format_error_message(const char* filename, const char* source, int
   return tmp;
 }
 
-char* common_format_error_message_about_token_valist(const char* filename, const char* source, int line, int column, struct token* token, const char* fmt, va_list args) {
-  // Both `line` and `column` must have same signedness 
-  // (e.g. there `line` cannot be negative if `column` positive)
-  if ((line < 0 || column < 0) && (line >= 0 || column >= 0))
-    return NULL;
-  
+char* common_format_error_message_about_token_valist(const char* filename, const char* source, const struct lexer* lexer, const struct token* token, const char* fmt, va_list args) {
   char* errmsg;
   util_vasprintf(&errmsg, fmt, args);
   if (!errmsg)
     return NULL;
   
+  struct lexer_location location = LEXER_LOCATION_INIT;
+  lexer_locate(lexer, token->offset, &location);
+  
+  // Only position is given for very long lines
+  if (location.lineLength > MAX_QUOTED_LINE_LENGTH) {
+    char* res = common_format_error_message(filename, source, location.line, location.column, "%s", errmsg);
+    allocator_free(errmsg);
+    return res;
+  }
+  
   char* hand = NULL;
-  size_t len = buffer_length(token->rawToken);
-  if ((line < 0 || column < 0) && len > 0) {
-    hand = malloc(len);
-    if (!hand)
+  size_t len = token->length;
+  if (len > 0) {
+    hand = allocator_malloc(len);
+    if (!hand) {
+      allocator_free(errmsg);
       return NULL;
+    }
     
     memset(hand, '~', len - 1);
     hand[len - 1] = '\0';
@@ -51,24 +61,25 @@ char* common_format_error_message_about_token_valist(const char* filename, const
   
   char* res = common_format_error_message(filename, 
                               source, 
-                              line < 0 ? token->startLine : line, 
-                              column < 0 ? token->startColumn : column, 
-                              "%s\n%s\n%*s^%s",
+                              location.line, 
+                              location.column, 
+                              "%s\n%.*s\n%*s^%s",
                               errmsg,
-                              buffer_string(token->fullLine),
-                              column < 0 ? token->startColumn : column,
+                              (int) location.lineLength,
+                              lexer->source ? lexer->source + location.lineStart : "",
+                              location.column,
                               "",
                               hand ? hand : "");
   
-  free(hand);
-  free(errmsg);
+  allocator_free(hand);
+  allocator_free(errmsg);
   return res;
 }
 
-char* common_format_error_message_about_token(const char* filename, const char* source, int line, int column, struct token* token, const char* fmt, ...) {
+char* common_format_error_message_about_token(const char* filename, const char* source, const struct lexer* lexer, const struct token* token, const char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  char* res = common_format_error_message_about_token_valist(filename, source, line, column, token, fmt, args);
+  char* res = common_format_error_message_about_token_valist(filename, source, lexer, token, fmt, args);
   va_end(args);
   return res;
 }
@@ -5,6 +5,7 @@
 
 #include "compiler_config.h"
 
+struct lexer;
 struct token;
 
 // All line and column number is zero based
@@ -13,9 +14,12 @@ char* common_format_error_message_valist(const char* filename, const char* sourc
 ATTRIBUTE_PRINTF(5, 6)
 char* common_format_error_message(const char* filename, const char* source, int line, int column, const char* fmt, ...);
 
-char* common_format_error_message_about_token_valist(const char* filename, const char* source, int line, int column, struct token* token, const char* fmt, va_list args);
-ATTRIBUTE_PRINTF(6, 7)
-char* common_format_error_message_about_token(const char* filename, const char* source, int line, int column, struct token* token, const char* fmt, ...);
+// Position is taken from `token` which must be one of
+// `lexer`'s, its line is quoted from lexer's input unless
+// it is very long
+char* common_format_error_message_about_token_valist(const char* filename, const char* source, const struct lexer* lexer, const struct token* token, const char* fmt, va_list args);
+ATTRIBUTE_PRINTF(5, 6)
+char* common_format_error_message_about_token(const char* filename, const char* source, const struct lexer* lexer, const struct token* token, const char* fmt, ...);
 
 #endif
 
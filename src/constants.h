@@ -2,9 +2,21 @@
 #define header_1664409698_ae224721_56a3_4b6d_9f02_71c76eb511ad_constants_h
 
 #define VM_MAX_REGISTERS 16
-#define VM_BYTECODE_VERSION 1
+#define VM_BYTECODE_VERSION 2
+#define VM_BYTECODE_VERSION_OLDEST 1
 #define ASSEMBLER_START_SYMBOL "@_start"
 #define BYTECODE_MAGIC ((uint64_t) 0x466F5855575500LL)
+#define BYTECODE_DEBUG_INFO_EXTENSION ".fluff_dbg"
+
+// Optional bytecode features (for requiredFeatures field)
+#define BYTECODE_FEATURE_COMPRESSED_INSTRUCTIONS (1 << 0)
+#define BYTECODE_FEATURE_COMPACT_INSTRUCTIONS (1 << 1)
+
+// Object file with prototype references left for the linker,
+// never supported by readers which execute bytecode
+#define BYTECODE_FEATURE_UNLINKED (1 << 2)
+#define BYTECODE_FEATURES_SUPPORTED (BYTECODE_FEATURE_COMPRESSED_INSTRUCTIONS | \
+                                     BYTECODE_FEATURE_COMPACT_INSTRUCTIONS)
 
 #endif
 
@@ -16,7 +16,6 @@
 struct entry {
   const char* name;
   statement_processor_func processor;
-  int condType;
 };
 
 static void setErr(struct statement_processor_context* ctx, bool canFreeErr, const char* err) {
@@ -33,52 +32,28 @@ static int commonReadNext(struct statement_processor_context* ctx, struct token*
   return 0;
 }
 
-static int typeCheckedReadNext(struct statement_processor_context* ctx, struct token** token, enum token_type type) {
+static const char* expectingMessage(enum token_type type) {
   static const char* lookup[] = {
 #   define X(t, str, ...) [t] = "statement_processor: Expecting '" str "'",
     TOKEN_TYPE
 #   undef X
   };
   
+  if (type < 0 || type >= ARRAY_SIZE(lookup)) 
+    return __FILE__ ": Out of bound lookup[i] access please report";
+  return lookup[type];
+}
+
+static int typeCheckedReadNext(struct statement_processor_context* ctx, struct token** token, enum token_type type) {
   int res = commonReadNext(ctx, token);
   if (res < 0)
     return res;
   
   if ((*token)->type != type) {
-    if (type < 0 || type > ARRAY_SIZE(lookup)) 
-      setErr(ctx, false, __FILE__ ": Out of bound lookup[i] access please report");
-    else
-      setErr(ctx, false, lookup[type]);
-    return -EFAULT;
-  }
-  
-  return 0;
-}
-
-// Return 0 on sucess otherwise negative errno
-// Errors:
-// -EFAULT: Error occured
-static int getInteger(struct statement_processor_context* ctx, int64_t* integer) {
-  struct token* token;
-  if (typeCheckedReadNext(ctx, &token, TOKEN_IMMEDIATE) < 0)
-    return -EFAULT;
-  
-  *integer = token->data.immediate;
-  return 0;
-}
-
-static int getIntegerU32(struct statement_processor_context* ctx, uint32_t* result) {
-  int64_t integer = 0;
-  int res = 0;
-  if ((res = getInteger(ctx, &integer)) < 0)
-    return res;
-  
-  if (res < 0 || res > UINT32_MAX) {
-    setErr(ctx, false, "Expected 32-bit unsigned");
+    setErr(ctx, false, expectingMessage(type));
     return -EFAULT;
   }
   
-  *result = (uint32_t) integer;
   return 0;
 }
 
@@ -104,7 +79,7 @@ static int getLabel(struct statement_processor_context* ctx, struct code_emitter
   
   int res = 0;
   if (label)
-    res = parser_stage2_get_label(ctx->stage2Context, buffer_string(token->data.labelName), label);
+    res = parser_stage2_get_label(ctx->stage2Context, token->data.labelName, label);
   return res;
 }
 
@@ -158,10 +133,10 @@ static int ins_ldr(struct statement_processor_context* ctx) {
         res = slowIntegerLdr(ctx, reg, token->data.immediate);
       break;
     case TOKEN_STRING:
-      res = stringLdr(ctx, reg, buffer_string(token->data.string));
+      res = stringLdr(ctx, reg, token->data.string);
       break;
     case TOKEN_LABEL_REF:
-      res = prototypeLdr(ctx, reg, buffer_string(token->data.string));
+      res = prototypeLdr(ctx, reg, token->data.string);
       break;
     default:
       setErr(ctx, false, "ins_ldr: Unknown second operand");
@@ -172,69 +147,6 @@ static int ins_ldr(struct statement_processor_context* ctx) {
   return res;
 }
 
-#define macro_two_reg_ins(name, emitter_func) \
-  static int name(struct statement_processor_context* ctx) { \
-    int a = getRegister(ctx); \
-    if (a < 0) \
-      return a; \
-    int b = getRegister(ctx); \
-    if (b < 0) \
-      return b; \
-     \
-    return emitter_func(ctx->stage2Context->emitter, ctx->funcEntry->udata1, a, b); \
-  }
-#define macro_three_reg_ins(name, emitter_func) \
-  static int name(struct statement_processor_context* ctx) { \
-    int a = getRegister(ctx); \
-    if (a < 0) \
-      return a; \
-    int b = getRegister(ctx); \
-    if (b < 0) \
-      return b; \
-    int c = getRegister(ctx); \
-    if (c < 0) \
-      return c; \
-     \
-    return emitter_func(ctx->stage2Context->emitter, ctx->funcEntry->udata1, a, b, c); \
-  }
-#define macro_one_reg_u16_u32_ins(name, emitter_func) \
-  static int name(struct statement_processor_context* ctx) { \
-    int a = getRegister(ctx); \
-    if (a < 0) \
-      return a; \
-    uint32_t b = 0; \
-    int bRes = getIntegerU32(ctx, &b); \
-    if (bRes < 0) \
-      return bRes; \
-     \
-    return emitter_func(ctx->stage2Context->emitter, ctx->funcEntry->udata1, a, b); \
-  }
-#define macro_no_arg_ins(name, emitter_func) \
-  static int name(struct statement_processor_context* ctx) { \
-    return emitter_func(ctx->stage2Context->emitter, ctx->funcEntry->udata1); \
-  }
-
-macro_no_arg_ins(ins_nop, code_emitter_emit_nop);
-macro_no_arg_ins(ins_ret, code_emitter_emit_ret);
-
-macro_two_reg_ins(ins_cmp, code_emitter_emit_cmp);
-macro_two_reg_ins(ins_mov, code_emitter_emit_mov);
-macro_one_reg_u16_u32_ins(ins_new_array, code_emitter_emit_new_array);
-
-macro_three_reg_ins(ins_add, code_emitter_emit_add);
-macro_three_reg_ins(ins_sub, code_emitter_emit_sub);
-macro_three_reg_ins(ins_mul, code_emitter_emit_mul);
-macro_three_reg_ins(ins_div, code_emitter_emit_div);
-macro_three_reg_ins(ins_mod, code_emitter_emit_mod);
-macro_three_reg_ins(ins_pow, code_emitter_emit_pow);
-macro_three_reg_ins(ins_set_array, code_emitter_emit_set_array);
-macro_three_reg_ins(ins_get_array, code_emitter_emit_get_array);
-
-#undef macro_no_arg_ins
-#undef macro_two_reg_u16_u32_ins
-#undef macro_three_reg_ins
-#undef macro_two_reg_ins
-
 static int ins_b(struct statement_processor_context* ctx) {
   struct code_emitter_label* label = NULL;
   int res = getLabel(ctx, &label);
@@ -244,78 +156,251 @@ static int ins_b(struct statement_processor_context* ctx) {
   return code_emitter_emit_jmp(ctx->stage2Context->emitter, ctx->funcEntry->udata1, label);
 }
 
-static struct entry instructions[] = {
-# define instruction(name, func) \
-  {name, func, OP_COND_AL}, \
-  {name ".al", func, OP_COND_AL}, \
-  {name ".eq", func, OP_COND_EQ}, \
-  {name ".lt", func, OP_COND_LT}, \
-  {name ".ne", func, OP_COND_NE}, \
-  {name ".gt", func, OP_COND_GT}, \
-  {name ".ge", func, OP_COND_GE}, \
-  {name ".le", func, OP_COND_LE}, \
-  
+static int ins_generic(struct statement_processor_context* ctx);
+
+static const struct entry instructions[] = {
   // Pseudo instructions
   // It can be ldint or ldconst based on argument
-  instruction("ldr", ins_ldr)
-  
-  // No arg instructions
-  instruction("nop", ins_nop)
-  instruction("ret", ins_ret)
+  {"ldr", ins_ldr},
   
   // Single label instructions
-  instruction("b", ins_b)
+  {"b", ins_b}
+};
+
+static const struct {
+  const char* suffix;
+  int cond;
+} conditions[] = {
+  {"", OP_COND_AL},
+  {".al", OP_COND_AL},
+  {".eq", OP_COND_EQ},
+  {".lt", OP_COND_LT},
+  {".ne", OP_COND_NE},
+  {".gt", OP_COND_GT},
+  {".ge", OP_COND_GE},
+  {".le", OP_COND_LE}
+};
+
+enum operand_kind {
+  OPERAND_REGISTER,
+  OPERAND_U32,
+  OPERAND_S32
+};
+
+#define MAX_OPERANDS 3
+
+struct operand_signature {
+  int count;
+  enum operand_kind kinds[MAX_OPERANDS];
+};
+
+// Operands follow from opcode's layout and number of 16-bit
+// fields it uses, a 32-bit field being two of them
+#define SIGNATURE_OP_LAYOUT_u16x3(fieldsUsed) \
+  {fieldsUsed, {OPERAND_REGISTER, OPERAND_REGISTER, OPERAND_REGISTER}}
+#define SIGNATURE_OP_LAYOUT_u16_u32(fieldsUsed) \
+  {(fieldsUsed) > 1 ? 2 : (fieldsUsed), {OPERAND_REGISTER, OPERAND_U32}}
+#define SIGNATURE_OP_LAYOUT_u16_s32(fieldsUsed) \
+  {(fieldsUsed) > 1 ? 2 : (fieldsUsed), {OPERAND_REGISTER, OPERAND_S32}}
+// Only jumps use it and they need a label (see ins_b)
+#define SIGNATURE_OP_LAYOUT_u32(fieldsUsed) \
+  {0}
+
+struct generic_instruction {
+  const char* name;
+  enum fluffyvm_opcode op;
+  enum fluffyvm_opcode_layout layout;
+  struct operand_signature signature;
+};
+
+// Every opcode assembled under its own name by ins_generic
+static const struct generic_instruction genericInstructions[] = {
+# define X(name, op, str, fieldsUsed, layout) \
+  {str, FLUFFYVM_ ## name, layout, SIGNATURE_ ## layout(fieldsUsed)},
+  FLUFFYVM_OPCODES
+# undef X
+};
+
+#undef SIGNATURE_OP_LAYOUT_u32
+#undef SIGNATURE_OP_LAYOUT_u16_s32
+#undef SIGNATURE_OP_LAYOUT_u16_u32
+#undef SIGNATURE_OP_LAYOUT_u16x3
+
+// Opcodes only reachable through pseudo instructions (ldr and b)
+// or reserved for the implementation
+static bool isGeneric(enum fluffyvm_opcode op) {
+  switch (op) {
+    case FLUFFYVM_OPCODE_JMP_FORWARD:
+    case FLUFFYVM_OPCODE_JMP_BACKWARD:
+    case FLUFFYVM_OPCODE_LOAD_CONSTANT:
+    case FLUFFYVM_OPCODE_LOAD_INTEGER:
+    case FLUFFYVM_OPCODE_LOAD_PROTOTYPE:
+    case FLUFFYVM_OPCODE_IMPLDEP1:
+    case FLUFFYVM_OPCODE_IMPLDEP2:
+    case FLUFFYVM_OPCODE_IMPLDEP3:
+    case FLUFFYVM_OPCODE_IMPLDEP4:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// Validate and extract all operands left in current statement
+// in one pass over its tokens
+// Return 0 on sucess otherwise negative errno
+// Errors:
+// -EFAULT: Error occured
+static int decodeOperands(struct statement_processor_context* ctx, const struct operand_signature* signature, int64_t* operands) {
+  struct token_iterator* iterator = ctx->stage2Context->iterator;
+  struct token** tokens = iterator->tokens + iterator->pointer;
+  size_t count = iterator->numTokens - iterator->pointer;
+  
+  if (count < (size_t) signature->count) {
+    if (count > 0)
+      iterator->current = tokens[count - 1];
+    setErr(ctx, false, "statement_processor: No token to read");
+    goto bad_operand;
+  }
   
-  // Two regs instructions
-  instruction("cmp", ins_cmp)
-  instruction("mov", ins_mov)
+  for (int i = 0; i < signature->count; i++) {
+    struct token* token = tokens[i];
+    enum token_type expected = signature->kinds[i] == OPERAND_REGISTER ? TOKEN_REGISTER : TOKEN_IMMEDIATE;
+    if (token->type != expected) {
+      iterator->current = token;
+      setErr(ctx, false, expectingMessage(expected));
+      goto bad_operand;
+    }
+    
+    switch (signature->kinds[i]) {
+      case OPERAND_REGISTER:
+        operands[i] = token->data.reg;
+        break;
+      case OPERAND_U32:
+        if (token->data.immediate < 0 || token->data.immediate > UINT32_MAX) {
+          iterator->current = token;
+          setErr(ctx, false, "Expected 32-bit unsigned");
+          goto bad_operand;
+        }
+        operands[i] = token->data.immediate;
+        break;
+      case OPERAND_S32:
+        if (token->data.immediate < INT32_MIN || token->data.immediate > INT32_MAX) {
+          iterator->current = token;
+          setErr(ctx, false, "Expected 32-bit signed");
+          goto bad_operand;
+        }
+        operands[i] = token->data.immediate;
+        break;
+    }
+  }
   
-  // Three regs instructions
-  instruction("add", ins_add)
-  instruction("sub", ins_sub)
-  instruction("mul", ins_mul)
-  instruction("div", ins_div)
-  instruction("mod", ins_mod)
-  instruction("pow", ins_pow)
-  instruction("get_array", ins_get_array)
-  instruction("set_array", ins_set_array)
+  if (count > (size_t) signature->count) {
+    iterator->current = tokens[signature->count];
+    setErr(ctx, false, "statement_processor: Too many operands");
+    goto bad_operand;
+  }
   
-  // One reg and an 32-bit unsigned arg
-  instruction("new_array", ins_new_array)
-# undef instruction
-};
+  if (count > 0)
+    iterator->current = tokens[count - 1];
+  iterator->pointer = iterator->numTokens;
+  return 0;
+
+bad_operand:
+  iterator->pointer = iterator->numTokens;
+  return -EFAULT;
+}
+
+static int ins_generic(struct statement_processor_context* ctx) {
+  const struct generic_instruction* instruction = &genericInstructions[ctx->funcEntry->udata2];
+  int64_t operands[MAX_OPERANDS] = {};
+  int res = decodeOperands(ctx, &instruction->signature, operands);
+  if (res < 0)
+    return res;
+  
+  struct code_emitter* emitter = ctx->stage2Context->emitter;
+  uint8_t cond = (uint8_t) ctx->funcEntry->udata1;
+  switch (instruction->layout) {
+    case OP_LAYOUT_u16x3:
+      return code_emitter_emit_u16x3(emitter, instruction->op, cond, operands[0], operands[1], operands[2]);
+    case OP_LAYOUT_u16_u32:
+      return code_emitter_emit_u16_u32(emitter, instruction->op, cond, operands[0], (uint32_t) operands[1]);
+    case OP_LAYOUT_u16_s32:
+      return code_emitter_emit_u16_s32(emitter, instruction->op, cond, operands[0], (int32_t) operands[1]);
+    case OP_LAYOUT_u32:
+      break;
+  }
+  
+  setErr(ctx, false, __FILE__ ": Opcode layout not supported by generic processor please report");
+  return -EFAULT;
+}
+
+#define PSEUDO_NAME_COUNT (ARRAY_SIZE(instructions) * ARRAY_SIZE(conditions))
+#define NAME_COUNT (PSEUDO_NAME_COUNT + ARRAY_SIZE(genericInstructions) * ARRAY_SIZE(conditions))
+
+// Longest opcode name with condition suffix
+#define MAX_NAME_SIZE 64
+
+// Every instruction name with every condition suffix, in
+// order pseudo instructions first then generic ones
+// Return false if there's no instruction at `index`
+static bool getInstruction(size_t index, struct parser_stage2* stage2, char* name, struct statement_processor* processor) {
+  const char* baseName;
+  size_t condition = index % ARRAY_SIZE(conditions);
+  *processor = (struct statement_processor) {
+    .udata = stage2,
+    
+    // Store what cond type current instruction is
+    .udata1 = conditions[condition].cond
+  };
+  
+  if (index < PSEUDO_NAME_COUNT) {
+    const struct entry* entry = &instructions[index / ARRAY_SIZE(conditions)];
+    baseName = entry->name;
+    processor->processor = entry->processor;
+  } else {
+    size_t generic = (index - PSEUDO_NAME_COUNT) / ARRAY_SIZE(conditions);
+    if (!isGeneric(genericInstructions[generic].op))
+      return false;
+    
+    baseName = genericInstructions[generic].name;
+    processor->processor = ins_generic;
+    processor->udata2 = (int) generic;
+  }
+  
+  snprintf(name, MAX_NAME_SIZE, "%s%s", baseName, conditions[condition].suffix);
+  return true;
+}
 
 int default_processor_register(struct statement_compiler* compiler, struct parser_stage2* stage2) {
   int res = 0;
-  bool status[ARRAY_SIZE(instructions)] = {};
+  size_t registered = 0;
+  char name[MAX_NAME_SIZE];
+  struct statement_processor processor;
   
-  for (int i = 0; i < ARRAY_SIZE(instructions); i++) {
-    struct statement_processor processor = {
-      .processor = instructions[i].processor,
-      .udata = stage2,
-      
-      // Store what cond type current instruction is
-      .udata1 = instructions[i].condType
-    };
+  for (; registered < NAME_COUNT; registered++) {
+    if (!getInstruction(registered, stage2, name, &processor))
+      continue;
     
-    if ((res = statement_compiler_register(compiler, instructions[i].name, &processor)) < 0)
+    if ((res = statement_compiler_register(compiler, name, &processor)) < 0)
       goto register_failure;
-    status[i] = true;
   }
   
 register_failure:
   assert(res != -EEXIST); /* This shouldnt fail on properly tested code */
   
   if (res < 0)
-    for (int i = 0; i < ARRAY_SIZE(instructions); i++)
-      if (status[i])
+    for (size_t i = 0; i < registered; i++)
+      if (getInstruction(i, stage2, name, &processor))
         // TODO: Do something if this fails for whatever reason
-        statement_compiler_unregister(compiler, instructions[i].name);
+        statement_compiler_unregister(compiler, name);
   
   return res;
 }
 
 void default_processor_unregister(struct statement_compiler* compiler, struct parser_stage2* stage2) {
-  for (int i = 0; i < ARRAY_SIZE(instructions); i++)
-    statement_compiler_unregister(compiler, instructions[i].name);
+  char name[MAX_NAME_SIZE];
+  struct statement_processor processor;
+  for (size_t i = 0; i < NAME_COUNT; i++)
+    if (getInstruction(i, stage2, name, &processor))
+      statement_compiler_unregister(compiler, name);
 }
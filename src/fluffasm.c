@@ -0,0 +1,123 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "fluffasm.h"
+#include "allocator.h"
+#include "assembler_context.h"
+#include "assembler_driver.h"
+#include "byte_buffer.h"
+#include "constants.h"
+
+struct fluffasm {
+  struct assembler_context* context;
+  struct assembler_driver_options options;
+  bool generateDebugInfo;
+  
+  // Only filled on success, emptied at start of each assemble
+  struct byte_buffer output;
+  struct byte_buffer debugInfo;
+  
+  // Result of last call, `errorMessage` is from the
+  // assembler and NULL if it had none
+  int lastError;
+  char* errorMessage;
+};
+
+int fluffasm_get_api_version(void) {
+  return FLUFFASM_API_VERSION;
+}
+
+struct fluffasm* fluffasm_new(void) {
+  struct fluffasm* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
+  
+  *self = (struct fluffasm) {
+    .options = ASSEMBLER_DRIVER_OPTIONS_DEFAULT,
+    .output = BYTE_BUFFER_INIT,
+    .debugInfo = BYTE_BUFFER_INIT
+  };
+  
+  self->context = assembler_context_new();
+  if (!self->context)
+    goto failure;
+  return self;
+
+failure:
+  fluffasm_free(self);
+  return NULL;
+}
+
+void fluffasm_free(struct fluffasm* self) {
+  if (!self)
+    return;
+  
+  assembler_context_free(self->context);
+  byte_buffer_deinit(&self->output);
+  byte_buffer_deinit(&self->debugInfo);
+  allocator_free(self->errorMessage);
+  allocator_free(self);
+}
+
+static void setResult(struct fluffasm* self, int res, char* errorMessage) {
+  allocator_free(self->errorMessage);
+  self->lastError = res;
+  self->errorMessage = errorMessage;
+}
+
+int fluffasm_set_version(struct fluffasm* self, int version) {
+  if (version < VM_BYTECODE_VERSION_OLDEST || version > VM_BYTECODE_VERSION) {
+    setResult(self, -EINVAL, NULL);
+    return -EINVAL;
+  }
+  
+  self->options.serializer.version = version;
+  setResult(self, 0, NULL);
+  return 0;
+}
+
+void fluffasm_set_compact_instructions(struct fluffasm* self, bool enable) {
+  self->options.compactInstructions = enable;
+}
+
+void fluffasm_set_compress_instructions(struct fluffasm* self, bool enable) {
+  self->options.serializer.compressInstructions = enable;
+}
+
+void fluffasm_set_strip_debug_info(struct fluffasm* self, bool enable) {
+  self->options.serializer.stripDebugInfo = enable;
+}
+
+void fluffasm_set_generate_debug_info(struct fluffasm* self, bool enable) {
+  self->generateDebugInfo = enable;
+}
+
+int fluffasm_assemble(struct fluffasm* self, const char* inputName, const char* source, size_t sourceSize) {
+  // Buffers keep their capacity for next script
+  self->output.size = 0;
+  self->debugInfo.size = 0;
+  
+  const char* errorMessage = NULL;
+  int res = assembler_context_assemble_buffer(self->context, inputName ? inputName : "<memory>", source, sourceSize, &self->options,
+                                              &errorMessage, &self->output, self->generateDebugInfo ? &self->debugInfo : NULL);
+  setResult(self, res < 0 ? res : 0, res < 0 ? (char*) errorMessage : NULL);
+  return self->lastError;
+}
+
+const void* fluffasm_get_output(const struct fluffasm* self, size_t* size) {
+  *size = self->output.size;
+  return self->output.size > 0 ? self->output.data : NULL;
+}
+
+const void* fluffasm_get_debug_info(const struct fluffasm* self, size_t* size) {
+  *size = self->debugInfo.size;
+  return self->debugInfo.size > 0 ? self->debugInfo.data : NULL;
+}
+
+const char* fluffasm_get_error(const struct fluffasm* self) {
+  if (self->lastError >= 0)
+    return NULL;
+  return self->errorMessage ? self->errorMessage : strerror(-self->lastError);
+}
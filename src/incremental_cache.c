@@ -0,0 +1,697 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "incremental_cache.h"
+#include "allocator.h"
+#include "arena.h"
+#include "assembler_driver.h"
+#include "bytecode/bytecode.h"
+#include "bytecode/prototype.h"
+#include "bytecode/protobuf_loader.h"
+#include "bytecode/protobuf_serializer.h"
+#include "byte_buffer.h"
+#include "config.h"
+#include "constants.h"
+#include "opcodes.h"
+#include "parser_stage1.h"
+#include "util.h"
+#include "vm_types.h"
+
+// "FINC", sidecar header
+#define INCREMENTAL_CACHE_MAGIC 0x46494E43
+
+// Bump when sidecar layout or what is cached changes
+#define INCREMENTAL_CACHE_FORMAT_TAG "fluff-assembler-incremental-1"
+
+// Options which change compiled prototypes
+#define OPTION_COMPACT_INSTRUCTIONS (1 << 0)
+#define OPTION_OBJECT (1 << 1)
+
+#define START_DIRECTIVE ".start_prototype"
+
+// End of chain in nextSameName
+#define NO_RANGE SIZE_MAX
+
+static const char formatVersion[] = INCREMENTAL_CACHE_FORMAT_TAG " "
+                                    stringify(CONFIG_VERSION_MAJOR) "."
+                                    stringify(CONFIG_VERSION_MINOR) "."
+                                    stringify(CONFIG_VERSION_PATCH)
+                                    CONFIG_VERSION_LOCAL_VERSION;
+
+// Followed by ranges, source and bytecode
+struct incremental_cache_header {
+  uint32_t magic;
+  uint32_t optionFlags;
+  // Of formatVersion, compiled code changes between versions
+  uint64_t versionHash;
+  uint64_t rangeCount;
+  uint64_t sourceSize;
+  uint64_t bytecodeSize;
+};
+
+struct incremental_cache* incremental_cache_new() {
+  struct incremental_cache* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
+  
+  *self = (struct incremental_cache) {
+    .data = BYTE_BUFFER_INIT,
+    .nameKey = BYTE_BUFFER_INIT
+  };
+  hashmap_init(&self->names, swiss_hashmap_hash_string, strcmp);
+  vec_init(&self->reuses);
+  vec_init(&self->skips);
+  vec_init(&self->newRanges);
+  
+  self->arena = arena_new(0);
+  if (!self->arena)
+    goto failure;
+  return self;
+
+failure:
+  incremental_cache_free(self);
+  return NULL;
+}
+
+void incremental_cache_free(struct incremental_cache* self) {
+  if (!self)
+    return;
+  
+  incremental_cache_reset(self);
+  hashmap_cleanup(&self->names);
+  arena_free(self->arena);
+  byte_buffer_deinit(&self->data);
+  byte_buffer_deinit(&self->nameKey);
+  vec_deinit(&self->reuses);
+  vec_deinit(&self->skips);
+  vec_deinit(&self->newRanges);
+  allocator_free(self);
+}
+
+char* incremental_cache_get_path(const char* outputPath) {
+  const char* basename = strrchr(outputPath, '/');
+  basename = basename ? basename + 1 : outputPath;
+  
+  const char* extension = strrchr(basename, '.');
+  int length = extension ? (int) (extension - outputPath) : (int) strlen(outputPath);
+  
+  char* path = NULL;
+  util_asprintf(&path, "%.*s%s", length, outputPath, INCREMENTAL_CACHE_EXTENSION);
+  return path;
+}
+
+void incremental_cache_reset(struct incremental_cache* self) {
+  bytecode_loader_free(self->loader);
+  allocator_free(self->prototypes);
+  allocator_free(self->nextSameName);
+  self->loader = NULL;
+  self->bytecode = NULL;
+  self->prototypes = NULL;
+  self->nextSameName = NULL;
+  
+  // Never used map has no table yet
+  if (hashmap_size(&self->names) > 0)
+    hashmap_clear(&self->names);
+  if (self->arena)
+    arena_reset(self->arena);
+  
+  self->data.size = 0;
+  self->isIndexed = false;
+  self->source = NULL;
+  self->sourceSize = 0;
+  self->ranges = NULL;
+  self->rangeCount = 0;
+  self->optionFlags = 0;
+  
+  // They point at old ranges
+  vec_clear(&self->reuses);
+  vec_clear(&self->skips);
+  self->nextReuse = 0;
+}
+
+static uint32_t getOptionFlags(const struct assembler_driver_options* options) {
+  static const struct assembler_driver_options defaultOptions = ASSEMBLER_DRIVER_OPTIONS_DEFAULT;
+  if (!options)
+    options = &defaultOptions;
+  
+  uint32_t flags = 0;
+  if (options->compactInstructions)
+    flags |= OPTION_COMPACT_INSTRUCTIONS;
+  if (options->object)
+    flags |= OPTION_OBJECT;
+  return flags;
+}
+
+// Same as lexer's
+static bool isIdentifierFirstLetter(char chr) {
+  return isalpha((unsigned char) chr) || chr == '_' || chr == '$';
+}
+
+static bool isIdentifier(char chr) {
+  return isalnum((unsigned char) chr) || chr == '_' || chr == '.' || chr == '$';
+}
+
+// Find name in `.start_prototype <name>` at `offset`
+// Return false if it isn't there
+static bool getPrototypeName(const char* source, size_t size, size_t offset, size_t* nameStart, size_t* nameLength) {
+  size_t directiveLength = strlen(START_DIRECTIVE);
+  if (size - offset <= directiveLength || memcmp(source + offset, START_DIRECTIVE, directiveLength) != 0)
+    return false;
+  
+  size_t current = offset + directiveLength;
+  if (isIdentifier(source[current]))
+    return false;
+  while (current < size && isspace((unsigned char) source[current]))
+    current++;
+  
+  if (current >= size || !isIdentifierFirstLetter(source[current]))
+    return false;
+  
+  *nameStart = current;
+  while (current < size && isIdentifier(source[current]))
+    current++;
+  *nameLength = current - *nameStart;
+  return true;
+}
+
+// Return NUL terminated copy of the name in self->nameKey
+// or NULL if out of memory
+static const char* getNameKey(struct incremental_cache* self, const char* source, size_t nameStart, size_t nameLength) {
+  self->nameKey.size = 0;
+  char* key = byte_buffer_append_space(&self->nameKey, nameLength + 1);
+  if (!key)
+    return NULL;
+  
+  memcpy(key, source + nameStart, nameLength);
+  key[nameLength] = '\0';
+  return key;
+}
+
+// Prototypes except main in pre-order, which is order of
+// their `.start_prototype` in the source
+static int collectPrototypes(struct incremental_cache* self, struct prototype* prototype, size_t* count) {
+  size_t i = 0;
+  struct prototype* child = NULL;
+  vec_foreach(&prototype->prototypes, child, i) {
+    if (*count >= self->rangeCount)
+      return -EINVAL;
+    self->prototypes[(*count)++] = child;
+  
+    int res = collectPrototypes(self, child, count);
+    if (res < 0)
+      return res;
+  }
+  return 0;
+}
+
+static int indexNames(struct incremental_cache* self) {
+  for (size_t i = 0; i < self->rangeCount; i++) {
+    self->nextSameName[i] = NO_RANGE;
+  
+    size_t nameStart;
+    size_t nameLength;
+    const struct incremental_cache_range* range = &self->ranges[i];
+    if (range->length == 0 || !getPrototypeName(self->source, self->sourceSize, range->offset, &nameStart, &nameLength))
+      continue;
+  
+    const char* key = getNameKey(self, self->source, nameStart, nameLength);
+    if (!key)
+      return -ENOMEM;
+  
+    size_t* head = hashmap_get(&self->names, key);
+    if (head) {
+      self->nextSameName[i] = *head;
+      *head = i;
+      continue;
+    }
+  
+    char* name = arena_strndup(self->arena, key, nameLength);
+    if (!name || (head = arena_alloc(self->arena, sizeof(*head))) == NULL)
+      return -ENOMEM;
+    *head = i;
+    if (hashmap_put(&self->names, name, head) < 0)
+      return -ENOMEM;
+  }
+  return 0;
+}
+
+static int checkRanges(struct incremental_cache* self) {
+  size_t constantCount = self->bytecode->constants.length;
+  for (size_t i = 0; i < self->rangeCount; i++) {
+    const struct incremental_cache_range* range = &self->ranges[i];
+    if (range->offset > self->sourceSize || range->length > self->sourceSize - range->offset)
+      return -EINVAL;
+    if (range->bodyStart > range->bodyEnd || range->bodyEnd > range->length)
+      return -EINVAL;
+    if (range->constantStart > range->constantEnd || range->constantEnd > constantCount)
+      return -EINVAL;
+  }
+  return 0;
+}
+
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EINVAL: Unusable data
+static int indexData(struct incremental_cache* self) {
+  struct incremental_cache_header header;
+  if (self->data.size < sizeof(header))
+    return -EINVAL;
+  memcpy(&header, self->data.data, sizeof(header));
+  
+  if (header.magic != INCREMENTAL_CACHE_MAGIC || header.versionHash != util_fnv1a64(formatVersion, strlen(formatVersion)))
+    return -EINVAL;
+  
+  size_t available = self->data.size - sizeof(header);
+  if (header.rangeCount > available / sizeof(struct incremental_cache_range))
+    return -EINVAL;
+  available -= header.rangeCount * sizeof(struct incremental_cache_range);
+  if (header.sourceSize > available || header.bytecodeSize != available - header.sourceSize)
+    return -EINVAL;
+  
+  const char* data = self->data.data;
+  self->optionFlags = header.optionFlags;
+  self->rangeCount = header.rangeCount;
+  self->ranges = (const struct incremental_cache_range*) (data + sizeof(header));
+  self->source = data + sizeof(header) + header.rangeCount * sizeof(struct incremental_cache_range);
+  self->sourceSize = header.sourceSize;
+  
+  if ((self->loader = bytecode_loader_new(self->source + self->sourceSize, header.bytecodeSize)) == NULL)
+    return -ENOMEM;
+  self->loader->allowUnlinked = (header.optionFlags & OPTION_OBJECT) != 0;
+  
+  int res = bytecode_loader_load(self->loader, &self->bytecode);
+  if (res < 0)
+    return res == -ENOMEM ? -ENOMEM : -EINVAL;
+  if ((res = checkRanges(self)) < 0)
+    return res;
+  if (self->rangeCount == 0)
+    return 0;
+  
+  self->prototypes = allocator_malloc(self->rangeCount * sizeof(*self->prototypes));
+  self->nextSameName = allocator_malloc(self->rangeCount * sizeof(*self->nextSameName));
+  if (!self->prototypes || !self->nextSameName)
+    return -ENOMEM;
+  
+  size_t count = 0;
+  if ((res = collectPrototypes(self, self->bytecode->mainPrototype, &count)) < 0)
+    return res;
+  if (count != self->rangeCount)
+    return -EINVAL;
+  return indexNames(self);
+}
+
+int incremental_cache_load(struct incremental_cache* self, const void* data, size_t size) {
+  incremental_cache_reset(self);
+  if (byte_buffer_append(&self->data, data, size) < 0)
+    return -ENOMEM;
+  return 0;
+}
+
+// Index last assembly if not yet, unusable one is forgotten
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+static int ensureIndexed(struct incremental_cache* self) {
+  if (self->isIndexed || self->data.size == 0)
+    return 0;
+  
+  int res = indexData(self);
+  if (res < 0) {
+    incremental_cache_reset(self);
+    return res == -ENOMEM ? -ENOMEM : 0;
+  }
+  
+  self->isIndexed = true;
+  return 0;
+}
+
+// Return index of old range which has same text as source
+// at `offset` or NO_RANGE
+static size_t findRange(struct incremental_cache* self, const char* source, size_t size, size_t offset, int* res) {
+  size_t nameStart;
+  size_t nameLength;
+  if (!getPrototypeName(source, size, offset, &nameStart, &nameLength))
+    return NO_RANGE;
+  
+  const char* key = getNameKey(self, source, nameStart, nameLength);
+  if (!key) {
+    *res = -ENOMEM;
+    return NO_RANGE;
+  }
+  
+  size_t* head = hashmap_get(&self->names, key);
+  for (size_t i = head ? *head : NO_RANGE; i != NO_RANGE; i = self->nextSameName[i]) {
+    const struct incremental_cache_range* range = &self->ranges[i];
+    if (range->length <= size - offset && memcmp(source + offset, self->source + range->offset, range->length) == 0)
+      return i;
+  }
+  return NO_RANGE;
+}
+
+static int addReuse(struct incremental_cache* self, size_t offset, size_t rangeIndex) {
+  const struct incremental_cache_range* range = &self->ranges[rangeIndex];
+  struct incremental_cache_reuse reuse = {
+    .offset = offset,
+    .endOffset = offset + range->bodyEnd,
+    .rangeIndex = rangeIndex
+  };
+  struct lexer_skip_range skip = {
+    .start = offset + range->bodyStart,
+    .end = offset + range->bodyEnd
+  };
+  
+  if (vec_push(&self->reuses, reuse) < 0 || vec_push(&self->skips, skip) < 0)
+    return -ENOMEM;
+  return 0;
+}
+
+// Return offset after end of comment starting at `offset`
+// or `size` if it doesn't end
+static size_t skipComment(const char* source, size_t size, size_t offset) {
+  size_t current = offset + 2;
+  const char* star;
+  while ((star = memchr(source + current, '*', size - current)) != NULL) {
+    current = star - source + 1;
+    if (current < size && source[current] == '/')
+      return current + 1;
+  }
+  return size;
+}
+
+// Directives are only looked for where lexer is sure to start a
+// token (after whitespace, `;`, `,`, comment or string) and
+// never inside comments or strings, so a range found here is
+// lexed same as it was in the old source. Missing some is fine
+int incremental_cache_prepare(struct incremental_cache* self, const struct assembler_driver_options* options, const char* source, size_t size) {
+  vec_clear(&self->reuses);
+  vec_clear(&self->skips);
+  vec_clear(&self->newRanges);
+  self->nextReuse = 0;
+  
+  int res = ensureIndexed(self);
+  if (res < 0)
+    return res;
+  if (self->rangeCount == 0 || self->optionFlags != getOptionFlags(options))
+    return 0;
+  
+  size_t offset = 0;
+  bool isTokenStart = true;
+  while (offset < size) {
+    char current = source[offset];
+    if (current == '/' && offset + 1 < size && source[offset + 1] == '*') {
+      offset = skipComment(source, size, offset);
+      isTokenStart = true;
+      continue;
+    }
+  
+    if (current == '\"') {
+      const char* end = memchr(source + offset + 1, '\"', size - offset - 1);
+      offset = end ? (size_t) (end - source) + 1 : size;
+      isTokenStart = true;
+      continue;
+    }
+  
+    if (current == '.' && isTokenStart) {
+      size_t rangeIndex = findRange(self, source, size, offset, &res);
+      if (res < 0)
+        return res;
+  
+      // Nested ones are reused with it
+      if (rangeIndex != NO_RANGE) {
+        if ((res = addReuse(self, offset, rangeIndex)) < 0)
+          return res;
+        offset += self->ranges[rangeIndex].length;
+        isTokenStart = true;
+        continue;
+      }
+    }
+  
+    isTokenStart = isspace((unsigned char) current) || current == ';' || current == ',';
+    offset++;
+  }
+  return 0;
+}
+
+const struct incremental_cache_reuse* incremental_cache_get_reuse(struct incremental_cache* self, size_t offset) {
+  if (self->nextReuse >= self->reuses.length || self->reuses.data[self->nextReuse].offset != offset)
+    return NULL;
+  return &self->reuses.data[self->nextReuse++];
+}
+
+bool incremental_cache_is_all_reused(const struct incremental_cache* self) {
+  return self->nextReuse == self->reuses.length;
+}
+
+// Return offset after `;` ending `statement`, comments may be
+// between (parser stage 1 skips them). Zero if not found
+static size_t findStatementEnd(const char* source, size_t size, const struct statement* statement) {
+  const struct token* last = statement->wholeStatement.data[statement->wholeStatement.length - 1];
+  if (last->length == UINT16_MAX)
+    return 0;
+  
+  size_t offset = last->offset + last->length;
+  while (offset < size) {
+    if (source[offset] == ';')
+      return offset + 1;
+  
+    if (source[offset] == '/' && offset + 1 < size && source[offset + 1] == '*')
+      offset = skipComment(source, size, offset);
+    else if (isspace((unsigned char) source[offset]))
+      offset++;
+    else
+      return 0;
+  }
+  return 0;
+}
+
+int64_t incremental_cache_begin_range(struct incremental_cache* self, const char* source, size_t size, const struct statement* startStatement, size_t constantStart) {
+  size_t offset = startStatement->wholeStatement.data[0]->offset;
+  size_t bodyStart = findStatementEnd(source, size, startStatement);
+  struct incremental_cache_range range = {
+    .offset = (uint32_t) offset,
+    // Zero until range ends if not found
+    .bodyStart = bodyStart == 0 ? 0 : (uint32_t) (bodyStart - offset),
+    .constantStart = (uint32_t) constantStart,
+    .constantEnd = (uint32_t) constantStart
+  };
+  
+  if (vec_push(&self->newRanges, range) < 0)
+    return -ENOMEM;
+  return self->newRanges.length - 1;
+}
+
+void incremental_cache_end_range(struct incremental_cache* self, size_t index, const char* source, size_t size, const struct statement* endStatement, size_t constantEnd) {
+  struct incremental_cache_range* range = &self->newRanges.data[index];
+  range->constantEnd = (uint32_t) constantEnd;
+  
+  // Can't tell where it is (or it is past what the sidecar's
+  // 32-bit offsets reach), left with zero length
+  size_t end = findStatementEnd(source, size, endStatement);
+  if (range->bodyStart == 0 || end == 0 || end > UINT32_MAX) {
+    range->bodyStart = 0;
+    return;
+  }
+  
+  range->length = (uint32_t) (end - range->offset);
+  range->bodyEnd = (uint32_t) (endStatement->wholeStatement.data[0]->offset - range->offset);
+}
+
+struct splice {
+  struct incremental_cache* cache;
+  const char* sourceFile;
+  
+  // Index of next copied prototype's range
+  size_t rangeIndex;
+  
+  int64_t constantDelta;
+  int64_t offsetDelta;
+  int lineDelta;
+  
+  // Column only moves on first line of the range
+  int firstLine;
+  int columnDelta;
+};
+
+// Point LOAD_CONSTANT at where its constant is now
+static int rebaseConstantLoad(struct splice* splice, vm_instruction* instruction) {
+  if (((*instruction >> 56) & ~OP_SHORT_FLAG) != FLUFFYVM_OPCODE_LOAD_CONSTANT)
+    return 0;
+  
+  // Changing instruction's size would move the jumps
+  if (OP_IS_SHORT(*instruction)) {
+    int64_t index = (int64_t) ((*instruction >> 32) & 0xFFFF) + splice->constantDelta;
+    if (index > OP_SHORT_MAX_U16)
+      return -EAGAIN;
+    *instruction = (*instruction & ~OP_SHORT_B_16(0xFFFF)) | OP_SHORT_B_16((uint32_t) index);
+  } else {
+    int64_t index = (int64_t) (uint32_t) *instruction + splice->constantDelta;
+    *instruction = (*instruction & ~OP_ARG_B_U16_U32(0xFFFF'FFFF)) | OP_ARG_B_U16_U32((uint32_t) index);
+  }
+  return 0;
+}
+
+static int copyRange(struct splice* splice) {
+  struct incremental_cache_range range = splice->cache->ranges[splice->rangeIndex++];
+  range.offset = (uint32_t) (range.offset + splice->offsetDelta);
+  range.constantStart = (uint32_t) (range.constantStart + splice->constantDelta);
+  range.constantEnd = (uint32_t) (range.constantEnd + splice->constantDelta);
+  return vec_push(&splice->cache->newRanges, range) < 0 ? -ENOMEM : 0;
+}
+
+static int copyPrototype(struct splice* splice, struct prototype* source, struct prototype** result) {
+  int res = 0;
+  if ((res = bytecode_loader_decode_prototype(splice->cache->loader, source)) < 0)
+    return res == -ENOMEM ? -ENOMEM : -EAGAIN;
+  if ((res = copyRange(splice)) < 0)
+    return res;
+  
+  int column = source->definedAtColumn + (source->definedAtLine == splice->firstLine ? splice->columnDelta : 0);
+  struct prototype* copy = prototype_new(splice->sourceFile, source->prototypeName, source->definedAtLine + splice->lineDelta, column);
+  if (!copy)
+    return -ENOMEM;
+  copy->isCompact = source->isCompact;
+  
+  if (vec_reserve(&copy->instructions, source->instructions.length) < 0 ||
+      vec_reserve(&copy->instructionLines, source->instructionLines.length) < 0 ||
+      vec_reserve(&copy->prototypes, source->prototypes.length) < 0) {
+    res = -ENOMEM;
+    goto failure;
+  }
+  vec_extend(&copy->instructions, &source->instructions);
+  
+  size_t i = 0;
+  vm_instruction* instruction = NULL;
+  vec_foreach_ptr(&copy->instructions, instruction, i)
+    if ((res = rebaseConstantLoad(splice, instruction)) < 0)
+      goto failure;
+  
+  int line = 0;
+  vec_foreach(&source->instructionLines, line, i)
+    vec_push(&copy->instructionLines, line + splice->lineDelta);
+  
+  struct prototype_reference* reference = NULL;
+  vec_foreach_ptr(&source->references, reference, i)
+    if ((res = prototype_add_reference(copy, reference->instruction, reference->symbolName)) < 0)
+      goto failure;
+  
+  struct prototype* child = NULL;
+  vec_foreach(&source->prototypes, child, i) {
+    struct prototype* childCopy = NULL;
+    if ((res = copyPrototype(splice, child, &childCopy)) < 0)
+      goto failure;
+  
+    // Reserved above, cannot fail
+    vec_push(&copy->prototypes, childCopy);
+  }
+  
+  *result = copy;
+  return 0;
+
+failure:
+  prototype_free(copy);
+  return res;
+}
+
+static int copyConstants(struct incremental_cache* self, const struct incremental_cache_range* range, struct bytecode* bytecode) {
+  int res = 0;
+  for (size_t i = range->constantStart; i < range->constantEnd; i++) {
+    // Result owns copy of strings, bytecode_free frees them
+    struct constant* constant = &self->bytecode->constants.data[i];
+    if (constant->type == BYTECODE_CONSTANT_STRING)
+      res = bytecode_add_constant_string(bytecode, constant->data.string);
+    else
+      res = bytecode_add_constant_generic(bytecode, *constant);
+  
+    // Same limit it was assembled with
+    if (res == -ENOSPC)
+      return -EAGAIN;
+    if (res < 0)
+      return res;
+  }
+  return 0;
+}
+
+int incremental_cache_splice(struct incremental_cache* self, const struct incremental_cache_reuse* reuse, struct bytecode* bytecode, const char* sourceFile, int line, int column, struct prototype** result, size_t* reusedCount) {
+  const struct incremental_cache_range* range = &self->ranges[reuse->rangeIndex];
+  struct prototype* source = self->prototypes[reuse->rangeIndex];
+  int res = bytecode_loader_decode_prototype(self->loader, source);
+  if (res < 0)
+    return res == -ENOMEM ? -ENOMEM : -EAGAIN;
+  
+  struct splice splice = {
+    .cache = self,
+    .sourceFile = sourceFile,
+    .rangeIndex = reuse->rangeIndex,
+    .constantDelta = (int64_t) bytecode->constants.length - range->constantStart,
+    .offsetDelta = (int64_t) reuse->offset - range->offset,
+    .lineDelta = line - source->definedAtLine,
+    .firstLine = source->definedAtLine,
+    .columnDelta = column - source->definedAtColumn
+  };
+  
+  if ((res = copyConstants(self, range, bytecode)) < 0)
+    return res;
+  if ((res = copyPrototype(&splice, source, result)) < 0)
+    return res;
+  
+  if (reusedCount)
+    *reusedCount = splice.rangeIndex - reuse->rangeIndex;
+  return 0;
+}
+
+// Whether bytes serialized with `options` can be sidecar's
+// bytecode as is (thread count doesn't change output)
+static bool isSidecarFormat(const struct bytecode_serializer_options* options, const struct bytecode_serializer_options* sidecarOptions) {
+  return options->version == sidecarOptions->version &&
+         options->compressInstructions == sidecarOptions->compressInstructions &&
+         options->stripDebugInfo == sidecarOptions->stripDebugInfo;
+}
+
+int incremental_cache_update(struct incremental_cache* self, const struct assembler_driver_options* options, const char* source, size_t size, struct bytecode* bytecode, const void* serialized, size_t serializedSize) {
+  static const struct bytecode_serializer_options serializerOptions = BYTECODE_SERIALIZER_OPTIONS_DEFAULT;
+  int res = 0;
+  struct byte_buffer data = BYTE_BUFFER_INIT;
+  struct incremental_cache_header header = {
+    .magic = INCREMENTAL_CACHE_MAGIC,
+    .optionFlags = getOptionFlags(options),
+    .versionHash = util_fnv1a64(formatVersion, strlen(formatVersion)),
+    .rangeCount = self->newRanges.length,
+    .sourceSize = size
+  };
+  
+  if (serialized && (!options || !isSidecarFormat(&options->serializer, &serializerOptions)))
+    serialized = NULL;
+  
+  size_t rangesSize = self->newRanges.length * sizeof(*self->newRanges.data);
+  if (byte_buffer_reserve(&data, sizeof(header) + rangesSize + size + (serialized ? serializedSize : 0)) < 0) {
+    res = -ENOMEM;
+    goto failure;
+  }
+  
+  // Header is rewritten once bytecode size is known
+  byte_buffer_append(&data, &header, sizeof(header));
+  byte_buffer_append(&data, self->newRanges.data, rangesSize);
+  byte_buffer_append(&data, source, size);
+  if (serialized)
+    byte_buffer_append(&data, serialized, serializedSize);
+  else if ((res = bytecode_serializer_protobuf_append(bytecode, &serializerOptions, &data)) < 0)
+    goto failure;
+  
+  header.bytecodeSize = data.size - sizeof(header) - rangesSize - size;
+  memcpy(data.data, &header, sizeof(header));
+  
+  // Indexed once it is prepared for, if ever
+  incremental_cache_reset(self);
+  byte_buffer_deinit(&self->data);
+  self->data = data;
+  return 0;
+
+failure:
+  byte_buffer_deinit(&data);
+  incremental_cache_reset(self);
+  return res == -ENOMEM ? -ENOMEM : -EFAULT;
+}
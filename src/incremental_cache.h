@@ -0,0 +1,173 @@
+#ifndef _headers_1668465530_Fluff_Assembler_incremental_cache
+#define _headers_1668465530_Fluff_Assembler_incremental_cache
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "byte_buffer.h"
+#include "hashmap.h"
+#include "lexer.h"
+#include "swiss_hashmap.h"
+#include "vec.h"
+
+// Reassembling a file after small edits without assembling
+// prototypes which didn't change (see --incremental)
+//
+// Cache holds source of last assembly, its result as protobuf
+// bytecode and where each prototype's `.start_prototype` up to
+// `.end_prototype;` range was in that source. Before next
+// assembly the new source is scanned for ranges with same
+// text as an old one, the lexer skips their bodies and parser
+// stage 2 copies old compiled prototype in instead, with its
+// constants appended to the pool and lines moved. Range's
+// text decides everything about the compiled prototype except
+// those, so output is same as assembling everything (except
+// long constant loads in compact prototypes stay long)
+//
+// Ranges are matched byte for byte against the old source so
+// a stale or foreign cache can only cost time
+
+#define INCREMENTAL_CACHE_EXTENSION ".fluff_inc"
+
+struct arena;
+struct assembler_driver_options;
+struct bytecode;
+struct bytecode_loader;
+struct prototype;
+struct statement;
+
+// Prototype's range in the source, stored in the sidecar
+struct incremental_cache_range {
+  // From `.start_prototype` to after `;` of `.end_prototype`,
+  // zero length if unknown (never matches)
+  uint32_t offset;
+  uint32_t length;
+
+  // Between the two directives' statements, relative
+  // to `offset`
+  uint32_t bodyStart;
+  uint32_t bodyEnd;
+
+  // Constants added to the pool while assembling it
+  uint32_t constantStart;
+  uint32_t constantEnd;
+};
+
+// Old range found again in the source being assembled
+struct incremental_cache_reuse {
+  // Of the `.start_prototype` and `.end_prototype`
+  // directives in new source
+  size_t offset;
+  size_t endOffset;
+  // Index in old ranges, also of the prototype in old
+  // bytecode's pre-order
+  size_t rangeIndex;
+};
+
+struct incremental_cache {
+  // Last assembly (sidecar contents), everything below
+  // points into it. Empty if there is none
+  struct byte_buffer data;
+  // `data` is checked and indexed only once it is needed
+  // (by incremental_cache_prepare), fields below are set
+  // from then on
+  bool isIndexed;
+  const char* source;
+  size_t sourceSize;
+  const struct incremental_cache_range* ranges;
+  size_t rangeCount;
+
+  // Options the prototypes were assembled with
+  uint32_t optionFlags;
+
+  struct bytecode_loader* loader;
+  struct bytecode* bytecode;
+  // Old prototypes except main in pre-order (same order
+  // as their ranges)
+  struct prototype** prototypes;
+  // Ranges with same prototype name are chained
+  size_t* nextSameName;
+  SWISS_HASHMAP(char, size_t) names;
+  struct arena* arena;
+  struct byte_buffer nameKey;
+
+  // Current assembly, `reuses` and `skips` are sorted and
+  // only read by the lexer and parser stage 2
+  vec_t(struct incremental_cache_reuse) reuses;
+  vec_t(struct lexer_skip_range) skips;
+  size_t nextReuse;
+  vec_t(struct incremental_cache_range) newRanges;
+};
+
+struct incremental_cache* incremental_cache_new();
+void incremental_cache_free(struct incremental_cache* self);
+
+// dir/name.fluff_bin -> dir/name.fluff_inc
+// Return NULL if out of memory
+char* incremental_cache_get_path(const char* outputPath);
+
+// Use sidecar `data` (copied) as last assembly, unusable
+// data (truncated, other assembler version...) just leaves
+// the cache empty once it is prepared
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int incremental_cache_load(struct incremental_cache* self, const void* data, size_t size);
+
+// Forget last assembly
+void incremental_cache_reset(struct incremental_cache* self);
+
+// Find what can be reused in `source` assembled with `options`
+// (nothing if they differ from last assembly's) and prepare
+// for recording the new ranges
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int incremental_cache_prepare(struct incremental_cache* self, const struct assembler_driver_options* options, const char* source, size_t size);
+
+// For parser stage 2, return what to reuse for prototype whose
+// `.start_prototype` is at `offset` or NULL to assemble it.
+// Must be asked for every prototype in source order
+const struct incremental_cache_reuse* incremental_cache_get_reuse(struct incremental_cache* self, size_t offset);
+
+// True if every reuse was taken by incremental_cache_get_reuse
+bool incremental_cache_is_all_reused(const struct incremental_cache* self);
+
+// Record range of prototype being assembled before its nested
+// ones, end it after with incremental_cache_end_range
+// `startStatement` and `endStatement` are the `.start_prototype`
+// and `.end_prototype` statements, neither is kept
+// Return index of the range or negative on error
+// Errors:
+// -ENOMEM: Not enough memory
+int64_t incremental_cache_begin_range(struct incremental_cache* self, const char* source, size_t size, const struct statement* startStatement, size_t constantStart);
+void incremental_cache_end_range(struct incremental_cache* self, size_t index, const char* source, size_t size, const struct statement* endStatement, size_t constantEnd);
+
+// Copy prototype of `reuse` with the nested ones into
+// `bytecode`, appending their constants and moving them
+// to `line` and `column` in `sourceFile`. Ranges of all of
+// them are recorded
+// `reusedCount` can be NULL, it is set to number of copied
+// prototypes
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EAGAIN: Cannot be reused here after all (a short constant
+//          load overflows), source must be assembled again
+//          after incremental_cache_reset
+int incremental_cache_splice(struct incremental_cache* self, const struct incremental_cache_reuse* reuse, struct bytecode* bytecode, const char* sourceFile, int line, int column, struct prototype** result, size_t* reusedCount);
+
+// Make successful assembly of `source` (the one prepared for)
+// into `bytecode` the last assembly, cache is left empty on
+// failure. `serialized` is `bytecode` serialized with
+// `options->serializer` or NULL, it is copied instead of
+// serializing again if sidecar is written with same options
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EFAULT: Cannot serialize the bytecode
+int incremental_cache_update(struct incremental_cache* self, const struct assembler_driver_options* options, const char* source, size_t size, struct bytecode* bytecode, const void* serialized, size_t serializedSize);
+
+#endif
+
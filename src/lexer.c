@@ -1,4 +1,3 @@
-#include <Block.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,260 +8,148 @@
 #include <inttypes.h>
 #include <string.h>
 #include <ctype.h>
-#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include "buffer.h"
+#include "allocator.h"
+#include "arena.h"
+#include "byte_buffer.h"
 #include "lexer.h"
 #include "constants.h"
+#include "hashmap.h"
 #include "util.h"
 #include "common.h"
+#include "spsc_queue.h"
 
-static void freeToken(struct token* token);
-struct lexer* lexer_new(FILE* input, const char* inputName) {
-  struct lexer* self = malloc(sizeof(*self));
-  if (!self)
-    return NULL;
+// FILE input is read in pieces of this size
+#define READ_CHUNK_SIZE (64 * 1024)
 
+static void resetState(struct lexer* self, FILE* input, const char* source, size_t sourceSize, const char* inputName) {
   self->input = input;
+  self->source = source;
+  self->sourceSize = sourceSize;
+  self->sourceOffset = 0;
   self->errorMessage = NULL;
   self->canFreeErrorMessage = false;
-  self->lookAhead = '\0';
   self->currentToken = NULL;
-  self->currentLine = 0;
-  self->currentColumn = -1;
-  self->isFirstToken = true;
-  self->isThrowingError = false;
   self->inputName = inputName;
-  self->currentLineBuffer = NULL;
-  self->currentTokenBuffer = NULL;
-  self->isEOF = false;
   self->isCompleted = false;
+  self->tokenCount = 0;
+  atomic_store_explicit(&self->releasedTokens, 0, memory_order_relaxed);
+  self->output = NULL;
+  self->skipRanges = NULL;
+  self->skipRangeCount = 0;
+  self->nextSkipRange = 0;
+  self->mappedInput = NULL;
+  self->mappedSize = 0;
+}
 
-  self->currentLineBuffer = buffer_new();
-  if (!self->currentLineBuffer)
-    goto failure;
-  self->currentTokenBuffer = NULL;
+struct lexer* lexer_new(FILE* input, const char* inputName) {
+  struct lexer* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
   
-  vec_init(&self->cleanups);
-  vec_init(&self->allLines);
-  vec_init(&self->allTokens);
+  atomic_init(&self->releasedTokens, 0);
+  resetState(self, input, NULL, 0, inputName);
+  self->inputCopy = (struct byte_buffer) BYTE_BUFFER_INIT;
+  self->symbolKey = (struct byte_buffer) BYTE_BUFFER_INIT;
+  hashmap_init(&self->symbols, swiss_hashmap_hash_string, strcmp);
+  vec_init(&self->tokenChunks);
+  self->firstLiveChunk = 0;
+  
+  self->strings = arena_new(0);
+  if (!self->strings)
+    goto failure;
   return self;
-
+  
 failure:
   lexer_free(self);
   return NULL;
 }
 
-void lexer_free(struct lexer* self) {
-  if (self->canFreeErrorMessage)
-    free((char*) self->errorMessage);
-  
-  int i = 0;
-  buffer_t* line = NULL;
-  vec_foreach(&self->allLines, line, i) {
-    buffer_free(line);
-  }
-  
-  i = 0;
-  struct token* token = NULL;
-  vec_foreach(&self->allTokens, token, i) {
-    freeToken(token);
-  }
-  
-  if (self->cleanups.length > 0) {
-    fprintf(stderr, __FILE__ ":%d: Unreleased cleanup detected!!! (this is a bug please report)\n", __LINE__);
-    abort();
-  }
-  
-  vec_deinit(&self->allLines);
-  vec_deinit(&self->allTokens);
-  vec_deinit(&self->cleanups);
+struct lexer* lexer_new_buffer(const char* source, size_t size, const char* inputName) {
+  struct lexer* self = lexer_new(NULL, inputName);
+  if (!self)
+    return NULL;
   
-  if (self->currentTokenBuffer)
-    buffer_free(self->currentTokenBuffer);
-  if (self->currentLineBuffer)
-    buffer_free(self->currentLineBuffer);
-  free(self);
+  self->source = source;
+  self->sourceSize = size;
+  return self;
 }
 
-static void freeToken(struct token* token) {
-  if (!token)
-    return;
-  
-  switch (token->type) {
-    case TOKEN_STRING:
-      if (token->data.string)
-        buffer_free(token->data.string);
-      break;
-    case TOKEN_LABEL_DECL:
-      if (token->data.labelDeclName)
-        buffer_free(token->data.labelDeclName);
-      break;
-    case TOKEN_LABEL_REF:
-      if (token->data.labelName)
-        buffer_free(token->data.labelName);
-      break;
-    case TOKEN_DIRECTIVE_NAME:
-      if (token->data.directiveName)
-        buffer_free(token->data.directiveName);
-      break;
-    case TOKEN_IDENTIFIER:
-      if (token->data.identifier)
-        buffer_free(token->data.identifier);
-      break;
-    case TOKEN_COMMENT:
-      if (token->data.comment)
-        buffer_free(token->data.comment);
-      break;
-    case TOKEN_STATEMENT_END:
-    case TOKEN_REGISTER:
-    case TOKEN_COMMA:
-    case TOKEN_IMMEDIATE:
-    case TOKEN_UNKNOWN:
-      break;
-  }
-
-  if (token->rawToken)
-    buffer_free(token->rawToken);
-  free(token);
+static void freeResults(struct lexer* self) {
+  if (self->canFreeErrorMessage)
+    allocator_free((char*) self->errorMessage);
+  if (self->mappedInput)
+    munmap(self->mappedInput, self->mappedSize);
 }
 
-// Return 0 on success
-// Errors:
-// -ENOMEM: Not enough memory
-static int pushErrorCleanup(struct lexer* self, runnable_block cleanupBlock) {
-  runnable_block copy = Block_copy(cleanupBlock);
-  if (!copy)
-    return -ENOMEM;
+void lexer_reset(struct lexer* self, FILE* input, const char* inputName) {
+  freeResults(self);
   
-  if (vec_push(&self->cleanups, copy) < 0) {
-    Block_release(copy);
-    return -ENOMEM;
-  }
-  return 0;
-}
-
-static void popErrorCleanup(struct lexer* self) {
-  if (self->cleanups.length == 0) {
-    fprintf(stderr, __FILE__ ":%d: Cleanup stack underflow!!! (this is a bug please report)\n", __LINE__);
-    abort();
-  }
+  // Keep token chunks, symbol table and input copy's
+  // capacity for next input. Reused chunks were appended
+  // at the end so dropping the holes puts all at front
+  vec_splice(&self->tokenChunks, 0, self->firstLiveChunk);
+  self->firstLiveChunk = 0;
+  self->inputCopy.size = 0;
+  arena_reset(self->strings);
+  hashmap_clear(&self->symbols);
   
-  Block_release(vec_pop(&self->cleanups));
+  resetState(self, input, NULL, 0, inputName);
 }
 
-static void recordTokenInfo(struct lexer* self) {
-  self->currentToken->rawToken = self->currentTokenBuffer;
-  self->currentToken->fullLine = self->currentLineBuffer;
-  self->currentToken->filename = self->inputName;
-  
-  self->currentToken->startColumn = self->startColumn; 
-  self->currentToken->startLine = self->startLine; 
-  
-  self->currentToken->endColumn = self->prevColumn; 
-  self->currentToken->endLine = self->prevLine;
+void lexer_reset_buffer(struct lexer* self, const char* source, size_t size, const char* inputName) {
+  lexer_reset(self, NULL, inputName);
+  self->source = source;
+  self->sourceSize = size;
 }
 
-// Return zero on success
-// Errors:
-// -ENAVAIL: No data left
-// -EFAULT: Read error (check errno for reason)
-static int getCharRaw(struct lexer* self) {
-  if (self->isEOF)
-    return -ENAVAIL;
-  
-  self->prevColumn = self->currentColumn;
-  self->prevLine = self->currentLine;
-  
-  if (self->lookAhead == '\n') {
-    // Replace current line buffer with new one
-    self->currentLine++;
-    self->currentColumn = -1;
-    self->prevColumn--;
-
-    if (vec_push(&self->allLines, self->currentLineBuffer) < 0)
-      return -ENOMEM;
-
-    self->currentLineBuffer = buffer_new();
-    if (self->currentLineBuffer == NULL)
-      return -ENOMEM;
-  }
-  
-  // Fetch data
-  if (fread(&self->lookAhead, 1, 1, self->input) != 1) {
-    if (feof(self->input) != 0) {
-      self->isEOF = true;
-      return -ENAVAIL;
-    }
-    
-    if (ferror(self->input) != 0)
-      return -EFAULT;
-    
-    fputs(__FILE__ ": FATAL: Cannot read input (unknown error) (this a bug please report)\n", stderr);
-    abort();
-  }
-  
-  if (self->lookAhead != '\n') {
-    // Increment to next column and append
-    self->currentColumn++;
-    
-    if (buffer_append_n(self->currentLineBuffer, &self->lookAhead, 1) < 0) 
-      return -ENOMEM;
-  }
-
-  return 0;
+void lexer_free(struct lexer* self) {
+  freeResults(self);
+  
+  size_t i = 0;
+  struct lexer_token_chunk* chunk = NULL;
+  vec_foreach(&self->tokenChunks, chunk, i)
+    allocator_free(chunk);
+  vec_deinit(&self->tokenChunks);
+  
+  hashmap_cleanup(&self->symbols);
+  arena_free(self->strings);
+  byte_buffer_deinit(&self->symbolKey);
+  byte_buffer_deinit(&self->inputCopy);
+  allocator_free(self);
 }
 
 static void throwError_vprintf(struct lexer* self, const char* fmt, va_list args) {
-  if (self->isThrowingError) {
-    fputs(__FILE__ ": FATAL: Nested error!!! (this a bug please report)\n", stderr);
-    abort();
-  }
-  
-  int errorLine = self->currentLine;
-  int errorColumn = self->currentColumn >= 0 ? self->currentColumn : 0;
-  
-  while (self->lookAhead != '\n')
-    if (getCharRaw(self) < 0)
-      break;
-  
-  recordTokenInfo(self);
-  
   char* buffer;
   util_vasprintf(&buffer, fmt, args);
   if (!buffer)
     goto format_error;
-
-  self->isThrowingError = true;
+  
+  // Points at where lexing stopped
+  struct token errorToken = {
+    .offset = self->sourceOffset
+  };
+  
   self->canFreeErrorMessage = true;
-  self->errorMessage = common_format_error_message_about_token(self->inputName, 
-                                                               "lexing error", 
-                                                               errorLine,
-                                                               errorColumn,
-                                                               self->currentToken,
+  self->errorMessage = common_format_error_message_about_token(self->inputName,
+                                                               "lexing error",
+                                                               self,
+                                                               &errorToken,
                                                                "%s",
                                                                buffer);
-  self->isThrowingError = false;
-  
+  allocator_free(buffer);
   if (self->errorMessage == NULL)
     goto format_error;
-  free(buffer);
-
-  runnable_block current = NULL;
-  int i = 0;
-  vec_foreach_rev(&self->cleanups, current, i) {
-    current();
-    Block_release(current);
-  }
-  vec_clear(&self->cleanups);
-
+  
   longjmp(self->onError, 1);
   abort();
   
   format_error:
   self->canFreeErrorMessage = false;
   self->errorMessage = "Cannot format error message";
-
+  
   longjmp(self->onError, 1);
   abort();
 }
@@ -275,67 +162,26 @@ static void throwError(struct lexer* lexer, const char* fmt, ...) {
   va_end(args);
 }
 
-static int getCharAllowEOF(struct lexer* self) {
-  if (!self->isFirstToken && 
-      feof(self->input) == 0 && 
-      buffer_append_n(self->currentTokenBuffer, &self->lookAhead, 1) < 0) {
-    throwError(self, "Error appending token buffer");
-  }
-
-  int res = getCharRaw(self);
-  if (res >= 0 || res == -ENAVAIL)
-    return res;
-
-  switch (res) {
-    case -ENAVAIL:
-      throwError(self, "No data left to read");
-    case -EFAULT:
-      throwError(self, "Read error: %d", errno);
-    case -ENOMEM:
-      throwError(self, "Not enough memory");
-  }
-  
-  throwError(self, "Unknown failure: %d", res);
-  return 0;
+// Current char or NUL at end of input
+static char peek(struct lexer* self) {
+  return self->sourceOffset < self->sourceSize ? self->source[self->sourceOffset] : '\0';
 }
 
 static void getChar(struct lexer* self) {
-  int res = getCharAllowEOF(self);
-  if (res >= 0)
-    return;
+  if (self->sourceOffset >= self->sourceSize)
+    throwError(self, "No data left to read");
+  self->sourceOffset++;
+}
 
-  switch (res) {
-    case -ENAVAIL:
-      throwError(self, "No data left to read");
-    case -EFAULT:
-      throwError(self, "Read error");
-  }
-  
-  throwError(self, "Unknown failure: %d", res);
-} 
-
-// Return white character skipped (including EOF)
-static int skipWhite(struct lexer* self) {
-  int count = 0;
-  while (isspace((unsigned char) self->lookAhead)) {
-    count++;
-    
-    int res = getCharRaw(self);
-    if (res >= 0)
-      continue;
-    
-    if (res == -ENAVAIL)
-      return count;
-    throwError(self, "Unknown failure: %d", res);
-  }
-  
-  return count;
+static void skipWhite(struct lexer* self) {
+  while (self->sourceOffset < self->sourceSize && isspace((unsigned char) self->source[self->sourceOffset]))
+    self->sourceOffset++;
 }
 
 static char matchNoSkipWhite(struct lexer* self, char c) {
-  if (self->lookAhead != c)
-    throwError(self, "Expected '%c' got '%c'", c, self->lookAhead);
-
+  if (peek(self) != c)
+    throwError(self, "Expected '%c' got '%c'", c, peek(self));
+  
   getChar(self);
   return c;
 }
@@ -343,38 +189,38 @@ static char matchNoSkipWhite(struct lexer* self, char c) {
 static int64_t getAnySignInteger(struct lexer* self) {
   size_t current = 0;
   
-  // Fixed 20 bytes because it 
+  // Fixed 20 bytes because it
   // always return int64_t and
   // maximum int64_t consumed
   // 20 bytes of space in string
   // form (including null terminator)
   char buffer[20] = {};
-  bool isNegative = self->lookAhead == '-';
+  bool isNegative = peek(self) == '-';
   
   if (isNegative)
     getChar(self);
   
-  if (!isdigit((unsigned char) self->lookAhead))
+  if (!isdigit((unsigned char) peek(self)))
     throwError(self, "Expected 'integer'");
-
-  char digit = self->lookAhead;
+  
+  char digit = peek(self);
   while (isdigit((unsigned char) digit)) {
     if (current + 1 >= sizeof(buffer))
       throwError(self, "Integer is too large");
-
+  
     buffer[current] = digit;
     buffer[current + 1] = '\0';
     current++;
-    
+  
     getChar(self);
-    digit = self->lookAhead;
+    digit = peek(self);
   }
-
+  
   errno = 0;
   intmax_t n = strtoimax(buffer, NULL, 10);
   if (errno == ERANGE || n > INT64_MAX)
     throwError(self, "Integer is overflowing");
-
+  
   if (isNegative)
     n *= -1;
   return (int64_t) n;
@@ -390,21 +236,21 @@ static int64_t getPositiveInteger(struct lexer* self) {
 static bool isIdentifierFirstLetter(char chr) {
   if (isalpha((unsigned char) chr))
     return true;
-
+  
   switch (chr) {
     case '_':
       return true;
     case '$':
       return true;
   }
-
+  
   return false;
 }
 
 static bool isIdentifier(char chr) {
   if (isalnum((unsigned char) chr))
     return true;
-
+  
   switch (chr) {
     case '_':
       return true;
@@ -413,51 +259,62 @@ static bool isIdentifier(char chr) {
     case '$':
       return true;
   }
-
+  
   return false;
 }
 
-static buffer_t* getIdentifier(struct lexer* self) {
-  if (!isIdentifierFirstLetter(self->lookAhead))
-    throwError(self, "Expected 'identifier'");
- 
-  buffer_t* buffer = buffer_new();
-  if (!buffer)
+// Return `length` bytes of input from `start` interned, repeated
+// names share one copy and a lookup instead of an allocation
+static const char* internSymbol(struct lexer* self, size_t start, size_t length) {
+  self->symbolKey.size = 0;
+  char* key = byte_buffer_append_space(&self->symbolKey, length + 1);
+  if (!key)
     throwError(self, "Out of memory");
-  if (pushErrorCleanup(self, ^() {
-        buffer_free(buffer);
-      }) < 0)
-    goto error_push_cleanup;
-  
-  while (isIdentifier(self->lookAhead)) {
-    if (buffer_append_n(buffer, &self->lookAhead, 1) < 0)
-      throwError(self, "Error appending");
-    
-    getChar(self);
-  }
+  memcpy(key, self->source + start, length);
+  key[length] = '\0';
+  
+  char* symbol = hashmap_get(&self->symbols, key);
+  if (symbol)
+    return symbol;
+  
+  if ((symbol = arena_strndup(self->strings, key, length)) == NULL)
+    throwError(self, "Out of memory");
+  if (hashmap_put(&self->symbols, symbol, symbol) < 0)
+    throwError(self, "Out of memory");
+  return symbol;
+}
 
-  popErrorCleanup(self);
-  return buffer;
+// Strings are rarely repeated, copy without interning
+static const char* copyString(struct lexer* self, size_t start, size_t length) {
+  char* copy = arena_strndup(self->strings, self->source + start, length);
+  if (!copy)
+    throwError(self, "Out of memory");
+  return copy;
+}
+
+static const char* getIdentifier(struct lexer* self) {
+  if (!isIdentifierFirstLetter(peek(self)))
+    throwError(self, "Expected 'identifier'");
   
-error_push_cleanup:
-  buffer_free(buffer);
-  throwError(self, "Error pushing cleanup block");
-  return NULL;
+  size_t start = self->sourceOffset;
+  while (isIdentifier(peek(self)))
+    getChar(self);
+  return internSymbol(self, start, self->sourceOffset - start);
 }
 
-static buffer_t* getLabelRef(struct lexer* self) {
+static const char* getLabelRef(struct lexer* self) {
   matchNoSkipWhite(self, '=');
   return getIdentifier(self);
 }
 
-static buffer_t* getDirectiveName(struct lexer* self) {
+static const char* getDirectiveName(struct lexer* self) {
   matchNoSkipWhite(self, '.');
   return getIdentifier(self);
 }
 
-static buffer_t* getLabelDecl(struct lexer* self) {
+static const char* getLabelDecl(struct lexer* self) {
   matchNoSkipWhite(self, ':');
-  buffer_t* ident = getIdentifier(self);
+  const char* ident = getIdentifier(self);
   matchNoSkipWhite(self, ':');
   return ident;
 }
@@ -467,75 +324,42 @@ static int64_t getImmediate(struct lexer* self) {
   return getAnySignInteger(self);
 }
 
-static buffer_t* getComment(struct lexer* self) {
+static size_t getComment(struct lexer* self) {
   matchNoSkipWhite(self, '/');
   
-  buffer_t* buffer = buffer_new();
-  if (!buffer)
-    throwError(self, "Out of memory");
-  if (pushErrorCleanup(self, ^() {
-      buffer_free(buffer);
-    }) < 0)
-    goto error_push_cleanup;
-  
-  switch (self->lookAhead) {
+  switch (peek(self)) {
     /* Multi line comment */
     case '*':
       matchNoSkipWhite(self, '*');
-      while (true) {
-        char current = self->lookAhead;
-        matchNoSkipWhite(self, self->lookAhead);
-
-        if (buffer_append_n(buffer, &current, 1) < 0)
-          throwError(self, "Error appending");
-        
-        // End of multiline comment
-        if (current == '/' && buffer->data[buffer_length(buffer) - 2] == '*') {
-          // Replace '*' at the end with NUL
-          buffer->data[buffer_length(buffer) - 2] = '\0';
-          break;
-        }
-      }
       break;
     default:
       throwError(self, "Expect single line or multiline comment");
   }
-
-  popErrorCleanup(self);
-  return buffer;
-
-error_push_cleanup:
-  buffer_free(buffer);
-  throwError(self, "Error pushing cleanup block");
-  return NULL;
+  
+  size_t start = self->sourceOffset;
+  while (true) {
+    char current = peek(self);
+    getChar(self);
+  
+    // End of multiline comment
+    if (current == '/' && self->sourceOffset - start >= 2 && self->source[self->sourceOffset - 2] == '*')
+      break;
+  }
+  
+  // Without the "*/"
+  return self->sourceOffset - start - 2;
 }
 
-static buffer_t* getString(struct lexer* self) {
+static const char* getString(struct lexer* self) {
   matchNoSkipWhite(self, '\"');
   
-  buffer_t* buffer = buffer_new();
-  if (!buffer)
-    throwError(self, "Out of memory");
-  if (pushErrorCleanup(self, ^() {
-      buffer_free(buffer);
-    }) < 0)
-    goto error_push_cleanup;
-  
-  while (self->lookAhead != '\"') {
-    char current = self->lookAhead;
-    matchNoSkipWhite(self, self->lookAhead);
-    if (buffer_append_n(buffer, &current, 1) < 0) 
-      throwError(self, "Error appending");
-  }
-    
-  popErrorCleanup(self);
+  size_t start = self->sourceOffset;
+  while (peek(self) != '\"')
+    getChar(self);
+  
+  const char* string = copyString(self, start, self->sourceOffset - start);
   matchNoSkipWhite(self, '\"');
-  return buffer;
-
-error_push_cleanup:
-  buffer_free(buffer);
-  throwError(self, "Error pushing cleanup block");
-  return NULL;
+  return string;
 }
 
 static int getRegister(struct lexer* self) {
@@ -548,7 +372,7 @@ static int getRegister(struct lexer* self) {
 }
 
 static void process(struct lexer* self) {
-  switch (self->lookAhead) {
+  switch (peek(self)) {
     case '$':
       self->currentToken->type = TOKEN_REGISTER;
       self->currentToken->data.reg = getRegister(self);
@@ -575,7 +399,7 @@ static void process(struct lexer* self) {
       goto exit_common;
     case '/':
       self->currentToken->type = TOKEN_COMMENT;
-      self->currentToken->data.comment = getComment(self);
+      self->currentToken->data.commentLength = getComment(self);
       goto exit_common;
     case '\"':
       self->currentToken->type = TOKEN_STRING;
@@ -587,83 +411,177 @@ static void process(struct lexer* self) {
       goto exit_common;
   }
   
-  if (isIdentifierFirstLetter(self->lookAhead)) {
+  if (isIdentifierFirstLetter(peek(self))) {
     self->currentToken->type = TOKEN_IDENTIFIER;
     self->currentToken->data.identifier = getIdentifier(self);
     goto exit_common;
   }
-
+  
   throwError(self, "Unknown token");
   
 exit_common:
   return;
 }
 
-// volatile because longjmp and setjmp
-static int lexer_process_one(struct lexer* self, struct token** result) {
-  self->currentToken = malloc(sizeof(*self->currentToken));
-  if (self->currentToken == NULL)
-    return -ENOMEM;
-  *self->currentToken = (struct token) {};
+void lexer_release_tokens(struct lexer* self, size_t count) {
+  atomic_store_explicit(&self->releasedTokens, count, memory_order_release);
+}
+
+// Take oldest chunk if all of its tokens were released
+static struct lexer_token_chunk* reuseChunk(struct lexer* self) {
+  size_t releasedChunks = atomic_load_explicit(&self->releasedTokens, memory_order_acquire) / LEXER_TOKEN_CHUNK_SIZE;
+  if (self->firstLiveChunk >= releasedChunks)
+    return NULL;
   
-  int res = 0;
-  if (setjmp(self->onError) != 0) {
-    res = -EFAULT;
-    goto lexer_failure;
+  struct lexer_token_chunk* chunk = self->tokenChunks.data[self->firstLiveChunk];
+  self->tokenChunks.data[self->firstLiveChunk] = NULL;
+  self->firstLiveChunk++;
+  return chunk;
+}
+
+// Return storage for the next token, NULL if out of memory
+static struct token* newToken(struct lexer* self) {
+  if (self->tokenCount / LEXER_TOKEN_CHUNK_SIZE < self->tokenChunks.length)
+    goto have_space;
+  
+  struct lexer_token_chunk* chunk = reuseChunk(self);
+  if (!chunk && (chunk = allocator_malloc(sizeof(*chunk))) == NULL)
+    return NULL;
+  
+  if (vec_push(&self->tokenChunks, chunk) < 0) {
+    allocator_free(chunk);
+    return NULL;
   }
   
-  self->currentTokenBuffer = buffer_new();
-  if (self->currentTokenBuffer == NULL)
-    throwError(self, "Error creating token buffer");
-  
-  if (self->isFirstToken) {
-    self->isFirstToken = false;
-    
-    if (getCharAllowEOF(self) == -ENAVAIL)
-      goto early_eof;
-    
-    skipWhite(self);
-    
-    if (self->isEOF)
-      goto early_eof;
+have_space:
+  return lexer_get_token(self, self->tokenCount);
+}
+
+// Whitespace after previous token is skipped already, so
+// next token starts inside the range if it is skipped
+static void skipRanges(struct lexer* self) {
+  while (self->nextSkipRange < self->skipRangeCount && self->skipRanges[self->nextSkipRange].start <= self->sourceOffset) {
+    const struct lexer_skip_range* range = &self->skipRanges[self->nextSkipRange];
+    if (self->sourceOffset < range->end)
+      self->sourceOffset = range->end;
+    self->nextSkipRange++;
   }
+}
+
+static int lexer_process_one(struct lexer* self) {
+  skipRanges(self);
+  
+  struct token* token = newToken(self);
+  if (!token)
+    return -ENOMEM;
+  *token = (struct token) {
+    .offset = self->sourceOffset
+  };
+  self->currentToken = token;
   
-  // Move start position
-  self->startColumn = self->currentColumn;
-  self->startLine = self->currentLine;
+  if (setjmp(self->onError) != 0) {
+    self->currentToken = NULL;
+    return -EFAULT;
+  }
   
   process(self);
-  recordTokenInfo(self);
-  self->currentTokenBuffer = NULL;
   
+  size_t length = self->sourceOffset - token->offset;
+  token->length = length > UINT16_MAX ? UINT16_MAX : (uint16_t) length;
   skipWhite(self);
-
-  // Save to token struct storage allocated earlier
-  if (result)
-    *result = self->currentToken;
-
+  
   self->currentToken = NULL;
-  self->currentTokenBuffer = NULL;
-  return res;
+  self->tokenCount++;
+  if (self->output)
+    spsc_queue_push(self->output, token);
+  return 0;
+}
 
-lexer_failure:
-  recordTokenInfo(self);
+// Regular files are mapped instead of copied, lexing starts
+// right away and pages are read in as the lexer reaches them
+//
+// Return 0 if mapped, 1 if input has to be read instead
+// Errors:
+// -EFBIG: Input larger than LEXER_MAX_INPUT_SIZE
+static int mapInput(struct lexer* self) {
+  struct stat info;
+  if (fstat(fileno(self->input), &info) < 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+    return 1;
+  
+  // Size is known up front so reject before reading anything
+  if ((uintmax_t) info.st_size > LEXER_MAX_INPUT_SIZE)
+    return -EFBIG;
+  
+  // Mapping starts at beginning of file, the FILE may have
+  // been read from already
+  if (ftello(self->input) != 0)
+    return 1;
+  
+  size_t size = (size_t) info.st_size;
+  void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(self->input), 0);
+  if (mapping == MAP_FAILED)
+    return 1;
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  
+  self->mappedInput = mapping;
+  self->mappedSize = size;
+  self->source = mapping;
+  self->sourceSize = size;
+  return 0;
+}
+
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EFAULT: Read error (check errno for reason)
+// -EFBIG: Input larger than LEXER_MAX_INPUT_SIZE
+static int readInput(struct lexer* self) {
+  while (true) {
+    // Size of pipes isn't known, stop as soon as it is too large
+    if (self->inputCopy.size > LEXER_MAX_INPUT_SIZE)
+      return -EFBIG;
+  
+    char* space = byte_buffer_append_space(&self->inputCopy, READ_CHUNK_SIZE);
+    if (!space)
+      return -ENOMEM;
   
-  // Also free's self->currentTokenBuffer as
-  // self->currentTokenBuffer == self->currentToken->rawToken
-  // at this context
-  freeToken(self->currentToken);
+    size_t count = fread(space, 1, READ_CHUNK_SIZE, self->input);
+    self->inputCopy.size -= READ_CHUNK_SIZE - count;
+    if (count < READ_CHUNK_SIZE)
+      break;
+  }
   
-  self->currentTokenBuffer = NULL;
-  self->currentToken = NULL;
-  return res;
+  if (ferror(self->input) != 0)
+    return -EFAULT;
+  
+  self->source = self->inputCopy.data;
+  self->sourceSize = self->inputCopy.size;
+  return 0;
+}
 
-early_eof:
-  if (result)
-    *result = NULL;
-  freeToken(self->currentToken);
-  self->currentToken = NULL;
-  return res;
+// Get whole input in memory, token offsets refer to it
+static int prepareInput(struct lexer* self) {
+  if (setjmp(self->onError) != 0)
+    return -EFAULT;
+  
+  int res = self->input ? mapInput(self) : 0;
+  if (res == 1)
+    res = readInput(self);
+  
+  switch (res) {
+    case -ENOMEM:
+      throwError(self, "Not enough memory");
+    case -EFAULT:
+      throwError(self, "Read error: %d", errno);
+    case -EFBIG:
+      throwError(self, "Input too large");
+  }
+  
+  if (self->sourceSize > LEXER_MAX_INPUT_SIZE)
+    throwError(self, "Input too large");
+  
+  skipWhite(self);
+  return 0;
 }
 
 int lexer_process(struct lexer* self) {
@@ -671,27 +589,46 @@ int lexer_process(struct lexer* self) {
     return -EINVAL;
   self->isCompleted = true;
   
-  struct token* currentToken = NULL;
-  int res = 0;
-  while (!self->errorMessage && !self->isEOF) {
-    res = lexer_process_one(self, &currentToken);
-    if (res < 0) 
-      break;
+  int res = prepareInput(self);
+  while (res >= 0 && self->sourceOffset < self->sourceSize)
+    res = lexer_process_one(self);
+  return res;
+}
+
+void lexer_locate(const struct lexer* self, size_t offset, struct lexer_location* location) {
+  if (offset > self->sourceSize)
+    offset = self->sourceSize;
   
-    // if (currentToken->type == TOKEN_COMMENT) {
-    //   freeToken(currentToken);
-    //   continue;
-    // }
-    
-    // Successful call but return NULL token signals early EOF
-    if (!currentToken)
-      break;
-    
-    if (vec_push(&self->allTokens, currentToken) < 0)
-      return -ENOMEM;
+  // Nothing read yet
+  if (!self->source) {
+    *location = (struct lexer_location) LEXER_LOCATION_INIT;
+    return;
   }
   
-  return res;
+  // Lines before cached one are counted back from it unless
+  // the count stopped at LEXER_LOCATION_MAX
+  const char* source = self->source;
+  if (offset < location->lineStart && location->line == LEXER_LOCATION_MAX)
+    *location = (struct lexer_location) LEXER_LOCATION_INIT;
+  while (offset < location->lineStart) {
+    // Byte before line start is previous line's newline
+    const char* newline = memrchr(source, '\n', location->lineStart - 1);
+    location->line--;
+    location->lineStart = newline ? (size_t) (newline - source) + 1 : 0;
+  }
+  
+  const char* newline;
+  while ((newline = memchr(source + location->lineStart, '\n', offset - location->lineStart)) != NULL) {
+    if (location->line < LEXER_LOCATION_MAX)
+      location->line++;
+    location->lineStart = newline - source + 1;
+  }
+  
+  const char* lineEnd = memchr(source + location->lineStart, '\n', self->sourceSize - location->lineStart);
+  location->lineLength = (lineEnd ? (size_t) (lineEnd - source) : self->sourceSize) - location->lineStart;
+  
+  size_t column = offset - location->lineStart;
+  location->column = column > LEXER_LOCATION_MAX ? LEXER_LOCATION_MAX : (int) column;
 }
 
 const char* lexer_get_token_name(enum token_type type) {
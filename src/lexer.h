@@ -1,15 +1,22 @@
 #ifndef header_1664370723_b4e2d9a3_18aa_480b_8b90_6f19fc9e5a98_lexer_h
 #define header_1664370723_b4e2d9a3_18aa_480b_8b90_6f19fc9e5a98_lexer_h
 
-#include "buffer.h"
+#include "byte_buffer.h"
+#include "swiss_hashmap.h"
 #include "util.h"
 #include "vec.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <setjmp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 
+struct arena;
+struct spsc_queue;
+
 #define TOKEN_TYPE \
   X(TOKEN_UNKNOWN, "unknown") \
   X(TOKEN_REGISTER, "register") \
@@ -29,67 +36,147 @@ enum token_type {
 # undef X
 };
 
-struct token {
-  const char* filename;
-  int startColumn;
-  int startLine;
-  int endColumn;
-  int endLine;
+// Bits of token's offset, inputs up to 1 TiB
+#define LEXER_OFFSET_BITS 40
 
-  enum token_type type;
-  
-  buffer_t* rawToken;
-  buffer_t* fullLine;
+// Tokens are plain 16 byte values, everything variable sized
+// lives in the lexer and stays valid until it is reset
+//
+// Line and column aren't stored, find them with lexer_locate
+struct token {
+  uint64_t type : 8;
+  // Length of the raw token text, saturates at UINT16_MAX
+  // (only error messages use it)
+  uint64_t length : 16;
+  // Where the token starts in lexer's input
+  uint64_t offset : LEXER_OFFSET_BITS;
 
   union {
     int reg;
     int64_t immediate;
 
-    buffer_t* labelName;
-    buffer_t* string;
-    buffer_t* labelDeclName;
-    buffer_t* directiveName;
-    buffer_t* identifier;
-    buffer_t* comment;
+    // Names (but not strings) are interned, same name is
+    // always same pointer
+    const char* labelName;
+    const char* labelDeclName;
+    const char* directiveName;
+    const char* identifier;
+    const char* string;
+
+    // Comments aren't copied, text (without "/*" and "*/")
+    // is `commentLength` bytes of input at `offset` + 2
+    uint64_t commentLength;
   } data;
 };
 
-struct lexer {
-  int startLine;
-  int startColumn;
-  int currentLine;
-  int currentColumn;
-  int prevLine;
-  int prevColumn;
-
-  bool isFirstToken;
-  bool isThrowingError;
-  bool isEOF;
-  bool isCompleted;
+static_assert(sizeof(struct token) == 16);
+
+// Inputs larger than token offsets can point into are rejected
+#define LEXER_MAX_INPUT_SIZE ((UINT64_C(1) << LEXER_OFFSET_BITS) - 1)
+
+// Tokens are stored in chunks which never move, so pointers
+// to tokens stay valid while the lexer is still appending
+// (pipelined mode) and tokens next to each other in the
+// input are next to each other in memory. Chunks whose tokens
+// were all released are reused for new tokens
+#define LEXER_TOKEN_CHUNK_SIZE 4096
+
+struct lexer_token_chunk {
+  struct token tokens[LEXER_TOKEN_CHUNK_SIZE];
+};
+
+// Line and column (zero based) of some offset, also caches
+// where its line starts so looking up nearby offsets scans
+// only the input between them. Both stop counting at
+// LEXER_LOCATION_MAX (line tables and messages use int)
+#define LEXER_LOCATION_MAX (INT_MAX - 1)
+
+struct lexer_location {
+  int line;
+  int column;
 
-  char lookAhead;
+  size_t lineStart;
+  // Excluding the newline
+  size_t lineLength;
+};
+
+#define LEXER_LOCATION_INIT {.line = 0, .column = 0, .lineStart = 0, .lineLength = 0}
+
+// Part of input lexed as if it wasn't there, token starting
+// between `start` and `end` starts at `end` instead
+struct lexer_skip_range {
+  size_t start;
+  size_t end;
+};
 
+struct lexer {
   const char* inputName;
+  // NULL when lexing from memory (see lexer_new_buffer)
   FILE* input;
+  // Whole input, regular files are mapped into `mappedInput` and
+  // other FILE input (pipes, terminals) is read into `inputCopy`
+  const char* source;
+  size_t sourceSize;
+  // Number of bytes consumed so far (for both kinds of input)
+  size_t sourceOffset;
+  struct byte_buffer inputCopy;
+  void* mappedInput;
+  size_t mappedSize;
 
+  bool isCompleted;
   bool canFreeErrorMessage;
   const char* errorMessage;
 
   jmp_buf onError;
 
-  buffer_t* currentTokenBuffer;
   struct token* currentToken;
+
+  // Interned names plus copies of strings, kept until reset
+  // because `ldr` may refer to them in any later statement
+  struct arena* strings;
+  SWISS_HASHMAP(char, char) symbols;
+  // NUL terminated copy of name being interned
+  struct byte_buffer symbolKey;
+
+  // Released chunks are moved out of here (leaving NULL) and
+  // appended again once reused, live ones start at `firstLiveChunk`
+  vec_t(struct lexer_token_chunk*) tokenChunks;
+  size_t firstLiveChunk;
+  size_t tokenCount;
   
-  buffer_t* currentLineBuffer;
-  
-  vec_t(buffer_t*) allLines;
-  vec_t(struct token*) allTokens;
-  vec_t(runnable_block) cleanups;
+  // Written by consumer (see lexer_release_tokens)
+  atomic_size_t releasedTokens;
+
+  // If not NULL tokens are also pushed here as they are
+  // lexed (pipelined mode, NULL after reset). The queue
+  // isn't closed by the lexer
+  struct spsc_queue* output;
+
+  // Sorted and not overlapping ranges to skip (incremental
+  // reassembly), must be set before lexer_process and
+  // outlive it. NULL after reset
+  const struct lexer_skip_range* skipRanges;
+  size_t skipRangeCount;
+  size_t nextSkipRange;
 };
 
+// Token must not be released
+static inline struct token* lexer_get_token(const struct lexer* self, size_t index) {
+  return &self->tokenChunks.data[index / LEXER_TOKEN_CHUNK_SIZE]->tokens[index % LEXER_TOKEN_CHUNK_SIZE];
+}
+
 struct lexer* lexer_new(FILE* input, const char* inputName);
+
+// Lex directly from `source` which must outlive the lexer
+struct lexer* lexer_new_buffer(const char* source, size_t size, const char* inputName);
 void lexer_free(struct lexer* self);
 
+// Drop all tokens and lines and prepare the lexer for new input
+// as if it was newly created but keeping allocated capacity
+// Tokens from previous input are no longer valid after this
+void lexer_reset(struct lexer* self, FILE* input, const char* inputName);
+void lexer_reset_buffer(struct lexer* self, const char* source, size_t size, const char* inputName);
+
 // 0 on success
 //
 // Errors:
@@ -98,6 +185,16 @@ void lexer_free(struct lexer* self);
 // -EINVAL: Call on errored lexer instance
 int lexer_process(struct lexer* self);
 
+// Tokens before index `count` won't be used anymore so their
+// chunks can hold new tokens, `count` never decreases. Safe to
+// call from other thread while lexing (pipelined mode)
+void lexer_release_tokens(struct lexer* self, size_t count);
+
+// Fill `location` for `offset` in lexer's input, `location`
+// must be initialized (LEXER_LOCATION_INIT) and is used as
+// starting point, input is scanned only between the two
+void lexer_locate(const struct lexer* self, size_t offset, struct lexer_location* location);
+
 const char* lexer_get_token_name(enum token_type type);
 
 #endif
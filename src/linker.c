@@ -0,0 +1,432 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "linker.h"
+#include "allocator.h"
+#include "arena.h"
+#include "bytecode/bytecode.h"
+#include "bytecode/prototype.h"
+#include "bytecode/protobuf_loader.h"
+#include "config.h"
+#include "hashmap.h"
+#include "opcodes.h"
+#include "swiss_hashmap.h"
+#include "trace.h"
+#include "util.h"
+#include "vec.h"
+#include "vm_limits.h"
+#include "vm_types.h"
+
+struct linker_constant {
+  // Strings are borrowed from the object's loader
+  struct constant constant;
+  int index;
+};
+
+// Constants are compared bit by bit so 0.0 and -0.0
+// stay apart and same NaNs are merged
+static size_t hashConstant(const struct linker_constant* key) {
+  uint64_t bits = 0;
+  switch (key->constant.type) {
+    case BYTECODE_CONSTANT_STRING:
+      return swiss_hashmap_hash_string(key->constant.data.string) ^ BYTECODE_CONSTANT_STRING;
+    case BYTECODE_CONSTANT_INTEGER:
+      bits = (uint64_t) key->constant.data.integer;
+      break;
+    case BYTECODE_CONSTANT_NUMBER:
+      memcpy(&bits, &key->constant.data.number, sizeof(key->constant.data.number));
+      break;
+  }
+  
+  // Finalizer of splitmix64, mixes into both halves
+  bits ^= key->constant.type;
+  bits = (bits ^ (bits >> 30)) * 0xBF58476D1CE4E5B9ull;
+  bits = (bits ^ (bits >> 27)) * 0x94D049BB133111EBull;
+  return (size_t) (bits ^ (bits >> 31));
+}
+
+static int compareConstant(const struct linker_constant* a, const struct linker_constant* b) {
+  if (a->constant.type != b->constant.type)
+    return 1;
+  
+  switch (a->constant.type) {
+    case BYTECODE_CONSTANT_STRING:
+      return strcmp(a->constant.data.string, b->constant.data.string);
+    case BYTECODE_CONSTANT_INTEGER:
+      return a->constant.data.integer != b->constant.data.integer;
+    case BYTECODE_CONSTANT_NUMBER:
+      return memcmp(&a->constant.data.number, &b->constant.data.number, sizeof(a->constant.data.number));
+  }
+  return 1;
+}
+
+struct linker* linker_new() {
+  struct linker* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
+  
+  vec_init(&self->objects);
+  hashmap_init(&self->symbols, swiss_hashmap_hash_string, strcmp);
+  hashmap_init(&self->constants, hashConstant, compareConstant);
+  self->bytecode = NULL;
+  self->errorMessage = NULL;
+  
+  self->arena = arena_new(0);
+  if (!self->arena)
+    goto failure;
+  return self;
+
+failure:
+  linker_free(self);
+  return NULL;
+}
+
+static void freeObject(struct linker_object* object) {
+  bytecode_loader_free(object->loader);
+  allocator_free(object->symbols);
+  allocator_free(object->constantMap);
+  allocator_free((char*) object->name);
+  allocator_free(object);
+}
+
+void linker_free(struct linker* self) {
+  if (!self)
+    return;
+  
+  size_t i = 0;
+  struct linker_object* object = NULL;
+  vec_foreach(&self->objects, object, i)
+    freeObject(object);
+  vec_deinit(&self->objects);
+  
+  hashmap_cleanup(&self->symbols);
+  hashmap_cleanup(&self->constants);
+  arena_free(self->arena);
+  allocator_free(self->errorMessage);
+  allocator_free(self);
+}
+
+ATTRIBUTE_PRINTF(2, 3)
+static int setError(struct linker* self, const char* fmt, ...) {
+  allocator_free(self->errorMessage);
+  self->errorMessage = NULL;
+  
+  va_list args;
+  va_start(args, fmt);
+  util_vasprintf(&self->errorMessage, fmt, args);
+  va_end(args);
+  return -EFAULT;
+}
+
+static const char* getLoadError(int res) {
+  switch (res) {
+    case -ENOTSUP:
+      return "Unsupported bytecode version or features";
+    case -EINVAL:
+      return "Malformed object";
+    default:
+      return "Unknown error";
+  }
+}
+
+static void removeSymbols(struct linker* self, struct linker_object* object, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    hashmap_remove(&self->symbols, object->symbols[i].prototype->prototypeName);
+}
+
+static int addSymbols(struct linker* self, struct linker_object* object) {
+  struct prototype* mainPrototype = object->bytecode->mainPrototype;
+  if (mainPrototype->prototypes.length == 0)
+    return 0;
+  
+  if ((object->symbols = allocator_malloc(mainPrototype->prototypes.length * sizeof(*object->symbols))) == NULL)
+    return -ENOMEM;
+  
+  int res = 0;
+  size_t i = 0;
+  struct prototype* prototype = NULL;
+  vec_foreach(&mainPrototype->prototypes, prototype, i) {
+    struct linker_symbol* existing = hashmap_get(&self->symbols, prototype->prototypeName);
+    if (existing) {
+      res = setError(self, "%s: Prototype '%s' already defined in '%s'", object->name, prototype->prototypeName, existing->object->name);
+      goto failure;
+    }
+  
+    object->symbols[i] = (struct linker_symbol) {
+      .object = object,
+      .prototype = prototype,
+      .isCopying = false
+    };
+    if (hashmap_put(&self->symbols, prototype->prototypeName, &object->symbols[i]) < 0) {
+      res = -ENOMEM;
+      goto failure;
+    }
+  }
+  return 0;
+
+failure:
+  removeSymbols(self, object, i);
+  return res;
+}
+
+int linker_add_object(struct linker* self, const char* name, const void* data, size_t size) {
+  int res = 0;
+  struct linker_object* object = allocator_malloc(sizeof(*object));
+  if (!object)
+    return -ENOMEM;
+  
+  object->loader = NULL;
+  object->symbols = NULL;
+  object->constantMap = NULL;
+  object->name = allocator_strdup(name);
+  if (!object->name) {
+    res = -ENOMEM;
+    goto failure;
+  }
+  
+  if ((object->loader = bytecode_loader_new(data, size)) == NULL) {
+    res = -ENOMEM;
+    goto failure;
+  }
+  
+  // Every prototype may end up copied so decode all at once
+  object->loader->allowUnlinked = true;
+  if ((res = bytecode_loader_load(object->loader, &object->bytecode)) < 0 ||
+      (res = bytecode_loader_decode_all(object->loader)) < 0) {
+    if (res != -ENOMEM)
+      res = setError(self, "%s: Cannot load object: %s", name, getLoadError(res));
+    goto failure;
+  }
+  
+  size_t constantCount = object->bytecode->constants.length;
+  if (constantCount > 0 && (object->constantMap = allocator_malloc(constantCount * sizeof(*object->constantMap))) == NULL) {
+    res = -ENOMEM;
+    goto failure;
+  }
+  
+  if (vec_push(&self->objects, object) < 0) {
+    res = -ENOMEM;
+    goto failure;
+  }
+  
+  if ((res = addSymbols(self, object)) < 0) {
+    vec_pop(&self->objects);
+    goto failure;
+  }
+  return 0;
+
+failure:
+  freeObject(object);
+  return res;
+}
+
+static int internConstant(struct linker* self, const struct constant* constant) {
+  struct linker_constant key = {.constant = *constant};
+  struct linker_constant* entry = hashmap_get(&self->constants, &key);
+  if (entry)
+    return entry->index;
+  
+  // Result owns copy of strings, bytecode_free frees them
+  int index;
+  if (constant->type == BYTECODE_CONSTANT_STRING)
+    index = bytecode_add_constant_string(self->bytecode, constant->data.string);
+  else
+    index = bytecode_add_constant_generic(self->bytecode, *constant);
+  if (index < 0)
+    return index;
+  
+  if ((entry = arena_alloc(self->arena, sizeof(*entry))) == NULL)
+    return -ENOMEM;
+  *entry = (struct linker_constant) {
+    .constant = *constant,
+    .index = index
+  };
+  
+  if (hashmap_put(&self->constants, entry, entry) < 0)
+    return -ENOMEM;
+  return index;
+}
+
+// Point LOAD_CONSTANT at the constant's index in the result
+static int remapConstant(struct linker* self, struct linker_object* object, struct prototype* prototype, vm_instruction* instruction) {
+  bool isShort = OP_IS_SHORT(*instruction);
+  if (((*instruction >> 56) & ~OP_SHORT_FLAG) != FLUFFYVM_OPCODE_LOAD_CONSTANT)
+    return 0;
+  
+  uint32_t index = isShort ? (uint32_t) ((*instruction >> 32) & 0xFFFF) : (uint32_t) *instruction;
+  if (index >= object->bytecode->constants.length)
+    return setError(self, "%s: Constant %" PRIu32 " loaded in '%s' doesn't exist", object->name, index, prototype->prototypeName);
+  
+  int mapped = object->constantMap[index];
+  if (mapped < 0) {
+    if ((mapped = internConstant(self, &object->bytecode->constants.data[index])) == -ENOSPC)
+      return setError(self, "Too many constants");
+    if (mapped < 0)
+      return mapped;
+    object->constantMap[index] = mapped;
+  }
+  
+  // Changing instruction's size would move the jumps
+  if (isShort && mapped > OP_SHORT_MAX_U16)
+    return setError(self, "%s: Constant loaded in '%s' doesn't fit short instruction after merging, assemble without compact instructions",
+                    object->name, prototype->prototypeName);
+  
+  if (isShort)
+    *instruction = (*instruction & ~OP_SHORT_B_16(0xFFFF)) | OP_SHORT_B_16((uint32_t) mapped);
+  else
+    *instruction = (*instruction & ~OP_ARG_B_U16_U32(0xFFFF'FFFF)) | OP_ARG_B_U16_U32((uint32_t) mapped);
+  return 0;
+}
+
+static int copyPrototype(struct linker* self, struct linker_object* object, struct prototype* source, struct prototype** result);
+
+// Return index of child prototype which `name` resolves to in
+// `prototype`, copying the symbol there if this is first
+// reference to it from `prototype`
+static int64_t resolveReference(struct linker* self, struct linker_object* object, struct prototype* prototype, size_t ownChildCount, const char* name) {
+  // Own childs would have been resolved by the assembler
+  for (size_t i = ownChildCount; i < prototype->prototypes.length; i++)
+    if (strcmp(prototype->prototypes.data[i]->prototypeName, name) == 0)
+      return i;
+  
+  struct linker_symbol* symbol = hashmap_get(&self->symbols, name);
+  if (!symbol)
+    return setError(self, "%s: Undefined prototype '%s' referenced in '%s'", object->name, name, prototype->prototypeName);
+  if (symbol->isCopying)
+    return setError(self, "%s: Prototype '%s' referenced in '%s' contains the reference", object->name, name, prototype->prototypeName);
+  if (prototype->prototypes.length >= VM_LIMIT_MAX_PROTOTYPE)
+    return setError(self, "%s: Too many prototypes in '%s'", object->name, prototype->prototypeName);
+  
+  struct prototype* copy = NULL;
+  symbol->isCopying = true;
+  int res = copyPrototype(self, symbol->object, symbol->prototype, &copy);
+  symbol->isCopying = false;
+  if (res < 0)
+    return res;
+  
+  if (vec_push(&prototype->prototypes, copy) < 0) {
+    prototype_free(copy);
+    return -ENOMEM;
+  }
+  return prototype->prototypes.length - 1;
+}
+
+static int copyPrototype(struct linker* self, struct linker_object* object, struct prototype* source, struct prototype** result) {
+  int res = 0;
+  // Unknown if debug info was stripped
+  const char* sourceFile = source->sourceFile ? source->sourceFile : object->name;
+  struct prototype* copy = prototype_new(sourceFile, source->prototypeName, source->definedAtLine, source->definedAtColumn);
+  if (!copy)
+    return -ENOMEM;
+  copy->isCompact = source->isCompact;
+  
+  if (vec_reserve(&copy->instructions, source->instructions.length) < 0 ||
+      vec_reserve(&copy->instructionLines, source->instructionLines.length) < 0 ||
+      vec_reserve(&copy->prototypes, source->prototypes.length) < 0) {
+    res = -ENOMEM;
+    goto failure;
+  }
+  vec_extend(&copy->instructions, &source->instructions);
+  vec_extend(&copy->instructionLines, &source->instructionLines);
+  
+  size_t i = 0;
+  vm_instruction* instruction = NULL;
+  vec_foreach_ptr(&copy->instructions, instruction, i)
+    if ((res = remapConstant(self, object, copy, instruction)) < 0)
+      goto failure;
+  
+  struct prototype* child = NULL;
+  vec_foreach(&source->prototypes, child, i) {
+    struct prototype* childCopy = NULL;
+    if ((res = copyPrototype(self, object, child, &childCopy)) < 0)
+      goto failure;
+    
+    // Reserved above, cannot fail
+    vec_push(&copy->prototypes, childCopy);
+  }
+  
+  // Same as parser_stage2 does for prototypes it knows
+  size_t ownChildCount = copy->prototypes.length;
+  struct prototype_reference* reference = NULL;
+  vec_foreach_ptr(&source->references, reference, i) {
+    int64_t location = resolveReference(self, object, copy, ownChildCount, reference->symbolName);
+    if (location < 0) {
+      res = (int) location;
+      goto failure;
+    }
+  
+    vm_instruction* placeholder = &copy->instructions.data[reference->instruction];
+    *placeholder = OP_ARG_OPCODE(FLUFFYVM_OPCODE_LOAD_PROTOTYPE) |
+                   OP_ARG_COND((*placeholder & 0x00FF'0000'0000'0000l) >> 48) |
+                   OP_ARG_A_U16_U32((*placeholder & 0x0000'FFFF'0000'0000l) >> 32) |
+                   OP_ARG_B_U16_U32((uint32_t) location);
+  }
+  
+  *result = copy;
+  return 0;
+
+failure:
+  prototype_free(copy);
+  return res;
+}
+
+// Only definitions may come from other objects, their
+// code would have nowhere to run
+static int checkObjects(struct linker* self) {
+  if (self->objects.length == 0)
+    return setError(self, "No objects to link");
+  
+  for (size_t i = 1; i < self->objects.length; i++) {
+    struct linker_object* object = self->objects.data[i];
+    struct prototype* mainPrototype = object->bytecode->mainPrototype;
+    if (mainPrototype->instructions.length > 0)
+      return setError(self, "%s: Only first object can have top level code", object->name);
+  }
+  return 0;
+}
+
+int linker_link(struct linker* self, struct bytecode** result) {
+  int res = 0;
+  struct trace_span span;
+  trace_span_begin(&span, "stage", "link");
+  
+  *result = NULL;
+  allocator_free(self->errorMessage);
+  self->errorMessage = NULL;
+  if ((res = checkObjects(self)) < 0)
+    goto check_failure;
+  
+  // Earlier link's constant indices mean nothing now, never
+  // used map has no table yet
+  if (hashmap_size(&self->constants) > 0)
+    hashmap_clear(&self->constants);
+  arena_reset(self->arena);
+  
+  size_t i = 0;
+  struct linker_object* object = NULL;
+  vec_foreach(&self->objects, object, i)
+    for (size_t constant = 0; constant < object->bytecode->constants.length; constant++)
+      object->constantMap[constant] = -1;
+  
+  if ((self->bytecode = bytecode_new()) == NULL) {
+    res = -ENOMEM;
+    goto bytecode_alloc_failure;
+  }
+  
+  struct linker_object* entry = self->objects.data[0];
+  if ((res = copyPrototype(self, entry, entry->bytecode->mainPrototype, &self->bytecode->mainPrototype)) < 0) {
+    bytecode_free(self->bytecode);
+    self->bytecode = NULL;
+  }
+  
+  *result = self->bytecode;
+  self->bytecode = NULL;
+bytecode_alloc_failure:
+check_failure:
+  trace_span_end(&span);
+  return res;
+}
@@ -0,0 +1,92 @@
+#ifndef _headers_1668379120_Fluff_Assembler_linker
+#define _headers_1668379120_Fluff_Assembler_linker
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hashmap.h"
+#include "swiss_hashmap.h"
+#include "vec.h"
+
+// Links object files (assembled with `object` in
+// assembler_driver_options) into one bytecode
+//
+// Top level prototypes (childs of each object's main
+// prototype) are the symbols. First object added is the
+// entry, its main prototype becomes the result's main
+// prototype while other objects' main prototypes may only
+// hold definitions
+//
+// LOAD_PROTOTYPE can only load childs of current prototype
+// so a reference is resolved by copying the symbol as new
+// child of the prototype which references it. Only symbols
+// referenced from the entry end up in the result, once per
+// prototype referencing them. Constants used by them are
+// merged into one pool without duplicates
+//
+// Plain bytecode is an object without references
+
+struct arena;
+struct bytecode;
+struct bytecode_loader;
+struct prototype;
+struct linker_constant;
+struct linker_object;
+
+struct linker_symbol {
+  struct linker_object* object;
+  struct prototype* prototype;
+
+  // Being copied, reference to it from inside the copy
+  // would never end
+  bool isCopying;
+};
+
+struct linker_object {
+  const char* name;
+  struct bytecode_loader* loader;
+  struct bytecode* bytecode;
+
+  // One for each top level prototype
+  struct linker_symbol* symbols;
+
+  // Index of each constant in the result, -1 until used
+  int* constantMap;
+};
+
+struct linker {
+  vec_t(struct linker_object*) objects;
+  SWISS_HASHMAP(char, struct linker_symbol) symbols;
+
+  // Result's constants for deduplication, entries
+  // are allocated from `arena`
+  SWISS_HASHMAP(struct linker_constant, struct linker_constant) constants;
+  struct bytecode* bytecode;
+  struct arena* arena;
+
+  // Why last call failed (NULL if out of memory)
+  char* errorMessage;
+};
+
+struct linker* linker_new();
+void linker_free(struct linker* self);
+
+// `data` must be kept alive until linker_free, `name` is
+// only used in error messages
+// Return 0 on success
+// Errors:
+// -EFAULT: Object cannot be loaded or defines a symbol
+//          already defined by earlier one
+// -ENOMEM: Not enough memory
+int linker_add_object(struct linker* self, const char* name, const void* data, size_t size);
+
+// `result` must be free'd with bytecode_free
+// Return 0 on success
+// Errors:
+// -EFAULT: Failure linking (undefined or recursive reference,
+//          no objects, too many constants or prototypes...)
+// -ENOMEM: Not enough memory
+int linker_link(struct linker* self, struct bytecode** result);
+
+#endif
+
@@ -0,0 +1,193 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lz_block.h"
+
+#define HASH_LOG 12
+#define HASH_SIZE (1 << HASH_LOG)
+#define MAX_OFFSET 65535
+
+// Like LZ4 the last few bytes are always literals
+// so matches never run to the very end
+#define LAST_LITERALS 5
+#define MATCH_FIND_LIMIT 12
+
+#define FAST_COPY_SIZE 16
+
+static inline uint32_t read32(const uint8_t* ptr) {
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+static inline uint32_t hash32(uint32_t value) {
+  return (value * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static uint8_t* writeLength(uint8_t* op, size_t len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t) len;
+  return op;
+}
+
+static uint8_t* writeSequence(uint8_t* op, const uint8_t* literals, size_t literalLen, size_t offset, size_t matchLen, bool isLast) {
+  uint8_t* token = op++;
+  *token = (uint8_t) ((literalLen >= 15 ? 15 : literalLen) << 4);
+  if (literalLen >= 15)
+    op = writeLength(op, literalLen - 15);
+
+  memcpy(op, literals, literalLen);
+  op += literalLen;
+
+  if (isLast)
+    return op;
+
+  *op++ = (uint8_t) (offset & 0xFF);
+  *op++ = (uint8_t) (offset >> 8);
+
+  matchLen -= LZ_BLOCK_MIN_MATCH;
+  *token |= (uint8_t) (matchLen >= 15 ? 15 : matchLen);
+  if (matchLen >= 15)
+    op = writeLength(op, matchLen - 15);
+  return op;
+}
+
+size_t lz_block_compress_bound(size_t size) {
+  // Incompressible input ends up as one literal run
+  return size + size / 255 + 16;
+}
+
+size_t lz_block_compress(const void* src, size_t srcSize, void* dst) {
+  const uint8_t* input = src;
+  uint8_t* op = dst;
+
+  // Position + 1 of last occurence of the hash, 0 is empty
+  uint32_t table[HASH_SIZE] = {};
+
+  size_t anchor = 0;
+  if (srcSize > MATCH_FIND_LIMIT) {
+    size_t matchLimit = srcSize - MATCH_FIND_LIMIT;
+    size_t extendLimit = srcSize - LAST_LITERALS;
+    size_t ip = 0;
+
+    while (ip < matchLimit) {
+      uint32_t sequence = read32(input + ip);
+      uint32_t hash = hash32(sequence);
+      size_t ref = table[hash];
+      table[hash] = (uint32_t) (ip + 1);
+
+      if (ref == 0 || ip - (ref - 1) > MAX_OFFSET || read32(input + ref - 1) != sequence) {
+        // Skip faster through incompressible parts
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+      ref--;
+
+      size_t matchLen = LZ_BLOCK_MIN_MATCH;
+      while (ip + matchLen < extendLimit && input[ref + matchLen] == input[ip + matchLen])
+        matchLen++;
+
+      op = writeSequence(op, input + anchor, ip - anchor, ip - ref, matchLen, false);
+      ip += matchLen;
+      anchor = ip;
+
+      // Index a position inside the match so next
+      // repeating pattern can still be found
+      if (ip - 2 < matchLimit)
+        table[hash32(read32(input + ip - 2))] = (uint32_t) (ip - 2 + 1);
+    }
+  }
+
+  op = writeSequence(op, input + anchor, srcSize - anchor, 0, 0, true);
+  return (size_t) (op - (uint8_t*) dst);
+}
+
+static inline int readLength(const uint8_t** ip, const uint8_t* end, size_t* len) {
+  uint8_t byte;
+  do {
+    if (*ip >= end)
+      return -EINVAL;
+    byte = *(*ip)++;
+    *len += byte;
+  } while (byte == 255);
+  return 0;
+}
+
+int lz_block_decompress(const void* src, size_t srcSize, void* dst, size_t dstSize) {
+  const uint8_t* ip = src;
+  const uint8_t* iend = ip + srcSize;
+  uint8_t* op = dst;
+  uint8_t* oend = op + dstSize;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    size_t literalLen = token >> 4;
+    if (literalLen == 15 && readLength(&ip, iend, &literalLen) < 0)
+      return -EINVAL;
+    if (literalLen > (size_t) (iend - ip) || literalLen > (size_t) (oend - op))
+      return -EINVAL;
+
+    // Short runs are the common case, copying fixed 16 bytes
+    // is faster than variable sized copy and the extra bytes
+    // written are overwritten later
+    if (literalLen <= FAST_COPY_SIZE && iend - ip >= FAST_COPY_SIZE && oend - op >= FAST_COPY_SIZE)
+      memcpy(op, ip, FAST_COPY_SIZE);
+    else
+      memcpy(op, ip, literalLen);
+    ip += literalLen;
+    op += literalLen;
+
+    // Last sequence has no match part
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return -EINVAL;
+    size_t offset = (size_t) ip[0] | (size_t) ip[1] << 8;
+    ip += 2;
+    if (offset == 0 || offset > (size_t) (op - (uint8_t*) dst))
+      return -EINVAL;
+
+    size_t matchLen = token & 0x0F;
+    if (matchLen == 15 && readLength(&ip, iend, &matchLen) < 0)
+      return -EINVAL;
+    matchLen += LZ_BLOCK_MIN_MATCH;
+    if (matchLen > (size_t) (oend - op))
+      return -EINVAL;
+
+    const uint8_t* match = op - offset;
+    if (matchLen <= FAST_COPY_SIZE && offset >= FAST_COPY_SIZE && oend - op >= FAST_COPY_SIZE) {
+      memcpy(op, match, FAST_COPY_SIZE);
+      op += matchLen;
+    } else if (offset >= matchLen) {
+      memcpy(op, match, matchLen);
+      op += matchLen;
+    } else if (offset >= 8) {
+      // Overlapping but each 8 bytes chunk doesn't
+      uint8_t* matchEnd = op + matchLen;
+      while (matchEnd - op >= 8) {
+        memcpy(op, match, 8);
+        op += 8;
+        match += 8;
+      }
+      while (op < matchEnd)
+        *op++ = *match++;
+    } else {
+      // Short repeating pattern (mostly runs of same byte)
+      for (size_t i = 0; i < matchLen; i++)
+        op[i] = match[i];
+      op += matchLen;
+    }
+  }
+
+  if (op != oend)
+    return -EINVAL;
+  return 0;
+}
+
@@ -0,0 +1,40 @@
+#ifndef _headers_1667391027_Fluff_Assembler_lz_block
+#define _headers_1667391027_Fluff_Assembler_lz_block
+
+#include <stddef.h>
+
+// Small LZ77 block codec (LZ4 style byte oriented sequences) used
+// for compressing instruction streams. Decoder is the priority
+// here so the format only has byte aligned fields
+//
+// Block is sequence of
+//   token    : 1 byte, high nibble literal length, low nibble
+//              match length minus LZ_BLOCK_MIN_MATCH (15 means
+//              more length bytes follow)
+//   literal length bytes (if literal nibble is 15, bytes of 255
+//              continues, last one is less than 255)
+//   literals
+//   offset   : 2 bytes little endian (omitted in last sequence)
+//   match length bytes (same as literal length bytes)
+//
+// Last sequence only contains literals
+
+#define LZ_BLOCK_MIN_MATCH 4
+
+// Worst case compressed size for `size` bytes of input
+size_t lz_block_compress_bound(size_t size);
+
+// Compress `src` into `dst` which must be at least
+// lz_block_compress_bound(srcSize) large
+// Return compressed size
+size_t lz_block_compress(const void* src, size_t srcSize, void* dst);
+
+// Decompress `src` into `dst` which must be exactly `dstSize`
+// bytes after decompression
+// Return 0 on success
+// Errors:
+// -EINVAL: Malformed or truncated input or size mismatch
+int lz_block_decompress(const void* src, size_t srcSize, void* dst, size_t dstSize);
+
+#endif
+
@@ -1,9 +1,31 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
-#include <time.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
 
+#include "allocator.h"
+#include "assembler_cache.h"
+#include "assembler_context.h"
 #include "assembler_driver.h"
+#include "assembler_stats.h"
+#include "batch_assembler.h"
+#include "client.h"
+#include "bench.h"
+#include "byte_buffer.h"
+#include "bytecode/bytecode.h"
+#include "bytecode/protobuf_serializer.h"
+#include "constants.h"
+#include "incremental_cache.h"
+#include "linker.h"
+#include "perf_counters.h"
+#include "server.h"
+#include "trace.h"
+#include "tracking_allocator.h"
+#include "util.h"
+#include "vec.h"
 
 /*
 Pipeline for source to bytecode generation
@@ -21,59 +43,702 @@ Parser Stage 1
 Source file
 */
 
-int main2(int argc, char** argv) {
-  if (argc < 3) {
-    printf("Usage: %s <source> <result>\n", argv[0]);
-    return EXIT_FAILURE;
+// Allocation sites shown by plain --alloc-stats
+#define DEFAULT_ALLOC_TOP_SITES 10
+
+static void printUsage(const char* name) {
+  printf("Usage: %s [options] <source> <result>\n", name);
+  printf("       %s [options] --batch [--jobs=<n>] [--manifest=<file>] [<source> <result>...]\n", name);
+  printf("       %s [options] --link <result> <objects...>\n", name);
+  printf("       %s --cache-dir=<dir> --cache-evict=<size>\n", name);
+  printf("       %s --server=<socket>\n", name);
+  printf("       %s --bench <benchmark> [args...]\n", name);
+  printf("\n");
+  printf("Options:\n");
+  printf("  --format-v1   Emit version 1 bytecode (unpacked instructions, no line info)\n");
+  printf("  --compress    Compress instruction streams (needs a reader with compression support)\n");
+  printf("  --compact     Use 32-bit short instructions where possible (needs a reader with compact support)\n");
+  printf("  --pipeline    Run lexer and both parser stages concurrently on separate threads\n");
+  printf("  --object      Emit object file for --link, prototypes defined in other sources can be loaded\n");
+  printf("  --incremental Keep <result without extension>%s and only assemble prototypes changed since\n", INCREMENTAL_CACHE_EXTENSION);
+  printf("                the last run, rest are copied from it\n");
+  printf("  --serialize-jobs=<n>\n");
+  printf("                Convert and pack large bytecode on <n> threads (0 for number of processors, default 1)\n");
+  printf("  --debug-info=<inline|sidecar|strip>\n");
+  printf("                Where line tables go, sidecar writes them to <result without extension>%s\n", BYTECODE_DEBUG_INFO_EXTENSION);
+  printf("  --connect=<socket>\n");
+  printf("                Assemble through server listening at <socket> instead of in process\n");
+  printf("  --cache-dir=<dir>\n");
+  printf("                Reuse outputs of identical earlier assembles from <dir> (created if missing)\n");
+  printf("  --cache-evict=<size>\n");
+  printf("                Trim least recently used entries until <dir> is at most <size> bytes (K, M, G suffix allowed)\n");
+  printf("  --stats[=text|json]\n");
+  printf("                Print per stage wall and CPU time and counters to stderr\n");
+  printf("  --alloc-stats[=<n>]\n");
+  printf("                Print allocations and peak heap per stage and top <n> allocation sites (default %d) to stderr\n", DEFAULT_ALLOC_TOP_SITES);
+  printf("  --perf-counters\n");
+  printf("                Add cycles, instructions, branch and cache misses per stage to --stats (Linux only)\n");
+  printf("  --trace=<file>\n");
+  printf("                Write timeline of stages and prototypes as Chrome trace event JSON (for chrome://tracing or Perfetto)\n");
+  printf("\n");
+  printf("Batch mode:\n");
+  printf("  --batch           Assemble every <source> <result> pair in one process\n");
+  printf("  --manifest=<file> Read more pairs from file, one '<source> <result>' per line (implies --batch)\n");
+  printf("  --jobs=<n>        Number of threads to use (default: number of processors)\n");
+  printf("\n");
+  printf("Link mode:\n");
+  printf("  --link        Link objects into <result>, first object's top level code is the entry and\n");
+  printf("                prototypes it loads from other objects are copied in (--format-v1, --compress,\n");
+  printf("                --debug-info and --serialize-jobs apply to <result>)\n");
+  printf("\n");
+  printf("Benchmarks:\n");
+  printf("  compression <bytecode files...>\n");
+  printf("  context [iterations] [source file]\n");
+  printf("  suite [--size=<n>] [--iterations=<n>] [--output=<file>] [--pipeline] [workloads...]\n");
+  printf("  generate <workload> <size> <output>\n");
+}
+
+// dir/name.fluff_bin -> dir/name.fluff_dbg
+static char* getSidecarPath(const char* outputFile) {
+  const char* basename = strrchr(outputFile, '/');
+  basename = basename ? basename + 1 : outputFile;
+  
+  const char* extension = strrchr(basename, '.');
+  int length = extension ? (int) (extension - outputFile) : (int) strlen(outputFile);
+  
+  char* path = NULL;
+  util_asprintf(&path, "%.*s%s", length, outputFile, BYTECODE_DEBUG_INFO_EXTENSION);
+  return path;
+}
+
+static const struct {
+  const char* name;
+  int (*run)(int argc, char** argv);
+} benchmarks[] = {
+  {"compression", bench_compression},
+  {"context", bench_context},
+  {"suite", bench_suite},
+  {"generate", bench_generate},
+  {"stress", bench_stress},
+  {"hashmap", bench_hashmap}
+};
+
+static int runBenchmark(const char* programName, int argc, char** argv) {
+  if (argc < 1)
+    goto invalid_usage;
+  
+  for (int i = 0; i < ARRAY_SIZE(benchmarks); i++)
+    if (strcmp(argv[0], benchmarks[i].name) == 0)
+      return benchmarks[i].run(argc - 1, argv + 1);
+  
+  printf("Unknown benchmark '%s'\n", argv[0]);
+invalid_usage:
+  printUsage(programName);
+  return EXIT_FAILURE;
+}
+
+#define BATCH_MAX_THREADS 1024
+
+typedef vec_t(struct batch_assembler_job) batch_job_vec;
+
+static void freeJobs(batch_job_vec* jobs) {
+  struct batch_assembler_job* job;
+  size_t i;
+  vec_foreach_ptr(jobs, job, i) {
+    allocator_free((char*) job->inputPath);
+    allocator_free((char*) job->outputPath);
+    allocator_free((char*) job->debugInfoPath);
   }
+  batch_assembler_cleanup(jobs->data, jobs->length);
+  vec_deinit(jobs);
+}
+
+static int addJob(batch_job_vec* jobs, const char* inputPath, const char* outputPath, bool debugInfoSidecar) {
+  struct batch_assembler_job job = {
+    .inputPath = allocator_strdup(inputPath),
+    .outputPath = allocator_strdup(outputPath),
+    .debugInfoPath = debugInfoSidecar ? getSidecarPath(outputPath) : NULL
+  };
   
-  int exitRes = EXIT_SUCCESS;
-  const char* inputFile = argv[1];
-  const char* outputFile = argv[2];
-  FILE* input = NULL;
-  FILE* output = NULL;
+  if (!job.inputPath || !job.outputPath || (debugInfoSidecar && !job.debugInfoPath))
+    goto alloc_failure;
+  if (vec_push(jobs, job) < 0)
+    goto alloc_failure;
+  return 0;
+
+alloc_failure:
+  allocator_free((char*) job.inputPath);
+  allocator_free((char*) job.outputPath);
+  allocator_free((char*) job.debugInfoPath);
+  return -ENOMEM;
+}
+
+// Each non empty line is "<source> <result>", lines
+// starting with '#' are comments
+static int readManifest(batch_job_vec* jobs, const char* path, bool debugInfoSidecar) {
+  FILE* manifest = fopen(path, "r");
+  if (!manifest) {
+    printf("Cannot open manifest '%s'!\n", path);
+    return -EIO;
+  }
   
-  if ((input = fopen(inputFile, "r")) == NULL) {
-    printf("Cannot open input file!");
-    exitRes = EXIT_FAILURE;
-    goto input_open_failure;
+  int res = 0;
+  char* line = NULL;
+  size_t lineSize = 0;
+  for (int lineNumber = 1; getline(&line, &lineSize, manifest) != -1; lineNumber++) {
+    char* savePtr = NULL;
+    const char* inputPath = strtok_r(line, " \t\r\n", &savePtr);
+    if (!inputPath || inputPath[0] == '#')
+      continue;
+    
+    const char* outputPath = strtok_r(NULL, " \t\r\n", &savePtr);
+    if (!outputPath || strtok_r(NULL, " \t\r\n", &savePtr)) {
+      printf("%s:%d: Expected '<source> <result>'\n", path, lineNumber);
+      res = -EINVAL;
+      break;
+    }
+    
+    if ((res = addJob(jobs, inputPath, outputPath, debugInfoSidecar)) < 0) {
+      printf("Not enough memory!\n");
+      break;
+    }
   }
   
-  if ((output = fopen(outputFile, "w")) == NULL) {
-    printf("Cannot open output file!");
-    exitRes = EXIT_FAILURE;
-    goto output_open_failure;
+  if (res >= 0 && ferror(manifest)) {
+    printf("Cannot read manifest '%s'!\n", path);
+    res = -EIO;
   }
+  
+  free(line);
+  fclose(manifest);
+  return res;
+}
 
-  void* compiled = NULL;
+static int runBatch(int argc, char** argv, const struct assembler_driver_options* options, bool debugInfoSidecar, const char* manifestPath, int threadCount, struct assembler_cache* cache) {
+  int exitRes = EXIT_FAILURE;
+  batch_job_vec jobs;
+  vec_init(&jobs);
+  
+  const char* inputPath = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) == 0)
+      continue;
+    
+    if (!inputPath) {
+      inputPath = argv[i];
+      continue;
+    }
+    
+    if (addJob(&jobs, inputPath, argv[i], debugInfoSidecar) < 0) {
+      printf("Not enough memory!\n");
+      goto failure;
+    }
+    inputPath = NULL;
+  }
+  
+  if (manifestPath && readManifest(&jobs, manifestPath, debugInfoSidecar) < 0)
+    goto failure;
+  
+  if (jobs.length == 0) {
+    printf("Nothing to assemble\n");
+    goto failure;
+  }
+  
+  struct batch_assembler_stats stats;
+  int res = batch_assembler_run(jobs.data, jobs.length, threadCount, options, cache, &stats);
+  if (res < 0) {
+    printf("Cannot start batch: %d\n", res);
+    goto failure;
+  }
+  
+  struct batch_assembler_job* job;
+  size_t i;
+  vec_foreach_ptr(&jobs, job, i)
+    if (job->result < 0)
+      printf("%s: Assembler failure: %s\n", job->inputPath, job->errorMessage ? job->errorMessage : "Not enough memory");
+  
+  printf("Assembled %zu of %zu files (%zu bytes) in %.2lf miliseconds on %d threads\n",
+         stats.succeeded, jobs.length, stats.totalSize, stats.wallTime * 1000, stats.threadCount);
+  printf("Total assembler time %.2lf miliseconds, %.2lf miliseconds per file\n",
+         stats.busyTime * 1000, stats.busyTime * 1000 / jobs.length);
+  
+  if (stats.failed == 0)
+    exitRes = EXIT_SUCCESS;
+
+failure:
+  freeJobs(&jobs);
+  return exitRes;
+}
+
+enum stats_format {
+  STATS_NONE,
+  STATS_TEXT,
+  STATS_JSON
+};
+
+// Stats go to stderr so they don't mix with normal output
+static void printStats(const struct assembler_stats* stats, struct assembler_cache* cache, enum stats_format format) {
+  struct assembler_cache_stats cacheStats;
+  if (cache)
+    assembler_cache_get_stats(cache, &cacheStats);
+  
+  if (format == STATS_JSON)
+    assembler_stats_print_json(stats, cache ? &cacheStats : NULL, stderr);
+  else
+    assembler_stats_print(stats, cache ? &cacheStats : NULL, stderr);
+}
+
+static int runSingle(const char* inputFile, const char* outputFile, const struct assembler_driver_options* options, bool debugInfoSidecar, const char* serverSocket, struct assembler_cache* cache, enum stats_format statsFormat, bool trackStages) {
+  char* debugInfoPath = NULL;
+  if (debugInfoSidecar && (debugInfoPath = getSidecarPath(outputFile)) == NULL) {
+    printf("Not enough memory!\n");
+    return EXIT_FAILURE;
+  }
+  
+  struct assembler_stats stats = ASSEMBLER_STATS_INIT;
+  struct assembler_context* context = NULL;
+  // Allocation tracking finds current stage through stats' timers
+  if (statsFormat != STATS_NONE || trackStages) {
+    if ((context = assembler_context_new()) == NULL) {
+      printf("Not enough memory!\n");
+      allocator_free(debugInfoPath);
+      return EXIT_FAILURE;
+    }
+    context->stats = &stats;
+  }
+  
   size_t compiledSize = 0;
+  size_t debugInfoSize = 0;
   const char* errorMessage = NULL;
   
-  clock_t startClock = clock();
-  int res = assembler_driver_assemble(inputFile, input, &errorMessage, &compiled, &compiledSize);
-  double cpuTime = ((double) clock() - (double) startClock) / CLOCKS_PER_SEC;
-  printf("Compiling took %.2lf miliseconds\n", cpuTime * 1000);
+  double startTime = util_monotonic_time();
+  int res;
+  if (serverSocket)
+    res = client_assemble_file(serverSocket, inputFile, outputFile, debugInfoPath, options, &errorMessage, &compiledSize, &debugInfoSize);
+  else if (cache)
+    res = assembler_cache_assemble_file(cache, context, inputFile, outputFile, debugInfoPath, options, &errorMessage, &compiledSize, &debugInfoSize);
+  else if (context)
+    res = assembler_context_assemble_file(context, inputFile, outputFile, debugInfoPath, options, &errorMessage, &compiledSize, &debugInfoSize);
+  else
+    res = assembler_driver_assemble_file(inputFile, outputFile, debugInfoPath, options, &errorMessage, &compiledSize, &debugInfoSize);
+  printf("Compiling took %.2lf miliseconds\n", (util_monotonic_time() - startTime) * 1000);
+  
+  if (statsFormat != STATS_NONE)
+    printStats(&stats, cache, statsFormat);
+  assembler_context_free(context);
+  
+  if (res < 0) {
+    printf("Assembler failure: %s\n", errorMessage ? errorMessage : "Not enough memory");
+    allocator_free((char*) errorMessage);
+    allocator_free(debugInfoPath);
+    return EXIT_FAILURE;
+  }
+  
+  printf("Wrote %zu bytes of bytecode\n", compiledSize);
+  if (debugInfoPath)
+    printf("Wrote %zu bytes of debug info to %s\n", debugInfoSize, debugInfoPath);
+  allocator_free(debugInfoPath);
+  return EXIT_SUCCESS;
+}
+
+static void printCacheStats(struct assembler_cache* cache) {
+  struct assembler_cache_stats stats;
+  assembler_cache_get_stats(cache, &stats);
+  
+  uint64_t lookups = stats.hits + stats.misses;
+  printf("Cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1lf%% hit rate), saved %.2lf miliseconds\n",
+         stats.hits, stats.misses, lookups > 0 ? (double) stats.hits * 100 / lookups : 0.0, stats.timeSaved * 1000);
+}
+
+static int runCacheEviction(struct assembler_cache* cache, uint64_t maxSize) {
+  int evictedCount = 0;
+  uint64_t evictedSize = 0;
+  int res = assembler_cache_evict(cache, maxSize, &evictedCount, &evictedSize);
+  if (res < 0) {
+    printf("Cannot evict from cache '%s': %d\n", cache->directory, res);
+    return EXIT_FAILURE;
+  }
+  
+  printf("Evicted %d entries (%" PRIu64 " bytes)\n", evictedCount, evictedSize);
+  return EXIT_SUCCESS;
+}
+
+// Plain bytes or with K, M or G suffix (power of 1024)
+static int parseSize(const char* str, uint64_t* result) {
+  char* end = NULL;
+  errno = 0;
+  unsigned long long size = strtoull(str, &end, 10);
+  if (errno != 0 || end == str)
+    return -EINVAL;
+  
+  int shift = 0;
+  switch (*end) {
+    case 'K': shift = 10; end++; break;
+    case 'M': shift = 20; end++; break;
+    case 'G': shift = 30; end++; break;
+  }
+  
+  if (*end != '\0' || size > (UINT64_MAX >> shift))
+    return -EINVAL;
+  
+  *result = (uint64_t) size << shift;
+  return 0;
+}
+
+static int writeTrace(struct trace* trace, const char* path) {
+  FILE* output = fopen(path, "w");
+  if (!output) {
+    printf("Cannot open trace file '%s'!\n", path);
+    return -EIO;
+  }
+  
+  int res = trace_write_json(trace, output);
+  if (fclose(output) != 0)
+    res = -EIO;
+  if (res < 0)
+    printf("Cannot write trace file '%s'!\n", path);
+  return res;
+}
+
+static int linkObjects(struct linker* linker, int argc, char** argv, const char** outputPath, vec_void_t* inputs) {
+  int res = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) == 0)
+      continue;
+    
+    if (!*outputPath) {
+      *outputPath = argv[i];
+      continue;
+    }
+    
+    void* data = NULL;
+    size_t size = 0;
+    if (util_read_file(argv[i], &data, &size) < 0) {
+      printf("Cannot open object file '%s'!\n", argv[i]);
+      return -EIO;
+    }
+    
+    // Linker reads from it until freed
+    if (vec_push(inputs, data) < 0) {
+      allocator_free(data);
+      return -ENOMEM;
+    }
+    
+    if ((res = linker_add_object(linker, argv[i], data, size)) < 0)
+      return res;
+  }
+  return 0;
+}
+
+static int runLink(int argc, char** argv, const struct assembler_driver_options* options, bool debugInfoSidecar) {
+  int exitRes = EXIT_FAILURE;
+  const char* outputPath = NULL;
+  char* debugInfoPath = NULL;
+  struct bytecode* bytecode = NULL;
+  struct byte_buffer result = BYTE_BUFFER_INIT;
+  struct byte_buffer debugInfo = BYTE_BUFFER_INIT;
+  vec_void_t inputs;
+  vec_init(&inputs);
+  
+  double startTime = util_monotonic_time();
+  struct linker* linker = linker_new();
+  if (!linker) {
+    printf("Not enough memory!\n");
+    goto failure;
+  }
   
+  int res = linkObjects(linker, argc, argv, &outputPath, &inputs);
+  if (res >= 0)
+    res = linker_link(linker, &bytecode);
+  if (res == -EIO)
+    goto failure;
   if (res < 0) {
-    printf("Assembler failure: %s\n", errorMessage);
-    free((char*) errorMessage);
-    exitRes = EXIT_FAILURE;
-    goto assemble_failure;
+    printf("Linker failure: %s\n", linker->errorMessage ? linker->errorMessage : "Not enough memory");
+    goto failure;
+  }
+  
+  if ((res = bytecode_serializer_protobuf_append(bytecode, &options->serializer, &result)) < 0) {
+    printf("Cannot serialize linked bytecode: %d\n", res);
+    goto failure;
+  }
+  
+  if (debugInfoSidecar) {
+    if ((debugInfoPath = getSidecarPath(outputPath)) == NULL) {
+      printf("Not enough memory!\n");
+      goto failure;
+    }
+    
+    res = bytecode_serializer_protobuf_debug_info_append(bytecode, &options->serializer, result.data, result.size, &debugInfo);
+    if (res < 0) {
+      printf("Cannot serialize debug info: %d\n", res);
+      goto failure;
+    }
   }
   
-  // Write compiled code
-  printf("Writing %zu bytes of bytecode\n", compiledSize);
-  if (fwrite(compiled, 1, compiledSize, output) != compiledSize)
-    goto write_result_failure;
+  if (util_write_file(outputPath, result.data, result.size) < 0) {
+    printf("Cannot write output file '%s'!\n", outputPath);
+    goto failure;
+  }
+  if (debugInfoPath && util_write_file(debugInfoPath, debugInfo.data, debugInfo.size) < 0) {
+    printf("Cannot write debug info file '%s'!\n", debugInfoPath);
+    goto failure;
+  }
   
-  free(compiled);
+  printf("Linking took %.2lf miliseconds\n", (util_monotonic_time() - startTime) * 1000);
+  printf("Wrote %zu bytes of bytecode\n", result.size);
+  if (debugInfoPath)
+    printf("Wrote %zu bytes of debug info to %s\n", debugInfo.size, debugInfoPath);
+  exitRes = EXIT_SUCCESS;
 
-write_result_failure:
-assemble_failure:
-  fclose(output);
-output_open_failure:
-  fclose(input);
-input_open_failure:
+failure:
+  bytecode_free(bytecode);
+  linker_free(linker);
+  
+  size_t i = 0;
+  void* input = NULL;
+  vec_foreach(&inputs, input, i)
+    allocator_free(input);
+  vec_deinit(&inputs);
+  
+  byte_buffer_deinit(&result);
+  byte_buffer_deinit(&debugInfo);
+  allocator_free(debugInfoPath);
   return exitRes;
 }
 
+static int runServer(const char* socketPath) {
+  printf("Listening on %s\n", socketPath);
+  int res = server_run(socketPath);
+  printf("Server failure: %d\n", res);
+  return EXIT_FAILURE;
+}
+
+int main2(int argc, char** argv) {
+  struct assembler_driver_options options = ASSEMBLER_DRIVER_OPTIONS_DEFAULT;
+  const char* positionals[2] = {};
+  int positionalCount = 0;
+  bool debugInfoSidecar = false;
+  bool batchMode = false;
+  bool linkMode = false;
+  const char* manifestPath = NULL;
+  int threadCount = 0;
+  const char* serverSocket = NULL;
+  const char* cacheDirectory = NULL;
+  bool cacheEvict = false;
+  uint64_t cacheMaxSize = 0;
+  enum stats_format statsFormat = STATS_NONE;
+  // Negative if allocations aren't tracked
+  int allocTopSites = -1;
+  const char* tracePath = NULL;
+  bool perfCounters = false;
+  
+  if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+    return runBenchmark(argv[0], argc - 2, argv + 2);
+  
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--", 2) != 0) {
+      // Batch mode collects the pairs by itself
+      if (positionalCount < ARRAY_SIZE(positionals))
+        positionals[positionalCount] = arg;
+      positionalCount++;
+      continue;
+    }
+    
+    if (strcmp(arg, "--format-v1") == 0) {
+      options.serializer.version = 1;
+    } else if (strcmp(arg, "--compress") == 0) {
+      options.serializer.compressInstructions = true;
+    } else if (strcmp(arg, "--compact") == 0) {
+      options.compactInstructions = true;
+    } else if (strcmp(arg, "--pipeline") == 0) {
+      options.pipelined = true;
+    } else if (strcmp(arg, "--object") == 0) {
+      options.object = true;
+    } else if (strcmp(arg, "--incremental") == 0) {
+      options.incremental = true;
+    } else if (strcmp(arg, "--link") == 0) {
+      linkMode = true;
+    } else if (strncmp(arg, "--serialize-jobs=", strlen("--serialize-jobs=")) == 0) {
+      char* end = NULL;
+      long jobs = strtol(arg + strlen("--serialize-jobs="), &end, 10);
+      if (*end != '\0' || jobs < 0 || jobs > BATCH_MAX_THREADS) {
+        printf("Invalid job count '%s'\n", arg);
+        goto invalid_usage;
+      }
+      options.serializer.threadCount = (int) jobs;
+    } else if (strcmp(arg, "--debug-info=inline") == 0) {
+      options.serializer.stripDebugInfo = false;
+      debugInfoSidecar = false;
+    } else if (strcmp(arg, "--debug-info=sidecar") == 0) {
+      options.serializer.stripDebugInfo = true;
+      debugInfoSidecar = true;
+    } else if (strcmp(arg, "--debug-info=strip") == 0) {
+      options.serializer.stripDebugInfo = true;
+      debugInfoSidecar = false;
+    } else if (strncmp(arg, "--server=", strlen("--server=")) == 0) {
+      return runServer(arg + strlen("--server="));
+    } else if (strncmp(arg, "--connect=", strlen("--connect=")) == 0) {
+      serverSocket = arg + strlen("--connect=");
+    } else if (strncmp(arg, "--cache-dir=", strlen("--cache-dir=")) == 0) {
+      cacheDirectory = arg + strlen("--cache-dir=");
+    } else if (strncmp(arg, "--cache-evict=", strlen("--cache-evict=")) == 0) {
+      if (parseSize(arg + strlen("--cache-evict="), &cacheMaxSize) < 0) {
+        printf("Invalid size '%s'\n", arg);
+        goto invalid_usage;
+      }
+      cacheEvict = true;
+    } else if (strcmp(arg, "--stats") == 0 || strcmp(arg, "--stats=text") == 0) {
+      statsFormat = STATS_TEXT;
+    } else if (strcmp(arg, "--stats=json") == 0) {
+      statsFormat = STATS_JSON;
+    } else if (strcmp(arg, "--alloc-stats") == 0) {
+      allocTopSites = DEFAULT_ALLOC_TOP_SITES;
+    } else if (strncmp(arg, "--alloc-stats=", strlen("--alloc-stats=")) == 0) {
+      char* end = NULL;
+      long topSites = strtol(arg + strlen("--alloc-stats="), &end, 10);
+      if (*end != '\0' || topSites < 0 || topSites > INT_MAX) {
+        printf("Invalid site count '%s'\n", arg);
+        goto invalid_usage;
+      }
+      allocTopSites = (int) topSites;
+    } else if (strcmp(arg, "--perf-counters") == 0) {
+      perfCounters = true;
+    } else if (strncmp(arg, "--trace=", strlen("--trace=")) == 0) {
+      tracePath = arg + strlen("--trace=");
+    } else if (strcmp(arg, "--batch") == 0) {
+      batchMode = true;
+    } else if (strncmp(arg, "--manifest=", strlen("--manifest=")) == 0) {
+      batchMode = true;
+      manifestPath = arg + strlen("--manifest=");
+    } else if (strncmp(arg, "--jobs=", strlen("--jobs=")) == 0) {
+      char* end = NULL;
+      long jobs = strtol(arg + strlen("--jobs="), &end, 10);
+      if (*end != '\0' || jobs < 1 || jobs > BATCH_MAX_THREADS) {
+        printf("Invalid job count '%s'\n", arg);
+        goto invalid_usage;
+      }
+      threadCount = (int) jobs;
+    } else {
+      printf("Unknown option '%s'\n", arg);
+      goto invalid_usage;
+    }
+  }
+  
+  if (serverSocket && (batchMode || cacheDirectory)) {
+    printf("--connect can't be used with --batch or --cache-dir\n");
+    goto invalid_usage;
+  }
+  
+  if (linkMode && (batchMode || serverSocket || cacheDirectory || cacheEvict || options.object)) {
+    printf("--link can't be used with --batch, --connect, --cache-dir, --cache-evict or --object\n");
+    goto invalid_usage;
+  }
+  
+  // Neither assembles from the file in this process
+  if (options.incremental && (serverSocket || cacheDirectory || linkMode)) {
+    printf("--incremental can't be used with --connect, --cache-dir or --link\n");
+    goto invalid_usage;
+  }
+  
+  // Counters are reported with the rest of stats
+  if (perfCounters && statsFormat == STATS_NONE)
+    statsFormat = STATS_TEXT;
+  
+  if ((statsFormat != STATS_NONE || allocTopSites >= 0) && (serverSocket || batchMode || cacheEvict || linkMode)) {
+    printf("--stats, --perf-counters and --alloc-stats can't be used with --connect, --batch, --cache-evict or --link\n");
+    goto invalid_usage;
+  }
+  
+  if (tracePath && (serverSocket || cacheEvict)) {
+    printf("--trace can't be used with --connect or --cache-evict\n");
+    goto invalid_usage;
+  }
+  
+  if (cacheEvict) {
+    if (!cacheDirectory || positionalCount != 0) {
+      printf("--cache-evict needs --cache-dir and nothing to assemble\n");
+      goto invalid_usage;
+    }
+  } else if (batchMode) {
+    if (positionalCount % 2 != 0)
+      goto invalid_usage;
+  } else if (linkMode) {
+    if (positionalCount < 2)
+      goto invalid_usage;
+  } else if (positionalCount != ARRAY_SIZE(positionals)) {
+    goto invalid_usage;
+  }
+  
+  // Nothing is allocated before this point, everything
+  // after can be tracked
+  static struct tracking_allocator trackingAllocator;
+  if (allocTopSites >= 0) {
+    if (tracking_allocator_init(&trackingAllocator) < 0) {
+      printf("Not enough memory!\n");
+      return EXIT_FAILURE;
+    }
+    allocator_set(&trackingAllocator.allocator);
+  }
+  
+  // Missing counters only leave them out of stats
+  int perfRes;
+  if (perfCounters && (perfRes = perf_counters_enable()) < 0)
+    fprintf(stderr, "Hardware counters unavailable: %s\n", strerror(-perfRes));
+  
+  struct trace* trace = NULL;
+  if (tracePath) {
+    if ((trace = trace_new()) == NULL) {
+      printf("Not enough memory!\n");
+      return EXIT_FAILURE;
+    }
+    trace_set(trace);
+    trace_set_thread_name("main");
+  }
+  
+  struct assembler_cache* cache = NULL;
+  if (cacheDirectory && (cache = assembler_cache_new(cacheDirectory)) == NULL) {
+    printf("Cannot open cache directory '%s': %s\n", cacheDirectory, strerror(errno));
+    trace_set(NULL);
+    trace_free(trace);
+    return EXIT_FAILURE;
+  }
+  
+  int exitRes;
+  if (cacheEvict) {
+    exitRes = runCacheEviction(cache, cacheMaxSize);
+  } else {
+    if (batchMode)
+      exitRes = runBatch(argc, argv, &options, debugInfoSidecar, manifestPath, threadCount, cache);
+    else if (linkMode)
+      exitRes = runLink(argc, argv, &options, debugInfoSidecar);
+    else
+      exitRes = runSingle(positionals[0], positionals[1], &options, debugInfoSidecar, serverSocket, cache, statsFormat, allocTopSites >= 0);
+    
+    if (cache)
+      printCacheStats(cache);
+  }
+  
+  assembler_cache_free(cache);
+  
+  // Every thread which recorded into it is done
+  if (trace) {
+    trace_set(NULL);
+    if (writeTrace(trace, tracePath) < 0)
+      exitRes = EXIT_FAILURE;
+    trace_free(trace);
+  }
+  
+  // Still the current allocator, anything leaked
+  // would still point into it
+  if (allocTopSites >= 0) {
+    fprintf(stderr, "\n");
+    tracking_allocator_print(&trackingAllocator, allocTopSites, stderr);
+  }
+  return exitRes;
+
+invalid_usage:
+  printUsage(argv[0]);
+  return EXIT_FAILURE;
+}
+
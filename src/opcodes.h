@@ -62,6 +62,42 @@
 
 #define OP_ARG_A_U32(op) ((op & 0xFFFF'FFFFLL) << 16)
 
+/*
+ * Short instruction format (32-bit, optional)
+ * Offset counted from MSB
+ * Byte 0   : Opcode | OP_SHORT_FLAG
+ * Byte 1   : Field A
+ * Byte 2   : Field B
+ * Byte 3   : Field C
+ * or for u16_s32 and u16_u32 layouts
+ * Byte 1   : Field A
+ * Byte 2-3 : Field B (sign extended for u16_s32)
+ *
+ * Condition is always OP_COND_AL. In compact instruction
+ * stream a word with OP_SHORT_FLAG set is complete short
+ * instruction, otherwise it is the first (most significant)
+ * half of normal instruction. Instruction pointers and
+ * jump deltas count 32-bit words in such stream
+ *
+ * In memory short instruction is kept as vm_instruction
+ * with the short word in the upper 32 bits so both forms can
+ * be stored in same array
+ */
+#define OP_SHORT_FLAG 0x80
+#define OP_SHORT_MAX_U8 0xFF
+#define OP_SHORT_MIN_S16 (-32768)
+#define OP_SHORT_MAX_S16 32767
+#define OP_SHORT_MAX_U16 0xFFFF
+
+#define OP_IS_SHORT(ins) ((((ins) >> 56) & OP_SHORT_FLAG) != 0)
+#define OP_WORD_COUNT(ins) (OP_IS_SHORT(ins) ? 1 : 2)
+
+#define OP_SHORT_OPCODE(op) (((op | OP_SHORT_FLAG) & 0xFFLL) << 56)
+#define OP_SHORT_A(op) ((op & 0xFFLL) << 48)
+#define OP_SHORT_B(op) ((op & 0xFFLL) << 40)
+#define OP_SHORT_C(op) ((op & 0xFFLL) << 32)
+#define OP_SHORT_B_16(op) ((op & 0xFFFFLL) << 32)
+
 enum fluffyvm_opcode {
 # define X(name, op, ...) FLUFFYVM_ ## name = op,
   FLUFFYVM_OPCODES
@@ -69,6 +105,15 @@ enum fluffyvm_opcode {
   FLUFFYVM_OPCODE_LAST
 };
 
+// How an opcode's fields are laid out, the `layout`
+// column of FLUFFYVM_OPCODES
+enum fluffyvm_opcode_layout {
+  OP_LAYOUT_u16x3,
+  OP_LAYOUT_u16_u32,
+  OP_LAYOUT_u16_s32,
+  OP_LAYOUT_u32
+};
+
 /*
 local COND_AL = 0x00  -- Always     (0b0000'0000)
 local COND_EQ = 0x11  -- Equal      (0b0001'0001)
@@ -3,52 +3,72 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "allocator.h"
 #include "bytecode/bytecode.h"
 #include "bytecode/prototype.h"
 #include "lexer.h"
 #include "parser_stage1.h"
 #include "common.h"
+#include "spsc_queue.h"
 #include "util.h"
 #include "vec.h"
 
-struct parser_stage1* parser_stage1_new(struct lexer* lexer) {
-  struct parser_stage1* self = malloc(sizeof(*self));
+static void resetState(struct parser_stage1* self, struct lexer* lexer) {
   self->lexer = lexer;
   self->canFreeErrorMsg = false;
   self->errorMessage = NULL;
   self->nextTokenPointer = 0;
+  self->statementCount = 0;
   self->isFirstToken = true;
   self->currentStatement = NULL;
   self->currentToken = NULL;
   self->isCompleted = false;
+  self->input = NULL;
+  self->output = NULL;
+}
+
+struct parser_stage1* parser_stage1_new(struct lexer* lexer) {
+  struct parser_stage1* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
   
+  resetState(self, lexer);
   vec_init(&self->allStatements);
   return self;
 }
 
-static void freeStatement(struct statement* statement) {
+void parser_stage1_free_statement(struct statement* statement) {
   if (!statement)
     return;
 
   vec_deinit(&statement->rawTokens);
   vec_deinit(&statement->wholeStatement);
-  free(statement);
+  allocator_free(statement);
 }
 
-void parser_stage1_free(struct parser_stage1* self) {
-  if (!self)
-    return;
-  
+static void freeResults(struct parser_stage1* self) {
   if (self->canFreeErrorMsg)
-    free((void*) self->errorMessage);
+    allocator_free((void*) self->errorMessage);
   
   struct statement* current = NULL;
-  int i = 0;
+  size_t i = 0;
   vec_foreach(&self->allStatements, current, i)
-    freeStatement(current);
+    parser_stage1_free_statement(current);
+}
+
+void parser_stage1_reset(struct parser_stage1* self, struct lexer* lexer) {
+  freeResults(self);
+  vec_clear(&self->allStatements);
+  resetState(self, lexer);
+}
+
+void parser_stage1_free(struct parser_stage1* self) {
+  if (!self)
+    return;
   
+  freeResults(self);
   vec_deinit(&self->allStatements);
-  free(self);
+  allocator_free(self);
 }
 
 ATTRIBUTE_PRINTF(2, 3)
@@ -58,7 +78,7 @@ static int setError(struct parser_stage1* self, const char* fmt, ...) {
   self->canFreeErrorMsg = false;
   self->errorMessage = common_format_error_message_about_token_valist(self->lexer->inputName, 
                                                "parsing error", 
-                                               -1, -1,
+                                               self->lexer,
                                                self->currentToken, 
                                                fmt, args);
   va_end(args);
@@ -77,12 +97,18 @@ static int setError(struct parser_stage1* self, const char* fmt, ...) {
 // -ENAVAIL: No token to read
 // -ENOMEM: Out of memory
 static int fetchNextTokenRaw(struct parser_stage1* self) {
-  if (self->nextTokenPointer >= self->lexer->allTokens.length) {
+  struct token* token = NULL;
+  if (self->input)
+    token = spsc_queue_pop(self->input);
+  else if (self->nextTokenPointer < self->lexer->tokenCount)
+    token = lexer_get_token(self->lexer, self->nextTokenPointer);
+  
+  if (!token) {
     setError(self, "No token to read");
     return -ENAVAIL;
   }
   
-  self->currentToken = self->lexer->allTokens.data[self->nextTokenPointer];
+  self->currentToken = token;
   self->nextTokenPointer++;
   
   if (vec_push(&self->currentStatement->rawTokens, self->currentToken) < 0)
@@ -123,7 +149,7 @@ static int fetchArgs(struct parser_stage1* self) {
 
 static int processOne(struct parser_stage1* self, struct statement** result) {
   int res = 0;
-  self->currentStatement = malloc(sizeof(*self->currentStatement));
+  self->currentStatement = allocator_malloc(sizeof(*self->currentStatement));
   if (!self->currentStatement)
     return -ENOMEM;
   *self->currentStatement = (struct statement) {};
@@ -144,7 +170,6 @@ static int processOne(struct parser_stage1* self, struct statement** result) {
     case TOKEN_COMMENT:
       needEndOfStatament = false;
       self->currentStatement->type = STATEMENT_COMMENT;
-      self->currentStatement->data.commentData = self->currentToken->data.comment;
       if ((res = fetchNextToken(self)) < 0) 
         goto fetch_error; 
       break;
@@ -199,7 +224,7 @@ unexpected_token:
   res = -EFAULT;
 fetch_error:
 token_push_error: 
-  freeStatement(self->currentStatement);
+  parser_stage1_free_statement(self->currentStatement);
    return res;
 }
 
@@ -211,23 +236,38 @@ int parser_stage1_process(struct parser_stage1* self) {
   struct statement* statement;
   int res = 0;
   
-  if (self->lexer->allTokens.length == 0)
+  bool hasTokens = self->input ? spsc_queue_wait(self->input) : self->lexer->tokenCount > 0;
+  if (!hasTokens)
     goto early_eof;
   
-  while (!self->errorMessage && self->nextTokenPointer <= self->lexer->allTokens.length) {
+  // Fetching past last token sets error message which ends this
+  while (!self->errorMessage) {
     if ((res = processOne(self, &statement)) < 0)
       break;
     
     if (statement->rawTokens.length == 0) {
-      freeStatement(statement);
+      parser_stage1_free_statement(statement);
       
       setError(self, "BUG: Cannot have statement without token (please report)");
       res = -EFAULT;
       break;
     }
     
-    if (vec_push(&self->allStatements, statement) < 0) 
+    // Current token is next statement's first (or this one's
+    // last at end of input) so it is kept
+    statement->tokenEnd = self->nextTokenPointer - 1;
+    self->statementCount++;
+    
+    if (self->output) {
+      if (!spsc_queue_push(self->output, statement))
+        parser_stage1_free_statement(statement);
+      continue;
+    }
+    
+    if (vec_push(&self->allStatements, statement) < 0) {
+      parser_stage1_free_statement(statement);
       return -ENOMEM;
+    }
   }
   
 early_eof:
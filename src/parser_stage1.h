@@ -4,7 +4,6 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-#include "buffer.h"
 #include "vec.h"
 
 // Stage 1 Parser_stage1 (Combine tokens into statements)
@@ -22,13 +21,20 @@ struct statement {
   vec_t(struct token*) rawTokens;
   vec_t(struct token*) wholeStatement;
   
+  // Lexer's tokens before this index aren't needed once this
+  // statement is done with (see lexer_release_tokens)
+  size_t tokenEnd;
+  
+  // Owned by the lexer, comment's text is found through
+  // its token (see struct token)
   union {
-    buffer_t* labelName;
-    buffer_t* commentData;
+    const char* labelName;
   } data;
 };
 
 struct lexer;
+struct spsc_queue;
+
 struct parser_stage1 {
   struct lexer* lexer;
   
@@ -40,13 +46,31 @@ struct parser_stage1 {
   struct token* currentToken;
   struct statement* currentStatement;
   
-  int nextTokenPointer;
+  size_t nextTokenPointer;
+  size_t statementCount;
+  
+  // Only filled when not pipelined. Stage 2 takes statements
+  // out (leaving NULL) and frees them as it goes
   vec_t(struct statement*) allStatements;
+  
+  // Pipelined mode (both NULL after reset), tokens are taken
+  // from `input` instead of lexer's tokens and statements are
+  // pushed to `output` instead of `allStatements`, stage 2
+  // owns them from there. Queues aren't closed by parser
+  struct spsc_queue* input;
+  struct spsc_queue* output;
 };
 
 struct parser_stage1* parser_stage1_new(struct lexer* lexer);
 void parser_stage1_free(struct parser_stage1* self);
 
+// Free statement taken from `allStatements` or `output`
+void parser_stage1_free_statement(struct statement* statement);
+
+// Drop all statements and prepare for new (not yet processed)
+// `lexer` keeping allocated capacity
+void parser_stage1_reset(struct parser_stage1* self, struct lexer* lexer);
+
 // 0 on success
 // Errors:
 // -EFAULT: Error parsing (check self->errormsg)
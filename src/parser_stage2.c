@@ -6,6 +6,8 @@
 #include <string.h>
 #include <assert.h>
 
+#include "allocator.h"
+#include "assembler_stats.h"
 #include "common.h"
 #include "code_emitter.h"
 #include "default_statement_processors.h"
@@ -13,20 +15,25 @@
 #include "opcodes.h"
 #include "token_iterator.h"
 #include "hashmap_base.h"
+#include "incremental_cache.h"
 #include "parser_stage2.h"
 #include "vm_limits.h"
 #include "parser_stage1.h"
 #include "lexer.h"
+#include "spsc_queue.h"
 #include "bytecode/prototype.h"
 #include "bytecode/bytecode.h"
 #include "constants.h"
 #include "statement_compiler.h"
+#include "trace.h"
 #include "util.h"
 #include "vec.h"
 #include "vm_types.h"
 
+static void clearContext(struct parser_stage2_context* ctx);
+
 struct parser_stage2* parser_stage2_new(struct parser_stage1* parser) {
-  struct parser_stage2* self = malloc(sizeof(*self));
+  struct parser_stage2* self = allocator_malloc(sizeof(*self));
   if (!self)
     return NULL;
   
@@ -44,6 +51,14 @@ struct parser_stage2* parser_stage2_new(struct parser_stage1* parser) {
   self->nextStatementPointer = 0;
   self->currentInputName = NULL;
   self->currentStatement = NULL;
+  self->compactInstructions = false;
+  self->allowUnresolvedPrototypes = false;
+  self->contextDepth = 0;
+  self->location = (struct lexer_location) LEXER_LOCATION_INIT;
+  self->stats = NULL;
+  self->input = NULL;
+  self->incremental = NULL;
+  vec_init(&self->contextPool);
   
   self->statementCompiler = statement_compiler_new(self, NULL);
   if (!self->statementCompiler)
@@ -59,18 +74,49 @@ failure:
   return NULL;
 }
 
+void parser_stage2_reset(struct parser_stage2* self, struct parser_stage1* parser) {
+  if (self->canFreeErrorMsg)
+    allocator_free((char*) self->errorMessage);
+  
+  self->bytecode = NULL;
+  self->canFreeErrorMsg = false;
+  self->errorMessage = NULL;
+  self->parser = parser;
+  self->isCompleted = false;
+  self->isFirstStatement = true;
+  self->currentStatement = NULL;
+  self->currentCtx = NULL;
+  self->nextStatementPointer = 0;
+  self->currentInputName = NULL;
+  self->location = (struct lexer_location) LEXER_LOCATION_INIT;
+  self->input = NULL;
+  self->incremental = NULL;
+}
+
 void parser_stage2_free(struct parser_stage2* self) {
   if (!self)
     return;
   
   if (self->canFreeErrorMsg)
-    free((char*) self->errorMessage);
+    allocator_free((char*) self->errorMessage);
   
   if (self->isStatementCompilerRegistered)
     default_processor_unregister(self->statementCompiler, self);
   
+  size_t i = 0;
+  struct parser_stage2_context* ctx = NULL;
+  vec_foreach(&self->contextPool, ctx, i) {
+    clearContext(ctx);
+    hashmap_cleanup(&ctx->labelLookup);
+    hashmap_cleanup(&ctx->prototypesRegistry);
+    vec_deinit(&ctx->prototypesRegistryEntries);
+    vec_deinit(&ctx->ipToOffset);
+    allocator_free(ctx);
+  }
+  vec_deinit(&self->contextPool);
+  
   statement_compiler_free(self->statementCompiler);
-  free(self);
+  allocator_free(self);
 }
 
 // Erorrs:
@@ -91,7 +137,7 @@ static int vsetErrorWithToken(struct parser_stage2* self, struct token* token, c
   if (token) {
     self->errorMessage = common_format_error_message_about_token_valist(self->currentInputName, 
                                                  "parsing stage2 error", 
-                                                 -1, -1,
+                                                 self->parser->lexer,
                                                  token, 
                                                  fmt, args);
   } else {
@@ -128,11 +174,33 @@ static int setError(struct parser_stage2* self, const char* fmt, ...) {
   return res;
 }
 
+// Nothing refers to statement or its tokens once stage 2 moves
+// past it, in pipelined mode lexer reuses the tokens' space
+static void releaseStatement(struct parser_stage2* self, struct statement* statement) {
+  if (!statement)
+    return;
+  
+  lexer_release_tokens(self->parser->lexer, statement->tokenEnd);
+  parser_stage1_free_statement(statement);
+}
+
 static int getNextStatementRaw(struct parser_stage2* self) {
-  if (self->nextStatementPointer >= self->parser->allStatements.length) 
+  struct statement* statement = NULL;
+  if (self->input) {
+    statement = spsc_queue_pop(self->input);
+  } else if (self->nextStatementPointer < self->parser->allStatements.length) {
+    // Taken from stage 1, it is freed here instead
+    statement = self->parser->allStatements.data[self->nextStatementPointer];
+    self->parser->allStatements.data[self->nextStatementPointer] = NULL;
+  }
+  
+  if (!statement)
     return -ERANGE;
   
-  self->currentStatement = self->parser->allStatements.data[self->nextStatementPointer];
+  // Kept until there is next one so errors at end of
+  // input can still point at the last statement
+  releaseStatement(self, self->currentStatement);
+  self->currentStatement = statement;
   self->nextStatementPointer++;
   return 0;
 }
@@ -156,7 +224,7 @@ static int processInstruction(struct parser_stage2* self, struct parser_stage2_c
   char* err = NULL;
   bool canFreeErr = false;
   
-  if (vec_push(&ctx->ipToStamement, self->currentStatement) < 0) {
+  if (vec_push(&ctx->ipToOffset, self->currentStatement->wholeStatement.data[0]->offset) < 0) {
     res = -ENOMEM;
     goto record_line_info_failed;
   }
@@ -177,7 +245,7 @@ static int processInstruction(struct parser_stage2* self, struct parser_stage2_c
     case -EFAULT:
       setError(self, "statement_compiler: %s", err);
       if (canFreeErr)
-        free(err);
+        allocator_free(err);
       res = -EFAULT;
       goto processing_error;
     case -ENOSPC:
@@ -185,7 +253,7 @@ static int processInstruction(struct parser_stage2* self, struct parser_stage2_c
       res = -EFAULT;
       goto processing_error;
     case -EADDRNOTAVAIL:
-      setError(self, "Unknown instruction '%s'", ctx->iterator->current->data.identifier->data);
+      setError(self, "Unknown instruction '%s'", ctx->iterator->current->data.identifier);
       res = -EFAULT;
       goto processing_error;
     default:
@@ -203,7 +271,7 @@ record_line_info_failed:
 
 static int processLabelDecl(struct parser_stage2* self, struct parser_stage2_context* ctx) {
   int res = 0;
-  const char* labelName = buffer_string(ctx->iterator->current->data.labelDeclName);
+  const char* labelName = ctx->iterator->current->data.labelDeclName;
   struct code_emitter_label* label;
   
   if ((res = parser_stage2_get_label(ctx, labelName, &label)) < 0)
@@ -222,12 +290,32 @@ label_lookup_failed:
 
 static int processPrototype(struct parser_stage2* self, const char* filename, const char* prototypeName, int line, int column, struct prototype** result);
 
+// Copy prototype unchanged since last assembly, `.end_prototype`
+// of it is current statement as its body isn't lexed
+// Errors:
+// -ENOMEM: Not enough memory
+// -EAGAIN: Cannot be reused
+static int reusePrototype(struct parser_stage2* self, const struct incremental_cache_reuse* reuse, const char* filename, int line, int column, struct prototype** result) {
+  // Range ended somewhere else than in last assembly
+  if (self->currentStatement->type != STATEMENT_ASSEMBLER_DIRECTIVE || self->currentStatement->wholeStatement.data[0]->offset != reuse->endOffset)
+    return -EAGAIN;
+  
+  size_t reusedCount = 0;
+  int res = incremental_cache_splice(self->incremental, reuse, self->bytecode, filename, line, column, result, &reusedCount);
+  if (res < 0)
+    return res;
+  
+  if (self->stats)
+    self->stats->reusedPrototypes += reusedCount;
+  return 0;
+}
+
 static int processStartPrototypeDirective(struct parser_stage2* self, struct parser_stage2_context* ctx) {
   struct prototype* newPrototype = NULL;
   const char* filename = self->currentInputName;
   const char* prototypeName = NULL;
-  int line = ctx->iterator->current->startLine;
-  int column = ctx->iterator->current->startColumn;
+  lexer_locate(self->parser->lexer, ctx->iterator->current->offset, &self->location);
+  struct lexer_location location = self->location;
   
   int res = token_iterator_next_identifier(ctx->iterator, &prototypeName);
   if (res == -EINVAL)
@@ -248,13 +336,42 @@ static int processStartPrototypeDirective(struct parser_stage2* self, struct par
     goto duplicate_prototype;
   }
   
+  // Range begins here as start statement is freed once
+  // next one is fetched
+  struct lexer* lexer = self->parser->lexer;
+  const struct incremental_cache_reuse* reuse = NULL;
+  int64_t rangeIndex = -1;
+  if (self->incremental)
+    reuse = incremental_cache_get_reuse(self->incremental, self->currentStatement->wholeStatement.data[0]->offset);
+  if (self->incremental && !reuse && (rangeIndex = incremental_cache_begin_range(self->incremental, lexer->source, lexer->sourceSize, self->currentStatement, self->bytecode->constants.length)) < 0) {
+    res = (int) rangeIndex;
+    goto prototype_generation_error;
+  }
+  
   if ((res = getNextStatement(self)) < 0)
     goto get_statement_failed;
   
-  res = processPrototype(self, filename, prototypeName, line, column, &newPrototype);
+  if (reuse) {
+    res = reusePrototype(self, reuse, filename, location.line, location.column, &newPrototype);
+    if (res < 0)
+      goto prototype_generation_error;
+    goto add_prototype;
+  }
+  
+  res = processPrototype(self, filename, prototypeName, location.line, location.column, &newPrototype);
   if (res < 0)
     goto prototype_generation_error;
   
+  if (self->incremental)
+    incremental_cache_end_range(self->incremental, rangeIndex, lexer->source, lexer->sourceSize,
+                                self->currentStatement, self->bytecode->constants.length);
+  
+add_prototype:
+  // Start statement is freed by now, later errors in this
+  // prototype point at the `.end_prototype` instead
+  token_iterator_reset(ctx->iterator, self->currentStatement);
+  token_iterator_next(ctx->iterator, NULL);
+  
   if (vec_push(&ctx->proto->prototypes, newPrototype) < 0) {
     prototype_free(newPrototype);
     res = -ENOMEM;
@@ -275,7 +392,7 @@ get_prototype_id_failed:
 // Errors:
 // -EFAULT: Error
 static int processAssemblerDirective(struct parser_stage2* self, struct parser_stage2_context* ctx) {
-  const char* directive = buffer_string(ctx->iterator->current->data.directiveName);
+  const char* directive = ctx->iterator->current->data.directiveName;
   int res = 0;
   if (strcmp(directive, "start_prototype") == 0) {
     res = processStartPrototypeDirective(self, ctx);
@@ -293,7 +410,7 @@ static int processAssemblerDirective(struct parser_stage2* self, struct parser_s
 
 static int fixPrototypeLoads(struct parser_stage2_context* ctx) {
   int res = 0;
-  int i = 0;
+  size_t i = 0;
   vm_instruction* current = NULL;
   
   vec_foreach_ptr(&ctx->emitter->instructions, current, i) {
@@ -303,9 +420,20 @@ static int fixPrototypeLoads(struct parser_stage2_context* ctx) {
     uint32_t temporaryID = (*current & 0x0000'0000'FFFF'FFFFl);
     struct prototype_registry_entry* entry = ctx->prototypesRegistryEntries.data[temporaryID];
     
+    // Linker patches it, the temporary ID means nothing there
+    if (entry->proto == NULL && ctx->owner->allowUnresolvedPrototypes) {
+      *current &= ~OP_ARG_B_U16_U32(0xFFFF'FFFFl);
+      if (prototype_add_reference(ctx->proto, i, entry->name) < 0) {
+        res = -ENOMEM;
+        goto unknown_prototype_load;
+      }
+      continue;
+    }
+    
     if (entry->proto == NULL) {
-      struct token* referenceBy = ctx->ipToStamement.data[i]->wholeStatement.data[0];
-      setErrorWithToken(ctx->owner, referenceBy, "Undefined prototype '%s' referenced", entry->name);
+      // Only its offset is left of the statement
+      struct token referenceBy = {.offset = ctx->ipToOffset.data[i]};
+      setErrorWithToken(ctx->owner, &referenceBy, "Undefined prototype '%s' referenced", entry->name);
       res = -EFAULT;
       goto unknown_prototype_load;
     }
@@ -321,36 +449,101 @@ unknown_prototype_load:
   return res;
 }
 
+// Get storage for context of prototype at current nesting
+// depth, its hashmaps and vectors are kept in self->contextPool
+// and reused by later prototypes and compilations
+static struct parser_stage2_context* acquireContext(struct parser_stage2* self) {
+  struct parser_stage2_context* ctx = NULL;
+  if (self->contextDepth < self->contextPool.length) {
+    ctx = self->contextPool.data[self->contextDepth];
+    goto reuse_context;
+  }
+  
+  ctx = allocator_malloc(sizeof(*ctx));
+  if (!ctx)
+    return NULL;
+  
+  hashmap_init(&ctx->labelLookup, swiss_hashmap_hash_string, strcmp);
+  hashmap_init(&ctx->prototypesRegistry, swiss_hashmap_hash_string, strcmp);
+  vec_init(&ctx->prototypesRegistryEntries);
+  vec_init(&ctx->ipToOffset);
+  
+  if (vec_push(&self->contextPool, ctx) < 0) {
+    allocator_free(ctx);
+    return NULL;
+  }
+  
+reuse_context:
+  ctx->owner = self;
+  ctx->proto = NULL;
+  ctx->emitter = NULL;
+  ctx->iterator = NULL;
+  self->contextDepth++;
+  return ctx;
+}
+
+static void clearContext(struct parser_stage2_context* ctx) {
+  size_t i = 0;
+  struct prototype_registry_entry* current = NULL;
+  vec_foreach(&ctx->prototypesRegistryEntries, current, i) { 
+    allocator_free((char*) current->name);
+    allocator_free(current);
+  }
+  
+  // Never used map has no table yet
+  if (hashmap_size(&ctx->labelLookup) > 0)
+    hashmap_clear(&ctx->labelLookup);
+  if (hashmap_size(&ctx->prototypesRegistry) > 0)
+    hashmap_clear(&ctx->prototypesRegistry);
+  vec_clear(&ctx->prototypesRegistryEntries);
+  vec_clear(&ctx->ipToOffset);
+}
+
+static void releaseContext(struct parser_stage2* self, struct parser_stage2_context* ctx) {
+  if (self->stats) {
+    self->stats->labels += hashmap_size(&ctx->labelLookup);
+    assembler_stats_sample_hashmap(&self->stats->labelLookup, hashmap_load_factor(&ctx->labelLookup),
+                                   hashmap_collisions_mean(&ctx->labelLookup));
+    assembler_stats_sample_hashmap(&self->stats->prototypesRegistry, hashmap_load_factor(&ctx->prototypesRegistry),
+                                   hashmap_collisions_mean(&ctx->prototypesRegistry));
+  }
+  
+  clearContext(ctx);
+  self->contextDepth--;
+}
+
 static int processPrototype(struct parser_stage2* self, const char* filename, const char* prototypeName, int line, int column, struct prototype** result) {
   const char* oldInputName = self->currentInputName;
   self->currentInputName = filename;
   
+  // Nested prototypes are processed inside this call so
+  // their spans nest like the prototype tree
+  struct trace_span span;
+  trace_span_begin(&span, "prototype", prototypeName);
+  
   int res = 0;
-  struct parser_stage2_context ctx = {
-    .owner = self,
-    .emitter = NULL,
-    .proto = NULL,
-    .iterator = NULL
-  };
   struct parser_stage2_context* oldCtx = self->currentCtx;
-  self->currentCtx = &ctx;
+  struct parser_stage2_context* ctx = acquireContext(self);
+  if (!ctx) {
+    res = -ENOMEM;
+    goto context_alloc_fail;
+  }
+  self->currentCtx = ctx;
   
-  ctx.proto = prototype_new(filename, prototypeName, line, column);
-  if (ctx.proto == NULL) {
+  ctx->proto = prototype_new(filename, prototypeName, line, column);
+  if (ctx->proto == NULL) {
     res = -ENOMEM;
     goto prototype_alloc_fail;
   }
   
-  ctx.emitter = code_emitter_new();
-  if (!ctx.emitter) {
+  ctx->emitter = code_emitter_new();
+  if (!ctx->emitter) {
     res = -ENOMEM;
     goto emitter_alloc_fail;
   }
-
-  hashmap_init(&ctx.labelLookup, hashmap_hash_string, strcmp);
-  hashmap_init(&ctx.prototypesRegistry, hashmap_hash_string, strcmp);
-  vec_init(&ctx.prototypesRegistryEntries);
-  vec_init(&ctx.ipToStamement);
+  ctx->emitter->compactEncoding = self->compactInstructions;
+  ctx->emitter->lexer = self->parser->lexer;
+  ctx->proto->isCompact = self->compactInstructions;
 
   // Process instructions
   bool isMainChunk = strcmp(prototypeName, ASSEMBLER_START_SYMBOL) == 0;
@@ -358,11 +551,13 @@ static int processPrototype(struct parser_stage2* self, const char* filename, co
   bool firstIteration = true;
   bool prototypeEnds = false;
   
-  if (self->parser->allStatements.length == 0)
+  // First statement is fetched before main prototype so
+  // none at all means empty input
+  if (!self->currentStatement)
     goto early_eof;
   
   while (true) {
-    if (self->nextStatementPointer >= self->parser->allStatements.length && !firstIteration) {
+    if (!firstIteration && self->nextStatementPointer >= self->parser->allStatements.length) {
       if (!isEOFSafe) {
         setError(self, "EOF detected!");
         res = -EFAULT;
@@ -375,25 +570,25 @@ static int processPrototype(struct parser_stage2* self, const char* filename, co
     firstIteration = true;
     
     struct statement* current = self->currentStatement;
-    ctx.iterator = token_iterator_new(current);
-    token_iterator_next(ctx.iterator, NULL);
+    ctx->iterator = token_iterator_new(current);
+    token_iterator_next(ctx->iterator, NULL);
     
-    if (!ctx.iterator) {
+    if (!ctx->iterator) {
       res = -ENOMEM;
       goto failed_alloc_token_iterator;
     }
     
     switch (current->type) {
       case STATEMENT_INSTRUCTION:
-        if ((res = processInstruction(self, &ctx)) < 0)
+        if ((res = processInstruction(self, ctx)) < 0)
           goto processing_error;
         break;
       case STATEMENT_LABEL_DECLARE:
-        if ((res = processLabelDecl(self, &ctx)) < 0)
+        if ((res = processLabelDecl(self, ctx)) < 0)
           goto processing_error;
         break;
       case STATEMENT_ASSEMBLER_DIRECTIVE:
-        res = processAssemblerDirective(self, &ctx);
+        res = processAssemblerDirective(self, ctx);
         if (res < 0) {
           goto processing_error;
         } else if (res == 1) { 
@@ -413,7 +608,7 @@ static int processPrototype(struct parser_stage2* self, const char* filename, co
       // If eof safe other code didnt expect error message is set
       if (isEOFSafe) {
         if (self->canFreeErrorMsg)
-          free((char*) self->errorMessage);
+          allocator_free((char*) self->errorMessage);
         
         self->errorMessage = NULL;
         self->canFreeErrorMsg = false;
@@ -424,18 +619,26 @@ static int processPrototype(struct parser_stage2* self, const char* filename, co
     }
 
 prototype_ended:
-    token_iterator_free(ctx.iterator);
-    ctx.iterator = NULL;
+    token_iterator_free(ctx->iterator);
+    ctx->iterator = NULL;
     
     if (prototypeEnds) 
       break;
   }
 
-early_eof:
-  res = code_emitter_finalize(ctx.emitter);
+early_eof:;
+  struct assembler_stats_timer finalizeTimer;
+  struct trace_span finalizeSpan;
+  trace_span_begin(&finalizeSpan, "stage", assembler_stats_get_stage_name(ASSEMBLER_STAGE_EMITTER_FINALIZE));
+  if (self->stats)
+    assembler_stats_timer_start(&finalizeTimer, ASSEMBLER_STAGE_EMITTER_FINALIZE);
+  res = code_emitter_finalize(ctx->emitter);
+  if (self->stats)
+    assembler_stats_timer_stop(self->stats, &finalizeTimer);
+  trace_span_end(&finalizeSpan);
   if (res == -EFAULT) {
     char* tmp;
-    util_asprintf(&tmp, "Code emitter error: %s", ctx.emitter->errorMessage);
+    util_asprintf(&tmp, "Code emitter error: %s", ctx->emitter->errorMessage);
     self->errorMessage = tmp;
     if (!tmp) {
       res = -ENOMEM;
@@ -444,51 +647,63 @@ early_eof:
     self->canFreeErrorMsg = true;
   }
   
-  if ((res = fixPrototypeLoads(&ctx)) < 0)
+  if ((res = fixPrototypeLoads(ctx)) < 0)
     goto fix_prototype_load_failure;
 
   // Reserving space
-  if (vec_reserve(&ctx.proto->instructions, ctx.emitter->instructions.length) < 0) { 
+  if (vec_reserve(&ctx->proto->instructions, ctx->emitter->instructions.length) < 0) { 
     res = -ENOMEM;
     goto finalizing_error;
   }
 
   // This *cannot* fail even if it fail the failure cant be detected and thus be silent
   // corruption!! 
-  vec_extend(&ctx.proto->instructions, &ctx.emitter->instructions);
+  vec_extend(&ctx->proto->instructions, &ctx->emitter->instructions);
+  
+  // Each statement emits one instruction so statement `i` is line of instruction `i`
+  if (vec_reserve(&ctx->proto->instructionLines, ctx->ipToOffset.length) < 0) { 
+    res = -ENOMEM;
+    goto finalizing_error;
+  }
+  
+  // Statements are in input order so lines are found in one pass
+  // (nested prototypes in between are skipped back over)
+  struct lexer_location* location = &self->location;
+  size_t statementIndex = 0;
+  size_t offset = 0;
+  vec_foreach(&ctx->ipToOffset, offset, statementIndex) {
+    lexer_locate(self->parser->lexer, offset, location);
+    if (location->line == LEXER_LOCATION_MAX) {
+      setError(self, "Too many lines for line table");
+      res = -EFAULT;
+      goto finalizing_error;
+    }
+    vec_push(&ctx->proto->instructionLines, location->line);
+  }
 
 finalizing_error:
 fix_prototype_load_failure:
 get_next_statement_failed:
 processing_error:
 eof_detected:
-  hashmap_cleanup(&ctx.labelLookup);
-  hashmap_cleanup(&ctx.prototypesRegistry);
-  
-  int i = 0;
-  struct prototype_registry_entry* current = NULL;
-  vec_foreach(&ctx.prototypesRegistryEntries, current, i) { 
-    free((char*) current->name);
-    free(current);
-  }
-  
-  vec_deinit(&ctx.prototypesRegistryEntries);
-  vec_deinit(&ctx.ipToStamement);
 failed_alloc_token_iterator:
-  token_iterator_free(ctx.iterator);
-  code_emitter_free(ctx.emitter); 
+  token_iterator_free(ctx->iterator);
+  code_emitter_free(ctx->emitter); 
 emitter_alloc_fail:
   // Only free prototype on failure
   if (res < 0) { 
-    prototype_free(ctx.proto);
-    ctx.proto = NULL;
+    prototype_free(ctx->proto);
+    ctx->proto = NULL;
   }
   
   if (result)
-    *result = ctx.proto;
+    *result = ctx->proto;
 prototype_alloc_fail:
+  releaseContext(self, ctx);
+context_alloc_fail:
   self->currentInputName = oldInputName;
   self->currentCtx = oldCtx;
+  trace_span_end(&span);
   return res;
 }
 
@@ -510,6 +725,14 @@ int parser_stage2_process(struct parser_stage2* self, struct bytecode** result)
   }
 
   res = processPrototype(self, self->parser->lexer->inputName, ASSEMBLER_START_SYMBOL, 0, 0, &self->bytecode->mainPrototype);
+  
+  // Bodies of untaken ones weren't lexed, the result or
+  // error is about different source
+  if (self->incremental && res != -ENOMEM && !incremental_cache_is_all_reused(self->incremental))
+    res = -EAGAIN;
+  
+  releaseStatement(self, self->currentStatement);
+  self->currentStatement = NULL;
 
 get_next_statement_error:
   if (res < 0) {
@@ -526,7 +749,7 @@ int parser_stage2_get_label(struct parser_stage2_context* ctx, const char* name,
   if (entry)
     goto lookup_hit;
   
-  entry = code_emitter_label_new(ctx->emitter, ctx->iterator->current);
+  entry = code_emitter_label_new(ctx->emitter, ctx->iterator->current->offset);
   if (!entry)
     return -ENOMEM;
   
@@ -540,7 +763,7 @@ int parser_stage2_get_label(struct parser_stage2_context* ctx, const char* name,
       break;
     default:
       if (err < 0)
-        setError(ctx->owner, "Unknown error adding label (its a bug please report): Label \'%s\' (Error: %s (%d))", name, strerror(err), err);
+        setError(ctx->owner, "Unknown error adding label (its a bug please report): Label \'%s\' (Error: %d)", name, err);
       break;
   }
 
@@ -562,15 +785,15 @@ int64_t parser_stage2_get_prototype_id(struct parser_stage2_context* ctx, const
   if (entry) 
     goto lookup_hit;
   
-  entry = malloc(sizeof(*entry));
+  entry = allocator_malloc(sizeof(*entry));
   if (!entry) {
     res = -ENOMEM;
     goto entry_alloc_failed;
   }
   entry->proto = NULL;
-  entry->name = strdup(name);
+  entry->name = allocator_strdup(name);
   if (entry->name == NULL) {
-    free(entry);
+    allocator_free(entry);
     goto entry_alloc_failed;
   }
   
@@ -588,8 +811,8 @@ int64_t parser_stage2_get_prototype_id(struct parser_stage2_context* ctx, const
   entry->id = ctx->prototypesRegistryEntries.length - 1; 
 insert_failed:
   if (res < 0) {
-    free((char*) entry->name);
-    free(entry);
+    allocator_free((char*) entry->name);
+    allocator_free(entry);
   }
 entry_alloc_failed:
 lookup_hit:
@@ -5,9 +5,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include "buffer.h"
 #include "vec.h"
 #include "hashmap.h"
+#include "lexer.h"
 
 // Stage 2 parser (Process statements into final bytecode product
 // which finally processed by protobuf to generate the data)
@@ -20,6 +20,9 @@ struct bytecode;
 struct parser_stage1;
 struct token_iterator;
 struct parser_stage2_context;
+struct assembler_stats;
+struct incremental_cache;
+struct spsc_queue;
 
 struct prototype_registry_entry {
   uint32_t id;
@@ -40,13 +43,42 @@ struct parser_stage2 {
   
   const char* currentInputName;
   
-  int nextStatementPointer; 
+  size_t nextStatementPointer; 
   struct statement* currentStatement;
   
   struct bytecode* bytecode;
   struct parser_stage2_context* currentCtx;
   
   bool isStatementCompilerRegistered;
+  
+  // Emit compact instructions (must be set before processing)
+  bool compactInstructions;
+  
+  // Loads of undefined prototypes are left as references
+  // for linker instead of being an error (must be set
+  // before processing)
+  bool allowUnresolvedPrototypes;
+  
+  // Contexts' storage indexed by prototype nesting depth
+  size_t contextDepth;
+  
+  // Last located offset, lines of later ones are counted
+  // from there instead of from start of input
+  struct lexer_location location;
+  
+  // Where to record emitter finalize time, labels and hashmap
+  // statistics, NULL if not wanted
+  struct assembler_stats* stats;
+  vec_t(struct parser_stage2_context*) contextPool;
+  
+  // Pipelined mode, statements are taken from here instead
+  // of parser's statements (NULL after reset)
+  struct spsc_queue* input;
+  
+  // Copy prototypes it found unchanged instead of compiling
+  // them and record ranges of the rest, must be prepared for
+  // the lexer's source. NULL if not wanted (NULL after reset)
+  struct incremental_cache* incremental;
 };
 
 struct parser_stage2_context {
@@ -54,10 +86,12 @@ struct parser_stage2_context {
   struct prototype* proto;
   struct code_emitter* emitter;
   
-  HASHMAP(char, struct code_emitter_label) labelLookup;
-  HASHMAP(char, struct prototype_registry_entry) prototypesRegistry;
+  SWISS_HASHMAP(char, struct code_emitter_label) labelLookup;
+  SWISS_HASHMAP(char, struct prototype_registry_entry) prototypesRegistry;
   vec_t(struct prototype_registry_entry*) prototypesRegistryEntries;
-  vec_t(struct statement*) ipToStamement;
+  // Offset of statement each instruction came from, statements
+  // themselves are freed once stage 2 moves past them
+  vec_t(size_t) ipToOffset;
   
   struct token_iterator* iterator;
 };
@@ -65,11 +99,20 @@ struct parser_stage2_context {
 struct parser_stage2* parser_stage2_new(struct parser_stage1* lexer);
 void parser_stage2_free(struct parser_stage2* self);
 
+// Prepare for new (not yet processed) `parser` while keeping
+// the statement compiler with its registered instructions and
+// per prototype storage. `compactInstructions` and
+// `allowUnresolvedPrototypes` are left as is
+// The bytecode from previous process is owned by the caller
+void parser_stage2_reset(struct parser_stage2* self, struct parser_stage1* parser);
+
 // 0 on success
 // Errors:
 // -EFAULT: Error parsing (check self->errormsg)
 // -ENOMEM: Not enough memory
 // -EINVAL: Attempt to process failed instance
+// -EAGAIN: Prototypes from `incremental` cannot be used,
+//          reset it and process the source again
 int parser_stage2_process(struct parser_stage2* self, struct bytecode** result);
 
 // 0 on success
@@ -0,0 +1,153 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/syscall.h>
+#endif
+
+#include "perf_counters.h"
+
+static atomic_bool isEnabled = false;
+
+// Bit per counter which failed to open on any thread
+static atomic_uint unavailable = 0;
+
+const char* perf_counters_get_name(enum perf_counter counter) {
+  static const char* lookup[] = {
+#   define X(t, str, ...) [t] = str,
+    PERF_COUNTER
+#   undef X
+  };
+  
+  return lookup[counter];
+}
+
+bool perf_counters_is_enabled() {
+  return atomic_load_explicit(&isEnabled, memory_order_relaxed);
+}
+
+bool perf_counters_is_available(enum perf_counter counter) {
+  return (atomic_load_explicit(&unavailable, memory_order_relaxed) & (1u << counter)) == 0;
+}
+
+#ifdef __linux__
+
+struct thread_counters {
+  bool isOpened;
+  // -1 if the counter couldn't be opened
+  int fds[PERF_COUNTER_COUNT];
+};
+
+static _Thread_local struct thread_counters threadCounters;
+
+// Closes counters of exiting threads
+static pthread_key_t threadExitKey;
+static pthread_once_t threadExitKeyOnce = PTHREAD_ONCE_INIT;
+
+static void closeCounters(void* _counters) {
+  struct thread_counters* counters = _counters;
+  for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+    if (counters->fds[i] >= 0)
+      close(counters->fds[i]);
+  counters->isOpened = false;
+}
+
+static void createThreadExitKey() {
+  pthread_key_create(&threadExitKey, closeCounters);
+}
+
+static int openCounter(uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  
+  // User space only, works with perf_event_paranoid up to 2
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  
+  // Calling thread on any CPU
+  int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  return fd >= 0 ? fd : -errno;
+}
+
+// Return result of opening first counter
+static int openCounters(struct thread_counters* counters) {
+  static const uint64_t configs[] = {
+    [PERF_COUNTER_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+    [PERF_COUNTER_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [PERF_COUNTER_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+    [PERF_COUNTER_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES
+  };
+  
+  int firstResult = 0;
+  unsigned failed = 0;
+  for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+    int res = openCounter(configs[i]);
+    if (i == 0)
+      firstResult = res;
+    
+    counters->fds[i] = res >= 0 ? res : -1;
+    if (res < 0)
+      failed |= 1u << i;
+  }
+  
+  atomic_fetch_or_explicit(&unavailable, failed, memory_order_relaxed);
+  counters->isOpened = true;
+  pthread_once(&threadExitKeyOnce, createThreadExitKey);
+  pthread_setspecific(threadExitKey, counters);
+  
+  if (failed == (1u << PERF_COUNTER_COUNT) - 1)
+    return firstResult;
+  return 0;
+}
+
+int perf_counters_enable() {
+  atomic_store_explicit(&isEnabled, true, memory_order_relaxed);
+  
+  int res = 0;
+  if (!threadCounters.isOpened)
+    res = openCounters(&threadCounters);
+  
+  // Nothing to count with
+  if (res < 0)
+    atomic_store_explicit(&isEnabled, false, memory_order_relaxed);
+  return res;
+}
+
+void perf_counters_read(struct perf_counters_sample* sample) {
+  memset(sample, 0, sizeof(*sample));
+  if (!threadCounters.isOpened)
+    openCounters(&threadCounters);
+  
+  for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+    // Value, time enabled and time running
+    uint64_t data[3];
+    if (threadCounters.fds[i] < 0 || read(threadCounters.fds[i], data, sizeof(data)) != sizeof(data))
+      continue;
+    
+    // Counter only ran part of the time (multiplexed with
+    // other events) so extrapolate
+    if (data[2] > 0 && data[2] < data[1])
+      data[0] = (uint64_t) ((double) data[0] * (double) data[1] / (double) data[2]);
+    sample->values[i] = data[0];
+  }
+}
+
+#else
+
+int perf_counters_enable() {
+  return -ENOSYS;
+}
+
+void perf_counters_read(struct perf_counters_sample* sample) {
+  memset(sample, 0, sizeof(*sample));
+}
+
+#endif
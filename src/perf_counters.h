@@ -0,0 +1,52 @@
+#ifndef _headers_1668290547_Fluff_Assembler_perf_counters
+#define _headers_1668290547_Fluff_Assembler_perf_counters
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hardware performance counters of calling thread through
+// perf_event_open (Linux only, see --perf-counters)
+//
+// Each thread opens its own counters on first read and closes
+// them when it exits. Counters which can't be opened (no PMU
+// in a VM, perf_event_paranoid or seccomp in containers) read
+// as zero and are reported as unavailable instead of failing.
+// Values are scaled up if kernel had to multiplex them
+
+#define PERF_COUNTER \
+  X(PERF_COUNTER_CYCLES, "cycles") \
+  X(PERF_COUNTER_INSTRUCTIONS, "instructions") \
+  X(PERF_COUNTER_BRANCH_MISSES, "branch_misses") \
+  X(PERF_COUNTER_CACHE_MISSES, "cache_misses")
+
+enum perf_counter {
+# define X(name, ...) name,
+  PERF_COUNTER
+# undef X
+  PERF_COUNTER_COUNT
+};
+
+struct perf_counters_sample {
+  uint64_t values[PERF_COUNTER_COUNT];
+};
+
+// Process wide switch, off by default. Call before starting
+// threads which are to be counted
+// Return 0 if at least one counter works on calling thread
+// Errors:
+// -ENOSYS: Not supported on this platform
+// Other negative errno from perf_event_open of first counter
+int perf_counters_enable();
+bool perf_counters_is_enabled();
+
+// Read calling thread's counters
+void perf_counters_read(struct perf_counters_sample* sample);
+
+// False if counter couldn't be opened on some thread
+// which read counters
+bool perf_counters_is_available(enum perf_counter counter);
+
+const char* perf_counters_get_name(enum perf_counter counter);
+
+#endif
+
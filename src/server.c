@@ -0,0 +1,346 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "allocator.h"
+#include "assembler_context.h"
+#include "assembler_driver.h"
+#include "byte_buffer.h"
+#include "server_protocol.h"
+#include "util.h"
+
+// Connections wait here for a free worker once accepted, accept
+// loop stops taking more (they wait in listen backlog) when full
+#define MAX_PENDING_CONNECTIONS 64
+
+// Idle connections hold a worker too, so a single processor
+// machine still serves a few clients at once
+#define MIN_WORKERS 4
+
+struct server;
+
+// Per worker state, kept for all connections the worker serves
+// so buffers and assembler context are reused between requests
+// and a warm connection assembles without allocating for I/O
+// or rebuilding the instruction registry
+struct connection {
+  struct server* server;
+  pthread_t thread;
+  
+  // Connection being served or -1, changes under server's lock
+  int fd;
+  struct assembler_context* context;
+  
+  char* name;
+  char* source;
+  size_t sourceCapacity;
+  
+  struct byte_buffer bytecode;
+  struct byte_buffer debugInfo;
+};
+
+struct server {
+  pthread_mutex_t lock;
+  pthread_cond_t hasPending;
+  pthread_cond_t hasSpace;
+  bool isStopping;
+  
+  // Ring of accepted connections not yet taken by a worker
+  int pending[MAX_PENDING_CONNECTIONS];
+  size_t pendingHead;
+  size_t pendingCount;
+  
+  struct connection* workers;
+  int workerCount;
+};
+
+static void connectionDeinit(struct connection* self) {
+  assembler_context_free(self->context);
+  allocator_free(self->name);
+  allocator_free(self->source);
+  byte_buffer_deinit(&self->bytecode);
+  byte_buffer_deinit(&self->debugInfo);
+}
+
+// Return 0 on success
+// Errors:
+// -EPIPE: Connection closed
+// -EPROTO: Malformed request
+// -ENOMEM: Not enough memory
+static int readRequest(struct connection* self, struct server_request_header* header) {
+  int res;
+  if ((res = server_protocol_read(self->fd, header, sizeof(*header))) < 0)
+    return res;
+  
+  if (header->magic != SERVER_PROTOCOL_MAGIC ||
+      header->nameSize > SERVER_PROTOCOL_MAX_NAME_SIZE ||
+      header->sourceSize > SERVER_PROTOCOL_MAX_SOURCE_SIZE)
+    return -EPROTO;
+  
+  // +1 so empty source still get non NULL buffer
+  if ((size_t) header->sourceSize + 1 > self->sourceCapacity) {
+    char* newSource = allocator_realloc(self->source, (size_t) header->sourceSize + 1);
+    if (!newSource)
+      return -ENOMEM;
+    self->source = newSource;
+    self->sourceCapacity = (size_t) header->sourceSize + 1;
+  }
+  
+  if ((res = server_protocol_read(self->fd, self->name, header->nameSize)) < 0)
+    return res;
+  self->name[header->nameSize] = '\0';
+  
+  return server_protocol_read(self->fd, self->source, header->sourceSize);
+}
+
+static int handleRequest(struct connection* self, const struct server_request_header* header) {
+  struct assembler_driver_options options;
+  bool wantDebugInfo = false;
+  const char* errorMessage = NULL;
+  
+  self->bytecode.size = 0;
+  self->debugInfo.size = 0;
+  
+  int res = server_protocol_decode_flags(header->flags, &options, &wantDebugInfo);
+  if (res < 0)
+    errorMessage = allocator_strdup("Unknown request flags");
+  else
+    res = assembler_context_assemble_buffer(self->context, self->name, self->source, header->sourceSize, &options, &errorMessage,
+                                            &self->bytecode, wantDebugInfo ? &self->debugInfo : NULL);
+  
+  struct server_response_header response = {
+    .magic = SERVER_PROTOCOL_MAGIC,
+    .result = res,
+    .bytecodeSize = res >= 0 ? self->bytecode.size : 0,
+    .debugInfoSize = res >= 0 ? self->debugInfo.size : 0,
+    .errorMessageSize = errorMessage ? strlen(errorMessage) : 0
+  };
+  
+  struct iovec iov[] = {
+    {&response, sizeof(response)},
+    {self->bytecode.data, response.bytecodeSize},
+    {self->debugInfo.data, response.debugInfoSize},
+    {(char*) errorMessage, response.errorMessageSize}
+  };
+  int writeRes = server_protocol_writev(self->fd, iov, ARRAY_SIZE(iov));
+  
+  allocator_free((char*) errorMessage);
+  return writeRes;
+}
+
+static void serveConnection(struct connection* self) {
+  struct server_request_header header;
+  
+  int res;
+  while ((res = readRequest(self, &header)) >= 0)
+    if (handleRequest(self, &header) < 0)
+      break;
+  
+  // Closing the connection is the only way to report
+  // malformed request as the stream can't be resynced
+  if (res == -EPROTO)
+    fprintf(stderr, "server: Malformed request, closing connection\n");
+}
+
+// Wait for next connection and set it as `self->fd`
+// Return false if server is stopping
+static bool takeConnection(struct connection* self) {
+  struct server* server = self->server;
+  pthread_mutex_lock(&server->lock);
+  while (server->pendingCount == 0 && !server->isStopping)
+    pthread_cond_wait(&server->hasPending, &server->lock);
+  
+  bool isTaken = !server->isStopping;
+  if (isTaken) {
+    self->fd = server->pending[server->pendingHead];
+    server->pendingHead = (server->pendingHead + 1) % MAX_PENDING_CONNECTIONS;
+    server->pendingCount--;
+    pthread_cond_signal(&server->hasSpace);
+  }
+  pthread_mutex_unlock(&server->lock);
+  return isTaken;
+}
+
+static void finishConnection(struct connection* self) {
+  pthread_mutex_lock(&self->server->lock);
+  close(self->fd);
+  self->fd = -1;
+  pthread_mutex_unlock(&self->server->lock);
+}
+
+static void* connectionWorker(void* _self) {
+  struct connection* self = _self;
+  while (takeConnection(self)) {
+    serveConnection(self);
+    finishConnection(self);
+  }
+  return NULL;
+}
+
+// Wait until there is room for `fd` then hand it to workers
+static void queueConnection(struct server* server, int fd) {
+  pthread_mutex_lock(&server->lock);
+  while (server->pendingCount == MAX_PENDING_CONNECTIONS)
+    pthread_cond_wait(&server->hasSpace, &server->lock);
+  
+  server->pending[(server->pendingHead + server->pendingCount) % MAX_PENDING_CONNECTIONS] = fd;
+  server->pendingCount++;
+  pthread_cond_signal(&server->hasPending);
+  pthread_mutex_unlock(&server->lock);
+}
+
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EAGAIN: Cannot create any thread
+static int startWorkers(struct server* server) {
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+  int count = processors > MIN_WORKERS ? (int) processors : MIN_WORKERS;
+  server->workers = allocator_calloc(count, sizeof(*server->workers));
+  if (!server->workers)
+    return -ENOMEM;
+  
+  // Workers which failed to start are fine as long as
+  // at least one is running
+  for (int i = 0; i < count; i++) {
+    struct connection* worker = &server->workers[server->workerCount];
+    *worker = (struct connection) {
+      .server = server,
+      .fd = -1,
+      .bytecode = BYTE_BUFFER_INIT,
+      .debugInfo = BYTE_BUFFER_INIT
+    };
+    
+    if ((worker->name = allocator_malloc(SERVER_PROTOCOL_MAX_NAME_SIZE + 1)) == NULL ||
+        (worker->context = assembler_context_new()) == NULL ||
+        pthread_create(&worker->thread, NULL, connectionWorker, worker) != 0) {
+      connectionDeinit(worker);
+      break;
+    }
+    server->workerCount++;
+  }
+  
+  if (server->workerCount == 0) {
+    allocator_free(server->workers);
+    return -EAGAIN;
+  }
+  return 0;
+}
+
+static void stopWorkers(struct server* server) {
+  pthread_mutex_lock(&server->lock);
+  server->isStopping = true;
+  
+  // Workers waiting for their client's next request see
+  // the connection closed instead
+  for (int i = 0; i < server->workerCount; i++)
+    if (server->workers[i].fd >= 0)
+      shutdown(server->workers[i].fd, SHUT_RDWR);
+  
+  for (; server->pendingCount > 0; server->pendingCount--) {
+    close(server->pending[server->pendingHead]);
+    server->pendingHead = (server->pendingHead + 1) % MAX_PENDING_CONNECTIONS;
+  }
+  pthread_cond_broadcast(&server->hasPending);
+  pthread_mutex_unlock(&server->lock);
+  
+  for (int i = 0; i < server->workerCount; i++) {
+    pthread_join(server->workers[i].thread, NULL);
+    connectionDeinit(&server->workers[i]);
+  }
+  allocator_free(server->workers);
+}
+
+// Remove socket left by a server which is no longer running
+// Return 0 if `addr` is free to bind
+// Errors:
+// -EEXIST: Something other than a socket is there
+// -EADDRINUSE: Server is listening on it
+static int removeStaleSocket(const struct sockaddr_un* addr) {
+  struct stat st;
+  if (lstat(addr->sun_path, &st) < 0)
+    return errno == ENOENT ? 0 : -errno;
+  if (!S_ISSOCK(st.st_mode))
+    return -EEXIST;
+  
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -errno;
+  
+  int res = 0;
+  if (connect(fd, (const struct sockaddr*) addr, sizeof(*addr)) == 0)
+    res = -EADDRINUSE;
+  else if (errno != ECONNREFUSED)
+    res = -errno;
+  else if (unlink(addr->sun_path) < 0 && errno != ENOENT)
+    res = -errno;
+  close(fd);
+  return res;
+}
+
+int server_run(const char* socketPath) {
+  struct sockaddr_un addr = {
+    .sun_family = AF_UNIX
+  };
+  
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    return -ENAMETOOLONG;
+  strcpy(addr.sun_path, socketPath);
+  
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -errno;
+  
+  struct server server = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .hasPending = PTHREAD_COND_INITIALIZER,
+    .hasSpace = PTHREAD_COND_INITIALIZER
+  };
+  
+  int res = 0;
+  if ((res = removeStaleSocket(&addr)) < 0)
+    goto listen_failure;
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+    res = -errno;
+    goto listen_failure;
+  }
+  if ((res = startWorkers(&server)) < 0)
+    goto start_workers_failure;
+  
+  while (true) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      
+      // Out of file descriptors or memory is temporary,
+      // existing connections will free some
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+        usleep(10 * 1000);
+        continue;
+      }
+      
+      res = -errno;
+      break;
+    }
+    
+    queueConnection(&server, client);
+  }
+  
+  stopWorkers(&server);
+start_workers_failure:
+  unlink(socketPath);
+listen_failure:
+  close(fd);
+  return res;
+}
+
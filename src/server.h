@@ -0,0 +1,23 @@
+#ifndef _headers_1667559950_Fluff_Assembler_server
+#define _headers_1667559950_Fluff_Assembler_server
+
+// Long running assembler listening on an Unix domain
+// socket (see server_protocol.h for wire format)
+
+// Serve until listening fails, connections are served by a
+// fixed pool of threads (one per online processor, at least 4)
+// and may carry any number of requests. A connection holds its
+// thread until closed, further clients wait until one is free
+// Stale socket at `socketPath` (nothing accepts on it) is
+// replaced, anything else there is left alone
+// Errors:
+// -ENAMETOOLONG: Socket path too long
+// -EEXIST: `socketPath` exists and isn't a socket
+// -EADDRINUSE: Another server is listening on `socketPath`
+// -ENOMEM: Not enough memory
+// -EAGAIN: Cannot create any thread
+// Other errno from socket, bind, listen or accept
+int server_run(const char* socketPath);
+
+#endif
+
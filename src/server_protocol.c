@@ -0,0 +1,88 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "server_protocol.h"
+#include "assembler_driver.h"
+
+uint32_t server_protocol_encode_flags(const struct assembler_driver_options* options, bool debugInfo) {
+  uint32_t flags = 0;
+  if (options->serializer.version == 1)
+    flags |= SERVER_REQUEST_FORMAT_V1;
+  if (options->serializer.compressInstructions)
+    flags |= SERVER_REQUEST_COMPRESS;
+  if (options->compactInstructions)
+    flags |= SERVER_REQUEST_COMPACT;
+  if (options->serializer.stripDebugInfo)
+    flags |= SERVER_REQUEST_STRIP_DEBUG_INFO;
+  if (options->object)
+    flags |= SERVER_REQUEST_OBJECT;
+  if (debugInfo)
+    flags |= SERVER_REQUEST_DEBUG_INFO;
+  return flags;
+}
+
+int server_protocol_decode_flags(uint32_t flags, struct assembler_driver_options* options, bool* debugInfo) {
+  if (flags & ~SERVER_REQUEST_FLAGS_ALL)
+    return -EINVAL;
+  
+  *options = (struct assembler_driver_options) ASSEMBLER_DRIVER_OPTIONS_DEFAULT;
+  if (flags & SERVER_REQUEST_FORMAT_V1)
+    options->serializer.version = 1;
+  options->serializer.compressInstructions = flags & SERVER_REQUEST_COMPRESS;
+  options->compactInstructions = flags & SERVER_REQUEST_COMPACT;
+  options->serializer.stripDebugInfo = flags & SERVER_REQUEST_STRIP_DEBUG_INFO;
+  options->object = flags & SERVER_REQUEST_OBJECT;
+  *debugInfo = flags & SERVER_REQUEST_DEBUG_INFO;
+  return 0;
+}
+
+int server_protocol_read(int fd, void* buffer, size_t size) {
+  char* current = buffer;
+  while (size > 0) {
+    ssize_t res = read(fd, current, size);
+    if (res == 0)
+      return -EPIPE;
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+    
+    current += res;
+    size -= res;
+  }
+  return 0;
+}
+
+int server_protocol_writev(int fd, struct iovec* iov, int count) {
+  struct msghdr msg = {
+    .msg_iov = iov,
+    .msg_iovlen = count
+  };
+  
+  while (msg.msg_iovlen > 0) {
+    // MSG_NOSIGNAL so closed peer is an error instead of SIGPIPE
+    ssize_t res = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+    
+    // Skip what was sent and retry the rest
+    while (msg.msg_iovlen > 0 && (size_t) res >= msg.msg_iov->iov_len) {
+      res -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = (char*) msg.msg_iov->iov_base + res;
+      msg.msg_iov->iov_len -= res;
+    }
+  }
+  return 0;
+}
+
@@ -0,0 +1,82 @@
+#ifndef _headers_1667559807_Fluff_Assembler_server_protocol
+#define _headers_1667559807_Fluff_Assembler_server_protocol
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct iovec;
+struct assembler_driver_options;
+
+/*
+ * Wire format of assembler server (Unix domain socket, so
+ * native byte order)
+ *
+ * Client sends any number of requests over one connection
+ *   struct server_request_header
+ *   name (nameSize bytes, not NUL terminated)
+ *   source (sourceSize bytes)
+ *
+ * Server answers each in order
+ *   struct server_response_header
+ *   bytecode (bytecodeSize bytes)
+ *   sidecar debug info (debugInfoSize bytes)
+ *   error message (errorMessageSize bytes, not NUL terminated)
+ */
+
+// "FAS" + protocol version
+#define SERVER_PROTOCOL_MAGIC 0x46415301
+
+#define SERVER_PROTOCOL_MAX_NAME_SIZE 4096
+#define SERVER_PROTOCOL_MAX_SOURCE_SIZE (64 * 1024 * 1024)
+
+// Request flags
+#define SERVER_REQUEST_FORMAT_V1 (1 << 0)
+#define SERVER_REQUEST_COMPRESS (1 << 1)
+#define SERVER_REQUEST_COMPACT (1 << 2)
+#define SERVER_REQUEST_STRIP_DEBUG_INFO (1 << 3)
+// Return sidecar debug info with the bytecode
+#define SERVER_REQUEST_DEBUG_INFO (1 << 4)
+#define SERVER_REQUEST_OBJECT (1 << 5)
+#define SERVER_REQUEST_FLAGS_ALL ((1 << 6) - 1)
+
+struct server_request_header {
+  uint32_t magic;
+  uint32_t flags;
+  uint32_t nameSize;
+  uint32_t sourceSize;
+};
+
+struct server_response_header {
+  uint32_t magic;
+  // 0 or negative errno from assembler_driver_assemble
+  int32_t result;
+  uint32_t bytecodeSize;
+  uint32_t debugInfoSize;
+  uint32_t errorMessageSize;
+};
+
+uint32_t server_protocol_encode_flags(const struct assembler_driver_options* options, bool debugInfo);
+
+// Return 0 on success
+// Errors:
+// -EINVAL: Unknown flags
+int server_protocol_decode_flags(uint32_t flags, struct assembler_driver_options* options, bool* debugInfo);
+
+// Read exactly `size` bytes, retrying on short read and EINTR
+// Return 0 on success
+// Errors:
+// -EPIPE: Connection closed (even partway)
+// Other errno from read
+int server_protocol_read(int fd, void* buffer, size_t size);
+
+// Write all of `iov` in as few syscalls as possible, `iov`
+// is modified in the process
+// Return 0 on success
+// Errors:
+// -EPIPE: Connection closed
+// Other errno from sendmsg
+int server_protocol_writev(int fd, struct iovec* iov, int count);
+
+#endif
+
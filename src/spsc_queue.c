@@ -0,0 +1,115 @@
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#include "spsc_queue.h"
+#include "allocator.h"
+
+// Busy spins before yielding, then yields before sleeping
+#define SPIN_COUNT 256
+#define YIELD_COUNT 64
+#define SLEEP_NS 20000
+
+static void backoff(int* attempt) {
+  int current = (*attempt)++;
+  if (current < SPIN_COUNT)
+    return;
+  
+  if (current < SPIN_COUNT + YIELD_COUNT) {
+    sched_yield();
+    return;
+  }
+  
+  struct timespec duration = {.tv_nsec = SLEEP_NS};
+  nanosleep(&duration, NULL);
+}
+
+int spsc_queue_init(struct spsc_queue* self, size_t capacity) {
+  size_t rounded = 1;
+  while (rounded < capacity)
+    rounded <<= 1;
+  
+  self->capacity = rounded;
+  self->slots = allocator_malloc(rounded * sizeof(*self->slots));
+  if (!self->slots)
+    return -ENOMEM;
+  
+  atomic_init(&self->tail, 0);
+  atomic_init(&self->head, 0);
+  atomic_init(&self->isClosed, false);
+  atomic_init(&self->isAborted, false);
+  self->cachedHead = 0;
+  self->cachedTail = 0;
+  return 0;
+}
+
+void spsc_queue_deinit(struct spsc_queue* self) {
+  allocator_free(self->slots);
+}
+
+bool spsc_queue_push(struct spsc_queue* self, void* item) {
+  size_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+  int attempt = 0;
+  while (tail - self->cachedHead >= self->capacity) {
+    if (atomic_load_explicit(&self->isAborted, memory_order_relaxed))
+      return false;
+  
+    self->cachedHead = atomic_load_explicit(&self->head, memory_order_acquire);
+    if (tail - self->cachedHead >= self->capacity)
+      backoff(&attempt);
+  }
+  
+  self->slots[tail & (self->capacity - 1)] = item;
+  atomic_store_explicit(&self->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+void spsc_queue_close(struct spsc_queue* self) {
+  atomic_store_explicit(&self->isClosed, true, memory_order_release);
+}
+
+bool spsc_queue_wait(struct spsc_queue* self) {
+  size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+  int attempt = 0;
+  while (head == self->cachedTail) {
+    if (atomic_load_explicit(&self->isAborted, memory_order_relaxed))
+      return false;
+  
+    // Check closed before tail, items pushed before
+    // close are then guaranteed to be seen
+    bool isClosed = atomic_load_explicit(&self->isClosed, memory_order_acquire);
+    self->cachedTail = atomic_load_explicit(&self->tail, memory_order_acquire);
+    if (head != self->cachedTail)
+      break;
+    if (isClosed)
+      return false;
+    backoff(&attempt);
+  }
+  
+  return !atomic_load_explicit(&self->isAborted, memory_order_relaxed);
+}
+
+void* spsc_queue_pop(struct spsc_queue* self) {
+  if (!spsc_queue_wait(self))
+    return NULL;
+  
+  size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+  void* item = self->slots[head & (self->capacity - 1)];
+  atomic_store_explicit(&self->head, head + 1, memory_order_release);
+  return item;
+}
+
+void spsc_queue_abort(struct spsc_queue* self) {
+  atomic_store_explicit(&self->isAborted, true, memory_order_relaxed);
+}
+
+void* spsc_queue_take_leftover(struct spsc_queue* self) {
+  size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&self->tail, memory_order_acquire))
+    return NULL;
+  
+  void* item = self->slots[head & (self->capacity - 1)];
+  atomic_store_explicit(&self->head, head + 1, memory_order_relaxed);
+  return item;
+}
+
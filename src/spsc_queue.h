@@ -0,0 +1,71 @@
+#ifndef _headers_1668034419_Fluff_Assembler_spsc_queue
+#define _headers_1668034419_Fluff_Assembler_spsc_queue
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bounded lock free single producer single consumer queue
+// of pointers, connects the pipelined assembler stages
+//
+// Each side keeps a cached copy of the other side's index
+// and only touches the shared one when the cached copy says
+// full or empty, so items effectively move in batches. Full
+// or empty side spins for a while then sleeps in short
+// steps instead of waiting on a lock
+
+#define SPSC_QUEUE_CACHE_LINE 64
+
+struct spsc_queue {
+  // Power of two
+  size_t capacity;
+  void** slots;
+
+  // Written by producer only
+  alignas(SPSC_QUEUE_CACHE_LINE) atomic_size_t tail;
+  size_t cachedHead;
+
+  // Written by consumer only
+  alignas(SPSC_QUEUE_CACHE_LINE) atomic_size_t head;
+  size_t cachedTail;
+
+  alignas(SPSC_QUEUE_CACHE_LINE) atomic_bool isClosed;
+  atomic_bool isAborted;
+};
+
+// `capacity` is rounded up to power of two
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int spsc_queue_init(struct spsc_queue* self, size_t capacity);
+void spsc_queue_deinit(struct spsc_queue* self);
+
+// Producer side
+// Waits while full, item is dropped if queue was aborted
+// Return false if it was dropped
+bool spsc_queue_push(struct spsc_queue* self, void* item);
+
+// No more pushes, consumer drains the rest then gets NULL
+void spsc_queue_close(struct spsc_queue* self);
+
+// Consumer side
+// Waits while empty, return NULL once closed and drained
+// or right away if aborted
+void* spsc_queue_pop(struct spsc_queue* self);
+
+// Wait until pop has something to return
+// Return false if it would return NULL
+bool spsc_queue_wait(struct spsc_queue* self);
+
+// Either side, consumer stops receiving and
+// producer's pushes are dropped from now on
+void spsc_queue_abort(struct spsc_queue* self);
+
+// Once neither side uses the queue, take items which were
+// pushed but never popped (so owned items can be freed)
+// Return NULL when none left
+void* spsc_queue_take_leftover(struct spsc_queue* self);
+
+#endif
+
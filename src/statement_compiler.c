@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <stdbool.h>
 
+#include "allocator.h"
 #include "hashmap.h"
 #include "parser_stage2.h"
 #include "token_iterator.h"
@@ -18,12 +19,12 @@ struct statement_compiler* statement_compiler_new(struct parser_stage2* parser,
     return NULL;
   }
   
-  struct statement_compiler* self = malloc(sizeof(*self));
+  struct statement_compiler* self = allocator_malloc(sizeof(*self));
   if (!self)
     return NULL;
   self->overrideBy = overrideBy;
   self->parser = parser;
-  hashmap_init(&self->emitterRegistry, hashmap_hash_string, strcmp);
+  hashmap_init(&self->emitterRegistry, swiss_hashmap_hash_string, strcmp);
   
   return self;
 }
@@ -39,21 +40,28 @@ void statement_compiler_free(struct statement_compiler* self) {
   
   if (!self)
     return;
-  free(self);
+  allocator_free(self);
 }
 
 int statement_compiler_register(struct statement_compiler* self, const char* name, struct statement_processor* entry) {
-  struct statement_processor* newEntry = malloc(sizeof(*newEntry));
+  struct statement_processor* newEntry = allocator_malloc(sizeof(*newEntry));
   if (!newEntry)
     return -ENOMEM;
   
   *newEntry = *entry;
-  newEntry->name = strdup(name);
+  newEntry->name = allocator_strdup(name);
   newEntry->owner = self;
+  if (!newEntry->name) {
+    allocator_free(newEntry);
+    return -ENOMEM;
+  }
 
-  int res = hashmap_put(&self->emitterRegistry, name, newEntry);
-  if (res < 0)
-    free(newEntry);
+  // Keyed by entry's own copy, `name` may be caller's buffer
+  int res = hashmap_put(&self->emitterRegistry, newEntry->name, newEntry);
+  if (res < 0) {
+    allocator_free((char*) newEntry->name);
+    allocator_free(newEntry);
+  }
   return res;
 }
 
@@ -62,8 +70,8 @@ int statement_compiler_unregister(struct statement_compiler* self, const char* n
   if (entry == NULL)
     return -EADDRNOTAVAIL;
   
-  free((char*) entry->name);
-  free(entry);
+  allocator_free((char*) entry->name);
+  allocator_free(entry);
   return 0;
 }
 
@@ -71,7 +79,7 @@ int statement_compile(struct statement_compiler* self, struct parser_stage2_cont
   if (context->iterator->current == NULL)
     return -EINVAL;
   
-  struct statement_processor* funcEntry = hashmap_get(&self->emitterRegistry, context->iterator->current->data.identifier->data);
+  struct statement_processor* funcEntry = hashmap_get(&self->emitterRegistry, context->iterator->current->data.identifier);
   if (!funcEntry)
     return -EADDRNOTAVAIL;
   
@@ -29,6 +29,7 @@ typedef int (*statement_processor_func)(struct statement_processor_context* ctx)
 struct statement_processor {
   void* udata;
   int udata1;
+  int udata2;
   statement_processor_func processor;
   
   const char* name;
@@ -38,7 +39,7 @@ struct statement_processor {
 struct statement_compiler {
   struct parser_stage2* parser;
   struct statement_compiler* overrideBy;
-  HASHMAP(char, struct statement_processor) emitterRegistry;
+  SWISS_HASHMAP(char, struct statement_processor) emitterRegistry;
 };
 
 struct statement_processor_context {
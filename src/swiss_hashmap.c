@@ -0,0 +1,462 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#include "swiss_hashmap.h"
+#include "allocator.h"
+
+// Control bytes, full slots store low 7 bits of hash
+// so only these have high bit set
+#define CTRL_EMPTY ((uint8_t) 0x80)
+#define CTRL_DELETED ((uint8_t) 0xFE)
+
+#define GROUP_SIZE SWISS_HASHMAP_GROUP_SIZE
+
+// Bitmask with one bit per slot in a group
+typedef uint32_t group_mask;
+
+#if defined(__SSE2__)
+static inline group_mask matchByte(const uint8_t* group, uint8_t byte) {
+  __m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+  return (group_mask) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) byte)));
+}
+
+// Empty and deleted are the only ones with high bit set
+static inline group_mask matchEmptyOrDeleted(const uint8_t* group) {
+  return (group_mask) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+}
+#else
+static inline group_mask matchByte(const uint8_t* group, uint8_t byte) {
+  group_mask mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++)
+    mask |= (group_mask) (group[i] == byte) << i;
+  return mask;
+}
+
+static inline group_mask matchEmptyOrDeleted(const uint8_t* group) {
+  group_mask mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++)
+    mask |= (group_mask) (group[i] >> 7) << i;
+  return mask;
+}
+#endif
+
+static inline group_mask matchEmpty(const uint8_t* group) {
+  return matchByte(group, CTRL_EMPTY);
+}
+
+static inline group_mask matchFull(const uint8_t* group) {
+  return ~matchEmptyOrDeleted(group) & ((1u << GROUP_SIZE) - 1);
+}
+
+static inline int lowestBit(group_mask mask) {
+  return __builtin_ctz(mask);
+}
+
+static inline bool isFull(uint8_t ctrl) {
+  return !(ctrl & 0x80);
+}
+
+static inline uint8_t hashTag(size_t hash) {
+  return (uint8_t) (hash & 0x7F);
+}
+
+// Triangular probing over groups, visits every group
+// exactly once since group count is power of two
+struct probe {
+  size_t mask;
+  size_t group;
+  size_t step;
+};
+
+static inline struct probe probeStart(const struct swiss_hashmap_base* self, size_t hash) {
+  size_t mask = self->capacity / GROUP_SIZE - 1;
+  return (struct probe) {
+    .mask = mask,
+    .group = (hash >> 7) & mask
+  };
+}
+
+static inline void probeNext(struct probe* probe) {
+  probe->step++;
+  probe->group = (probe->group + probe->step) & probe->mask;
+}
+
+// Most entries allowed in a table of `capacity` (7/8 load)
+static size_t maxLoad(size_t capacity) {
+  return capacity - capacity / 8;
+}
+
+static size_t capacityFor(const struct swiss_hashmap_base* self, size_t count) {
+  size_t capacity = self->initialCapacity;
+  while (maxLoad(capacity) < count) {
+    if (capacity > SIZE_MAX / 2)
+      return 0;
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+static struct swiss_hashmap_slot* findSlot(const struct swiss_hashmap_base* self, const void* key, size_t hash, size_t* probed) {
+  uint8_t tag = hashTag(hash);
+  struct probe probe = probeStart(self, hash);
+  for (; probe.step <= probe.mask; probeNext(&probe)) {
+    const uint8_t* group = &self->ctrl[probe.group * GROUP_SIZE];
+    struct swiss_hashmap_slot* slots = &self->slots[probe.group * GROUP_SIZE];
+    
+    // Matching slot is most likely needed right after, so
+    // overlap its cache miss with control bytes' one
+    __builtin_prefetch(&slots[0]);
+  
+    for (group_mask match = matchByte(group, tag); match; match &= match - 1) {
+      struct swiss_hashmap_slot* slot = &slots[lowestBit(match)];
+      if (self->compare(key, slot->key) == 0) {
+        if (probed)
+          *probed = probe.step;
+        return slot;
+      }
+    }
+  
+    if (matchEmpty(group))
+      break;
+  }
+  return NULL;
+}
+
+// Index of first empty or deleted slot `hash` probes, there
+// is always one as load is kept under 7/8
+static size_t findInsertIndex(const struct swiss_hashmap_base* self, size_t hash) {
+  struct probe probe = probeStart(self, hash);
+  group_mask free;
+  while ((free = matchEmptyOrDeleted(&self->ctrl[probe.group * GROUP_SIZE])) == 0)
+    probeNext(&probe);
+  return probe.group * GROUP_SIZE + lowestBit(free);
+}
+
+static void setSlot(struct swiss_hashmap_base* self, size_t index, uint8_t tag, const void* key, void* data) {
+  self->ctrl[index] = tag;
+  self->slots[index] = (struct swiss_hashmap_slot) {
+    .key = key,
+    .data = data
+  };
+}
+
+// Control bytes and slots share one allocation, control
+// bytes first so slots stay aligned
+static int rehash(struct swiss_hashmap_base* self, size_t capacity) {
+  if (capacity == 0 || capacity > SIZE_MAX / (1 + sizeof(struct swiss_hashmap_slot)))
+    return -ENOMEM;
+  
+  uint8_t* ctrl = allocator_malloc(capacity * (1 + sizeof(struct swiss_hashmap_slot)));
+  if (!ctrl)
+    return -ENOMEM;
+  
+  uint8_t* oldCtrl = self->ctrl;
+  struct swiss_hashmap_slot* oldSlots = self->slots;
+  size_t oldCapacity = self->capacity;
+  
+  memset(ctrl, CTRL_EMPTY, capacity);
+  self->ctrl = ctrl;
+  self->slots = (struct swiss_hashmap_slot*) (ctrl + capacity);
+  self->capacity = capacity;
+  self->growthLeft = maxLoad(capacity) - self->size;
+  
+  for (size_t i = 0; i < oldCapacity; i++) {
+    if (!isFull(oldCtrl[i]))
+      continue;
+  
+    size_t hash = self->hash(oldSlots[i].key);
+    setSlot(self, findInsertIndex(self, hash), hashTag(hash), oldSlots[i].key, oldSlots[i].data);
+  }
+  
+  allocator_free(oldCtrl);
+  return 0;
+}
+
+static void removeSlot(struct swiss_hashmap_base* self, struct swiss_hashmap_slot* slot) {
+  size_t index = (size_t) (slot - self->slots);
+  if (self->keyFree)
+    self->keyFree((void*) slot->key);
+  self->size--;
+  
+  // Probing never went past a group with an empty slot,
+  // so nothing relies on this one staying occupied
+  if (matchEmpty(&self->ctrl[index / GROUP_SIZE * GROUP_SIZE])) {
+    self->ctrl[index] = CTRL_EMPTY;
+    self->growthLeft++;
+  } else {
+    self->ctrl[index] = CTRL_DELETED;
+  }
+}
+
+static void freeKeys(struct swiss_hashmap_base* self) {
+  if (!self->keyFree || self->size == 0)
+    return;
+  
+  for (size_t i = 0; i < self->capacity; i++)
+    if (isFull(self->ctrl[i]))
+      self->keyFree((void*) self->slots[i].key);
+}
+
+void swiss_hashmap_base_init(struct swiss_hashmap_base* self, size_t (*hash)(const void*), int (*compare)(const void*, const void*)) {
+  *self = (struct swiss_hashmap_base) {
+    .initialCapacity = SWISS_HASHMAP_DEFAULT_CAPACITY,
+    .hash = hash,
+    .compare = compare
+  };
+}
+
+void swiss_hashmap_base_cleanup(struct swiss_hashmap_base* self) {
+  if (!self)
+    return;
+  
+  freeKeys(self);
+  allocator_free(self->ctrl);
+  *self = (struct swiss_hashmap_base) {};
+}
+
+void swiss_hashmap_base_set_key_alloc_funcs(struct swiss_hashmap_base* self, void* (*keyDup)(const void*), void (*keyFree)(void*)) {
+  self->keyDup = keyDup;
+  self->keyFree = keyFree;
+}
+
+int swiss_hashmap_base_reserve(struct swiss_hashmap_base* self, size_t capacity) {
+  size_t oldInitialCapacity = self->initialCapacity;
+  self->initialCapacity = SWISS_HASHMAP_DEFAULT_CAPACITY;
+  
+  size_t newCapacity = capacityFor(self, capacity);
+  if (newCapacity == 0) {
+    self->initialCapacity = oldInitialCapacity;
+    return -ENOMEM;
+  }
+  
+  self->initialCapacity = newCapacity;
+  if (newCapacity <= self->capacity)
+    return 0;
+  
+  int res = rehash(self, newCapacity);
+  if (res < 0)
+    self->initialCapacity = oldInitialCapacity;
+  return res;
+}
+
+int swiss_hashmap_base_put(struct swiss_hashmap_base* self, const void* key, void* data) {
+  if (!key || !data)
+    return -EINVAL;
+  
+  int res = 0;
+  if (self->capacity == 0 && (res = rehash(self, self->initialCapacity)) < 0)
+    return res;
+  
+  size_t hash = self->hash(key);
+  if (findSlot(self, key, hash, NULL))
+    return -EEXIST;
+  
+  size_t index = findInsertIndex(self, hash);
+  if (self->growthLeft == 0 && self->ctrl[index] == CTRL_EMPTY) {
+    // Mostly deleted slots, rehashing in place frees them
+    size_t capacity = self->size < maxLoad(self->capacity) / 2 ? self->capacity : self->capacity * 2;
+    if ((res = rehash(self, capacity)) < 0)
+      return res;
+    index = findInsertIndex(self, hash);
+  }
+  
+  if (self->keyDup && (key = self->keyDup(key)) == NULL)
+    return -ENOMEM;
+  
+  if (self->ctrl[index] == CTRL_EMPTY)
+    self->growthLeft--;
+  setSlot(self, index, hashTag(hash), key, data);
+  self->size++;
+  return 0;
+}
+
+void* swiss_hashmap_base_get(const struct swiss_hashmap_base* self, const void* key) {
+  if (!key || self->size == 0)
+    return NULL;
+  
+  struct swiss_hashmap_slot* slot = findSlot(self, key, self->hash(key), NULL);
+  return slot ? slot->data : NULL;
+}
+
+void* swiss_hashmap_base_remove(struct swiss_hashmap_base* self, const void* key) {
+  if (!key || self->size == 0)
+    return NULL;
+  
+  struct swiss_hashmap_slot* slot = findSlot(self, key, self->hash(key), NULL);
+  if (!slot)
+    return NULL;
+  
+  void* data = slot->data;
+  removeSlot(self, slot);
+  return data;
+}
+
+void swiss_hashmap_base_clear(struct swiss_hashmap_base* self) {
+  freeKeys(self);
+  self->size = 0;
+  if (self->capacity == 0)
+    return;
+  
+  memset(self->ctrl, CTRL_EMPTY, self->capacity);
+  self->growthLeft = maxLoad(self->capacity);
+}
+
+void swiss_hashmap_base_reset(struct swiss_hashmap_base* self) {
+  freeKeys(self);
+  self->size = 0;
+  
+  // Table is reallocated on next insert
+  if (self->capacity != self->initialCapacity) {
+    allocator_free(self->ctrl);
+    self->ctrl = NULL;
+    self->slots = NULL;
+    self->capacity = 0;
+    self->growthLeft = 0;
+    return;
+  }
+  
+  swiss_hashmap_base_clear(self);
+}
+
+// Return first full slot at or after `index`
+static struct swiss_hashmap_slot* findFull(const struct swiss_hashmap_base* self, size_t index) {
+  if (self->size == 0)
+    return NULL;
+  
+  // Head until next group boundary
+  for (; index < self->capacity && index % GROUP_SIZE != 0; index++)
+    if (isFull(self->ctrl[index]))
+      return &self->slots[index];
+  
+  for (; index < self->capacity; index += GROUP_SIZE) {
+    group_mask full = matchFull(&self->ctrl[index]);
+    if (full)
+      return &self->slots[index + lowestBit(full)];
+  }
+  return NULL;
+}
+
+struct swiss_hashmap_slot* swiss_hashmap_base_iter(const struct swiss_hashmap_base* self, const struct swiss_hashmap_slot* pos) {
+  return findFull(self, pos ? (size_t) (pos - self->slots) : 0);
+}
+
+bool swiss_hashmap_base_iter_valid(const struct swiss_hashmap_base* self, const struct swiss_hashmap_slot* iter) {
+  return self && iter && iter >= self->slots && iter < &self->slots[self->capacity] &&
+         isFull(self->ctrl[iter - self->slots]);
+}
+
+bool swiss_hashmap_base_iter_next(const struct swiss_hashmap_base* self, struct swiss_hashmap_slot** iter) {
+  if (!*iter)
+    return false;
+  return (*iter = findFull(self, (size_t) (*iter - self->slots) + 1)) != NULL;
+}
+
+bool swiss_hashmap_base_iter_remove(struct swiss_hashmap_base* self, struct swiss_hashmap_slot** iter) {
+  if (!*iter)
+    return false;
+  
+  if (swiss_hashmap_base_iter_valid(self, *iter))
+    removeSlot(self, *iter);
+  return (*iter = findFull(self, (size_t) (*iter - self->slots) + 1)) != NULL;
+}
+
+const void* swiss_hashmap_base_iter_get_key(const struct swiss_hashmap_slot* iter) {
+  return iter ? iter->key : NULL;
+}
+
+void* swiss_hashmap_base_iter_get_data(const struct swiss_hashmap_slot* iter) {
+  return iter ? iter->data : NULL;
+}
+
+int swiss_hashmap_base_iter_set_data(struct swiss_hashmap_slot* iter, void* data) {
+  if (!iter)
+    return -EFAULT;
+  if (!data)
+    return -EINVAL;
+  
+  iter->data = data;
+  return 0;
+}
+
+double swiss_hashmap_base_load_factor(const struct swiss_hashmap_base* self) {
+  if (self->capacity == 0)
+    return 0;
+  return (double) self->size / (double) self->capacity;
+}
+
+size_t swiss_hashmap_base_collisions(const struct swiss_hashmap_base* self, const void* key) {
+  size_t probed = 0;
+  if (!key || self->size == 0 || !findSlot(self, key, self->hash(key), &probed))
+    return 0;
+  return probed;
+}
+
+double swiss_hashmap_base_collisions_mean(const struct swiss_hashmap_base* self) {
+  if (self->size == 0)
+    return 0;
+  
+  size_t total = 0;
+  for (size_t i = 0; i < self->capacity; i++)
+    if (isFull(self->ctrl[i]))
+      total += swiss_hashmap_base_collisions(self, self->slots[i].key);
+  return (double) total / (double) self->size;
+}
+
+double swiss_hashmap_base_collisions_variance(const struct swiss_hashmap_base* self) {
+  if (self->size == 0)
+    return 0;
+  
+  double mean = swiss_hashmap_base_collisions_mean(self);
+  double total = 0;
+  for (size_t i = 0; i < self->capacity; i++) {
+    if (!isFull(self->ctrl[i]))
+      continue;
+  
+    double deviation = (double) swiss_hashmap_base_collisions(self, self->slots[i].key) - mean;
+    total += deviation * deviation;
+  }
+  return total / (double) self->size;
+}
+
+#define HASH_MULTIPLIER UINT64_C(0x9E3779B97F4A7C15)
+
+// Multiply and fold high half back in, mixes every input
+// bit into every output bit
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 product = (unsigned __int128) a * b;
+  return (uint64_t) product ^ (uint64_t) (product >> 64);
+#else
+  uint64_t product = a * b;
+  return product ^ (product >> 32);
+#endif
+}
+
+size_t swiss_hashmap_hash_string(const char* key) {
+  size_t length = strlen(key);
+  uint64_t hash = mix(length ^ HASH_MULTIPLIER, HASH_MULTIPLIER);
+  
+  uint64_t word;
+  for (; length >= sizeof(word); key += sizeof(word), length -= sizeof(word)) {
+    memcpy(&word, key, sizeof(word));
+    hash = mix(hash ^ word, HASH_MULTIPLIER);
+  }
+  
+  word = 0;
+  memcpy(&word, key, length);
+  hash = mix(hash ^ word, HASH_MULTIPLIER);
+  
+  // Final avalanche so both tag (low bits) and group
+  // index (high bits) depend on whole key
+  hash ^= hash >> 33;
+  hash *= UINT64_C(0xFF51AFD7ED558CCD);
+  hash ^= hash >> 33;
+  return (size_t) hash;
+}
+
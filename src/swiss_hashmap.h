@@ -0,0 +1,135 @@
+#ifndef _headers_1668121785_Fluff_Assembler_swiss_hashmap
+#define _headers_1668121785_Fluff_Assembler_swiss_hashmap
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Swiss table style open addressing map, drop in for the
+// templated hashmap. Declare with SWISS_HASHMAP() instead
+// of HASHMAP() and the usual hashmap_* macros from
+// hashmap.h work on it unchanged
+//
+// Slots are split in groups of 16 with one control byte
+// each, holding 7 bits of the key's hash when full. Lookup
+// compares whole group of control bytes at once (SSE2 if
+// available) and only calls compare function on slots
+// whose hash bits matched, so most misses never touch a
+// key. Probing goes group to group and stops at first
+// group with an empty slot
+//
+// Unlike HASHMAP() there is no secondary hash, the hash
+// function must mix well into both low and high bits
+// (swiss_hashmap_hash_string does)
+
+#define SWISS_HASHMAP_GROUP_SIZE 16
+
+// Entries until first growth if not reserved
+#define SWISS_HASHMAP_DEFAULT_CAPACITY SWISS_HASHMAP_GROUP_SIZE
+
+struct swiss_hashmap_slot {
+  const void* key;
+  void* data;
+};
+
+struct swiss_hashmap_base {
+  // Power of two multiple of group size or zero
+  // before first insert
+  size_t capacity;
+  size_t size;
+  // Inserts into empty slots left before table has to
+  // grow, deleted slots are not empty
+  size_t growthLeft;
+  size_t initialCapacity;
+
+  uint8_t* ctrl;
+  struct swiss_hashmap_slot* slots;
+
+  size_t (*hash)(const void*);
+  int (*compare)(const void*, const void*);
+  void* (*keyDup)(const void*);
+  void (*keyFree)(void*);
+};
+
+// Same layout HASHMAP() has so hashmap.h's macros can
+// dispatch on `map_base` type
+#define SWISS_HASHMAP(key_type, data_type) \
+  struct { \
+    struct swiss_hashmap_base map_base; \
+    struct { \
+      const key_type* t_key; \
+      data_type* t_data; \
+      size_t (*t_hash_func)(const key_type*); \
+      int (*t_compare_func)(const key_type*, const key_type*); \
+      key_type* (*t_key_dup_func)(const key_type*); \
+      void (*t_key_free_func)(key_type*); \
+      int (*t_foreach_func)(const key_type*, data_type*, void*); \
+      struct { \
+        struct swiss_hashmap_base* iter_map; \
+        struct swiss_hashmap_slot* iter_pos; \
+        struct { \
+          const key_type* t_key; \
+          data_type* t_data; \
+        } iter_types[0]; \
+      } t_iterator; \
+    } map_types[0]; \
+  }
+
+// Functions below mirror hashmap_base.h's and are meant to be
+// used through hashmap.h's macros
+
+void swiss_hashmap_base_init(struct swiss_hashmap_base* self, size_t (*hash)(const void*), int (*compare)(const void*, const void*));
+void swiss_hashmap_base_cleanup(struct swiss_hashmap_base* self);
+void swiss_hashmap_base_set_key_alloc_funcs(struct swiss_hashmap_base* self, void* (*keyDup)(const void*), void (*keyFree)(void*));
+
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int swiss_hashmap_base_reserve(struct swiss_hashmap_base* self, size_t capacity);
+
+// Return 0 on success
+// Errors:
+// -EINVAL: `key` or `data` is NULL
+// -EEXIST: `key` already exists
+// -ENOMEM: Not enough memory
+int swiss_hashmap_base_put(struct swiss_hashmap_base* self, const void* key, void* data);
+
+// Return NULL if not found
+void* swiss_hashmap_base_get(const struct swiss_hashmap_base* self, const void* key);
+void* swiss_hashmap_base_remove(struct swiss_hashmap_base* self, const void* key);
+
+// Clear keeps the table's memory, reset shrinks it back
+// to initial capacity
+void swiss_hashmap_base_clear(struct swiss_hashmap_base* self);
+void swiss_hashmap_base_reset(struct swiss_hashmap_base* self);
+
+// Removing during iteration never moves other entries, so
+// iterators stay valid across swiss_hashmap_base_remove
+// (but not across put)
+struct swiss_hashmap_slot* swiss_hashmap_base_iter(const struct swiss_hashmap_base* self, const struct swiss_hashmap_slot* pos);
+bool swiss_hashmap_base_iter_valid(const struct swiss_hashmap_base* self, const struct swiss_hashmap_slot* iter);
+bool swiss_hashmap_base_iter_next(const struct swiss_hashmap_base* self, struct swiss_hashmap_slot** iter);
+bool swiss_hashmap_base_iter_remove(struct swiss_hashmap_base* self, struct swiss_hashmap_slot** iter);
+const void* swiss_hashmap_base_iter_get_key(const struct swiss_hashmap_slot* iter);
+void* swiss_hashmap_base_iter_get_data(const struct swiss_hashmap_slot* iter);
+
+// Return 0 on success
+// Errors:
+// -EFAULT: `iter` is NULL
+// -EINVAL: `data` is NULL
+int swiss_hashmap_base_iter_set_data(struct swiss_hashmap_slot* iter, void* data);
+
+double swiss_hashmap_base_load_factor(const struct swiss_hashmap_base* self);
+
+// Collisions are counted in groups probed past the key's
+// home group, zero if key doesn't exist
+size_t swiss_hashmap_base_collisions(const struct swiss_hashmap_base* self, const void* key);
+double swiss_hashmap_base_collisions_mean(const struct swiss_hashmap_base* self);
+double swiss_hashmap_base_collisions_variance(const struct swiss_hashmap_base* self);
+
+// Hashes eight bytes per step instead of one like
+// hashmap_hash_string
+size_t swiss_hashmap_hash_string(const char* key);
+
+#endif
+
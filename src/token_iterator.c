@@ -2,24 +2,29 @@
 #include <errno.h>
 
 #include "token_iterator.h"
+#include "allocator.h"
 #include "parser_stage1.h"
 #include "lexer.h"
 
 struct token_iterator* token_iterator_new(struct statement* statement) {
-  struct token_iterator* self = malloc(sizeof(*self));
+  struct token_iterator* self = allocator_malloc(sizeof(*self));
   if (!self)
     return NULL;
   
+  token_iterator_reset(self, statement);
+  return self;
+}
+
+void token_iterator_free(struct token_iterator* self) {
+  allocator_free(self);
+}
+
+void token_iterator_reset(struct token_iterator* self, struct statement* statement) {
   self->pointer = 0;
   self->numTokens = statement->wholeStatement.length;
   self->statement = statement;
   self->tokens = statement->wholeStatement.data;
   self->current = NULL;
-  return self;
-}
-
-void token_iterator_free(struct token_iterator* self) {
-  free(self);
 }
 
 int token_iterator_next_identifier(struct token_iterator* self, const char** ident) {
@@ -32,7 +37,7 @@ int token_iterator_next_identifier(struct token_iterator* self, const char** ide
 
 next_failed:
   if (ident && res == 0)
-    *ident = buffer_string(tmp->data.identifier);
+    *ident = tmp->data.identifier;
   return res;
 }
 
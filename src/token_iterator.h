@@ -1,6 +1,8 @@
 #ifndef _headers_1666490570_Fluff_Assembler_statement_iterator
 #define _headers_1666490570_Fluff_Assembler_statement_iterator
 
+#include <stddef.h>
+
 struct statement;
 struct token;
 
@@ -9,13 +11,16 @@ struct token_iterator {
   
   struct token** tokens;
   struct token* current;
-  int pointer;
-  int numTokens;
+  size_t pointer;
+  size_t numTokens;
 };
 
 struct token_iterator* token_iterator_new(struct statement* statement);
 void token_iterator_free(struct token_iterator* self);
 
+// Start over on `statement`
+void token_iterator_reset(struct token_iterator* self, struct statement* statement);
+
 // Errors: 
 // -ENODATA: No more token to read
 int token_iterator_next(struct token_iterator* self, struct token** token);
@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "allocator.h"
+#include "arena.h"
+#include "util.h"
+
+static struct trace* current = NULL;
+
+// Small ids in order threads first record something,
+// pthread_t isn't a number everywhere
+static atomic_uint_fast32_t nextThreadId = 1;
+static _Thread_local uint32_t threadId = 0;
+
+static uint32_t getThreadId() {
+  if (threadId == 0)
+    threadId = (uint32_t) atomic_fetch_add_explicit(&nextThreadId, 1, memory_order_relaxed);
+  return threadId;
+}
+
+struct trace* trace_new() {
+  struct trace* self = allocator_malloc(sizeof(*self));
+  if (!self)
+    return NULL;
+  
+  *self = (struct trace) {
+    .startTime = util_monotonic_time()
+  };
+  vec_init(&self->events);
+  vec_init(&self->threads);
+  
+  if ((self->strings = arena_new(0)) == NULL)
+    goto arena_alloc_failure;
+  if (pthread_mutex_init(&self->lock, NULL) != 0)
+    goto mutex_init_failure;
+  return self;
+
+mutex_init_failure:
+  arena_free(self->strings);
+arena_alloc_failure:
+  allocator_free(self);
+  return NULL;
+}
+
+void trace_free(struct trace* self) {
+  if (!self)
+    return;
+  
+  vec_deinit(&self->events);
+  vec_deinit(&self->threads);
+  arena_free(self->strings);
+  pthread_mutex_destroy(&self->lock);
+  allocator_free(self);
+}
+
+void trace_set(struct trace* trace) {
+  current = trace;
+}
+
+struct trace* trace_get() {
+  return current;
+}
+
+void trace_span_begin(struct trace_span* span, const char* category, const char* name) {
+  if (!current)
+    return;
+  
+  span->category = category;
+  span->name = name;
+  span->start = util_monotonic_time();
+}
+
+void trace_span_end(struct trace_span* span) {
+  if (!current)
+    return;
+  
+  double end = util_monotonic_time();
+  struct trace_event event = {
+    .category = span->category,
+    .threadId = getThreadId(),
+    .start = (span->start - current->startTime) * 1e6,
+    .duration = (end - span->start) * 1e6
+  };
+  
+  pthread_mutex_lock(&current->lock);
+  event.name = arena_strndup(current->strings, span->name, strlen(span->name));
+  if (!event.name || vec_push(&current->events, event) < 0)
+    current->droppedEvents++;
+  pthread_mutex_unlock(&current->lock);
+}
+
+void trace_set_thread_name(const char* name) {
+  if (!current)
+    return;
+  
+  struct trace_thread thread = {
+    .threadId = getThreadId()
+  };
+  
+  pthread_mutex_lock(&current->lock);
+  thread.name = arena_strndup(current->strings, name, strlen(name));
+  if (thread.name)
+    vec_push(&current->threads, thread);
+  pthread_mutex_unlock(&current->lock);
+}
+
+static void printJsonString(const char* str, FILE* output) {
+  fputc('"', output);
+  for (; *str; str++) {
+    unsigned char c = (unsigned char) *str;
+    if (c == '"' || c == '\\')
+      fprintf(output, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(output, "\\u%04x", c);
+    else
+      fputc(c, output);
+  }
+  fputc('"', output);
+}
+
+int trace_write_json(struct trace* self, FILE* output) {
+  long pid = (long) getpid();
+  pthread_mutex_lock(&self->lock);
+  
+  fprintf(output, "{\"traceEvents\": [\n");
+  fprintf(output, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %ld, \"args\": {\"name\": \"FluffAssembler\"}}", pid);
+  
+  size_t i = 0;
+  struct trace_thread* thread = NULL;
+  vec_foreach_ptr(&self->threads, thread, i) {
+    fprintf(output, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": %" PRIu32 ", \"args\": {\"name\": ", pid, thread->threadId);
+    printJsonString(thread->name, output);
+    fprintf(output, "}}");
+  }
+  
+  struct trace_event* event = NULL;
+  vec_foreach_ptr(&self->events, event, i) {
+    fprintf(output, ",\n  {\"name\": ");
+    printJsonString(event->name, output);
+    fprintf(output, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3lf, \"dur\": %.3lf, \"pid\": %ld, \"tid\": %" PRIu32 "}",
+            event->category, event->start, event->duration, pid, event->threadId);
+  }
+  
+  fprintf(output, "\n],\n");
+  fprintf(output, "\"displayTimeUnit\": \"ms\",\n");
+  fprintf(output, "\"otherData\": {\"dropped_events\": %" PRIu64 "}}\n", self->droppedEvents);
+  
+  pthread_mutex_unlock(&self->lock);
+  return ferror(output) ? -EIO : 0;
+}
@@ -0,0 +1,81 @@
+#ifndef _headers_1668203911_Fluff_Assembler_trace
+#define _headers_1668203911_Fluff_Assembler_trace
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vec.h"
+
+struct arena;
+
+// Timeline of spans in Chrome trace event format (see --trace)
+// which opens in chrome://tracing or ui.perfetto.dev
+//
+// One trace is installed process wide and every thread records
+// into it. Spans of same thread nest by time so the viewer shows
+// each prototype inside its parent and stages inside the job
+// they belong to. With no trace installed a span costs a call
+// and a branch
+
+struct trace_event {
+  // Copied into trace's arena
+  const char* name;
+  // Static string
+  const char* category;
+  uint32_t threadId;
+
+  // In microseconds, start since trace was created
+  double start;
+  double duration;
+};
+
+struct trace_thread {
+  uint32_t threadId;
+  const char* name;
+};
+
+struct trace {
+  double startTime;
+
+  // Guards everything below
+  pthread_mutex_t lock;
+  struct arena* strings;
+  vec_t(struct trace_event) events;
+  vec_t(struct trace_thread) threads;
+
+  // Lost to out of memory, written to the output
+  // so truncated timeline is not mistaken for real one
+  uint64_t droppedEvents;
+};
+
+struct trace_span {
+  const char* category;
+  const char* name;
+  double start;
+};
+
+struct trace* trace_new();
+void trace_free(struct trace* self);
+
+// NULL to stop tracing (default). Only change this while no
+// other thread is recording, in practice before main starts
+// assembling and after it is done
+void trace_set(struct trace* trace);
+struct trace* trace_get();
+
+// Span on calling thread, `category` must be static and `name`
+// must stay valid until trace_span_end (it is copied then)
+void trace_span_begin(struct trace_span* span, const char* category, const char* name);
+void trace_span_end(struct trace_span* span);
+
+// Label calling thread in the viewer, `name` is copied
+void trace_set_thread_name(const char* name);
+
+// Return 0 on success
+// Errors:
+// -EIO: Cannot write to `output`
+int trace_write_json(struct trace* self, FILE* output);
+
+#endif
+
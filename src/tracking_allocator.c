@@ -0,0 +1,274 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracking_allocator.h"
+#include "allocator.h"
+#include "assembler_stats.h"
+#include "util.h"
+
+#define INITIAL_SITE_CAPACITY 256
+
+// Put in front of every block, keeps the
+// returned memory aligned like malloc's
+struct block_header {
+  alignas(max_align_t) size_t size;
+  // -1 if site table couldn't grow
+  int site;
+};
+
+// Site table itself uses libc directly, it must not
+// recurse into the allocator it is tracking
+
+static uint64_t hashSite(const char* file, int line) {
+  // __FILE__ of same file is same string in practice,
+  // comparing pointers is enough
+  return ((uintptr_t) file * 31 + (uint64_t) line) * UINT64_C(0x9E3779B97F4A7C15);
+}
+
+static void insertSite(struct tracking_allocator* self, int site) {
+  int mask = self->tableCapacity - 1;
+  int index = (int) (hashSite(self->sites[site].file, self->sites[site].line) >> 32) & mask;
+  while (self->table[index] != 0)
+    index = (index + 1) & mask;
+  self->table[index] = site + 1;
+}
+
+static int growTable(struct tracking_allocator* self) {
+  int newCapacity = self->tableCapacity * 2;
+  int* newTable = calloc(newCapacity, sizeof(*newTable));
+  if (!newTable)
+    return -ENOMEM;
+  
+  free(self->table);
+  self->table = newTable;
+  self->tableCapacity = newCapacity;
+  for (int i = 0; i < self->siteCount; i++)
+    insertSite(self, i);
+  return 0;
+}
+
+// Return -1 if out of memory
+static int findSite(struct tracking_allocator* self, const char* file, int line) {
+  int mask = self->tableCapacity - 1;
+  int index = (int) (hashSite(file, line) >> 32) & mask;
+  for (; self->table[index] != 0; index = (index + 1) & mask) {
+    struct tracking_allocator_site* site = &self->sites[self->table[index] - 1];
+    if (site->file == file && site->line == line)
+      return self->table[index] - 1;
+  }
+  
+  if (self->siteCount == self->siteCapacity) {
+    int newCapacity = self->siteCapacity * 2;
+    struct tracking_allocator_site* newSites = realloc(self->sites, newCapacity * sizeof(*newSites));
+    if (!newSites)
+      return -1;
+    self->sites = newSites;
+    self->siteCapacity = newCapacity;
+  }
+  
+  int site = self->siteCount++;
+  self->sites[site] = (struct tracking_allocator_site) {
+    .file = file,
+    .line = line
+  };
+  
+  // Keep load factor under half
+  if (self->siteCount * 2 > self->tableCapacity) {
+    if (growTable(self) < 0) {
+      self->siteCount--;
+      return -1;
+    }
+  } else {
+    self->table[index] = site + 1;
+  }
+  return site;
+}
+
+static struct tracking_allocator_usage* getCurrentStage(struct tracking_allocator* self) {
+  return &self->stages[assembler_stats_get_current_stage()];
+}
+
+// Caller holds the lock
+static void addBlock(struct tracking_allocator* self, struct block_header* header, size_t size, const char* file, int line) {
+  struct tracking_allocator_usage* stage = getCurrentStage(self);
+  header->size = size;
+  header->site = findSite(self, file, line);
+  
+  self->liveBytes += size;
+  self->total.allocations++;
+  self->total.bytes += size;
+  self->total.netBytes += size;
+  stage->allocations++;
+  stage->bytes += size;
+  stage->netBytes += size;
+  
+  if (self->liveBytes > self->total.peakBytes)
+    self->total.peakBytes = self->liveBytes;
+  if (self->liveBytes > stage->peakBytes)
+    stage->peakBytes = self->liveBytes;
+  
+  if (header->site < 0)
+    return;
+  
+  struct tracking_allocator_site* site = &self->sites[header->site];
+  site->allocations++;
+  site->bytes += size;
+  site->liveBytes += size;
+  if (site->liveBytes > site->peakBytes)
+    site->peakBytes = site->liveBytes;
+}
+
+// Caller holds the lock
+static void removeBlock(struct tracking_allocator* self, const struct block_header* header) {
+  self->liveBytes -= header->size;
+  self->total.netBytes -= header->size;
+  getCurrentStage(self)->netBytes -= header->size;
+  if (header->site >= 0)
+    self->sites[header->site].liveBytes -= header->size;
+}
+
+static void* trackedMalloc(struct allocator* allocator, size_t size, const char* file, int line) {
+  struct tracking_allocator* self = container_of(allocator, struct tracking_allocator, allocator);
+  if (size > SIZE_MAX - sizeof(struct block_header))
+    return NULL;
+  
+  struct block_header* header = malloc(sizeof(*header) + size);
+  if (!header)
+    return NULL;
+  
+  pthread_mutex_lock(&self->lock);
+  addBlock(self, header, size, file, line);
+  pthread_mutex_unlock(&self->lock);
+  return header + 1;
+}
+
+static void* trackedCalloc(struct allocator* allocator, size_t count, size_t size, const char* file, int line) {
+  if (size != 0 && count > SIZE_MAX / size)
+    return NULL;
+  
+  void* ptr = trackedMalloc(allocator, count * size, file, line);
+  if (ptr)
+    memset(ptr, 0, count * size);
+  return ptr;
+}
+
+static void trackedFree(struct allocator* allocator, void* ptr) {
+  struct tracking_allocator* self = container_of(allocator, struct tracking_allocator, allocator);
+  if (!ptr)
+    return;
+  
+  struct block_header* header = (struct block_header*) ptr - 1;
+  pthread_mutex_lock(&self->lock);
+  removeBlock(self, header);
+  pthread_mutex_unlock(&self->lock);
+  free(header);
+}
+
+// Counts as free of old block and allocation of new
+// one at realloc's site
+static void* trackedRealloc(struct allocator* allocator, void* ptr, size_t size, const char* file, int line) {
+  struct tracking_allocator* self = container_of(allocator, struct tracking_allocator, allocator);
+  if (!ptr)
+    return trackedMalloc(allocator, size, file, line);
+  
+  if (size == 0) {
+    trackedFree(allocator, ptr);
+    return NULL;
+  }
+  
+  if (size > SIZE_MAX - sizeof(struct block_header))
+    return NULL;
+  
+  struct block_header* header = (struct block_header*) ptr - 1;
+  struct block_header* newHeader = realloc(header, sizeof(*header) + size);
+  if (!newHeader)
+    return NULL;
+  
+  pthread_mutex_lock(&self->lock);
+  removeBlock(self, newHeader);
+  addBlock(self, newHeader, size, file, line);
+  pthread_mutex_unlock(&self->lock);
+  return newHeader + 1;
+}
+
+int tracking_allocator_init(struct tracking_allocator* self) {
+  *self = (struct tracking_allocator) {
+    .allocator = {
+      .malloc = trackedMalloc,
+      .calloc = trackedCalloc,
+      .realloc = trackedRealloc,
+      .free = trackedFree
+    },
+    .siteCapacity = INITIAL_SITE_CAPACITY,
+    .tableCapacity = INITIAL_SITE_CAPACITY * 2
+  };
+  
+  self->sites = malloc(self->siteCapacity * sizeof(*self->sites));
+  self->table = calloc(self->tableCapacity, sizeof(*self->table));
+  if (!self->sites || !self->table) {
+    free(self->sites);
+    free(self->table);
+    return -ENOMEM;
+  }
+  
+  pthread_mutex_init(&self->lock, NULL);
+  return 0;
+}
+
+void tracking_allocator_deinit(struct tracking_allocator* self) {
+  pthread_mutex_destroy(&self->lock);
+  free(self->table);
+  free(self->sites);
+}
+
+static int compareSiteBytes(const void* _a, const void* _b) {
+  const struct tracking_allocator_site* a = _a;
+  const struct tracking_allocator_site* b = _b;
+  if (a->bytes != b->bytes)
+    return a->bytes > b->bytes ? -1 : 1;
+  return 0;
+}
+
+static void printUsage(const char* name, const struct tracking_allocator_usage* usage, FILE* output) {
+  fprintf(output, "%-18s %12" PRIu64 " %14" PRIu64 " %14" PRId64 " %14zu\n", name,
+          usage->allocations, usage->bytes, usage->netBytes, usage->peakBytes);
+}
+
+void tracking_allocator_print(struct tracking_allocator* self, int topSites, FILE* output) {
+  pthread_mutex_lock(&self->lock);
+  
+  fprintf(output, "%-18s %12s %14s %14s %14s\n", "Stage", "Allocations", "Bytes", "Net bytes", "Peak bytes");
+  for (int i = 0; i < ASSEMBLER_STAGE_COUNT; i++)
+    printUsage(assembler_stats_get_stage_name(i), &self->stages[i], output);
+  printUsage("other", &self->stages[ASSEMBLER_STAGE_COUNT], output);
+  printUsage("total", &self->total, output);
+  fprintf(output, "Live bytes now:     %zu\n", self->liveBytes);
+  
+  // Sort a copy, blocks refer to sites by index
+  struct tracking_allocator_site* sorted = NULL;
+  int count = self->siteCount;
+  if (topSites <= 0 || count == 0 || (sorted = malloc(count * sizeof(*sorted))) == NULL)
+    goto no_sites;
+  
+  memcpy(sorted, self->sites, count * sizeof(*sorted));
+  qsort(sorted, count, sizeof(*sorted), compareSiteBytes);
+  
+  if (topSites > count)
+    topSites = count;
+  
+  fprintf(output, "\n");
+  fprintf(output, "Top %d allocation sites by bytes (of %d):\n", topSites, count);
+  fprintf(output, "%12s %14s %14s %14s  %s\n", "Allocations", "Bytes", "Live bytes", "Peak bytes", "Site");
+  for (int i = 0; i < topSites; i++)
+    fprintf(output, "%12" PRIu64 " %14" PRIu64 " %14zu %14zu  %s:%d\n", sorted[i].allocations, sorted[i].bytes,
+            sorted[i].liveBytes, sorted[i].peakBytes, sorted[i].file, sorted[i].line);
+  free(sorted);
+  
+no_sites:
+  pthread_mutex_unlock(&self->lock);
+}
+
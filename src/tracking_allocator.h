@@ -0,0 +1,75 @@
+#ifndef _headers_1667987671_Fluff_Assembler_tracking_allocator
+#define _headers_1667987671_Fluff_Assembler_tracking_allocator
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "allocator.h"
+#include "assembler_stats.h"
+
+// Allocator counting allocations per pipeline stage and
+// per allocation site (see --alloc-stats)
+//
+// Stage is the one calling thread is timing through
+// assembler_stats_timer_start, so allocations are only
+// split per stage if assembler_context's stats is set.
+// Every block carries a small header for its size, and
+// all operations take a lock, this is for profiling only
+//
+// Blocks runtime (Block_copy) allocates by itself and
+// isn't counted
+
+struct tracking_allocator_usage {
+  uint64_t allocations;
+  uint64_t bytes;
+  // Bytes allocated minus bytes freed
+  int64_t netBytes;
+  // Highest live heap seen while allocating
+  size_t peakBytes;
+};
+
+struct tracking_allocator_site {
+  const char* file;
+  int line;
+
+  uint64_t allocations;
+  uint64_t bytes;
+  size_t liveBytes;
+  size_t peakBytes;
+};
+
+struct tracking_allocator {
+  struct allocator allocator;
+  pthread_mutex_t lock;
+
+  size_t liveBytes;
+  struct tracking_allocator_usage total;
+  // Extra last entry for allocations outside of any stage
+  struct tracking_allocator_usage stages[ASSEMBLER_STAGE_COUNT + 1];
+
+  // Blocks refer to sites by index so they never move
+  // around, `table` is open addressing index into them
+  // (plus one, zero is empty slot) on file and line
+  struct tracking_allocator_site* sites;
+  int siteCount;
+  int siteCapacity;
+  int* table;
+  int tableCapacity;
+};
+
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+int tracking_allocator_init(struct tracking_allocator* self);
+
+// Must not be the current allocator anymore
+void tracking_allocator_deinit(struct tracking_allocator* self);
+
+// Print usage per stage and `topSites` sites which allocated
+// the most bytes (none if zero)
+void tracking_allocator_print(struct tracking_allocator* self, int topSites, FILE* output);
+
+#endif
+
@@ -1,21 +1,34 @@
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "util.h"
+#include "allocator.h"
+#include "byte_buffer.h"
+
+// Unmappable files are read in pieces of this size
+#define READ_CHUNK_SIZE (64 * 1024)
 
 size_t util_vasprintf(char** buffer, const char* fmt, va_list args) {
   va_list copy;
   va_copy(copy, args);
-  size_t size = vsnprintf(NULL, 0, fmt, copy);
+  int size = vsnprintf(NULL, 0, fmt, copy);
   va_end(copy);
 
-  *buffer = malloc(size + 1);
+  // Output longer than INT_MAX can't be formatted
+  *buffer = size >= 0 ? allocator_malloc((size_t) size + 1) : NULL;
   if (*buffer == NULL)
     return -ENOMEM;
 
-  return vsnprintf(*buffer, size + 1, fmt, args);
+  return vsnprintf(*buffer, (size_t) size + 1, fmt, args);
 }
 
 size_t util_asprintf(char** buffer, const char* fmt, ...) {
@@ -26,3 +39,161 @@ size_t util_asprintf(char** buffer, const char* fmt, ...) {
   return ret;
 }
 
+uint64_t util_fnv1a64(const void* data, size_t size) {
+  const uint8_t* bytes = data;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+double util_monotonic_time() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+double util_thread_cpu_time() {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+int util_read_file(const char* path, void** result, size_t* size) {
+  int res = 0;
+  char* buffer = NULL;
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return -EIO;
+
+  long length;
+  if (fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+    res = -EIO;
+    goto read_failure;
+  }
+
+  // +1 so empty file still get non NULL buffer
+  if ((buffer = allocator_malloc((size_t) length + 1)) == NULL) {
+    res = -ENOMEM;
+    goto read_failure;
+  }
+
+  if (fread(buffer, 1, (size_t) length, file) != (size_t) length) {
+    allocator_free(buffer);
+    res = -EIO;
+    goto read_failure;
+  }
+
+  *result = buffer;
+  *size = (size_t) length;
+read_failure:
+  fclose(file);
+  return res;
+}
+
+int util_write_file(const char* path, const void* data, size_t size) {
+  FILE* file = fopen(path, "wb");
+  if (!file)
+    return -EIO;
+  
+  int res = 0;
+  if (fwrite(data, 1, size, file) != size)
+    res = -EIO;
+  if (fclose(file) != 0)
+    res = -EIO;
+  return res;
+}
+
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EIO: Cannot read the file
+// -EFBIG: File larger than `maxSize`
+static int readAll(int fd, size_t maxSize, struct util_mapped_file* result) {
+  int res = 0;
+  struct byte_buffer copy = BYTE_BUFFER_INIT;
+  while (true) {
+    // Size isn't known up front, stop as soon as it is too large
+    if (copy.size > maxSize) {
+      res = -EFBIG;
+      goto read_failure;
+    }
+
+    char* space = byte_buffer_append_space(&copy, READ_CHUNK_SIZE);
+    if (!space) {
+      res = -ENOMEM;
+      goto read_failure;
+    }
+
+    ssize_t count = read(fd, space, READ_CHUNK_SIZE);
+    if (count < 0) {
+      res = -EIO;
+      goto read_failure;
+    }
+
+    copy.size -= READ_CHUNK_SIZE - (size_t) count;
+    if (count == 0)
+      break;
+  }
+
+  result->data = result->copy = copy.data;
+  result->size = copy.size;
+  return 0;
+
+read_failure:
+  byte_buffer_deinit(&copy);
+  return res;
+}
+
+int util_map_file(const char* path, size_t maxSize, struct util_mapped_file* result) {
+  *result = (struct util_mapped_file) UTIL_MAPPED_FILE_INIT;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -EIO;
+
+  int res = 0;
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    res = -EIO;
+    goto map_done;
+  }
+
+  if (!S_ISREG(info.st_mode)) {
+    res = readAll(fd, maxSize, result);
+    goto map_done;
+  }
+
+  if ((uintmax_t) info.st_size > maxSize) {
+    res = -EFBIG;
+    goto map_done;
+  }
+
+  // Nothing to map, empty data still isn't NULL
+  if (info.st_size == 0) {
+    result->data = "";
+    goto map_done;
+  }
+
+  size_t size = (size_t) info.st_size;
+  void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED) {
+    res = errno == ENOMEM ? -ENOMEM : -EIO;
+    goto map_done;
+  }
+  madvise(mapping, size, MADV_SEQUENTIAL);
+
+  result->data = result->mapping = mapping;
+  result->size = size;
+map_done:
+  close(fd);
+  return res;
+}
+
+void util_unmap_file(struct util_mapped_file* self) {
+  if (self->mapping)
+    munmap(self->mapping, self->size);
+  allocator_free(self->copy);
+  *self = (struct util_mapped_file) UTIL_MAPPED_FILE_INIT;
+}
@@ -3,6 +3,7 @@
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "compiler_config.h"
 
@@ -11,11 +12,56 @@ size_t util_vasprintf(char** buffer, const char* fmt, va_list args);
 ATTRIBUTE_PRINTF(2, 3)
 size_t util_asprintf(char** buffer, const char* fmt, ...);
 
+// 64-bit FNV-1a, cheap non cryptographic checksum
+uint64_t util_fnv1a64(const void* data, size_t size);
+
+// Monotonic wall clock time in seconds
+double util_monotonic_time();
+
+// CPU time consumed by calling thread in seconds
+double util_thread_cpu_time();
+
+// Read whole file into allocator_malloc'ed buffer
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EIO: Cannot read the file
+int util_read_file(const char* path, void** result, size_t* size);
+
+// Return 0 on success
+// Errors:
+// -EIO: Cannot open or write the file
+int util_write_file(const char* path, const void* data, size_t size);
+
+struct util_mapped_file {
+  const void* data;
+  size_t size;
+
+  // Only one of these is set (neither for empty files)
+  void* mapping;
+  void* copy;
+};
+
+#define UTIL_MAPPED_FILE_INIT {.data = NULL, .size = 0, .mapping = NULL, .copy = NULL}
+
+// Map whole file read only, pages are read in as they are first
+// touched. Files which can't be mapped (pipes) are read into
+// allocator_malloc'ed copy instead. Release with util_unmap_file
+// Return 0 on success
+// Errors:
+// -ENOMEM: Not enough memory
+// -EIO: Cannot read the file
+// -EFBIG: File larger than `maxSize` (regular files are
+//         rejected before anything is read)
+int util_map_file(const char* path, size_t maxSize, struct util_mapped_file* result);
+void util_unmap_file(struct util_mapped_file* self);
+
 typedef void (^runnable_block)();
 
 // Tiny useful macros from Linux kernel
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 #define FIELD_SIZEOF(t, f) (sizeof(((t*) NULL)->f))
+#define container_of(ptr, type, member) ((type*) ((char*) (ptr) - offsetof(type, member)))
 
 #define __stringify_1(x...)	#x
 #define stringify(x...)	__stringify_1(x)